@@ -419,9 +419,6 @@ int main (int argc, char **argv) /* {{{ */
         /* 1 / 100 second */
         struct timespec ts = { 0, 10000000 };
 
-        ts.tv_sec = (time_t) now;
-        ts.tv_nsec = (long) ((now - ((double) ts.tv_sec)) * 1e9);
-
         nanosleep (&ts, /* remaining = */ NULL);
         now = dtime ();
 
@@ -89,6 +89,7 @@ static void exit_usage (const char *name, int status) {
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
       " * listval\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
+      " * trace\n"
 
       "\nIdentifiers:\n\n"
 
@@ -389,6 +390,35 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
 #undef BAIL_OUT
 } /* listval */
 
+static int trace (lcc_connection_t *c, int argc, char **argv)
+{
+  char **lines = NULL;
+  size_t lines_num = 0;
+
+  int status;
+  size_t i;
+
+  assert (strcasecmp (argv[0], "trace") == 0);
+
+  if (argc != 1) {
+    fprintf (stderr, "ERROR: trace: Does not accept any arguments.\n");
+    return (-1);
+  }
+
+  status = lcc_trace (c, &lines, &lines_num);
+  if (status != 0) {
+    fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+    return (status);
+  }
+
+  for (i = 0; i < lines_num; ++i) {
+    printf ("%s\n", lines[i]);
+    free (lines[i]);
+  }
+  free (lines);
+  return (0);
+} /* trace */
+
 static int putval (lcc_connection_t *c, int argc, char **argv)
 {
   lcc_value_list_t vl = LCC_VALUE_LIST_INIT;
@@ -593,6 +623,8 @@ int main (int argc, char **argv) {
     status = listval (c, argc - optind, argv + optind);
   else if (strcasecmp (argv[optind], "putval") == 0)
     status = putval (c, argc - optind, argv + optind);
+  else if (strcasecmp (argv[optind], "trace") == 0)
+    status = trace (c, argc - optind, argv + optind);
   else {
     fprintf (stderr, "%s: invalid command: %s\n", argv[0], argv[optind]);
     return (1);
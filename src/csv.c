@@ -46,6 +46,7 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	int offset;
 	int status;
 	size_t i;
+	gauge_t rates_buffer[ds->ds_num];
 	gauge_t *rates = NULL;
 
 	assert (0 == strcmp (ds->type, vl->type));
@@ -64,10 +65,7 @@ static int value_list_to_string (char *buffer, int buffer_len,
 				&& (ds->ds[i].type != DS_TYPE_GAUGE)
 				&& (ds->ds[i].type != DS_TYPE_DERIVE)
 				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
-		{
-			sfree (rates);
 			return (-1);
-		}
 
 		if (ds->ds[i].type == DS_TYPE_GAUGE)
 		{
@@ -76,13 +74,15 @@ static int value_list_to_string (char *buffer, int buffer_len,
 		}
 		else if (store_rates != 0)
 		{
-			if (rates == NULL)
-				rates = uc_get_rate (ds, vl);
 			if (rates == NULL)
 			{
-				WARNING ("csv plugin: "
-						"uc_get_rate failed.");
-				return (-1);
+				if (uc_get_rates (ds, vl, rates_buffer) != 0)
+				{
+					WARNING ("csv plugin: "
+							"uc_get_rates failed.");
+					return (-1);
+				}
+				rates = rates_buffer;
 			}
 			status = ssnprintf (buffer + offset,
 					buffer_len - offset,
@@ -111,15 +111,11 @@ static int value_list_to_string (char *buffer, int buffer_len,
 		}
 
 		if ((status < 1) || (status >= (buffer_len - offset)))
-		{
-			sfree (rates);
 			return (-1);
-		}
 
 		offset += status;
 	} /* for ds->ds_num */
 
-	sfree (rates);
 	return (0);
 } /* int value_list_to_string */
 
@@ -25,9 +25,10 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 #include "utils_complain.h"
 
+#include <pthread.h>
+
 #include <sys/types.h>
 #include <sys/un.h>
 
@@ -43,22 +44,44 @@
 #endif
 
 #define CJ_DEFAULT_HOST "localhost"
-#define CJ_KEY_MAGIC 0x43484b59UL /* CHKY */
-#define CJ_IS_KEY(key) ((key)->magic == CJ_KEY_MAGIC)
 #define CJ_ANY "*"
 #define COUCH_MIN(x,y) ((x) < (y) ? (x) : (y))
 
+/* How long the engine thread waits for socket activity before checking for
+ * newly submitted URLs. */
+#define CJ_POLL_INTERVAL_MS 100
+
 struct cj_key_s;
 typedef struct cj_key_s cj_key_t;
 struct cj_key_s /* {{{ */
 {
-  unsigned long magic;
   char *path;
   char *type;
   char *instance;
 };
 /* }}} */
 
+/* The configured key paths are compiled into a trie that mirrors the
+ * structure of the JSON document, e.g. "httpd/requests/count" and
+ * "httpd/requests/current" become
+ *   { "httpd": { "requests": { "count": $key, "current": $key } } }
+ * Leaves have "key" set, inner nodes have children. */
+struct cj_node_s;
+typedef struct cj_node_s cj_node_t;
+struct cj_node_s /* {{{ */
+{
+  char *name;
+  size_t name_len;
+  cj_key_t *key;
+
+  /* Sorted by cj_name_compare() for binary search. */
+  cj_node_t *children;
+  size_t children_num;
+  /* Matches any name not found in "children". */
+  cj_node_t *any;
+};
+/* }}} */
+
 struct cj_s /* {{{ */
 {
   char *instance;
@@ -82,15 +105,19 @@ struct cj_s /* {{{ */
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
 
+  /* Protected by engine_lock. "busy" is set while a fetch is queued or
+   * running in the engine thread. */
+  _Bool busy;
+  struct cj_s *next;
+  c_complain_t complaint;
+
   yajl_handle yajl;
-  c_avl_tree_t *tree;
-  cj_key_t *key;
+  cj_node_t tree;
   int depth;
+  /* Nesting level within a subtree no configured key refers to. */
+  int skip_depth;
   struct {
-    union {
-      c_avl_tree_t *tree;
-      cj_key_t *key;
-    };
+    cj_node_t const *node;
     _Bool in_array;
     int index;
     char name[DATA_MAX_NAME_LEN];
@@ -104,6 +131,14 @@ typedef size_t yajl_len_t;
 typedef unsigned int yajl_len_t;
 #endif
 
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t engine_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t engine_thread;
+static _Bool engine_running = 0;
+static _Bool engine_stop = 0;
+/* URL blocks waiting to be added to the multi handle. */
+static cj_t *engine_submitted = NULL;
+
 static int cj_read (user_data_t *ud);
 static void cj_submit (cj_t *db, cj_key_t *key, value_t *value);
 
@@ -171,6 +206,50 @@ static int cj_get_type (cj_key_t *key)
   return ds->ds[0].type;
 }
 
+static int cj_name_compare (char const *a, size_t a_len, /* {{{ */
+    char const *b, size_t b_len)
+{
+  int status;
+
+  status = memcmp (a, b, COUCH_MIN (a_len, b_len));
+  if (status != 0)
+    return (status);
+
+  if (a_len == b_len)
+    return (0);
+  return ((a_len < b_len) ? -1 : 1);
+} /* }}} int cj_name_compare */
+
+/* Returns the child of "node" named "name" or, if there is none, the
+ * wildcard child. Returns NULL if neither exists. */
+static cj_node_t const *cj_node_lookup (cj_node_t const *node, /* {{{ */
+    char const *name, size_t name_len)
+{
+  size_t lo = 0;
+  size_t hi;
+
+  if (node == NULL)
+    return (NULL);
+
+  hi = node->children_num;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    cj_node_t const *child = node->children + mid;
+    int status;
+
+    status = cj_name_compare (name, name_len, child->name, child->name_len);
+    if (status == 0)
+      return (child);
+    else if (status < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return (node->any);
+} /* }}} cj_node_t *cj_node_lookup */
+
 static int cj_cb_map_key (void *ctx, const unsigned char *val,
     yajl_len_t len);
 
@@ -197,49 +276,55 @@ static void cj_cb_inc_array_index (void *ctx, _Bool update_key)
 #define CJ_CB_ABORT    0
 #define CJ_CB_CONTINUE 1
 
+/* yajl has no way to skip over parts of a document, so within subtrees no
+ * key refers to, the callbacks only keep track of the nesting level. */
+
 static int cj_cb_boolean (void * ctx, int boolVal)
 {
-  cj_cb_inc_array_index (ctx, /* update_key = */ 0);
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth == 0)
+    cj_cb_inc_array_index (ctx, /* update_key = */ 0);
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_null (void * ctx)
 {
-  cj_cb_inc_array_index (ctx, /* update_key = */ 0);
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth == 0)
+    cj_cb_inc_array_index (ctx, /* update_key = */ 0);
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_number (void *ctx,
     const char *number, yajl_len_t number_len)
 {
-  char buffer[number_len + 1];
-
   cj_t *db = (cj_t *)ctx;
-  cj_key_t *key = db->state[db->depth].key;
+  cj_node_t const *node;
   value_t vt;
   int type;
   int status;
 
-  /* Create a null-terminated version of the string. */
-  memcpy (buffer, number, number_len);
-  buffer[sizeof (buffer) - 1] = 0;
+  if (db->skip_depth > 0)
+    return (CJ_CB_CONTINUE);
 
-  if ((key == NULL) || !CJ_IS_KEY (key)) {
-    if (key != NULL && !db->state[db->depth].in_array/*can be inhomogeneous*/)
-      NOTICE ("curl_json plugin: Found \"%s\", but the configuration expects"
-              " a map.", buffer);
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
-    key = db->state[db->depth].key;
-    if (key == NULL) {
-      return (CJ_CB_CONTINUE);
-    }
-  }
-  else
+  cj_cb_inc_array_index (ctx, /* update_key = */ 1);
+  node = db->state[db->depth].node;
+  if ((node == NULL) || (node->key == NULL))
   {
-    cj_cb_inc_array_index (ctx, /* update_key = */ 1);
+    if ((node != NULL) && !db->state[db->depth].in_array/*can be inhomogeneous*/)
+      NOTICE ("curl_json plugin: Found \"%.*s\", but the configuration "
+          "expects a map.", (int) number_len, number);
+    return (CJ_CB_CONTINUE);
   }
 
-  type = cj_get_type (key);
+  /* Create a null-terminated version of the string. */
+  char buffer[number_len + 1];
+  memcpy (buffer, number, number_len);
+  buffer[sizeof (buffer) - 1] = 0;
+
+  type = cj_get_type (node->key);
   status = parse_value (buffer, &vt, type);
   if (status != 0)
   {
@@ -247,24 +332,28 @@ static int cj_cb_number (void *ctx,
     return (CJ_CB_CONTINUE);
   }
 
-  cj_submit (db, key, &vt);
+  cj_submit (db, node->key, &vt);
   return (CJ_CB_CONTINUE);
 } /* int cj_cb_number */
 
-/* Queries the key-tree of the parent context for "in_name" and, if found,
- * updates the "key" field of the current context. Otherwise, "key" is set to
- * NULL. */
+/* Looks up "in_name" in the trie node of the parent context and updates the
+ * "node" field of the current context. The name is only copied if it
+ * matched, since only matching names end up in the type instance. */
 static int cj_cb_map_key (void *ctx,
     unsigned char const *in_name, yajl_len_t in_name_len)
 {
   cj_t *db = (cj_t *)ctx;
-  c_avl_tree_t *tree;
+  cj_node_t const *node;
 
-  tree = db->state[db->depth-1].tree;
+  if (db->skip_depth > 0)
+    return (CJ_CB_CONTINUE);
+
+  node = cj_node_lookup (db->state[db->depth-1].node,
+      (char const *) in_name, (size_t) in_name_len);
+  db->state[db->depth].node = node;
 
-  if (tree != NULL)
+  if (node != NULL)
   {
-    cj_key_t *value = NULL;
     char *name;
     size_t name_len;
 
@@ -274,24 +363,6 @@ static int cj_cb_map_key (void *ctx,
         sizeof (db->state[db->depth].name) - 1);
     memcpy (name, in_name, name_len);
     name[name_len] = 0;
-
-    if (c_avl_get (tree, name, (void *) &value) == 0) {
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    }
-    else if (c_avl_get (tree, CJ_ANY, (void *) &value) == 0)
-      if (CJ_IS_KEY((cj_key_t*)value)) {
-        db->state[db->depth].key = value;
-      }
-      else {
-        db->state[db->depth].tree = (c_avl_tree_t*) value;
-      }
-    else
-      db->state[db->depth].key = NULL;
   }
 
   return (CJ_CB_CONTINUE);
@@ -304,6 +375,16 @@ static int cj_cb_string (void *ctx, const unsigned char *val,
   return (cj_cb_number (ctx, (const char *) val, len));
 } /* int cj_cb_string */
 
+/* Returns true if the map or array starting at the current context contains
+ * nothing we are interested in. */
+static _Bool cj_cb_skip (cj_t *db)
+{
+  cj_node_t const *node = db->state[db->depth].node;
+
+  return ((node == NULL)
+      || ((node->children_num == 0) && (node->any == NULL)));
+}
+
 static int cj_cb_start (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
@@ -319,26 +400,58 @@ static int cj_cb_start (void *ctx)
 static int cj_cb_end (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].tree = NULL;
+  db->state[db->depth].node = NULL;
   --db->depth;
   return (CJ_CB_CONTINUE);
 }
 
 static int cj_cb_start_map (void *ctx)
 {
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth > 0)
+  {
+    db->skip_depth++;
+    return (CJ_CB_CONTINUE);
+  }
+
   cj_cb_inc_array_index (ctx, /* update_key = */ 1);
+  if (cj_cb_skip (db))
+  {
+    db->skip_depth = 1;
+    return (CJ_CB_CONTINUE);
+  }
   return cj_cb_start (ctx);
 }
 
 static int cj_cb_end_map (void *ctx)
 {
+  cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth > 0)
+  {
+    db->skip_depth--;
+    return (CJ_CB_CONTINUE);
+  }
   return cj_cb_end (ctx);
 }
 
 static int cj_cb_start_array (void * ctx)
 {
   cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth > 0)
+  {
+    db->skip_depth++;
+    return (CJ_CB_CONTINUE);
+  }
+
   cj_cb_inc_array_index (ctx, /* update_key = */ 1);
+  if (cj_cb_skip (db))
+  {
+    db->skip_depth = 1;
+    return (CJ_CB_CONTINUE);
+  }
   if (db->depth+1 < YAJL_MAX_DEPTH) {
     db->state[db->depth+1].in_array = 1;
     db->state[db->depth+1].index = 0;
@@ -349,6 +462,12 @@ static int cj_cb_start_array (void * ctx)
 static int cj_cb_end_array (void * ctx)
 {
   cj_t *db = (cj_t *)ctx;
+
+  if (db->skip_depth > 0)
+  {
+    db->skip_depth--;
+    return (CJ_CB_CONTINUE);
+  }
   db->state[db->depth].in_array = 0;
   return cj_cb_end (ctx);
 }
@@ -381,25 +500,28 @@ static void cj_key_free (cj_key_t *key) /* {{{ */
   sfree (key);
 } /* }}} void cj_key_free */
 
-static void cj_tree_free (c_avl_tree_t *tree) /* {{{ */
+/* Frees the contents of "node", but not "node" itself. */
+static void cj_node_clear (cj_node_t *node) /* {{{ */
 {
-  char *name;
-  void *value;
-
-  while (c_avl_pick (tree, (void *) &name, (void *) &value) == 0)
-  {
-    cj_key_t *key = (cj_key_t *)value;
+  size_t i;
 
-    if (CJ_IS_KEY(key))
-      cj_key_free (key);
-    else
-      cj_tree_free ((c_avl_tree_t *)value);
+  for (i = 0; i < node->children_num; i++)
+    cj_node_clear (node->children + i);
+  sfree (node->children);
+  node->children_num = 0;
 
-    sfree (name);
+  if (node->any != NULL)
+  {
+    cj_node_clear (node->any);
+    sfree (node->any);
   }
 
-  c_avl_destroy (tree);
-} /* }}} void cj_tree_free */
+  cj_key_free (node->key);
+  node->key = NULL;
+  sfree (node->name);
+} /* }}} void cj_node_clear */
+
+static void cj_engine_shutdown (void);
 
 static void cj_free (void *arg) /* {{{ */
 {
@@ -412,13 +534,15 @@ static void cj_free (void *arg) /* {{{ */
   if (db == NULL)
     return;
 
+  /* The engine thread may still hold a reference to this block. */
+  if (db->url != NULL)
+    cj_engine_shutdown ();
+
   if (db->curl != NULL)
     curl_easy_cleanup (db->curl);
   db->curl = NULL;
 
-  if (db->tree != NULL)
-    cj_tree_free (db->tree);
-  db->tree = NULL;
+  cj_node_clear (&db->tree);
 
   sfree (db->instance);
   sfree (db->host);
@@ -438,11 +562,6 @@ static void cj_free (void *arg) /* {{{ */
 
 /* Configuration handling functions {{{ */
 
-static c_avl_tree_t *cj_avl_create(void)
-{
-  return c_avl_create ((int (*) (const void *, const void *)) strcmp);
-}
-
 static int cj_config_append_string (const char *name, struct curl_slist **dest, /* {{{ */
     oconfig_item_t *ci)
 {
@@ -462,6 +581,70 @@ static int cj_config_append_string (const char *name, struct curl_slist **dest,
   return (0);
 } /* }}} int cj_config_append_string */
 
+/* Returns the child of "node" named "name", creating it if necessary. */
+static cj_node_t *cj_node_get_child (cj_node_t *node, /* {{{ */
+    char const *name, size_t name_len)
+{
+  cj_node_t *tmp;
+  char *copy;
+  size_t lo = 0;
+  size_t hi = node->children_num;
+
+  if ((name_len == strlen (CJ_ANY))
+      && (memcmp (name, CJ_ANY, name_len) == 0))
+  {
+    if (node->any == NULL)
+    {
+      node->any = calloc (1, sizeof (*node->any));
+      if (node->any == NULL)
+        return (NULL);
+      node->any->name_len = strlen (CJ_ANY);
+    }
+    return (node->any);
+  }
+
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int status;
+
+    status = cj_name_compare (name, name_len,
+        node->children[mid].name, node->children[mid].name_len);
+    if (status == 0)
+      return (node->children + mid);
+    else if (status < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  copy = malloc (name_len + 1);
+  if (copy == NULL)
+    return (NULL);
+  memcpy (copy, name, name_len);
+  copy[name_len] = 0;
+
+  tmp = realloc (node->children,
+      (node->children_num + 1) * sizeof (*node->children));
+  if (tmp == NULL)
+  {
+    sfree (copy);
+    return (NULL);
+  }
+  node->children = tmp;
+
+  memmove (node->children + lo + 1, node->children + lo,
+      (node->children_num - lo) * sizeof (*node->children));
+  node->children_num++;
+
+  tmp = node->children + lo;
+  memset (tmp, 0, sizeof (*tmp));
+  tmp->name = copy;
+  tmp->name_len = name_len;
+
+  return (tmp);
+} /* }}} cj_node_t *cj_node_get_child */
+
 static int cj_config_add_key (cj_t *db, /* {{{ */
                                    oconfig_item_t *ci)
 {
@@ -483,7 +666,6 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     ERROR ("curl_json plugin: calloc failed.");
     return (-1);
   }
-  key->magic = CJ_KEY_MAGIC;
 
   if (strcasecmp ("Key", ci->key) == 0)
   {
@@ -534,55 +716,41 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
 
-  /* store path in a tree that will match the json map structure, example:
-   * "httpd/requests/count",
-   * "httpd/requests/current" ->
-   * { "httpd": { "requests": { "count": $key, "current": $key } } }
-   */
+  /* Add the path to the trie, one node per path component. */
   char *ptr;
   char *name;
-  c_avl_tree_t *tree;
-
-  if (db->tree == NULL)
-    db->tree = cj_avl_create();
+  cj_node_t *node;
 
-  tree = db->tree;
+  node = &db->tree;
   ptr = key->path;
   if (*ptr == '/')
     ++ptr;
 
   name = ptr;
-  while ((ptr = strchr (name, '/')) != NULL)
+  while ((node != NULL) && ((ptr = strchr (name, '/')) != NULL))
   {
-    char ent[PATH_MAX];
-    c_avl_tree_t *value;
-    size_t len;
-
-    len = ptr - name;
-    if (len == 0)
-      break;
-
-    len = COUCH_MIN(len, sizeof (ent)-1);
-    sstrncpy (ent, name, len+1);
-
-    if (c_avl_get (tree, ent, (void *) &value) != 0)
-    {
-      value = cj_avl_create ();
-      c_avl_insert (tree, strdup (ent), value);
-    }
+    if ((ptr == name) || (node->key != NULL))
+      node = NULL;
+    else
+      node = cj_node_get_child (node, name, (size_t) (ptr - name));
 
-    tree = value;
     name = ptr + 1;
   }
 
-  if (strlen (name) == 0)
+  if ((node != NULL) && ((strlen (name) == 0) || (node->key != NULL)))
+    node = NULL;
+  else if (node != NULL)
+    node = cj_node_get_child (node, name, strlen (name));
+
+  if ((node == NULL) || (node->key != NULL)
+      || (node->children_num != 0) || (node->any != NULL))
   {
     ERROR ("curl_json plugin: invalid key: %s", key->path);
     cj_key_free (key);
     return (-1);
   }
 
-  c_avl_insert (tree, strdup (name), key);
+  node->key = key;
   return (status);
 } /* }}} int cj_config_add_key */
 
@@ -598,6 +766,7 @@ static int cj_init_curl (cj_t *db) /* {{{ */
   curl_easy_setopt (db->curl, CURLOPT_NOSIGNAL, 1L);
   curl_easy_setopt (db->curl, CURLOPT_WRITEFUNCTION, cj_curl_callback);
   curl_easy_setopt (db->curl, CURLOPT_WRITEDATA, db);
+  curl_easy_setopt (db->curl, CURLOPT_PRIVATE, db);
   curl_easy_setopt (db->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
   curl_easy_setopt (db->curl, CURLOPT_ERRORBUFFER, db->curl_errbuf);
   curl_easy_setopt (db->curl, CURLOPT_URL, db->url);
@@ -677,6 +846,7 @@ static int cj_config_add_url (oconfig_item_t *ci) /* {{{ */
   }
 
   db->timeout = -1;
+  C_COMPLAIN_INIT (&db->complaint);
 
   if (strcasecmp ("URL", ci->key) == 0)
     status = cf_util_get_string (ci, &db->url);
@@ -738,7 +908,7 @@ static int cj_config_add_url (oconfig_item_t *ci) /* {{{ */
 
   if (status == 0)
   {
-    if (db->tree == NULL)
+    if ((db->tree.children_num == 0) && (db->tree.any == NULL))
     {
       WARNING ("curl_json plugin: No (valid) `Key' block within `%s' \"`%s'\".",
                db->url ? "URL" : "Sock", db->url ? db->url : db->sock);
@@ -897,18 +1067,18 @@ static int cj_sock_perform (cj_t *db) /* {{{ */
 } /* }}} int cj_sock_perform */
 
 
-static int cj_curl_perform(cj_t *db) /* {{{ */
+/* Checks the outcome of a transfer. "status" is the result reported by
+ * libcurl. */
+static int cj_curl_check (cj_t *db, CURLcode status) /* {{{ */
 {
-  int status;
   long rc;
   char *url;
   url = db->url;
 
-  status = curl_easy_perform (db->curl);
   if (status != CURLE_OK)
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
-           status, db->curl_errbuf, url);
+    ERROR ("curl_json plugin: curl request failed with status %i: %s (%s)",
+           (int) status, db->curl_errbuf, url);
     return (-1);
   }
 
@@ -918,17 +1088,20 @@ static int cj_curl_perform(cj_t *db) /* {{{ */
   /* The response code is zero if a non-HTTP transport was used. */
   if ((rc != 0) && (rc != 200))
   {
-    ERROR ("curl_json plugin: curl_easy_perform failed with "
+    ERROR ("curl_json plugin: curl request failed with "
         "response code %ld (%s)", rc, url);
     return (-1);
   }
   return (0);
-} /* }}} int cj_curl_perform */
+} /* }}} int cj_curl_check */
 
-static int cj_perform (cj_t *db) /* {{{ */
+/* Prepares "db" for parsing a new document. */
+static int cj_perform_begin (cj_t *db) /* {{{ */
 {
-  int status;
-  yajl_handle yprev = db->yajl;
+  db->depth = 0;
+  db->skip_depth = 0;
+  memset (&db->state, 0, sizeof(db->state));
+  db->state[db->depth].node = &db->tree;
 
   db->yajl = yajl_alloc (&ycallbacks,
 #if HAVE_YAJL_V2
@@ -940,18 +1113,23 @@ static int cj_perform (cj_t *db) /* {{{ */
   if (db->yajl == NULL)
   {
     ERROR ("curl_json plugin: yajl_alloc failed.");
-    db->yajl = yprev;
     return (-1);
   }
 
-  if (db->url)
-    status = cj_curl_perform (db);
-  else
-    status = cj_sock_perform (db);
+  return (0);
+} /* }}} int cj_perform_begin */
+
+/* Completes parsing if the document was received successfully, i.e. if
+ * "status" is zero, and releases the parser. */
+static int cj_perform_end (cj_t *db, int status) /* {{{ */
+{
+  if (db->yajl == NULL)
+    return (-1);
+
   if (status < 0)
   {
     yajl_free (db->yajl);
-    db->yajl = yprev;
+    db->yajl = NULL;
     return (-1);
   }
 
@@ -970,18 +1148,264 @@ static int cj_perform (cj_t *db) /* {{{ */
         (char *) errmsg);
     yajl_free_error (db->yajl, errmsg);
     yajl_free (db->yajl);
-    db->yajl = yprev;
+    db->yajl = NULL;
     return (-1);
   }
 
   yajl_free (db->yajl);
-  db->yajl = yprev;
+  db->yajl = NULL;
   return (0);
-} /* }}} int cj_perform */
+} /* }}} int cj_perform_end */
+
+/* Asynchronous fetching of URLs {{{
+ *
+ * All URL blocks share one curl multi handle, which is driven by a single
+ * engine thread. The read callbacks only hand their block to the engine and
+ * return; the document is parsed as it arrives and the values are
+ * dispatched from the engine thread. */
+
+static void cj_multi_wait (CURLM *multi, int timeout_ms) /* {{{ */
+{
+#if LIBCURL_VERSION_NUM >= 0x071c00
+  curl_multi_wait (multi, /* extra_fds = */ NULL, 0,
+      timeout_ms, /* numfds = */ NULL);
+#else
+  fd_set fdread;
+  fd_set fdwrite;
+  fd_set fdexcep;
+  int maxfd = -1;
+  struct timeval tv;
+
+  FD_ZERO (&fdread);
+  FD_ZERO (&fdwrite);
+  FD_ZERO (&fdexcep);
+  curl_multi_fdset (multi, &fdread, &fdwrite, &fdexcep, &maxfd);
+
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (maxfd >= 0)
+    select (maxfd + 1, &fdread, &fdwrite, &fdexcep, &tv);
+  else
+    nanosleep (&(struct timespec) { tv.tv_sec, tv.tv_usec * 1000 }, NULL);
+#endif
+} /* }}} void cj_multi_wait */
+
+static int cj_fetch_start (CURLM *multi, cj_t *db) /* {{{ */
+{
+  CURLMcode status;
+
+  if (cj_perform_begin (db) != 0)
+    return (-1);
+
+  status = curl_multi_add_handle (multi, db->curl);
+  if (status != CURLM_OK)
+  {
+    ERROR ("curl_json plugin: curl_multi_add_handle failed: %s (%s)",
+        curl_multi_strerror (status), db->url);
+    cj_perform_end (db, -1);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int cj_fetch_start */
+
+static void cj_fetch_finish (cj_t *db, int status) /* {{{ */
+{
+  cj_perform_end (db, status);
+
+  pthread_mutex_lock (&engine_lock);
+  db->busy = 0;
+  pthread_mutex_unlock (&engine_lock);
+} /* }}} void cj_fetch_finish */
+
+static void *cj_engine_thread (void *arg) /* {{{ */
+{
+  CURLM *multi = arg;
+  /* Blocks whose transfer is running, linked through "next". Only the
+   * engine thread touches this list. */
+  cj_t *active = NULL;
+  cj_t *submitted;
+
+  while (42)
+  {
+    CURLMsg *msg;
+    int msgs_left;
+    int running = 0;
+    _Bool stop;
+
+    pthread_mutex_lock (&engine_lock);
+    while (!engine_stop && (engine_submitted == NULL) && (active == NULL))
+      pthread_cond_wait (&engine_cond, &engine_lock);
+    submitted = engine_submitted;
+    engine_submitted = NULL;
+    stop = engine_stop;
+    pthread_mutex_unlock (&engine_lock);
+
+    if (stop)
+      break;
+
+    while (submitted != NULL)
+    {
+      cj_t *db = submitted;
+      submitted = db->next;
+
+      if (cj_fetch_start (multi, db) == 0)
+      {
+        db->next = active;
+        active = db;
+      }
+      else
+        cj_fetch_finish (db, -1);
+    }
+
+    curl_multi_perform (multi, &running);
+
+    while ((msg = curl_multi_info_read (multi, &msgs_left)) != NULL)
+    {
+      cj_t **prev;
+      cj_t *db;
+      char *private = NULL;
+      CURLcode result;
+
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, &private);
+      db = (cj_t *) private;
+      result = msg->data.result;
+      curl_multi_remove_handle (multi, db->curl);
+
+      for (prev = &active; *prev != NULL; prev = &(*prev)->next)
+      {
+        if (*prev == db)
+        {
+          *prev = db->next;
+          break;
+        }
+      }
+
+      cj_fetch_finish (db, cj_curl_check (db, result));
+    }
+
+    if (running > 0)
+      cj_multi_wait (multi, CJ_POLL_INTERVAL_MS);
+  } /* while (42) */
+
+  /* Abort everything still queued or in flight. */
+  while (active != NULL)
+  {
+    cj_t *db = active;
+    active = db->next;
+
+    curl_multi_remove_handle (multi, db->curl);
+    cj_fetch_finish (db, -1);
+  }
+
+  while (submitted != NULL)
+  {
+    cj_t *db = submitted;
+    submitted = db->next;
+    cj_fetch_finish (db, -1);
+  }
+
+  curl_multi_cleanup (multi);
+  return ((void *) 0);
+} /* }}} void *cj_engine_thread */
+
+/* Starts the engine thread. The thread is started lazily because the daemon
+ * may fork after the configuration was read. Must hold engine_lock. */
+static int cj_engine_start (void) /* {{{ */
+{
+  CURLM *multi;
+  int status;
+
+  if (engine_running)
+    return (0);
+
+  multi = curl_multi_init ();
+  if (multi == NULL)
+  {
+    ERROR ("curl_json plugin: curl_multi_init failed.");
+    return (-1);
+  }
+
+  engine_stop = 0;
+  status = plugin_thread_create (&engine_thread, /* attr = */ NULL,
+      cj_engine_thread, /* arg = */ multi);
+  if (status != 0)
+  {
+    ERROR ("curl_json plugin: Starting the engine thread failed.");
+    curl_multi_cleanup (multi);
+    return (-1);
+  }
+
+  engine_running = 1;
+  return (0);
+} /* }}} int cj_engine_start */
+
+static void cj_engine_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&engine_lock);
+  if (!engine_running)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return;
+  }
+  engine_stop = 1;
+  pthread_cond_signal (&engine_cond);
+  pthread_mutex_unlock (&engine_lock);
+
+  pthread_join (engine_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&engine_lock);
+  engine_running = 0;
+  engine_stop = 0;
+  pthread_mutex_unlock (&engine_lock);
+} /* }}} void cj_engine_shutdown */
+
+/* Hands the URL block to the engine thread. Returns immediately. */
+static int cj_engine_submit (cj_t *db) /* {{{ */
+{
+  pthread_mutex_lock (&engine_lock);
+
+  if (engine_stop)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (-1);
+  }
+
+  if (db->busy)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    c_complain (LOG_WARNING, &db->complaint,
+        "curl_json plugin: The previous request to %s has not finished yet. "
+        "Skipping this interval.", db->url);
+    return (0);
+  }
+
+  if (cj_engine_start () != 0)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (-1);
+  }
+
+  db->busy = 1;
+  db->next = engine_submitted;
+  engine_submitted = db;
+  pthread_cond_signal (&engine_cond);
+  pthread_mutex_unlock (&engine_lock);
+
+  c_release (LOG_INFO, &db->complaint,
+      "curl_json plugin: Requests to %s complete in time again.", db->url);
+  return (0);
+} /* }}} int cj_engine_submit */
+
+/* }}} End of asynchronous fetching of URLs */
 
 static int cj_read (user_data_t *ud) /* {{{ */
 {
   cj_t *db;
+  int status;
 
   if ((ud == NULL) || (ud->data == NULL))
   {
@@ -991,12 +1415,20 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db = (cj_t *) ud->data;
 
-  db->depth = 0;
-  memset (&db->state, 0, sizeof(db->state));
-  db->state[db->depth].tree = db->tree;
-  db->key = NULL;
+  if (db->url != NULL)
+  {
+    /* Values are dispatched from the engine thread, which does not know
+     * this callback's interval. */
+    if (db->interval == 0)
+      db->interval = plugin_get_interval ();
+    return cj_engine_submit (db);
+  }
+
+  status = cj_perform_begin (db);
+  if (status != 0)
+    return (status);
 
-  return cj_perform (db);
+  return cj_perform_end (db, cj_sock_perform (db));
 } /* }}} int cj_read */
 
 static int cj_init (void) /* {{{ */
@@ -1007,10 +1439,17 @@ static int cj_init (void) /* {{{ */
   return (0);
 } /* }}} int cj_init */
 
+static int cj_shutdown (void) /* {{{ */
+{
+  cj_engine_shutdown ();
+  return (0);
+} /* }}} int cj_shutdown */
+
 void module_register (void)
 {
   plugin_register_complex_config ("curl_json", cj_config);
   plugin_register_init ("curl_json", cj_init);
+  plugin_register_shutdown ("curl_json", cj_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,125 @@
+/**
+ * collectd - src/daemon/collectd-bench-network.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+/* The network plugin compiled into collectd-bench, so that the micro
+ * benchmarks can call its packet parser directly. */
+
+#define module_register network_module_register
+#include "../network.c" /* sic */
+
+#include "collectd-bench.h"
+
+/* Fills "buffer" with identifier parts, which are parsed but not
+ * dispatched, so that the benchmark doesn't depend on the write queue. */
+static size_t bench_network_payload (char *buffer, size_t buffer_size) /* {{{ */
+{
+  char *ptr = buffer;
+  int size_left = (int) buffer_size;
+
+  while (42)
+  {
+    char name[DATA_MAX_NAME_LEN];
+
+    ssnprintf (name, sizeof (name), "host%i.example.com",
+        (int) (ptr - buffer));
+    if (write_part_string (&ptr, &size_left, TYPE_HOST,
+          name, (int) strlen (name)) != 0)
+      break;
+  }
+
+  return (buffer_size - (size_t) size_left);
+} /* }}} size_t bench_network_payload */
+
+int bench_network_receive_encrypted (int packets, _Bool derive_keys, /* {{{ */
+    uint64_t *ret_duration)
+{
+  char auth_file[] = "/tmp/collectd-bench.XXXXXX";
+  char payload[1024];
+  char packet[BUFF_SIG_SIZE + sizeof (payload)];
+  char copy[sizeof (packet)];
+  size_t packet_size;
+  sockent_t *server = NULL;
+  sockent_t *client = NULL;
+  uint64_t start;
+  int status = -1;
+  int fd;
+  int i;
+
+  fd = mkstemp (auth_file);
+  if (fd < 0)
+    return (-1);
+  if (write (fd, "bench: secret\n", 14) != 14)
+  {
+    close (fd);
+    unlink (auth_file);
+    return (-1);
+  }
+  close (fd);
+
+  server = sockent_create (SOCKENT_TYPE_SERVER);
+  client = sockent_create (SOCKENT_TYPE_CLIENT);
+  if ((server == NULL) || (client == NULL))
+    goto out;
+
+  server->data.server.security_level = SECURITY_LEVEL_ENCRYPT;
+  server->data.server.auth_file = strdup (auth_file);
+  client->data.client.security_level = SECURITY_LEVEL_ENCRYPT;
+  client->data.client.username = strdup ("bench");
+  client->data.client.password = strdup ("secret");
+  if ((sockent_init_crypto (server) != 0)
+      || (sockent_init_crypto (client) != 0))
+    goto out;
+
+  packet_size = network_encrypt_buffer (client, payload,
+      bench_network_payload (payload, sizeof (payload)), packet);
+
+  start = bench_time ();
+  for (i = 0; i < packets; i++)
+  {
+    /* Dropping the cached key makes the parser read the AuthFile, hash the
+     * password and key the cipher again, as it did for every packet before
+     * keys were cached. */
+    if (derive_keys)
+      network_user_keys_clear (server->data.server.user_keys);
+
+    /* Packets are decrypted in place. */
+    memcpy (copy, packet, packet_size);
+    parse_packet (server, copy, packet_size, /* flags = */ 0,
+        /* username = */ NULL);
+  }
+  *ret_duration = bench_time () - start;
+  status = 0;
+
+out:
+  if (client != NULL)
+    sockent_destroy (client);
+  if (server != NULL)
+    sockent_destroy (server);
+  unlink (auth_file);
+  return (status);
+} /* }}} int bench_network_receive_encrypted */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,996 @@
+/**
+ * collectd - src/daemon/collectd-bench.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#define _GNU_SOURCE /* For RTLD_NEXT */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "filter_chain.h"
+#include "utils_cache.h"
+#include "utils_ignorelist.h"
+#include "utils_format_json.h"
+#include "utils_format_graphite.h"
+#include "collectd-bench.h"
+
+#include <pthread.h>
+#include <dlfcn.h>
+
+/*
+ * collectd-bench runs the plugin core in-process: it reads a configuration
+ * file (which may set up filter chains and load write plugins), registers a
+ * "null" writer and dispatches synthetic values from several threads as fast
+ * as possible. The result is printed as one JSON object.
+ *
+ * With "-m", one of the micro benchmarks below is run instead. They time the
+ * helpers the plugins call once per value list, without the plugin core.
+ */
+
+/* Defined in collectd.c for the daemon. */
+char hostname_g[DATA_MAX_NAME_LEN];
+cdtime_t interval_g;
+int  pidfile_from_cli = 0;
+int  timeout_g;
+#if HAVE_LIBKSTAT
+kstat_ctl_t *kc;
+#endif /* HAVE_LIBKSTAT */
+
+#define DEF_NUM_THREADS  4
+#define DEF_NUM_HOSTS  100
+#define DEF_NUM_PLUGINS 10
+#define DEF_NUM_VALUES  10
+#define DEF_DURATION    10
+
+/* Latencies are counted in a log-linear histogram: below 16ns every
+ * nanosecond has its own bucket, above that each power of two is split into
+ * 16 buckets. Percentiles are thus accurate to about 6%. */
+#define BENCH_SUB_BUCKETS 16
+#define BENCH_BUCKETS (61 * BENCH_SUB_BUCKETS)
+
+/* Counters of one thread. Each thread only updates its own counters, so no
+ * locking is needed on the hot path. The structures are never freed, so the
+ * totals can be computed after the threads have exited. */
+struct bench_thread_s;
+typedef struct bench_thread_s bench_thread_t;
+struct bench_thread_s
+{
+  uint64_t histogram[BENCH_STAGE_NUM][BENCH_BUCKETS];
+  uint64_t count[BENCH_STAGE_NUM];
+  uint64_t sum[BENCH_STAGE_NUM];
+  uint64_t max[BENCH_STAGE_NUM];
+
+  uint64_t dispatched;
+  uint64_t written;
+  uint64_t allocations;
+  uint64_t locks;
+  uint64_t locks_contended;
+  uint64_t lock_wait;
+
+  bench_thread_t *next;
+};
+
+static const char *stage_names[BENCH_STAGE_NUM] =
+{
+  "dispatch",
+  "queue",
+  "pre_cache",
+  "cache",
+  "post_cache"
+};
+
+static bench_thread_t *threads_head = NULL;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   threads_key;
+static _Bool           threads_key_created = 0;
+
+static int conf_num_threads = DEF_NUM_THREADS;
+static int conf_num_hosts = DEF_NUM_HOSTS;
+static int conf_num_plugins = DEF_NUM_PLUGINS;
+static int conf_num_values = DEF_NUM_VALUES;
+static int conf_duration = DEF_DURATION;
+static _Bool conf_null_writer = 1;
+static const char *conf_micro = NULL;
+
+static cdtime_t time_base = 0;
+static int loop = 1;
+
+__attribute__((noreturn))
+static void exit_usage (int status) /* {{{ */
+{
+  fprintf ((status == EXIT_SUCCESS) ? stdout : stderr,
+      "Usage: collectd-bench [OPTIONS]\n"
+      "\n"
+      "Runs the collectd plugin core in-process and measures how fast it\n"
+      "handles values. The result is printed as a JSON object.\n"
+      "\n"
+      "Available options:\n"
+      "  -C <file>       Configuration file, which may set up filter chains\n"
+      "                  and load write plugins. Read plugins are not needed.\n"
+      "                  Default: "CONFIGFILE"\n"
+      "  -d <seconds>    Duration of the benchmark. (Default: %i)\n"
+      "  -t <number>     Number of dispatching threads. (Default: %i)\n"
+      "  -H <number>     Number of hosts to emulate. (Default: %i)\n"
+      "  -p <number>     Number of plugin instances per host. (Default: %i)\n"
+      "  -v <number>     Number of values per plugin instance. (Default: %i)\n"
+      "  -n              Don't register the null writer.\n"
+      "  -m <name>       Run a micro benchmark instead: format_json,\n"
+      "                  format_graphite, ignorelist or network_encrypt.\n"
+      "  -h              Display help (this message)\n"
+      "\n"PACKAGE_NAME" "PACKAGE_VERSION", http://collectd.org/\n",
+      DEF_DURATION, DEF_NUM_THREADS, DEF_NUM_HOSTS, DEF_NUM_PLUGINS,
+      DEF_NUM_VALUES);
+  exit (status);
+} /* }}} void exit_usage */
+
+static void sig_int_handler (int __attribute__((unused)) signal) /* {{{ */
+{
+  loop = 0;
+} /* }}} void sig_int_handler */
+
+/* Returns the counters of the calling thread, or NULL if it has none yet. */
+static bench_thread_t *bench_thread_lookup (void) /* {{{ */
+{
+  if (!threads_key_created)
+    return (NULL);
+
+  return (pthread_getspecific (threads_key));
+} /* }}} bench_thread_t *bench_thread_lookup */
+
+static bench_thread_t *bench_thread_get (void) /* {{{ */
+{
+  bench_thread_t *t;
+
+  if (!threads_key_created)
+    return (NULL);
+
+  t = pthread_getspecific (threads_key);
+  if (t != NULL)
+    return (t);
+
+  t = calloc (1, sizeof (*t));
+  if (t == NULL)
+    return (NULL);
+  pthread_setspecific (threads_key, t);
+
+  pthread_mutex_lock (&threads_lock);
+  t->next = threads_head;
+  threads_head = t;
+  pthread_mutex_unlock (&threads_lock);
+
+  return (t);
+} /* }}} bench_thread_t *bench_thread_get */
+
+/*
+ * Counting allocations and lock contention
+ *
+ * With the GNU C library, malloc(3) may be replaced by the application and
+ * the library's own allocations go through the replacement, too. Calls to
+ * pthread_mutex_lock(3) from the daemon and from the loaded plugins resolve
+ * to the definition in this executable. Only threads which have counters
+ * are counted.
+ */
+#if defined(__GLIBC__)
+# define BENCH_COUNT_ALLOCATIONS 1
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *malloc (size_t size) /* {{{ */
+{
+  bench_thread_t *t = bench_thread_lookup ();
+
+  if (t != NULL)
+    t->allocations++;
+  return (__libc_malloc (size));
+} /* }}} void *malloc */
+
+void *calloc (size_t nmemb, size_t size) /* {{{ */
+{
+  bench_thread_t *t = bench_thread_lookup ();
+
+  if (t != NULL)
+    t->allocations++;
+  return (__libc_calloc (nmemb, size));
+} /* }}} void *calloc */
+
+void *realloc (void *ptr, size_t size) /* {{{ */
+{
+  bench_thread_t *t = bench_thread_lookup ();
+
+  if (t != NULL)
+    t->allocations++;
+  return (__libc_realloc (ptr, size));
+} /* }}} void *realloc */
+#else
+# define BENCH_COUNT_ALLOCATIONS 0
+#endif
+
+#if defined(__GLIBC__) && defined(RTLD_NEXT)
+# define BENCH_COUNT_LOCKS 1
+static int (*real_mutex_lock) (pthread_mutex_t *) = NULL;
+
+static void bench_resolve_mutex_lock (void) /* {{{ */
+{
+  *(void **) (&real_mutex_lock) = dlsym (RTLD_NEXT, "pthread_mutex_lock");
+  if (real_mutex_lock == NULL)
+  {
+    fprintf (stderr, "dlsym (pthread_mutex_lock) failed: %s\n", dlerror ());
+    abort ();
+  }
+} /* }}} void bench_resolve_mutex_lock */
+
+int pthread_mutex_lock (pthread_mutex_t *mutex) /* {{{ */
+{
+  bench_thread_t *t;
+  uint64_t start;
+  int status;
+
+  if (real_mutex_lock == NULL)
+    bench_resolve_mutex_lock ();
+
+  t = bench_thread_lookup ();
+  if (t == NULL)
+    return (real_mutex_lock (mutex));
+
+  t->locks++;
+  status = pthread_mutex_trylock (mutex);
+  if (status != EBUSY)
+    return (status);
+
+  t->locks_contended++;
+  start = bench_time ();
+  status = real_mutex_lock (mutex);
+  t->lock_wait += bench_time () - start;
+
+  return (status);
+} /* }}} int pthread_mutex_lock */
+#else
+# define BENCH_COUNT_LOCKS 0
+#endif
+
+/*
+ * Stage timing, see collectd-bench.h
+ */
+uint64_t bench_time (void) /* {{{ */
+{
+  struct timespec ts = { 0, 0 };
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec) * 1000000000 + (uint64_t) ts.tv_nsec);
+} /* }}} uint64_t bench_time */
+
+static size_t bench_bucket (uint64_t value) /* {{{ */
+{
+  int exponent;
+
+  if (value < BENCH_SUB_BUCKETS)
+    return ((size_t) value);
+
+#if __GNUC__
+  exponent = 63 - __builtin_clzll (value);
+#else
+  for (exponent = 4; (value >> exponent) > 1; exponent++)
+    /* nothing */;
+#endif
+
+  /* The four bits below the most significant one select the sub-bucket. */
+  return (((size_t) (exponent - 3)) * BENCH_SUB_BUCKETS
+      + (size_t) ((value >> (exponent - 4)) - BENCH_SUB_BUCKETS));
+} /* }}} size_t bench_bucket */
+
+/* Returns the largest value counted in "bucket". */
+static uint64_t bench_bucket_value (size_t bucket) /* {{{ */
+{
+  int exponent;
+  uint64_t sub;
+
+  if (bucket < BENCH_SUB_BUCKETS)
+    return ((uint64_t) bucket);
+
+  exponent = (int) (bucket / BENCH_SUB_BUCKETS) + 3;
+  sub = (uint64_t) (bucket % BENCH_SUB_BUCKETS);
+
+  return (((BENCH_SUB_BUCKETS + sub + 1) << (exponent - 4)) - 1);
+} /* }}} uint64_t bench_bucket_value */
+
+void bench_record (int stage, uint64_t start, uint64_t end) /* {{{ */
+{
+  bench_thread_t *t = bench_thread_get ();
+  uint64_t latency = (end > start) ? (end - start) : 0;
+
+  if ((t == NULL) || (stage < 0) || (stage >= BENCH_STAGE_NUM))
+    return;
+
+  t->histogram[stage][bench_bucket (latency)]++;
+  t->count[stage]++;
+  t->sum[stage] += latency;
+  if (t->max[stage] < latency)
+    t->max[stage] = latency;
+} /* }}} void bench_record */
+
+/*
+ * The "bench" plugin
+ */
+static int bench_init (void) /* {{{ */
+{
+  /* Registered so that plugin_init_all() starts the write threads even if
+   * the configuration doesn't load any plugins. */
+  return (0);
+} /* }}} int bench_init */
+
+static int bench_null_write (const data_set_t __attribute__((unused)) *ds, /* {{{ */
+    const value_list_t __attribute__((unused)) *vl,
+    user_data_t __attribute__((unused)) *ud)
+{
+  bench_thread_t *t = bench_thread_get ();
+
+  if (t != NULL)
+    t->written++;
+  return (0);
+} /* }}} int bench_null_write */
+
+/* Without a log plugin, every message would go to STDERR, which is slow enough
+ * to skew the results. Only warnings and errors are printed. */
+static void bench_log (int severity, const char *msg, /* {{{ */
+    user_data_t __attribute__((unused)) *ud)
+{
+  if (severity <= LOG_WARNING)
+    fprintf (stderr, "%s\n", msg);
+} /* }}} void bench_log */
+
+/* Emulates a read plugin: dispatches every "num_threads"th value, starting at
+ * "index", round after round until the benchmark ends. */
+static void *bench_dispatch_thread (void *arg) /* {{{ */
+{
+  int index = (int) (intptr_t) arg;
+  int cardinality = conf_num_hosts * conf_num_plugins * conf_num_values;
+  bench_thread_t *t;
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t value;
+  uint64_t round;
+
+  t = bench_thread_get ();
+  if (t == NULL)
+    return ((void *) -1);
+
+  vl.values = &value;
+  vl.values_len = 1;
+  vl.interval = interval_g;
+  sstrncpy (vl.plugin, "bench", sizeof (vl.plugin));
+  sstrncpy (vl.type, "derive", sizeof (vl.type));
+
+  for (round = 0; loop; round++)
+  {
+    int i;
+
+    value.derive = (derive_t) round;
+    vl.time = time_base + round * interval_g;
+
+    for (i = index; (i < cardinality) && loop; i += conf_num_threads)
+    {
+      uint64_t start;
+
+      ssnprintf (vl.host, sizeof (vl.host), "host%i",
+          i / (conf_num_plugins * conf_num_values));
+      ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance), "%i",
+          (i / conf_num_values) % conf_num_plugins);
+      ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%i",
+          i % conf_num_values);
+
+      start = bench_time ();
+      plugin_dispatch_values (&vl);
+      bench_record (BENCH_STAGE_DISPATCH, start, bench_time ());
+      t->dispatched++;
+    }
+  }
+
+  return ((void *) 0);
+} /* }}} void *bench_dispatch_thread */
+
+/*
+ * Reporting
+ */
+struct bench_totals_s
+{
+  uint64_t histogram[BENCH_STAGE_NUM][BENCH_BUCKETS];
+  uint64_t count[BENCH_STAGE_NUM];
+  uint64_t sum[BENCH_STAGE_NUM];
+  uint64_t max[BENCH_STAGE_NUM];
+
+  uint64_t dispatched;
+  uint64_t written;
+  uint64_t allocations;
+  uint64_t locks;
+  uint64_t locks_contended;
+  uint64_t lock_wait;
+};
+typedef struct bench_totals_s bench_totals_t;
+
+static void bench_totals (bench_totals_t *totals) /* {{{ */
+{
+  bench_thread_t *t;
+
+  memset (totals, 0, sizeof (*totals));
+
+  pthread_mutex_lock (&threads_lock);
+  for (t = threads_head; t != NULL; t = t->next)
+  {
+    int i;
+    size_t j;
+
+    for (i = 0; i < BENCH_STAGE_NUM; i++)
+    {
+      for (j = 0; j < BENCH_BUCKETS; j++)
+        totals->histogram[i][j] += t->histogram[i][j];
+      totals->count[i] += t->count[i];
+      totals->sum[i] += t->sum[i];
+      if (totals->max[i] < t->max[i])
+        totals->max[i] = t->max[i];
+    }
+
+    totals->dispatched += t->dispatched;
+    totals->written += t->written;
+    totals->allocations += t->allocations;
+    totals->locks += t->locks;
+    totals->locks_contended += t->locks_contended;
+    totals->lock_wait += t->lock_wait;
+  }
+  pthread_mutex_unlock (&threads_lock);
+} /* }}} void bench_totals */
+
+static uint64_t bench_percentile (const bench_totals_t *totals, /* {{{ */
+    int stage, double percent)
+{
+  uint64_t want;
+  uint64_t sum = 0;
+  size_t i;
+
+  if (totals->count[stage] == 0)
+    return (0);
+
+  want = (uint64_t) ceil (((double) totals->count[stage]) * percent / 100.0);
+  if (want < 1)
+    want = 1;
+
+  for (i = 0; i < BENCH_BUCKETS; i++)
+  {
+    sum += totals->histogram[stage][i];
+    if (sum >= want)
+      break;
+  }
+
+  if (i >= BENCH_BUCKETS)
+    return (totals->max[stage]);
+  /* The bucket's upper bound may be larger than any value seen. */
+  if (bench_bucket_value (i) > totals->max[stage])
+    return (totals->max[stage]);
+  return (bench_bucket_value (i));
+} /* }}} uint64_t bench_percentile */
+
+static void bench_report (const bench_totals_t *totals, /* {{{ */
+    uint64_t dispatch_time, uint64_t process_time, size_t cache_size)
+{
+  uint64_t processed = totals->count[BENCH_STAGE_PRE_CACHE];
+  int i;
+
+  printf ("{\"version\":\"%s\",", PACKAGE_VERSION);
+  printf ("\"threads\":%i,\"write_threads\":%li,\"cardinality\":%i,",
+      conf_num_threads, global_option_get_long ("WriteThreads", 5),
+      conf_num_hosts * conf_num_plugins * conf_num_values);
+  printf ("\"pre_cache_chain\":%s,\"post_cache_chain\":%s,",
+      (fc_chain_get_by_name (global_option_get ("PreCacheChain")) != NULL)
+      ? "true" : "false",
+      (fc_chain_get_by_name (global_option_get ("PostCacheChain")) != NULL)
+      ? "true" : "false");
+  printf ("\"duration\":%.3f,", ((double) dispatch_time) / 1e9);
+  printf ("\"values_dispatched\":%"PRIu64",\"values_processed\":%"PRIu64","
+      "\"values_written\":%"PRIu64",\"cache_entries\":%zu,",
+      totals->dispatched, processed, totals->written, cache_size);
+  printf ("\"dispatched_per_second\":%.1f,\"processed_per_second\":%.1f,",
+      (dispatch_time > 0)
+      ? ((double) totals->dispatched) * 1e9 / ((double) dispatch_time) : 0.0,
+      (process_time > 0)
+      ? ((double) processed) * 1e9 / ((double) process_time) : 0.0);
+
+  if (BENCH_COUNT_ALLOCATIONS && (processed > 0))
+    printf ("\"allocations_per_value\":%.2f,",
+        ((double) totals->allocations) / ((double) processed));
+  else
+    printf ("\"allocations_per_value\":null,");
+
+  if (BENCH_COUNT_LOCKS)
+    printf ("\"locks\":{\"acquired\":%"PRIu64",\"contended\":%"PRIu64","
+        "\"wait_ns\":%"PRIu64"},",
+        totals->locks, totals->locks_contended, totals->lock_wait);
+  else
+    printf ("\"locks\":null,");
+
+  printf ("\"stages\":{");
+  for (i = 0; i < BENCH_STAGE_NUM; i++)
+  {
+    printf ("%s\"%s\":{\"count\":%"PRIu64",\"mean_ns\":%.1f,"
+        "\"p50_ns\":%"PRIu64",\"p90_ns\":%"PRIu64",\"p99_ns\":%"PRIu64","
+        "\"p999_ns\":%"PRIu64",\"max_ns\":%"PRIu64"}",
+        (i == 0) ? "" : ",", stage_names[i], totals->count[i],
+        (totals->count[i] > 0)
+        ? ((double) totals->sum[i]) / ((double) totals->count[i]) : 0.0,
+        bench_percentile (totals, i, 50.0),
+        bench_percentile (totals, i, 90.0),
+        bench_percentile (totals, i, 99.0),
+        bench_percentile (totals, i, 99.9),
+        totals->max[i]);
+  }
+  printf ("}}\n");
+} /* }}} void bench_report */
+
+/*
+ * Micro benchmarks
+ */
+#define MICRO_ITERATIONS 1000000
+
+static data_source_t micro_dsrc[] =
+{
+  { "derive",   DS_TYPE_DERIVE,   0.0, NAN },
+  { "counter",  DS_TYPE_COUNTER,  0.0, NAN },
+  { "absolute", DS_TYPE_ABSOLUTE, 0.0, NAN },
+  { "gauge",    DS_TYPE_GAUGE,    0.0, NAN }
+};
+static data_set_t micro_ds = { "bench", STATIC_ARRAY_SIZE (micro_dsrc), micro_dsrc };
+
+static void micro_value_list (value_list_t *vl, value_t *values, int n) /* {{{ */
+{
+  values[0].derive = (derive_t) n;
+  values[1].counter = (counter_t) n * 1000;
+  values[2].absolute = 7;
+  values[3].gauge = ((double) n) / 8.0;
+
+  vl->values = values;
+  vl->values_len = STATIC_ARRAY_SIZE (micro_dsrc);
+  vl->time = time_base + ((cdtime_t) n) * MS_TO_CDTIME_T (1);
+  vl->interval = interval_g;
+  sstrncpy (vl->host, "example.com", sizeof (vl->host));
+  sstrncpy (vl->plugin, "bench", sizeof (vl->plugin));
+  ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance), "eth%i",
+      n % 1000);
+  sstrncpy (vl->type, "bench", sizeof (vl->type));
+} /* }}} void micro_value_list */
+
+static void micro_report (const char *name, uint64_t iterations, /* {{{ */
+    uint64_t duration)
+{
+  printf ("{\"version\":\"%s\",\"benchmark\":\"%s\",\"iterations\":%"PRIu64","
+      "\"duration\":%.3f,\"per_second\":%.1f}\n",
+      PACKAGE_VERSION, name, iterations, ((double) duration) / 1e9,
+      (duration > 0) ? ((double) iterations) * 1e9 / ((double) duration) : 0.0);
+} /* }}} void micro_report */
+
+struct micro_json_formatter_s
+{
+  const char *suffix;
+  int (*initialize) (char *, size_t *, size_t *);
+  int (*value_list) (char *, size_t *, size_t *,
+      const data_set_t *, const value_list_t *, int);
+  int (*finalize) (char *, size_t *, size_t *);
+};
+
+static struct micro_json_formatter_s micro_json_formatters[] =
+{
+  { "", format_json_initialize, format_json_value_list,
+    format_json_finalize },
+  { "_baseline", baseline_format_json_initialize,
+    baseline_format_json_value_list, baseline_format_json_finalize }
+};
+
+/* Formats value lists into 4 kByte batches, as write_http does, and one
+ * value list per 8 kByte message, as write_kafka and amqp do. Each mode runs
+ * with the current formatter and with the old snprintf() based one. */
+static int micro_format_json (void) /* {{{ */
+{
+  char buffer[8192];
+  value_t values[STATIC_ARRAY_SIZE (micro_dsrc)];
+  value_list_t vl = VALUE_LIST_INIT;
+  size_t i;
+
+  for (i = 0; i < 2 * STATIC_ARRAY_SIZE (micro_json_formatters); i++)
+  {
+    struct micro_json_formatter_s *f = micro_json_formatters
+      + (i % STATIC_ARRAY_SIZE (micro_json_formatters));
+    _Bool per_message = (i >= STATIC_ARRAY_SIZE (micro_json_formatters));
+    size_t fill = 0;
+    size_t free = per_message ? sizeof (buffer) : 4096;
+    char name[64];
+    uint64_t start;
+    int n;
+
+    f->initialize (buffer, &fill, &free);
+    start = bench_time ();
+    for (n = 0; n < MICRO_ITERATIONS; n++)
+    {
+      micro_value_list (&vl, values, n);
+      if (per_message)
+      {
+        f->initialize (buffer, &fill, &free);
+        f->value_list (buffer, &fill, &free, &micro_ds, &vl,
+            /* store rates = */ 0);
+        f->finalize (buffer, &fill, &free);
+        continue;
+      }
+
+      if (f->value_list (buffer, &fill, &free, &micro_ds, &vl, 0) == 0)
+        continue;
+
+      f->finalize (buffer, &fill, &free);
+      f->initialize (buffer, &fill, &free);
+      f->value_list (buffer, &fill, &free, &micro_ds, &vl, 0);
+    }
+
+    ssnprintf (name, sizeof (name), "format_json%s%s",
+        per_message ? "_message" : "", f->suffix);
+    micro_report (name, MICRO_ITERATIONS, bench_time () - start);
+  }
+
+  return (0);
+} /* }}} int micro_format_json */
+
+/* Formats 1000 identifiers over and over, as write_graphite does once per
+ * interval, with and without the path cache. */
+static int micro_format_graphite (void) /* {{{ */
+{
+  graphite_cache_t *cache;
+  char buffer[1024];
+  value_t values[STATIC_ARRAY_SIZE (micro_dsrc)];
+  value_list_t vl = VALUE_LIST_INIT;
+  int i;
+
+  cache = graphite_cache_create (GRAPHITE_CACHE_DEFAULT_SIZE);
+  if (cache == NULL)
+  {
+    fprintf (stderr, "graphite_cache_create failed.\n");
+    return (-1);
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    uint64_t start;
+    int n;
+
+    start = bench_time ();
+    for (n = 0; n < MICRO_ITERATIONS; n++)
+    {
+      micro_value_list (&vl, values, n);
+      format_graphite_cached ((i == 0) ? cache : NULL,
+          buffer, sizeof (buffer), &micro_ds, &vl,
+          "collectd.", NULL, '_', GRAPHITE_SEPARATE_INSTANCES);
+    }
+    micro_report ((i == 0) ? "format_graphite" : "format_graphite_uncached",
+        MICRO_ITERATIONS, bench_time () - start);
+  }
+
+  graphite_cache_destroy (cache);
+  return (0);
+} /* }}} int micro_format_graphite */
+
+/* Matches 5000 interface names against 200 names and 20 regular expressions,
+ * as the interface plugin does once per interval. */
+static int micro_ignorelist (void) /* {{{ */
+{
+  ignorelist_t *il;
+  char names[5000][32];
+  uint64_t start;
+  int i;
+  int n;
+
+  il = ignorelist_create (/* invert = */ 0);
+  if (il == NULL)
+  {
+    fprintf (stderr, "ignorelist_create failed.\n");
+    return (-1);
+  }
+
+  for (i = 0; i < 200; i++)
+  {
+    char entry[32];
+    ssnprintf (entry, sizeof (entry), "eth%i", i);
+    ignorelist_add (il, entry);
+  }
+#if HAVE_REGEX_H
+  for (i = 0; i < 20; i++)
+  {
+    char entry[32];
+    ssnprintf (entry, sizeof (entry), "/^veth%x[0-9a-f]*z$/", i);
+    ignorelist_add (il, entry);
+  }
+#endif
+
+  for (i = 0; i < (int) STATIC_ARRAY_SIZE (names); i++)
+    ssnprintf (names[i], sizeof (names[i]), "veth%08x%s",
+        i * 2654435761U, (i % 10 == 0) ? "z" : "");
+
+  start = bench_time ();
+  for (n = 0; n < MICRO_ITERATIONS / (int) STATIC_ARRAY_SIZE (names); n++)
+    for (i = 0; i < (int) STATIC_ARRAY_SIZE (names); i++)
+      ignorelist_match (il, names[i]);
+  micro_report ("ignorelist", MICRO_ITERATIONS, bench_time () - start);
+
+  ignorelist_free (il);
+  return (0);
+} /* }}} int micro_ignorelist */
+
+#if HAVE_LIBGCRYPT
+/* Receives encrypted 1 kByte packets, as the network plugin's dispatch
+ * thread does, with the cached per-user key and with the key derived from
+ * the AuthFile for every packet. */
+static int micro_network_encrypt (void) /* {{{ */
+{
+  int packets = MICRO_ITERATIONS / 10;
+  int i;
+
+  for (i = 0; i < 2; i++)
+  {
+    uint64_t duration = 0;
+
+    if (bench_network_receive_encrypted (packets, /* derive keys = */ i == 1,
+          &duration) != 0)
+    {
+      fprintf (stderr, "bench_network_receive_encrypted failed.\n");
+      return (-1);
+    }
+    micro_report ((i == 0) ? "network_encrypt" : "network_encrypt_uncached",
+        (uint64_t) packets, duration);
+  }
+
+  return (0);
+} /* }}} int micro_network_encrypt */
+#endif
+
+static int micro_run (const char *name) /* {{{ */
+{
+  interval_g = TIME_T_TO_CDTIME_T (10);
+  time_base = cdtime ();
+
+  if (strcasecmp ("format_json", name) == 0)
+    return (micro_format_json ());
+  else if (strcasecmp ("format_graphite", name) == 0)
+    return (micro_format_graphite ());
+  else if (strcasecmp ("ignorelist", name) == 0)
+    return (micro_ignorelist ());
+#if HAVE_LIBGCRYPT
+  else if (strcasecmp ("network_encrypt", name) == 0)
+    return (micro_network_encrypt ());
+#endif
+
+  fprintf (stderr, "Unknown micro benchmark: %s\n", name);
+  exit_usage (EXIT_FAILURE);
+} /* }}} int micro_run */
+
+static int init_global_variables (void) /* {{{ */
+{
+  char const *str;
+
+  interval_g = cf_get_default_interval ();
+
+  str = global_option_get ("Timeout");
+  timeout_g = (str != NULL) ? atoi (str) : 2;
+  if (timeout_g <= 1)
+  {
+    fprintf (stderr, "Cannot set the timeout to a correct value.\n");
+    return (-1);
+  }
+
+  str = global_option_get ("Hostname");
+  sstrncpy (hostname_g, (str != NULL) ? str : "localhost",
+      sizeof (hostname_g));
+
+  return (0);
+} /* }}} int init_global_variables */
+
+static int get_positive_int (const char *str) /* {{{ */
+{
+  int value = atoi (str);
+
+  if (value < 1)
+  {
+    fprintf (stderr, "Not a positive number: %s\n", str);
+    exit_usage (EXIT_FAILURE);
+  }
+  return (value);
+} /* }}} int get_positive_int */
+
+int main (int argc, char **argv) /* {{{ */
+{
+  struct sigaction sig_int_action;
+  const char *configfile = CONFIGFILE;
+  pthread_t *dispatch_threads;
+  bench_totals_t *totals;
+  uint64_t start;
+  uint64_t dispatch_end;
+  uint64_t process_end;
+  uint64_t next_read;
+  uint64_t processed;
+  size_t cache_size;
+  int i;
+
+  while (42)
+  {
+    int c = getopt (argc, argv, "C:d:t:H:p:v:nm:h");
+
+    if (c == -1)
+      break;
+
+    switch (c)
+    {
+      case 'C':
+        configfile = optarg;
+        break;
+      case 'd':
+        conf_duration = get_positive_int (optarg);
+        break;
+      case 't':
+        conf_num_threads = get_positive_int (optarg);
+        break;
+      case 'H':
+        conf_num_hosts = get_positive_int (optarg);
+        break;
+      case 'p':
+        conf_num_plugins = get_positive_int (optarg);
+        break;
+      case 'v':
+        conf_num_values = get_positive_int (optarg);
+        break;
+      case 'n':
+        conf_null_writer = 0;
+        break;
+      case 'm':
+        conf_micro = optarg;
+        break;
+      case 'h':
+        exit_usage (EXIT_SUCCESS);
+      default:
+        exit_usage (EXIT_FAILURE);
+    }
+  }
+
+  if (optind < argc)
+    exit_usage (EXIT_FAILURE);
+
+#if BENCH_COUNT_LOCKS
+  bench_resolve_mutex_lock ();
+#endif
+
+  memset (&sig_int_action, 0, sizeof (sig_int_action));
+  sig_int_action.sa_handler = sig_int_handler;
+  sigaction (SIGINT, &sig_int_action, NULL);
+  sigaction (SIGTERM, &sig_int_action, NULL);
+
+  plugin_init_ctx ();
+
+  if (conf_micro != NULL)
+    return ((micro_run (conf_micro) == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+  if (cf_read (configfile))
+  {
+    fprintf (stderr, "Error: Reading the config file failed!\n");
+    return (EXIT_FAILURE);
+  }
+
+  if (init_global_variables () != 0)
+    return (EXIT_FAILURE);
+
+  if (pthread_key_create (&threads_key, /* destructor = */ NULL) != 0)
+  {
+    fprintf (stderr, "pthread_key_create failed.\n");
+    return (EXIT_FAILURE);
+  }
+  threads_key_created = 1;
+
+  plugin_register_init ("bench", bench_init);
+  plugin_register_log ("bench", bench_log, /* user data = */ NULL);
+  if (conf_null_writer)
+    plugin_register_write ("bench_null", bench_null_write,
+        /* user data = */ NULL);
+
+  if (plugin_init_all () != 0)
+    fprintf (stderr, "Warning: Initializing some plugins failed.\n");
+
+  dispatch_threads = calloc ((size_t) conf_num_threads,
+      sizeof (*dispatch_threads));
+  totals = calloc (1, sizeof (*totals));
+  if ((dispatch_threads == NULL) || (totals == NULL))
+  {
+    fprintf (stderr, "calloc failed.\n");
+    return (EXIT_FAILURE);
+  }
+
+  time_base = cdtime ();
+  start = bench_time ();
+  for (i = 0; i < conf_num_threads; i++)
+  {
+    if (pthread_create (dispatch_threads + i, /* attr = */ NULL,
+          bench_dispatch_thread, (void *) (intptr_t) i) != 0)
+    {
+      fprintf (stderr, "pthread_create failed.\n");
+      return (EXIT_FAILURE);
+    }
+  }
+
+  /* Run the periodic work of the daemon's main loop, e.g. the cache's
+   * timeout handling, while the benchmark runs. */
+  next_read = start + CDTIME_T_TO_NS (interval_g);
+  while (loop && ((bench_time () - start) < (uint64_t) conf_duration * 1000000000))
+  {
+    struct timespec ts = { 0, 10000000 };
+
+    nanosleep (&ts, NULL);
+    if (bench_time () >= next_read)
+    {
+      plugin_read_all ();
+      next_read += CDTIME_T_TO_NS (interval_g);
+    }
+  }
+
+  loop = 0;
+  for (i = 0; i < conf_num_threads; i++)
+    pthread_join (dispatch_threads[i], NULL);
+  dispatch_end = bench_time ();
+
+  /* Wait for the write threads to handle the queued values. Values dropped
+   * because of "WriteQueueLimitHigh" never arrive, so give up once no
+   * progress is made for a second. */
+  process_end = dispatch_end;
+  processed = 0;
+  while (42)
+  {
+    struct timespec ts = { 0, 1000000 };
+    uint64_t now;
+
+    bench_totals (totals);
+    now = bench_time ();
+    if (totals->count[BENCH_STAGE_PRE_CACHE] != processed)
+    {
+      processed = totals->count[BENCH_STAGE_PRE_CACHE];
+      process_end = now;
+    }
+
+    if ((processed >= totals->dispatched)
+        || ((now - process_end) > 1000000000))
+      break;
+    nanosleep (&ts, NULL);
+  }
+
+  cache_size = uc_get_size ();
+  plugin_shutdown_all ();
+
+  bench_totals (totals);
+  bench_report (totals, dispatch_end - start, process_end - start,
+      cache_size);
+
+  sfree (totals);
+  sfree (dispatch_threads);
+  return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,70 @@
+/**
+ * collectd - src/daemon/collectd-bench.h
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#ifndef COLLECTD_BENCH_H
+#define COLLECTD_BENCH_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/* Stages of the value pipeline timed by collectd-bench. The plugin core calls
+ * the functions below when built with -DCOLLECTD_BENCH=1. */
+enum bench_stage_e
+{
+  BENCH_STAGE_DISPATCH,   /* plugin_dispatch_values(), i.e. enqueueing */
+  BENCH_STAGE_QUEUE,      /* waiting in the write queue */
+  BENCH_STAGE_PRE_CACHE,  /* checks and the pre-cache chain */
+  BENCH_STAGE_CACHE,      /* uc_update() */
+  BENCH_STAGE_POST_CACHE, /* the post-cache chain and the write callbacks */
+  BENCH_STAGE_NUM
+};
+
+/* Returns a monotonic time stamp in nanoseconds. */
+uint64_t bench_time (void);
+
+/* Records that "stage" took from "start" to "end". */
+void bench_record (int stage, uint64_t start, uint64_t end);
+
+/* The snprintf() based JSON formatter used before format_json_value_list()
+ * formatted in place. Same interface as utils_format_json.h; used as the
+ * baseline of the "format_json" micro benchmark. */
+int baseline_format_json_initialize (char *buffer,
+    size_t *ret_buffer_fill, size_t *ret_buffer_free);
+int baseline_format_json_value_list (char *buffer,
+    size_t *ret_buffer_fill, size_t *ret_buffer_free,
+    const data_set_t *ds, const value_list_t *vl, int store_rates);
+int baseline_format_json_finalize (char *buffer,
+    size_t *ret_buffer_fill, size_t *ret_buffer_free);
+
+#if HAVE_LIBGCRYPT
+/* Has the network plugin parse "packets" encrypted packets and stores the
+ * time that took in "ret_duration". With "derive_keys", the cached key is
+ * dropped before every packet. */
+int bench_network_receive_encrypted (int packets, _Bool derive_keys,
+    uint64_t *ret_duration);
+#endif
+
+#endif /* COLLECTD_BENCH_H */
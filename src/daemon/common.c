@@ -939,6 +939,7 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
         size_t offset = 0;
         int status;
         size_t i;
+        gauge_t rates_buffer[ds->ds_num];
         gauge_t *rates = NULL;
 
         assert (0 == strcmp (ds->type, vl->type));
@@ -949,15 +950,9 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
         status = ssnprintf (ret + offset, ret_len - offset, \
                         __VA_ARGS__); \
         if (status < 1) \
-        { \
-                sfree (rates); \
                 return (-1); \
-        } \
         else if (((size_t) status) >= (ret_len - offset)) \
-        { \
-                sfree (rates); \
                 return (-1); \
-        } \
         else \
                 offset += ((size_t) status); \
 } while (0)
@@ -970,12 +965,15 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
                         BUFFER_ADD (":"GAUGE_FORMAT, vl->values[i].gauge);
                 else if (store_rates)
                 {
-                        if (rates == NULL)
-                                rates = uc_get_rate (ds, vl);
                         if (rates == NULL)
                         {
-                                WARNING ("format_values: uc_get_rate failed.");
-                                return (-1);
+                                if (uc_get_rates (ds, vl, rates_buffer) != 0)
+                                {
+                                        WARNING ("format_values: "
+                                                        "uc_get_rates failed.");
+                                        return (-1);
+                                }
+                                rates = rates_buffer;
                         }
                         BUFFER_ADD (":"GAUGE_FORMAT, rates[i]);
                 }
@@ -989,17 +987,126 @@ int format_values (char *ret, size_t ret_len, /* {{{ */
                 {
                         ERROR ("format_values: Unknown data source type: %i",
                                         ds->ds[i].type);
-                        sfree (rates);
                         return (-1);
                 }
         } /* for ds->ds_num */
 
 #undef BUFFER_ADD
 
-        sfree (rates);
         return (0);
 } /* }}} int format_values */
 
+static double const format_gauge_pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6
+};
+
+/* Formats `value' exactly like "%.15g" would, for the common case of values
+ * with up to 15 significant and at most six decimal digits. Returns the
+ * length of the result or zero if `value' is not such a number. */
+static size_t format_gauge_fast (char *buffer, size_t buffer_size, /* {{{ */
+                gauge_t value)
+{
+        char temp[32];
+        char *end = temp + sizeof (temp);
+        char *str = end;
+        _Bool negative = (value < 0.0);
+        double absolute = fabs (value);
+        uint64_t mantissa = 0;
+        int decimals;
+        size_t len;
+
+        if (value == 0.0)
+        {
+                /* "%g" prints the sign of negative zero. */
+                char const *zero = signbit (value) ? "-0" : "0";
+
+                len = strlen (zero);
+                if (len >= buffer_size)
+                        return (0);
+                memcpy (buffer, zero, len + 1);
+                return (len);
+        }
+
+        if ((absolute < 1e-4) || (absolute >= 1e15))
+                return (0);
+
+        /* If `mantissa / 10^decimals' rounds to `value', then `value' is the
+         * closest double to that decimal number. Since the number has at most
+         * 15 significant digits, this is what "%.15g" prints. */
+        for (decimals = 0;
+                        decimals < (int) STATIC_ARRAY_SIZE (format_gauge_pow10);
+                        decimals++)
+        {
+                double scaled = absolute * format_gauge_pow10[decimals];
+
+                if (scaled >= 1e15)
+                        return (0);
+
+                mantissa = (uint64_t) (scaled + 0.5);
+                if (((double) mantissa) / format_gauge_pow10[decimals] == absolute)
+                        break;
+        }
+        if (decimals >= (int) STATIC_ARRAY_SIZE (format_gauge_pow10))
+                return (0);
+
+        while ((decimals > 0) && ((mantissa % 10) == 0))
+        {
+                mantissa /= 10;
+                decimals--;
+        }
+
+        do
+        {
+                *(--str) = (char) ('0' + (mantissa % 10));
+                mantissa /= 10;
+        } while (mantissa != 0);
+
+        if (decimals > 0)
+        {
+                int digits = (int) (end - str);
+                int i;
+
+                /* Pad with zeros, e.g. "0.0042". */
+                while (digits <= decimals)
+                {
+                        *(--str) = '0';
+                        digits++;
+                }
+
+                str--;
+                for (i = 0; i < digits - decimals; i++)
+                        str[i] = str[i + 1];
+                str[digits - decimals] = '.';
+        }
+        if (negative)
+                *(--str) = '-';
+
+        len = (size_t) (end - str);
+        if (len >= buffer_size)
+                return (0);
+        memcpy (buffer, str, len);
+        buffer[len] = 0;
+        return (len);
+} /* }}} size_t format_gauge_fast */
+
+int format_gauge (char *buffer, size_t buffer_size, gauge_t value) /* {{{ */
+{
+        size_t len = 0;
+        int status;
+
+        /* The fast path only implements the default format. The comparison
+         * is resolved at compile time. */
+        if ((strcmp (GAUGE_FORMAT, "%.15g") == 0) && isfinite (value))
+                len = format_gauge_fast (buffer, buffer_size, value);
+        if (len > 0)
+                return ((int) len);
+
+        status = ssnprintf (buffer, buffer_size, GAUGE_FORMAT, value);
+        if ((status < 1) || (((size_t) status) >= buffer_size))
+                return (-1);
+        return (status);
+} /* }}} int format_gauge */
+
 int parse_identifier (char *str, char **ret_host,
 		char **ret_plugin, char **ret_plugin_instance,
 		char **ret_type, char **ret_type_instance)
@@ -314,6 +314,10 @@ int format_values (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl,
 		_Bool store_rates);
 
+/* Formats a gauge value with GAUGE_FORMAT, avoiding printf for most values.
+ * Returns the length of the string or less than zero if it doesn't fit. */
+int format_gauge (char *buffer, size_t buffer_size, gauge_t value);
+
 int parse_identifier (char *str, char **ret_host,
 		char **ret_plugin, char **ret_plugin_instance,
 		char **ret_type, char **ret_type_instance);
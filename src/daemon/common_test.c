@@ -379,6 +379,49 @@ DEF_TEST(value_to_rate)
   return 0;
 }
 
+DEF_TEST(format_gauge)
+{
+  gauge_t cases[] = { 0.0, -0.0, 1.0, -1.0, 0.1, 0.2 + 0.1, 1.0 / 3.0,
+    1e-4, 9.9999e-5, 123456789012345.0, 999999999999999.0, 1e15, 1e300,
+    4.9e-324, 0.5, 1234.5678, 1.000001, 1.0000001, 0.000123, 42.125,
+    NAN, INFINITY, -INFINITY };
+  double const scale[] = { 1.0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+    1e9, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9, 1e-10, 1e-11,
+    1e-12, 1e-13, 1e-14 };
+  unsigned int seed = 42;
+  char want[64];
+  char got[64];
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++) {
+    snprintf (want, sizeof (want), GAUGE_FORMAT, cases[i]);
+    OK(format_gauge (got, sizeof (got), cases[i]) == (int) strlen (want));
+    EXPECT_EQ_STR (want, got);
+  }
+
+  /* Values with few decimal places, as most metrics have, and arbitrary
+   * ones. The output must be the same as printf's. */
+  for (i = 0; i < 100000; i++) {
+    double d = (double) (rand_r (&seed) % 2000001 - 1000000);
+    gauge_t g;
+
+    if ((i % 2) == 0)
+      g = d / scale[rand_r (&seed) % 7];
+    else
+      g = d * scale[rand_r (&seed) % STATIC_ARRAY_SIZE (scale)]
+        + ((double) rand_r (&seed)) / RAND_MAX;
+
+    snprintf (want, sizeof (want), GAUGE_FORMAT, g);
+    format_gauge (got, sizeof (got), g);
+    if (strcmp (want, got) != 0)
+      EXPECT_EQ_STR (want, got);
+  }
+
+  OK(format_gauge (got, 3, 1234.5) < 0);
+
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(sstrncpy);
@@ -391,6 +434,7 @@ int main (void)
   RUN_TEST(strunescape);
   RUN_TEST(parse_values);
   RUN_TEST(value_to_rate);
+  RUN_TEST(format_gauge);
 
   END_TEST;
 }
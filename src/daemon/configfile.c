@@ -120,6 +120,7 @@ static cf_global_option_t cf_global_options[] =
 	{"Timeout",     NULL, "2"},
 	{"AutoLoadPlugin", NULL, "false"},
 	{"CollectInternalStats", NULL, "false"},
+	{"TraceSampling", NULL, "0"},
 	{"PreCacheChain",  NULL, "PreCache"},
 	{"PostCacheChain", NULL, "PostCache"},
 	{"MaxReadInterval", NULL, "86400"}
@@ -267,6 +268,36 @@ static int dispatch_value_plugindir (oconfig_item_t *ci)
 	return (0);
 }
 
+static int dispatch_write_queue_policy (oconfig_item_t *ci, /* {{{ */
+		int *ret_policy)
+{
+	char const *policy;
+
+	if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING))
+	{
+		ERROR ("The `WriteQueuePolicy' option requires exactly one "
+				"string argument.");
+		return (-1);
+	}
+	policy = ci->values[0].value.string;
+
+	if (strcasecmp ("DropNewest", policy) == 0)
+		*ret_policy = WRITE_QUEUE_DROP_NEWEST;
+	else if (strcasecmp ("DropOldest", policy) == 0)
+		*ret_policy = WRITE_QUEUE_DROP_OLDEST;
+	else if (strcasecmp ("Block", policy) == 0)
+		*ret_policy = WRITE_QUEUE_BLOCK;
+	else
+	{
+		ERROR ("Invalid `WriteQueuePolicy' \"%s\". Valid policies "
+				"are \"DropNewest\", \"DropOldest\" and "
+				"\"Block\".", policy);
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int dispatch_write_queue_policy */
+
 static int dispatch_loadplugin (oconfig_item_t *ci)
 {
 	int i;
@@ -305,6 +336,16 @@ static int dispatch_loadplugin (oconfig_item_t *ci)
 			cf_util_get_cdtime (child, &ctx.flush_interval);
 		else if (strcasecmp ("FlushTimeout", child->key) == 0)
 			cf_util_get_cdtime (child, &ctx.flush_timeout);
+		else if (strcasecmp ("WriteThreads", child->key) == 0)
+			cf_util_get_int (child, &ctx.write_threads);
+		else if (strcasecmp ("WriteQueueLimit", child->key) == 0)
+		{
+			int limit = 0;
+			if (cf_util_get_int (child, &limit) == 0)
+				ctx.write_queue_limit = (long) limit;
+		}
+		else if (strcasecmp ("WriteQueuePolicy", child->key) == 0)
+			dispatch_write_queue_policy (child, &ctx.write_queue_policy);
 		else {
 			WARNING("Ignoring unknown LoadPlugin option \"%s\" "
 					"for plugin \"%s\"",
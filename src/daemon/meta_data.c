@@ -32,10 +32,18 @@
 
 /*
  * Data types
+ *
+ * The entries of a meta_data_t live in one flat, immutable "blob": a sorted
+ * array of fixed size entries followed by a string area holding all keys and
+ * string values. Keys and strings are referenced by offset into that area.
+ * Cloning a meta_data_t only increments the blob's reference count; changing
+ * it builds a new blob and releases the old one (copy-on-write). This way
+ * plugin_value_list_clone() costs one allocation regardless of the number of
+ * entries.
  */
 union meta_value_u
 {
-  char    *mv_string;
+  size_t   mv_string; /* offset into the string area */
   int64_t  mv_signed_int;
   uint64_t mv_unsigned_int;
   double   mv_double;
@@ -43,20 +51,41 @@ union meta_value_u
 };
 typedef union meta_value_u meta_value_t;
 
-struct meta_entry_s;
-typedef struct meta_entry_s meta_entry_t;
 struct meta_entry_s
 {
-  char         *key;
-  meta_value_t  value;
-  int           type;
-  meta_entry_t *next;
+  size_t       key; /* offset into the string area */
+  int          type;
+  meta_value_t value;
 };
+typedef struct meta_entry_s meta_entry_t;
+
+struct md_blob_s
+{
+  pthread_mutex_t lock; /* protects refcount only */
+  unsigned int    refcount;
+
+  size_t       entries_num;
+  meta_entry_t entries[];
+  /* The string area follows the last entry. */
+};
+typedef struct md_blob_s md_blob_t;
+
+#define MD_STRINGS(b) ((char *) &(b)->entries[(b)->entries_num])
+
+/* Unpacked view of one entry, used while building new blobs. */
+struct md_view_s
+{
+  const char  *key;
+  const char  *string;
+  int          type;
+  meta_value_t value;
+};
+typedef struct md_view_s md_view_t;
 
 struct meta_data_s
 {
-  meta_entry_t   *head;
-  pthread_mutex_t lock;
+  md_blob_t      *blob; /* NULL if empty */
+  pthread_mutex_t lock; /* protects the blob pointer */
 };
 
 /*
@@ -80,209 +109,290 @@ static char *md_strdup (const char *orig) /* {{{ */
   return (dest);
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc (const char *key) /* {{{ */
+static md_blob_t *md_blob_ref (md_blob_t *b) /* {{{ */
 {
-  meta_entry_t *e;
-
-  e = calloc (1, sizeof (*e));
-  if (e == NULL)
-  {
-    ERROR ("md_entry_alloc: calloc failed.");
-    return (NULL);
-  }
-
-  e->key = md_strdup (key);
-  if (e->key == NULL)
-  {
-    free (e);
-    ERROR ("md_entry_alloc: md_strdup failed.");
+  if (b == NULL)
     return (NULL);
-  }
 
-  e->type = 0;
-  e->next = NULL;
+  pthread_mutex_lock (&b->lock);
+  b->refcount++;
+  pthread_mutex_unlock (&b->lock);
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_alloc */
+  return (b);
+} /* }}} md_blob_t *md_blob_ref */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_clone_contents (const meta_entry_t *orig) /* {{{ */
+static void md_blob_unref (md_blob_t *b) /* {{{ */
 {
-  meta_entry_t *copy;
+  _Bool last;
 
-  /* WARNINGS :
-   *  - we do not check that orig != NULL here. You should have done it before.
-   *  - we do not set copy->next. DO NOT FORGET TO SET copy->next IN YOUR FUNCTION
-   */
+  if (b == NULL)
+    return;
 
-  copy = md_entry_alloc (orig->key);
-  if (copy == NULL)
-    return (NULL);
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup (orig->value.mv_string);
-  else
-    copy->value = orig->value;
+  pthread_mutex_lock (&b->lock);
+  assert (b->refcount > 0);
+  b->refcount--;
+  last = (b->refcount == 0);
+  pthread_mutex_unlock (&b->lock);
 
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone_contents */
+  if (!last)
+    return;
+
+  pthread_mutex_destroy (&b->lock);
+  free (b);
+} /* }}} void md_blob_unref */
 
-static meta_entry_t *md_entry_clone (const meta_entry_t *orig) /* {{{ */
+static void md_blob_view (const md_blob_t *b, size_t i, /* {{{ */
+    md_view_t *v)
 {
-  meta_entry_t *copy;
+  const meta_entry_t *e = &b->entries[i];
+  const char *strings = MD_STRINGS (b);
+
+  v->key = strings + e->key;
+  v->type = e->type;
+  v->value = e->value;
+  v->string = (e->type == MD_TYPE_STRING)
+    ? strings + e->value.mv_string : NULL;
+} /* }}} void md_blob_view */
+
+/* Binary search for "key". Returns the entry or NULL if "key" is absent. */
+static const meta_entry_t *md_blob_lookup (const md_blob_t *b, /* {{{ */
+    const char *key)
+{
+  const char *strings;
+  size_t lo;
+  size_t hi;
 
-  if (orig == NULL)
+  if (b == NULL)
     return (NULL);
 
-  copy = md_entry_clone_contents(orig);
+  strings = MD_STRINGS (b);
+  lo = 0;
+  hi = b->entries_num;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcasecmp (key, strings + b->entries[mid].key);
 
-  copy->next = md_entry_clone (orig->next);
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone */
+    if (cmp == 0)
+      return (&b->entries[mid]);
+    else if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
 
-static void md_entry_free (meta_entry_t *e) /* {{{ */
+  return (NULL);
+} /* }}} meta_entry_t *md_blob_lookup */
+
+/* Walks the union of the entries in "a", "b" and "v" in key order. Entries
+ * in "v" take precedence over entries in "b", which take precedence over
+ * entries in "a". An entry called "delete_key" is skipped. If "dst" is NULL,
+ * only the number of resulting entries and the required size of the string
+ * area are calculated. Otherwise the entries are written to "dst", which must
+ * have been allocated according to the result of an earlier call. */
+static void md_blob_walk (const md_blob_t *a, const md_blob_t *b, /* {{{ */
+    const md_view_t *v, const char *delete_key,
+    md_blob_t *dst, size_t *ret_num, size_t *ret_strings_size)
 {
-  if (e == NULL)
-    return;
+  size_t a_num = (a != NULL) ? a->entries_num : 0;
+  size_t b_num = (b != NULL) ? b->entries_num : 0;
+  size_t ia = 0;
+  size_t ib = 0;
+  _Bool v_done = (v == NULL);
+  char *strings = (dst != NULL) ? MD_STRINGS (dst) : NULL;
+  size_t num = 0;
+  size_t offset = 0;
+
+  while ((ia < a_num) || (ib < b_num) || !v_done)
+  {
+    md_view_t va;
+    md_view_t vb;
+    const md_view_t *winner = NULL;
+    const char *key = NULL;
+    size_t len;
 
-  free (e->key);
+    if (ia < a_num)
+    {
+      md_blob_view (a, ia, &va);
+      key = va.key;
+    }
+    if (ib < b_num)
+    {
+      md_blob_view (b, ib, &vb);
+      if ((key == NULL) || (strcasecmp (vb.key, key) < 0))
+        key = vb.key;
+    }
+    if (!v_done && ((key == NULL) || (strcasecmp (v->key, key) < 0)))
+      key = v->key;
 
-  if (e->type == MD_TYPE_STRING)
-    free (e->value.mv_string);
+    /* Pick the entry with the highest precedence and advance every input
+     * positioned on this key. */
+    if ((ia < a_num) && (strcasecmp (va.key, key) == 0))
+    {
+      winner = &va;
+      ia++;
+    }
+    if ((ib < b_num) && (strcasecmp (vb.key, key) == 0))
+    {
+      winner = &vb;
+      ib++;
+    }
+    if (!v_done && (strcasecmp (v->key, key) == 0))
+    {
+      winner = v;
+      v_done = 1;
+    }
+    assert (winner != NULL);
 
-  if (e->next != NULL)
-    md_entry_free (e->next);
+    if ((delete_key != NULL) && (strcasecmp (winner->key, delete_key) == 0))
+      continue;
 
-  free (e);
-} /* }}} void md_entry_free */
+    len = strlen (winner->key) + 1;
+    if (dst != NULL)
+    {
+      meta_entry_t *e = &dst->entries[num];
 
-static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
-{
-  meta_entry_t *this;
-  meta_entry_t *prev;
+      e->key = offset;
+      e->type = winner->type;
+      e->value = winner->value;
+      memcpy (strings + offset, winner->key, len);
+    }
+    offset += len;
 
-  if ((md == NULL) || (e == NULL))
-    return (-EINVAL);
+    if (winner->type == MD_TYPE_STRING)
+    {
+      len = strlen (winner->string) + 1;
+      if (dst != NULL)
+      {
+        dst->entries[num].value.mv_string = offset;
+        memcpy (strings + offset, winner->string, len);
+      }
+      offset += len;
+    }
 
-  pthread_mutex_lock (&md->lock);
+    num++;
+  }
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+  if (ret_num != NULL)
+    *ret_num = num;
+  if (ret_strings_size != NULL)
+    *ret_strings_size = offset;
+} /* }}} void md_blob_walk */
 
-    prev = this;
-    this = this->next;
-  }
+/* Builds a new blob from the union of "a", "b" and "v" (see md_blob_walk()).
+ * Stores NULL in "ret" if the result is empty. */
+static int md_blob_build (const md_blob_t *a, const md_blob_t *b, /* {{{ */
+    const md_view_t *v, const char *delete_key, md_blob_t **ret)
+{
+  md_blob_t *blob;
+  size_t num = 0;
+  size_t strings_size = 0;
 
-  if (this == NULL)
+  md_blob_walk (a, b, v, delete_key,
+      /* dst = */ NULL, &num, &strings_size);
+  if (num == 0)
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
-    {
-      assert (prev != NULL);
-      prev->next = e;
-    }
-
-    e->next = NULL;
+    *ret = NULL;
+    return (0);
   }
-  else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
 
-    e->next = this->next;
+  blob = malloc (sizeof (*blob)
+      + num * sizeof (blob->entries[0]) + strings_size);
+  if (blob == NULL)
+  {
+    ERROR ("md_blob_build: malloc failed.");
+    return (-ENOMEM);
   }
 
+  pthread_mutex_init (&blob->lock, /* attr = */ NULL);
+  blob->refcount = 1;
+  blob->entries_num = num;
+  md_blob_walk (a, b, v, delete_key,
+      blob, /* ret_num = */ NULL, /* ret_strings_size = */ NULL);
+
+  *ret = blob;
+  return (0);
+} /* }}} int md_blob_build */
+
+/* Replaces the contents of "md" with a new blob containing its current
+ * entries, overridden by "v" and without "delete_key". */
+static int md_update (meta_data_t *md, /* {{{ */
+    const md_view_t *v, const char *delete_key)
+{
+  md_blob_t *old;
+  md_blob_t *new;
+  int status;
+
+  pthread_mutex_lock (&md->lock);
+  old = md->blob;
+  status = md_blob_build (old, /* b = */ NULL, v, delete_key, &new);
+  if (status == 0)
+    md->blob = new;
   pthread_mutex_unlock (&md->lock);
 
-  if (this != NULL)
-  {
-    this->next = NULL;
-    md_entry_free (this);
-  }
+  if (status != 0)
+    return (status);
 
+  md_blob_unref (old);
   return (0);
-} /* }}} int md_entry_insert */
+} /* }}} int md_update */
 
-/* XXX: The lock on md must be held while calling this function! */
-static int md_entry_insert_clone (meta_data_t *md, meta_entry_t *orig) /* {{{ */
+static int md_add (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t value, const char *string)
 {
-  meta_entry_t *e;
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  md_view_t v = { key, string, type, value };
 
-  /* WARNINGS :
-   *  - we do not check that md and e != NULL here. You should have done it before.
-   *  - we do not use the lock. You should have set it before.
-   */
+  if ((md == NULL) || (key == NULL))
+    return (-EINVAL);
 
-  e = md_entry_clone_contents(orig);
+  return (md_update (md, &v, /* delete_key = */ NULL));
+} /* }}} int md_add */
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+/* Looks up "key" and copies its value to "ret_value". For strings, a copy of
+ * the string is returned. */
+static int md_get (meta_data_t *md, const char *key, /* {{{ */
+    int type, const char *func, meta_value_t *ret_value, char **ret_string)
+{
+  const meta_entry_t *e;
+
+  if ((md == NULL) || (key == NULL))
+    return (-EINVAL);
+
+  pthread_mutex_lock (&md->lock);
+
+  e = md_blob_lookup (md->blob, key);
+  if (e == NULL)
   {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
+  }
 
-    prev = this;
-    this = this->next;
+  if (e->type != type)
+  {
+    ERROR ("%s: Type mismatch for key `%s'", func, key);
+    pthread_mutex_unlock (&md->lock);
+    return (-ENOENT);
   }
 
-  if (this == NULL)
+  if (type == MD_TYPE_STRING)
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
+    char *temp = md_strdup (MD_STRINGS (md->blob) + e->value.mv_string);
+    if (temp == NULL)
     {
-      assert (prev != NULL);
-      prev->next = e;
+      pthread_mutex_unlock (&md->lock);
+      ERROR ("%s: md_strdup failed.", func);
+      return (-ENOMEM);
     }
-
-    e->next = NULL;
+    *ret_string = temp;
   }
-  else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
-
-    e->next = this->next;
-  }
-
-  if (this != NULL)
+  else
   {
-    this->next = NULL;
-    md_entry_free (this);
+    *ret_value = e->value;
   }
 
+  pthread_mutex_unlock (&md->lock);
   return (0);
-} /* }}} int md_entry_insert_clone */
-
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
-    const char *key)
-{
-  meta_entry_t *e;
-
-  if ((md == NULL) || (key == NULL))
-    return (NULL);
-
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp (key, e->key) == 0)
-      break;
-
-  return (e);
-} /* }}} meta_entry_t *md_entry_lookup */
+} /* }}} int md_get */
 
 /*
  * Public functions
@@ -315,7 +425,7 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
     return (NULL);
 
   pthread_mutex_lock (&orig->lock);
-  copy->head = md_entry_clone (orig->head);
+  copy->blob = md_blob_ref (orig->blob);
   pthread_mutex_unlock (&orig->lock);
 
   return (copy);
@@ -323,7 +433,10 @@ meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
 
 int meta_data_clone_merge (meta_data_t **dest, meta_data_t *orig) /* {{{ */
 {
-  meta_entry_t *e;
+  md_blob_t *src;
+  md_blob_t *old;
+  md_blob_t *new;
+  int status;
 
   if (orig == NULL)
     return (0);
@@ -334,13 +447,35 @@ int meta_data_clone_merge (meta_data_t **dest, meta_data_t *orig) /* {{{ */
   }
 
   pthread_mutex_lock (&orig->lock);
-  for (e=orig->head; e != NULL; e = e->next)
+  src = md_blob_ref (orig->blob);
+  pthread_mutex_unlock (&orig->lock);
+
+  if (src == NULL)
+    return (0);
+
+  pthread_mutex_lock (&(*dest)->lock);
+  old = (*dest)->blob;
+  if (old == NULL)
   {
-    md_entry_insert_clone((*dest), e);
+    /* Share the source blob. */
+    (*dest)->blob = md_blob_ref (src);
+    status = 0;
   }
-  pthread_mutex_unlock (&orig->lock);
+  else
+  {
+    status = md_blob_build (old, src, /* v = */ NULL,
+        /* delete_key = */ NULL, &new);
+    if (status == 0)
+      (*dest)->blob = new;
+    else
+      old = NULL;
+  }
+  pthread_mutex_unlock (&(*dest)->lock);
 
-  return (0);
+  md_blob_unref (old);
+  md_blob_unref (src);
+
+  return (status);
 } /* }}} int meta_data_clone_merge */
 
 void meta_data_destroy (meta_data_t *md) /* {{{ */
@@ -348,68 +483,52 @@ void meta_data_destroy (meta_data_t *md) /* {{{ */
   if (md == NULL)
     return;
 
-  md_entry_free (md->head);
+  md_blob_unref (md->blob);
   pthread_mutex_destroy (&md->lock);
   free (md);
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int status;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return (1);
-    }
-  }
-
+  status = (md_blob_lookup (md->blob, key) != NULL) ? 1 : 0;
   pthread_mutex_unlock (&md->lock);
-  return (0);
+
+  return (status);
 } /* }}} int meta_data_exists */
 
 int meta_data_type (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  const meta_entry_t *e;
+  int type;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return e->type;
-    }
-  }
-
+  e = md_blob_lookup (md->blob, key);
+  type = (e != NULL) ? e->type : 0;
   pthread_mutex_unlock (&md->lock);
-  return 0;
+
+  return type;
 } /* }}} int meta_data_type */
 
 int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
-  meta_entry_t *e;
+  size_t i;
+  int count;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
   pthread_mutex_lock (&md->lock);
 
-  for (e = md->head; e != NULL; e = e->next)
-    ++count;
-
+  count = (md->blob != NULL) ? (int) md->blob->entries_num : 0;
   if (count == 0)
   {
     pthread_mutex_unlock (&md->lock);
@@ -417,8 +536,8 @@ int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
   }
 
   *toc = calloc(count, sizeof(**toc));
-  for (e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
+  for (i = 0; i < md->blob->entries_num; i++)
+    (*toc)[i] = strdup(MD_STRINGS (md->blob) + md->blob->entries[i].key);
 
   pthread_mutex_unlock (&md->lock);
   return count;
@@ -426,42 +545,19 @@ int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 
 int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  _Bool exists;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
   pthread_mutex_lock (&md->lock);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
-  }
-
-  if (this == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
-
+  exists = (md_blob_lookup (md->blob, key) != NULL);
   pthread_mutex_unlock (&md->lock);
 
-  this->next = NULL;
-  md_entry_free (this);
+  if (!exists)
+    return (-ENOENT);
 
-  return (0);
+  return (md_update (md, /* v = */ NULL, key));
 } /* }}} int meta_data_delete */
 
 /*
@@ -470,97 +566,48 @@ int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 int meta_data_add_string (meta_data_t *md, /* {{{ */
     const char *key, const char *value)
 {
-  meta_entry_t *e;
+  meta_value_t v = { 0 };
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_string = md_strdup (value);
-  if (e->value.mv_string == NULL)
-  {
-    ERROR ("meta_data_add_string: md_strdup failed.");
-    md_entry_free (e);
-    return (-ENOMEM);
-  }
-  e->type = MD_TYPE_STRING;
-
-  return (md_entry_insert (md, e));
+  return (md_add (md, key, MD_TYPE_STRING, v, value));
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t v = { 0 };
 
-  if ((md == NULL) || (key == NULL))
-    return (-EINVAL);
-
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  v.mv_signed_int = value;
+  return (md_add (md, key, MD_TYPE_SIGNED_INT, v, NULL));
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t value)
 {
-  meta_entry_t *e;
-
-  if ((md == NULL) || (key == NULL))
-    return (-EINVAL);
-
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
+  meta_value_t v = { 0 };
 
-  return (md_entry_insert (md, e));
+  v.mv_unsigned_int = value;
+  return (md_add (md, key, MD_TYPE_UNSIGNED_INT, v, NULL));
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double (meta_data_t *md, /* {{{ */
     const char *key, double value)
 {
-  meta_entry_t *e;
-
-  if ((md == NULL) || (key == NULL))
-    return (-EINVAL);
-
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
+  meta_value_t v = { 0 };
 
-  return (md_entry_insert (md, e));
+  v.mv_double = value;
+  return (md_add (md, key, MD_TYPE_DOUBLE, v, NULL));
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool value)
 {
-  meta_entry_t *e;
+  meta_value_t v = { 0 };
 
-  if ((md == NULL) || (key == NULL))
-    return (-EINVAL);
-
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return (md_entry_insert (md, e));
+  v.mv_boolean = value;
+  return (md_add (md, key, MD_TYPE_BOOLEAN, v, NULL));
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -569,161 +616,77 @@ int meta_data_add_boolean (meta_data_t *md, /* {{{ */
 int meta_data_get_string (meta_data_t *md, /* {{{ */
     const char *key, char **value)
 {
-  meta_entry_t *e;
-  char *temp;
+  meta_value_t v;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_STRING)
-  {
-    ERROR ("meta_data_get_string: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  temp = md_strdup (e->value.mv_string);
-  if (temp == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    ERROR ("meta_data_get_string: md_strdup failed.");
-    return (-ENOMEM);
-  }
-
-  pthread_mutex_unlock (&md->lock);
-
-  *value = temp;
-
-  return (0);
+  return (md_get (md, key, MD_TYPE_STRING, "meta_data_get_string",
+        &v, value));
 } /* }}} int meta_data_get_string */
 
 int meta_data_get_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_SIGNED_INT)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_signed_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  status = md_get (md, key, MD_TYPE_SIGNED_INT, "meta_data_get_signed_int",
+      &v, /* ret_string = */ NULL);
+  if (status == 0)
+    *value = v.mv_signed_int;
+  return (status);
 } /* }}} int meta_data_get_signed_int */
 
 int meta_data_get_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_UNSIGNED_INT)
-  {
-    ERROR ("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_unsigned_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  status = md_get (md, key, MD_TYPE_UNSIGNED_INT, "meta_data_get_unsigned_int",
+      &v, /* ret_string = */ NULL);
+  if (status == 0)
+    *value = v.mv_unsigned_int;
+  return (status);
 } /* }}} int meta_data_get_unsigned_int */
 
 int meta_data_get_double (meta_data_t *md, /* {{{ */
     const char *key, double *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_DOUBLE)
-  {
-    ERROR ("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_double;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  status = md_get (md, key, MD_TYPE_DOUBLE, "meta_data_get_double",
+      &v, /* ret_string = */ NULL);
+  if (status == 0)
+    *value = v.mv_double;
+  return (status);
 } /* }}} int meta_data_get_double */
 
 int meta_data_get_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool *value)
 {
-  meta_entry_t *e;
+  meta_value_t v;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_BOOLEAN)
-  {
-    ERROR ("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_boolean;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  status = md_get (md, key, MD_TYPE_BOOLEAN, "meta_data_get_boolean",
+      &v, /* ret_string = */ NULL);
+  if (status == 0)
+    *value = v.mv_boolean;
+  return (status);
 } /* }}} int meta_data_get_boolean */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -109,9 +109,61 @@ DEF_TEST(base)
   return 0;
 }
 
+DEF_TEST(clone)
+{
+  meta_data_t *m;
+  meta_data_t *c;
+  char **toc = NULL;
+  char *s;
+  int64_t si;
+  int i;
+
+  CHECK_NOT_NULL (m = meta_data_create ());
+  CHECK_ZERO (meta_data_add_string (m, "b", "bar"));
+  CHECK_ZERO (meta_data_add_signed_int (m, "a", 1));
+
+  CHECK_NOT_NULL (c = meta_data_clone (m));
+  CHECK_ZERO (meta_data_get_string (c, "B", &s));
+  EXPECT_EQ_STR ("bar", s);
+  sfree (s);
+
+  /* modifying the clone does not change the original */
+  CHECK_ZERO (meta_data_add_signed_int (c, "a", 2));
+  CHECK_ZERO (meta_data_add_string (c, "c", "qux"));
+  CHECK_ZERO (meta_data_get_signed_int (m, "a", &si));
+  EXPECT_EQ_INT (1, (int) si);
+  OK(!meta_data_exists (m, "c"));
+  CHECK_ZERO (meta_data_get_signed_int (c, "a", &si));
+  EXPECT_EQ_INT (2, (int) si);
+
+  /* and vice versa */
+  CHECK_ZERO (meta_data_delete (m, "b"));
+  OK(meta_data_exists (c, "b"));
+
+  /* merging overrides existing keys */
+  CHECK_ZERO (meta_data_add_signed_int (m, "d", 4));
+  CHECK_ZERO (meta_data_clone_merge (&c, m));
+  CHECK_ZERO (meta_data_get_signed_int (c, "a", &si));
+  EXPECT_EQ_INT (1, (int) si);
+
+  EXPECT_EQ_INT (4, meta_data_toc (c, &toc));
+  EXPECT_EQ_STR ("a", toc[0]);
+  EXPECT_EQ_STR ("b", toc[1]);
+  EXPECT_EQ_STR ("c", toc[2]);
+  EXPECT_EQ_STR ("d", toc[3]);
+  for (i = 0; i < 4; i++)
+    sfree (toc[i]);
+  sfree (toc);
+
+  meta_data_destroy (m);
+  meta_data_destroy (c);
+  return 0;
+}
+
 int main (void)
 {
   RUN_TEST(base);
+  RUN_TEST(clone);
 
   END_TEST;
 }
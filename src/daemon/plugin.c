@@ -37,9 +37,25 @@
 #include "utils_heap.h"
 #include "utils_time.h"
 #include "utils_random.h"
+#include "utils_trace.h"
 
 #include <ltdl.h>
 
+/* When built into collectd-bench, the time spent in each stage of the
+ * pipeline is reported to the benchmark. */
+#if COLLECTD_BENCH
+# include "collectd-bench.h"
+# define BENCH_START(t) uint64_t t = bench_time ()
+# define BENCH_STAGE(stage, t) do { \
+	uint64_t bench_end = bench_time (); \
+	bench_record ((stage), (t), bench_end); \
+	(t) = bench_end; \
+} while (0)
+#else
+# define BENCH_START(t) /* nothing */
+# define BENCH_STAGE(stage, t) do { } while (0)
+#endif
+
 /*
  * Private structures
  */
@@ -77,7 +93,56 @@ struct write_queue_s
 {
 	value_list_t *vl;
 	plugin_ctx_t ctx;
+	trace_t *trace;
 	write_queue_t *next;
+#if COLLECTD_BENCH
+	uint64_t bench_enqueued;
+#endif
+};
+
+struct writer_entry_s;
+typedef struct writer_entry_s writer_entry_t;
+struct writer_entry_s
+{
+	const data_set_t *ds;
+	value_list_t *vl;
+	gauge_t *rates;
+	plugin_ctx_t ctx;
+	_Bool traced; /* time the callback for the trace statistics */
+	writer_entry_t *next;
+};
+
+struct writer_queue_s;
+typedef struct writer_queue_s writer_queue_t;
+struct writer_queue_s
+{
+	char *name;
+	plugin_write_cb callback;
+	user_data_t udata;
+
+	/* Protected by "lock". */
+	writer_entry_t *head;
+	writer_entry_t *tail;
+	long length;
+	derive_t dropped;
+	_Bool loop;
+	_Bool stopped; /* shutting down, see writer_queue_write() */
+	_Bool hung;    /* the threads didn't finish when shutting down */
+	_Bool orphaned; /* destroyed by one of its own threads */
+	int threads_active;
+
+	long limit;
+	int policy;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;  /* signalled when a value list is added */
+	pthread_cond_t space; /* signalled when a value list is removed */
+	pthread_cond_t done;  /* signalled when a thread exits */
+	pthread_t *threads;
+	int threads_num;
+	int threads_running;
+
+	writer_queue_t *next;
 };
 
 struct flush_callback_s {
@@ -133,13 +198,22 @@ static _Bool           plugin_ctx_key_initialized = 0;
 static long            write_limit_high = 0;
 static long            write_limit_low = 0;
 
+/* How long writers with a queue get to write the queued values when shutting
+ * down. What is left after that is dropped. */
+#ifndef WRITER_QUEUE_SHUTDOWN_TIMEOUT
+# define WRITER_QUEUE_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T (10)
+#endif
+static writer_queue_t *writer_queues = NULL;
+static _Bool           writer_queues_started = 0;
+static pthread_mutex_t writer_queues_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static derive_t        stats_values_dropped = 0;
 static _Bool           record_statistics = 0;
 
 /*
  * Static functions
  */
-static int plugin_dispatch_values_internal (value_list_t *vl);
+static int plugin_dispatch_values_internal (value_list_t *vl, trace_t *trace);
 
 static const char *plugin_get_dir (void)
 {
@@ -153,6 +227,10 @@ static void plugin_update_internal_statistics (void) { /* {{{ */
 	derive_t copy_write_queue_length;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
+	char const **writer_names = NULL;
+	cdtime_t *writer_latency = NULL;
+	size_t writers_num = 0;
+	writer_queue_t *wq;
 
 	copy_write_queue_length = write_queue_length;
 
@@ -182,6 +260,33 @@ static void plugin_update_internal_statistics (void) { /* {{{ */
 	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
 	plugin_dispatch_values (&vl);
 
+	/* Queues of writers with their own write threads */
+	pthread_mutex_lock (&writer_queues_lock);
+	for (wq = writer_queues; wq != NULL; wq = wq->next)
+	{
+		long length;
+		derive_t dropped;
+
+		pthread_mutex_lock (&wq->lock);
+		length = wq->length;
+		dropped = wq->dropped;
+		pthread_mutex_unlock (&wq->lock);
+
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"write_queue-%s", wq->name);
+
+		vl.values[0].gauge = (gauge_t) length;
+		sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		plugin_dispatch_values (&vl);
+
+		vl.values[0].derive = dropped;
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+	pthread_mutex_unlock (&writer_queues_lock);
+
 	/* Cache */
 	sstrncpy (vl.plugin_instance, "cache",
 			sizeof (vl.plugin_instance));
@@ -192,6 +297,27 @@ static void plugin_update_internal_statistics (void) { /* {{{ */
 	vl.type_instance[0] = 0;
 	plugin_dispatch_values (&vl);
 
+	/* Write latency : average time spent in each write callback, measured
+	 * on the traced value lists (see "TraceSampling"). */
+	if (trace_writer_latency (&writer_names, &writer_latency,
+				&writers_num) == 0)
+	{
+		size_t i;
+
+		sstrncpy (vl.plugin_instance, "write_latency",
+				sizeof (vl.plugin_instance));
+		sstrncpy (vl.type, "latency", sizeof (vl.type));
+		for (i = 0; i < writers_num; i++)
+		{
+			vl.values[0].gauge = CDTIME_T_TO_DOUBLE (writer_latency[i]);
+			sstrncpy (vl.type_instance, writer_names[i],
+					sizeof (vl.type_instance));
+			plugin_dispatch_values (&vl);
+		}
+		sfree (writer_names);
+		sfree (writer_latency);
+	}
+
 	return;
 } /* }}} void plugin_update_internal_statistics */
 
@@ -566,6 +692,7 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 		start = cdtime ();
 
 		old_ctx = plugin_set_ctx (rf->rf_ctx);
+		trace_read_begin (start);
 
 		if (rf_type == RF_SIMPLE)
 		{
@@ -584,6 +711,7 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 			status = (*callback) (&rf->rf_udata);
 		}
 
+		trace_read_begin (0);
 		plugin_set_ctx (old_ctx);
 
 		/* If the function signals failure, we will increase the
@@ -730,6 +858,7 @@ static value_list_t *plugin_value_list_clone (value_list_t const *vl_orig) /* {{
 	if (vl == NULL)
 		return (NULL);
 	memcpy (vl, vl_orig, sizeof (*vl));
+	vl->rates = NULL;
 
 	vl->values = calloc (vl_orig->values_len, sizeof (*vl->values));
 	if (vl->values == NULL)
@@ -795,6 +924,10 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 	 * available to the write plugins when actually dispatching the
 	 * value-list later on. */
 	q->ctx = plugin_get_ctx ();
+	q->trace = trace_sample (vl);
+#if COLLECTD_BENCH
+	q->bench_enqueued = bench_time ();
+#endif
 
 	pthread_mutex_lock (&write_lock);
 
@@ -817,7 +950,31 @@ static int plugin_write_enqueue (value_list_t const *vl) /* {{{ */
 	return (0);
 } /* }}} int plugin_write_enqueue */
 
-static value_list_t *plugin_write_dequeue (void) /* {{{ */
+/* Appends the queue entries "head" ... "tail" to the write queue. */
+static void plugin_write_enqueue_list (write_queue_t *head, /* {{{ */
+		write_queue_t *tail, long num)
+{
+	pthread_mutex_lock (&write_lock);
+
+	if (write_queue_tail == NULL)
+	{
+		write_queue_head = head;
+		write_queue_tail = tail;
+		write_queue_length = num;
+	}
+	else
+	{
+		write_queue_tail->next = head;
+		write_queue_tail = tail;
+		write_queue_length += num;
+	}
+
+	pthread_cond_broadcast (&write_cond);
+	pthread_mutex_unlock (&write_lock);
+} /* }}} void plugin_write_enqueue_list */
+
+/* Returns the next value list and its trace, if it is being traced. */
+static value_list_t *plugin_write_dequeue (trace_t **ret_trace) /* {{{ */
 {
 	write_queue_t *q;
 	value_list_t *vl;
@@ -845,6 +1002,13 @@ static value_list_t *plugin_write_dequeue (void) /* {{{ */
 
 	(void) plugin_set_ctx (q->ctx);
 
+	trace_stamp (q->trace, TRACE_STAGE_DEQUEUE);
+	*ret_trace = q->trace;
+
+#if COLLECTD_BENCH
+	bench_record (BENCH_STAGE_QUEUE, q->bench_enqueued, bench_time ());
+#endif
+
 	vl = q->vl;
 	sfree (q);
 	return (vl);
@@ -854,11 +1018,14 @@ static void *plugin_write_thread (void __attribute__((unused)) *args) /* {{{ */
 {
 	while (write_loop)
 	{
-		value_list_t *vl = plugin_write_dequeue ();
+		trace_t *trace = NULL;
+		value_list_t *vl = plugin_write_dequeue (&trace);
 		if (vl == NULL)
 			continue;
 
-		plugin_dispatch_values_internal (vl);
+		trace_begin (trace);
+		plugin_dispatch_values_internal (vl, trace);
+		trace_end (trace);
 
 		plugin_value_list_free (vl);
 	}
@@ -936,6 +1103,7 @@ static void stop_write_threads (void) /* {{{ */
 	{
 		write_queue_t *q1 = q;
 		plugin_value_list_free (q->vl);
+		sfree (q->trace);
 		q = q->next;
 		sfree (q1);
 		i++;
@@ -953,6 +1121,515 @@ static void stop_write_threads (void) /* {{{ */
 	}
 } /* }}} void stop_write_threads */
 
+/*
+ * Write callbacks with a queue of their own. The write threads only append
+ * the value lists to the writer's queue, so that a slow or blocked writer
+ * does not delay the others. What happens if the queue is full is up to the
+ * writer's policy.
+ */
+static void writer_entry_free (writer_entry_t *e) /* {{{ */
+{
+	if (e == NULL)
+		return;
+
+	plugin_value_list_free (e->vl);
+	sfree (e->rates);
+	sfree (e);
+} /* }}} void writer_entry_free */
+
+static void writer_queue_free (writer_queue_t *wq);
+
+static void *writer_queue_thread (void *arg) /* {{{ */
+{
+	writer_queue_t *wq = arg;
+
+	while (42)
+	{
+		writer_entry_t *e;
+
+		pthread_mutex_lock (&wq->lock);
+		while (wq->loop && (wq->head == NULL))
+			pthread_cond_wait (&wq->cond, &wq->lock);
+
+		/* Keep writing until the queue is empty, even when shutting
+		 * down. */
+		e = wq->head;
+		if (e == NULL)
+		{
+			_Bool last;
+
+			wq->threads_active--;
+			last = wq->orphaned && (wq->threads_active == 0);
+			pthread_cond_broadcast (&wq->done);
+			pthread_mutex_unlock (&wq->lock);
+
+			/* Nobody else is left to free an orphaned queue. */
+			if (last)
+				writer_queue_free (wq);
+			break;
+		}
+
+		wq->head = e->next;
+		if (wq->head == NULL)
+			wq->tail = NULL;
+		wq->length--;
+		pthread_cond_signal (&wq->space);
+		pthread_mutex_unlock (&wq->lock);
+
+		(void) plugin_set_ctx (e->ctx);
+		e->vl->rates = e->rates;
+		if (e->traced)
+		{
+			cdtime_t start = cdtime ();
+			wq->callback (e->ds, e->vl, &wq->udata);
+			trace_writer_queued (wq->name, cdtime () - start);
+		}
+		else
+			wq->callback (e->ds, e->vl, &wq->udata);
+		e->vl->rates = NULL;
+
+		writer_entry_free (e);
+	}
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *writer_queue_thread */
+
+static void writer_queue_start (writer_queue_t *wq) /* {{{ */
+{
+	int i;
+
+	if (wq->threads != NULL)
+		return;
+
+	wq->threads = calloc ((size_t) wq->threads_num, sizeof (*wq->threads));
+	if (wq->threads == NULL)
+	{
+		ERROR ("plugin: writer_queue_start: calloc failed.");
+		return;
+	}
+
+	pthread_mutex_lock (&wq->lock);
+	wq->loop = 1;
+	wq->stopped = 0;
+	pthread_mutex_unlock (&wq->lock);
+
+	for (i = 0; i < wq->threads_num; i++)
+	{
+		char errbuf[1024];
+		int status;
+
+		pthread_mutex_lock (&wq->lock);
+		wq->threads_active++;
+		pthread_mutex_unlock (&wq->lock);
+
+		status = pthread_create (wq->threads + wq->threads_running,
+				/* attr = */ NULL, writer_queue_thread, wq);
+		if (status != 0)
+		{
+			pthread_mutex_lock (&wq->lock);
+			wq->threads_active--;
+			pthread_mutex_unlock (&wq->lock);
+
+			ERROR ("plugin: writer_queue_start: pthread_create "
+					"failed for the `%s' writer with "
+					"status %i (%s).", wq->name, status,
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+		wq->threads_running++;
+	}
+} /* }}} void writer_queue_start */
+
+/* Tells the threads to exit once the queue is empty. Write threads waiting
+ * for space in the queue are woken up and no longer wait. */
+static void writer_queue_release (writer_queue_t *wq) /* {{{ */
+{
+	pthread_mutex_lock (&wq->lock);
+	wq->loop = 0;
+	wq->stopped = 1;
+	pthread_cond_broadcast (&wq->cond);
+	pthread_cond_broadcast (&wq->space);
+	pthread_mutex_unlock (&wq->lock);
+} /* }}} void writer_queue_release */
+
+/* Waits until "deadline" for the threads to write the queued values and
+ * exit. If they don't, the rest is dropped and the threads are left alone:
+ * they may be stuck in the write callback. */
+static void writer_queue_stop (writer_queue_t *wq, cdtime_t deadline) /* {{{ */
+{
+	writer_entry_t *dropped = NULL;
+	long dropped_num = 0;
+	int i;
+
+	writer_queue_release (wq);
+
+	if (wq->threads == NULL)
+		return;
+
+	pthread_mutex_lock (&wq->lock);
+	while (wq->threads_active > 0)
+	{
+		struct timespec ts;
+
+		CDTIME_T_TO_TIMESPEC (deadline, &ts);
+		if (pthread_cond_timedwait (&wq->done, &wq->lock, &ts) == ETIMEDOUT)
+			break;
+	}
+
+	if (wq->threads_active > 0)
+	{
+		wq->hung = 1;
+		dropped = wq->head;
+		dropped_num = wq->length;
+		wq->dropped += (derive_t) wq->length;
+		wq->head = NULL;
+		wq->tail = NULL;
+		wq->length = 0;
+	}
+	pthread_mutex_unlock (&wq->lock);
+
+	if (wq->hung)
+	{
+		WARNING ("plugin: The `%s' writer did not finish in time. "
+				"Dropping %li queued value list%s.", wq->name,
+				dropped_num, (dropped_num == 1) ? "" : "s");
+		while (dropped != NULL)
+		{
+			writer_entry_t *next = dropped->next;
+			writer_entry_free (dropped);
+			dropped = next;
+		}
+	}
+
+	for (i = 0; i < wq->threads_running; i++)
+	{
+		int status;
+
+		if (wq->hung)
+			status = pthread_detach (wq->threads[i]);
+		else
+			status = pthread_join (wq->threads[i], NULL);
+		if (status != 0)
+			ERROR ("plugin: writer_queue_stop: pthread_%s failed.",
+					wq->hung ? "detach" : "join");
+	}
+	sfree (wq->threads);
+	wq->threads_running = 0;
+} /* }}} void writer_queue_stop */
+
+static void writer_queue_free (writer_queue_t *wq) /* {{{ */
+{
+	/* Only left if no thread could be started. */
+	while (wq->head != NULL)
+	{
+		writer_entry_t *e = wq->head;
+		wq->head = e->next;
+		writer_entry_free (e);
+	}
+
+	if ((wq->udata.data != NULL) && (wq->udata.free_func != NULL))
+		wq->udata.free_func (wq->udata.data);
+
+	pthread_cond_destroy (&wq->done);
+	pthread_cond_destroy (&wq->space);
+	pthread_cond_destroy (&wq->cond);
+	pthread_mutex_destroy (&wq->lock);
+	sfree (wq->threads);
+	sfree (wq->name);
+	sfree (wq);
+} /* }}} void writer_queue_free */
+
+static _Bool writer_queue_is_own_thread (writer_queue_t *wq) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < wq->threads_running; i++)
+		if (pthread_equal (wq->threads[i], pthread_self ()))
+			return (1);
+
+	return (0);
+} /* }}} _Bool writer_queue_is_own_thread */
+
+/* Called from one of the queue's threads. The queued value lists are
+ * dropped, the threads exit once their callback returns and the last one
+ * frees the queue. */
+static void writer_queue_orphan (writer_queue_t *wq) /* {{{ */
+{
+	writer_entry_t *dropped;
+	int i;
+
+	pthread_mutex_lock (&wq->lock);
+	dropped = wq->head;
+	wq->dropped += (derive_t) wq->length;
+	wq->head = NULL;
+	wq->tail = NULL;
+	wq->length = 0;
+	wq->loop = 0;
+	wq->stopped = 1;
+	wq->orphaned = 1;
+	pthread_cond_broadcast (&wq->cond);
+	pthread_cond_broadcast (&wq->space);
+	pthread_mutex_unlock (&wq->lock);
+
+	while (dropped != NULL)
+	{
+		writer_entry_t *next = dropped->next;
+		writer_entry_free (dropped);
+		dropped = next;
+	}
+
+	for (i = 0; i < wq->threads_running; i++)
+		pthread_detach (wq->threads[i]);
+} /* }}} void writer_queue_orphan */
+
+static void writer_queue_destroy (void *arg) /* {{{ */
+{
+	writer_queue_t *wq = arg;
+	writer_queue_t *prev;
+
+	if (wq == NULL)
+		return;
+
+	pthread_mutex_lock (&writer_queues_lock);
+	if (writer_queues == wq)
+		writer_queues = wq->next;
+	else
+	{
+		for (prev = writer_queues; prev != NULL; prev = prev->next)
+		{
+			if (prev->next != wq)
+				continue;
+			prev->next = wq->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&writer_queues_lock);
+
+	/* A writer unregistering itself from within its callback must not wait
+	 * for its own thread. */
+	if (writer_queue_is_own_thread (wq))
+	{
+		writer_queue_orphan (wq);
+		return;
+	}
+
+	writer_queue_stop (wq, cdtime () + WRITER_QUEUE_SHUTDOWN_TIMEOUT);
+
+	/* Threads that are stuck in the callback still use the queue. */
+	if (wq->hung)
+	{
+		pthread_mutex_lock (&wq->lock);
+		if (wq->threads_active > 0)
+		{
+			pthread_mutex_unlock (&wq->lock);
+			return;
+		}
+		pthread_mutex_unlock (&wq->lock);
+	}
+
+	writer_queue_free (wq);
+} /* }}} void writer_queue_destroy */
+
+/* Calls the writer from the calling thread. */
+static int writer_queue_write_direct (writer_queue_t *wq, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	trace_t *trace = trace_current ();
+	cdtime_t start = (trace != NULL) ? cdtime () : 0;
+	int status;
+
+	status = wq->callback (ds, vl, &wq->udata);
+	if (trace != NULL)
+		trace_writer (trace, wq->name, cdtime () - start);
+	return (status);
+} /* }}} int writer_queue_write_direct */
+
+/* The write callback registered for writers with a queue. */
+static int writer_queue_write (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, user_data_t *ud)
+{
+	writer_queue_t *wq = ud->data;
+	writer_entry_t *e;
+	writer_entry_t *dropped = NULL;
+	data_set_t *ds_registered = NULL;
+
+	/* Values of data sets that are not registered, e.g. those passed to
+	 * plugin_write() by the Perl plugin, are written right away because
+	 * "ds" may not be valid later on. */
+	if ((data_sets == NULL)
+			|| (c_avl_get (data_sets, ds->type, (void *) &ds_registered) != 0)
+			|| (ds_registered != ds))
+		return (writer_queue_write_direct (wq, ds, vl));
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (ENOMEM);
+	e->ds = ds;
+	e->ctx = plugin_get_ctx ();
+	e->traced = (trace_current () != NULL);
+
+	e->vl = plugin_value_list_clone (vl);
+	if (e->vl == NULL)
+	{
+		sfree (e);
+		return (ENOMEM);
+	}
+
+	/* The rates point to the stack of the write thread. */
+	if (vl->rates != NULL)
+	{
+		e->rates = calloc (vl->values_len, sizeof (*e->rates));
+		if (e->rates == NULL)
+		{
+			writer_entry_free (e);
+			return (ENOMEM);
+		}
+		memcpy (e->rates, vl->rates,
+				vl->values_len * sizeof (*e->rates));
+	}
+
+	pthread_mutex_lock (&wq->lock);
+
+	if ((wq->limit > 0) && (wq->policy == WRITE_QUEUE_BLOCK))
+	{
+		while (wq->loop && (wq->length >= wq->limit))
+			pthread_cond_wait (&wq->space, &wq->lock);
+	}
+
+	/* When shutting down, value lists are queued as long as the threads
+	 * are writing what is left. Once they are gone, the writer is called
+	 * right away, unless it is stuck. */
+	if (wq->stopped && (wq->hung || (wq->threads_active == 0)))
+	{
+		_Bool hung = wq->hung;
+
+		if (hung)
+			wq->dropped++;
+		pthread_mutex_unlock (&wq->lock);
+
+		writer_entry_free (e);
+		if (hung)
+			return (-1);
+		return (writer_queue_write_direct (wq, ds, vl));
+	}
+
+	/* With "Block", the queue only grows beyond the limit before the
+	 * threads have been started. */
+	if ((wq->limit > 0) && (wq->length >= wq->limit)
+			&& (wq->policy != WRITE_QUEUE_BLOCK))
+	{
+		if (wq->policy == WRITE_QUEUE_DROP_OLDEST)
+		{
+			dropped = wq->head;
+			wq->head = dropped->next;
+			if (wq->head == NULL)
+				wq->tail = NULL;
+			wq->length--;
+			wq->dropped++;
+		}
+		else /* if (wq->policy == WRITE_QUEUE_DROP_NEWEST) */
+		{
+			dropped = e;
+			e = NULL;
+			wq->dropped++;
+		}
+	}
+
+	if (e != NULL)
+	{
+		if (wq->tail == NULL)
+			wq->head = e;
+		else
+			wq->tail->next = e;
+		wq->tail = e;
+		wq->length++;
+		pthread_cond_signal (&wq->cond);
+	}
+
+	pthread_mutex_unlock (&wq->lock);
+
+	writer_entry_free (dropped);
+	return (0);
+} /* }}} int writer_queue_write */
+
+static int writer_queue_register (const char *name, /* {{{ */
+		plugin_write_cb callback, user_data_t *ud, plugin_ctx_t ctx)
+{
+	writer_queue_t *wq;
+	user_data_t wq_ud = { 0 };
+
+	wq = calloc (1, sizeof (*wq));
+	if (wq == NULL)
+	{
+		ERROR ("plugin: writer_queue_register: calloc failed.");
+		return (-1);
+	}
+
+	wq->name = strdup (name);
+	if (wq->name == NULL)
+	{
+		ERROR ("plugin: writer_queue_register: strdup failed.");
+		sfree (wq);
+		return (-1);
+	}
+
+	wq->callback = callback;
+	if (ud != NULL)
+		wq->udata = *ud;
+	wq->limit = ctx.write_queue_limit;
+	wq->policy = ctx.write_queue_policy;
+	wq->threads_num = (ctx.write_threads > 0) ? ctx.write_threads : 1;
+	pthread_mutex_init (&wq->lock, /* attr = */ NULL);
+	pthread_cond_init (&wq->cond, /* attr = */ NULL);
+	pthread_cond_init (&wq->space, /* attr = */ NULL);
+	pthread_cond_init (&wq->done, /* attr = */ NULL);
+
+	pthread_mutex_lock (&writer_queues_lock);
+	wq->next = writer_queues;
+	writer_queues = wq;
+	/* Threads are started by plugin_init_all(), i.e. after daemonizing,
+	 * unless that has already happened. */
+	if (writer_queues_started)
+		writer_queue_start (wq);
+	pthread_mutex_unlock (&writer_queues_lock);
+
+	wq_ud.data = wq;
+	wq_ud.free_func = writer_queue_destroy;
+
+	return (create_register_callback (&list_write, name,
+				(void *) writer_queue_write, &wq_ud));
+} /* }}} int writer_queue_register */
+
+static void start_writer_queues (void) /* {{{ */
+{
+	writer_queue_t *wq;
+
+	pthread_mutex_lock (&writer_queues_lock);
+	writer_queues_started = 1;
+	for (wq = writer_queues; wq != NULL; wq = wq->next)
+		writer_queue_start (wq);
+	pthread_mutex_unlock (&writer_queues_lock);
+} /* }}} void start_writer_queues */
+
+/* Lets all writers with a queue write what they have, in parallel, and stops
+ * their threads. */
+static void stop_writer_queues (void) /* {{{ */
+{
+	writer_queue_t *wq;
+	cdtime_t deadline;
+
+	pthread_mutex_lock (&writer_queues_lock);
+	writer_queues_started = 0;
+	for (wq = writer_queues; wq != NULL; wq = wq->next)
+		writer_queue_release (wq);
+
+	deadline = cdtime () + WRITER_QUEUE_SHUTDOWN_TIMEOUT;
+	for (wq = writer_queues; wq != NULL; wq = wq->next)
+		writer_queue_stop (wq, deadline);
+	pthread_mutex_unlock (&writer_queues_lock);
+} /* }}} void stop_writer_queues */
+
 /*
  * Public functions
  */
@@ -1317,6 +1994,11 @@ int plugin_register_complex_read (const char *group, const char *name,
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *ud)
 {
+	plugin_ctx_t ctx = plugin_get_ctx ();
+
+	if ((ctx.write_threads > 0) || (ctx.write_queue_limit > 0))
+		return (writer_queue_register (name, callback, ud, ctx));
+
 	return (create_register_callback (&list_write, name,
 				(void *) callback, ud));
 } /* int plugin_register_write */
@@ -1703,6 +2385,8 @@ int plugin_init_all (void)
 	if (IS_TRUE (global_option_get ("CollectInternalStats")))
 		record_statistics = 1;
 
+	trace_init (global_option_get_long ("TraceSampling", 0));
+
 	chain_name = global_option_get ("PreCacheChain");
 	pre_cache_chain = fc_chain_get_by_name (chain_name);
 
@@ -1775,6 +2459,7 @@ int plugin_init_all (void)
 		le = le->next;
 	}
 
+	start_writer_queues ();
 	start_write_threads ((size_t) write_threads_num);
 
 	max_read_interval = global_option_get_time ("MaxReadInterval",
@@ -1863,6 +2548,8 @@ int plugin_write (const char *plugin, /* {{{ */
 		const data_set_t *ds, const value_list_t *vl)
 {
   llentry_t *le;
+  trace_t *trace;
+  cdtime_t start = 0;
   int status;
 
   if (vl == NULL)
@@ -1871,6 +2558,9 @@ int plugin_write (const char *plugin, /* {{{ */
   if (list_write == NULL)
     return (ENOENT);
 
+  /* Time the write callbacks if the value list is being traced. */
+  trace = trace_current ();
+
   if (ds == NULL)
   {
     ds = plugin_get_ds (vl->type);
@@ -1897,7 +2587,12 @@ int plugin_write (const char *plugin, /* {{{ */
 
       DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
       callback = cf->cf_callback;
+      if (trace != NULL)
+        start = cdtime ();
       status = (*callback) (ds, vl, &cf->cf_udata);
+      /* Queued writers are timed by writer_queue_thread(). */
+      if ((trace != NULL) && (callback != writer_queue_write))
+        trace_writer (trace, le->key, cdtime () - start);
       if (status != 0)
         failure++;
       else
@@ -1935,7 +2630,11 @@ int plugin_write (const char *plugin, /* {{{ */
 
     DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
     callback = cf->cf_callback;
+    if (trace != NULL)
+      start = cdtime ();
     status = (*callback) (ds, vl, &cf->cf_udata);
+    if ((trace != NULL) && (callback != writer_queue_write))
+      trace_writer (trace, le->key, cdtime () - start);
   }
 
   return (status);
@@ -1991,6 +2690,11 @@ int plugin_shutdown_all (void)
 
 	destroy_read_heap ();
 
+	/* Let the writers with a queue write what is queued, so that it is
+	 * included in the flush below. This also wakes up write threads
+	 * waiting for space in a queue, which would otherwise never exit. */
+	stop_writer_queues ();
+
 	plugin_flush (/* plugin = */ NULL,
 			/* timeout = */ 0,
 			/* identifier = */ NULL);
@@ -2082,13 +2786,14 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-static int plugin_dispatch_values_internal (value_list_t *vl)
+static int plugin_dispatch_values_internal (value_list_t *vl, trace_t *trace)
 {
 	int status;
 	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
 
 	value_t *saved_values;
 	int      saved_values_len;
+	gauge_t const *saved_rates;
 
 	data_set_t *ds;
 
@@ -2140,6 +2845,8 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	assert (vl->time != 0);
 	assert (vl->interval != 0);
 
+	BENCH_START (bench_t);
+
 	DEBUG ("plugin_dispatch_values: time = %.3f; interval = %.3f; "
 			"host = %s; "
 			"plugin = %s; plugin_instance = %s; "
@@ -2222,12 +2929,26 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 				vl->values     = saved_values;
 				vl->values_len = saved_values_len;
 			}
+			BENCH_STAGE (BENCH_STAGE_PRE_CACHE, bench_t);
+			trace_stamp (trace, TRACE_STAGE_PRE_CACHE);
 			return (0);
 		}
 	}
+	BENCH_STAGE (BENCH_STAGE_PRE_CACHE, bench_t);
+	trace_stamp (trace, TRACE_STAGE_PRE_CACHE);
+
+	/* Update the value cache. The rates are computed once here and
+	 * attached to the value list, so that targets and write callbacks
+	 * don't have to look them up again. */
+	gauge_t rates[ds->ds_num];
 
-	/* Update the value cache */
-	uc_update (ds, vl);
+	saved_rates = vl->rates;
+	if (uc_update (ds, vl, rates) == 0)
+		vl->rates = rates;
+	else
+		vl->rates = NULL;
+	BENCH_STAGE (BENCH_STAGE_CACHE, bench_t);
+	trace_stamp (trace, TRACE_STAGE_CACHE);
 
 	if (post_cache_chain != NULL)
 	{
@@ -2242,6 +2963,10 @@ static int plugin_dispatch_values_internal (value_list_t *vl)
 	}
 	else
 		fc_default_action (ds, vl);
+	BENCH_STAGE (BENCH_STAGE_POST_CACHE, bench_t);
+	trace_stamp (trace, TRACE_STAGE_POST_CACHE);
+
+	vl->rates = saved_rates;
 
 	/* Restore the state of the value_list so that plugins don't get
 	 * confused.. */
@@ -2324,10 +3049,11 @@ static _Bool check_drop_value (void) /* {{{ */
 		return (0);
 } /* }}} _Bool check_drop_value */
 
+static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int plugin_dispatch_values (value_list_t const *vl)
 {
 	int status;
-	static pthread_mutex_t statistics_lock = PTHREAD_MUTEX_INITIALIZER;
 
 	if (check_drop_value ()) {
 		if(record_statistics) {
@@ -2351,6 +3077,75 @@ int plugin_dispatch_values (value_list_t const *vl)
 	return (0);
 }
 
+int plugin_dispatch_values_batch (value_list_t const *vls, /* {{{ */
+		size_t vls_num)
+{
+	write_queue_t *head = NULL;
+	write_queue_t *tail = NULL;
+	plugin_ctx_t ctx;
+	derive_t dropped = 0;
+	long num = 0;
+	int failed = 0;
+	size_t i;
+
+	ctx = plugin_get_ctx ();
+
+	for (i = 0; i < vls_num; i++)
+	{
+		write_queue_t *q;
+
+		if (check_drop_value ())
+		{
+			dropped++;
+			continue;
+		}
+
+		q = malloc (sizeof (*q));
+		if (q == NULL)
+		{
+			failed++;
+			continue;
+		}
+		q->next = NULL;
+		q->ctx = ctx;
+#if COLLECTD_BENCH
+		q->bench_enqueued = bench_time ();
+#endif
+
+		q->vl = plugin_value_list_clone (vls + i);
+		if (q->vl == NULL)
+		{
+			sfree (q);
+			failed++;
+			continue;
+		}
+		q->trace = trace_sample (q->vl);
+
+		if (tail == NULL)
+			head = q;
+		else
+			tail->next = q;
+		tail = q;
+		num++;
+	}
+
+	if (head != NULL)
+		plugin_write_enqueue_list (head, tail, num);
+
+	if ((dropped > 0) && record_statistics)
+	{
+		pthread_mutex_lock (&statistics_lock);
+		stats_values_dropped += dropped;
+		pthread_mutex_unlock (&statistics_lock);
+	}
+
+	if (failed > 0)
+		ERROR ("plugin_dispatch_values_batch: Failed to enqueue %i of %zu "
+				"value lists.", failed, vls_num);
+
+	return (failed);
+} /* }}} int plugin_dispatch_values_batch */
+
 __attribute__((sentinel))
 int plugin_dispatch_multivalue (value_list_t const *template, /* {{{ */
 		_Bool store_percentage, int store_type, ...)
@@ -108,12 +108,16 @@ struct value_list_s
 	char     type[DATA_MAX_NAME_LEN];
 	char     type_instance[DATA_MAX_NAME_LEN];
 	meta_data_t *meta;
+	/* Rates as computed by the value cache. Only set while the value
+	 * list is passed to the post-cache chain and the write callbacks;
+	 * use uc_get_rates() to access them. */
+	gauge_t const *rates;
 };
 typedef struct value_list_s value_list_t;
 
 #define VALUE_LIST_INIT { NULL, 0, 0, plugin_get_interval (), \
-	"localhost", "", "", "", "", NULL }
-#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", NULL }
+	"localhost", "", "", "", "", NULL, NULL }
+#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", NULL, NULL }
 
 struct data_source_s
 {
@@ -176,11 +180,20 @@ struct user_data_s
 };
 typedef struct user_data_s user_data_t;
 
+#define WRITE_QUEUE_DROP_NEWEST 0
+#define WRITE_QUEUE_DROP_OLDEST 1
+#define WRITE_QUEUE_BLOCK       2
+
 struct plugin_ctx_s
 {
 	cdtime_t interval;
 	cdtime_t flush_interval;
 	cdtime_t flush_timeout;
+	/* Write callbacks get their own queue and threads if either of the
+	 * first two is non-zero. */
+	int write_threads;
+	long write_queue_limit;
+	int write_queue_policy;
 };
 typedef struct plugin_ctx_s plugin_ctx_t;
 
@@ -299,6 +312,8 @@ int plugin_register_complex_read (const char *group, const char *name,
 		plugin_read_cb callback,
 		cdtime_t interval,
 		user_data_t *user_data);
+/* If the plugin was loaded with "WriteThreads" or "WriteQueueLimit", the
+ * callback is called by threads of its own, which are fed by a queue. */
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *user_data);
 int plugin_register_flush (const char *name,
@@ -354,6 +369,20 @@ void plugin_log_available_writers (void);
  */
 int plugin_dispatch_values (value_list_t const *vl);
 
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches `vls_num' value lists at once. This is equivalent to calling
+ *  `plugin_dispatch_values' for each value list, but the value lists are
+ *  appended to the write queue with a single lock operation.
+ *
+ * RETURNS
+ *  The number of value lists it failed to dispatch (zero on success).
+ */
+int plugin_dispatch_values_batch (value_list_t const *vls, size_t vls_num);
+
 /*
  * NAME
  *  plugin_dispatch_multivalue
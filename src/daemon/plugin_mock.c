@@ -25,6 +25,7 @@
  */
 
 #include "plugin.h"
+#include "configfile.h"
 
 #if HAVE_LIBKSTAT
 kstat_ctl_t *kc = NULL;
@@ -47,16 +48,119 @@ int plugin_register_read (const char *name, int (*callback) (void))
   return ENOTSUP;
 }
 
+int plugin_register_complex_read (const char *group, const char *name,
+    plugin_read_cb callback, cdtime_t interval, user_data_t *user_data)
+{
+  return ENOTSUP;
+}
+
 int plugin_register_shutdown (const char *name, int (*callback) (void))
 {
   return ENOTSUP;
 }
 
+int plugin_register_write (const char *name,
+    plugin_write_cb callback, user_data_t *user_data)
+{
+  return ENOTSUP;
+}
+
+int plugin_register_flush (const char *name,
+    plugin_flush_cb callback, user_data_t *user_data)
+{
+  return ENOTSUP;
+}
+
+int plugin_register_notification (const char *name,
+    plugin_notification_cb callback, user_data_t *user_data)
+{
+  return ENOTSUP;
+}
+
+int plugin_unregister_config (const char *name)
+{
+  return ENOTSUP;
+}
+
+int plugin_unregister_init (const char *name)
+{
+  return ENOTSUP;
+}
+
+int plugin_unregister_write (const char *name)
+{
+  return ENOTSUP;
+}
+
+int plugin_unregister_shutdown (const char *name)
+{
+  return ENOTSUP;
+}
+
 int plugin_dispatch_values (value_list_t const *vl)
 {
   return ENOTSUP;
 }
 
+int plugin_dispatch_notification (const notification_t *notif)
+{
+  return ENOTSUP;
+}
+
+int plugin_notification_meta_add_boolean (notification_t *n,
+    const char *name, _Bool value)
+{
+  return ENOTSUP;
+}
+
+int plugin_notification_meta_free (notification_meta_t *n)
+{
+  return ENOTSUP;
+}
+
+int plugin_notification_meta_copy (notification_t *dst,
+    const notification_t *src)
+{
+  return ENOTSUP;
+}
+
+int plugin_thread_create (pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start_routine) (void *), void *arg)
+{
+  return pthread_create (thread, attr, start_routine, arg);
+}
+
+int cf_util_get_string (const oconfig_item_t *ci, char **ret_string)
+{
+  return ENOTSUP;
+}
+
+int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer,
+    size_t buffer_size)
+{
+  return ENOTSUP;
+}
+
+int cf_util_get_int (const oconfig_item_t *ci, int *ret_value)
+{
+  return ENOTSUP;
+}
+
+int cf_util_get_double (const oconfig_item_t *ci, double *ret_value)
+{
+  return ENOTSUP;
+}
+
+int cf_util_get_boolean (const oconfig_item_t *ci, _Bool *ret_bool)
+{
+  return ENOTSUP;
+}
+
+int cf_util_get_cdtime (const oconfig_item_t *ci, cdtime_t *ret_value)
+{
+  return ENOTSUP;
+}
+
 void plugin_log (int level, char const *format, ...)
 {
   char buffer[1024];
@@ -34,9 +34,14 @@
 #include <assert.h>
 #include <pthread.h>
 
+struct cache_timeout_list_s;
+
 typedef struct cache_entry_s
 {
 	char name[6 * DATA_MAX_NAME_LEN];
+	/* Lengths of the host, plugin, plugin instance, type and type instance
+	 * parts of "name", so it can be split without parsing it. */
+	unsigned char name_parts[5];
 	size_t     values_num;
 	gauge_t   *values_gauge;
 	value_t   *values_raw;
@@ -66,11 +71,30 @@ typedef struct cache_entry_s
 	size_t   history_length;
 
 	meta_data_t *meta;
+
+	/* Position in the timeout list, see below. */
+	struct cache_timeout_list_s *timeout_list;
+	struct cache_entry_s *timeout_prev;
+	struct cache_entry_s *timeout_next;
 } cache_entry_t;
 
+/* Deadline index used by uc_check_timeout(): one list per interval, in which
+ * entries are moved to the tail whenever they are updated. Each list is thus
+ * ordered by "last_update" and hence by "last_update + interval * timeout_g",
+ * so expired entries are always found at the head. */
+typedef struct cache_timeout_list_s
+{
+  cdtime_t interval;
+  cache_entry_t *head;
+  cache_entry_t *tail;
+  struct cache_timeout_list_s *next;
+} cache_timeout_list_t;
+
 static c_avl_tree_t   *cache_tree = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
+static cache_timeout_list_t *timeout_lists = NULL;
+
 static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
 {
 #if COLLECT_DEBUG
@@ -125,6 +149,94 @@ static void cache_free (cache_entry_t *ce)
   sfree (ce);
 } /* void cache_free */
 
+/* `cache_lock' has to be held. */
+static void uc_timeout_unlink (cache_entry_t *ce) /* {{{ */
+{
+  cache_timeout_list_t *tl = ce->timeout_list;
+
+  if (tl == NULL)
+    return;
+
+  if (ce->timeout_prev != NULL)
+    ce->timeout_prev->timeout_next = ce->timeout_next;
+  else
+    tl->head = ce->timeout_next;
+
+  if (ce->timeout_next != NULL)
+    ce->timeout_next->timeout_prev = ce->timeout_prev;
+  else
+    tl->tail = ce->timeout_prev;
+
+  ce->timeout_list = NULL;
+  ce->timeout_prev = NULL;
+  ce->timeout_next = NULL;
+} /* }}} void uc_timeout_unlink */
+
+/* Moves "ce" to the tail of the timeout list of its interval. Must be called
+ * with `cache_lock' held whenever "last_update" or "interval" is changed. */
+static void uc_timeout_touch (cache_entry_t *ce) /* {{{ */
+{
+  cache_timeout_list_t *tl = ce->timeout_list;
+
+  if ((tl != NULL) && (tl->interval == ce->interval) && (tl->tail == ce))
+    return;
+
+  uc_timeout_unlink (ce);
+
+  if ((tl == NULL) || (tl->interval != ce->interval))
+  {
+    for (tl = timeout_lists; tl != NULL; tl = tl->next)
+      if (tl->interval == ce->interval)
+        break;
+  }
+
+  if (tl == NULL)
+  {
+    tl = calloc (1, sizeof (*tl));
+    if (tl == NULL)
+    {
+      ERROR ("utils_cache: uc_timeout_touch: calloc failed. "
+          "\"%s\" will not time out.", ce->name);
+      return;
+    }
+    tl->interval = ce->interval;
+    tl->next = timeout_lists;
+    timeout_lists = tl;
+  }
+
+  ce->timeout_list = tl;
+  ce->timeout_prev = tl->tail;
+  ce->timeout_next = NULL;
+  if (tl->tail != NULL)
+    tl->tail->timeout_next = ce;
+  else
+    tl->head = ce;
+  tl->tail = ce;
+} /* }}} void uc_timeout_touch */
+
+/* Fills in the identifier of "vl" from "ce->name". */
+static void uc_name_to_vl (const cache_entry_t *ce, value_list_t *vl) /* {{{ */
+{
+  const char *ptr = ce->name;
+
+  sstrncpy (vl->host, ptr, ce->name_parts[0] + 1);
+  ptr += ce->name_parts[0] + 1;
+
+  sstrncpy (vl->plugin, ptr, ce->name_parts[1] + 1);
+  ptr += ce->name_parts[1];
+  if (ce->name_parts[2] > 0)
+  {
+    sstrncpy (vl->plugin_instance, ptr + 1, ce->name_parts[2] + 1);
+    ptr += ce->name_parts[2] + 1;
+  }
+  ptr++;
+
+  sstrncpy (vl->type, ptr, ce->name_parts[3] + 1);
+  ptr += ce->name_parts[3];
+  if (ce->name_parts[4] > 0)
+    sstrncpy (vl->type_instance, ptr + 1, ce->name_parts[4] + 1);
+} /* }}} void uc_name_to_vl */
+
 static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
 {
   size_t i;
@@ -141,7 +253,7 @@ static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
 } /* void uc_check_range */
 
 static int uc_insert (const data_set_t *ds, const value_list_t *vl,
-    const char *key)
+    const char *key, gauge_t *ret_rates)
 {
   char *key_copy;
   cache_entry_t *ce;
@@ -165,6 +277,11 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   }
 
   sstrncpy (ce->name, key, sizeof (ce->name));
+  ce->name_parts[0] = (unsigned char) strlen (vl->host);
+  ce->name_parts[1] = (unsigned char) strlen (vl->plugin);
+  ce->name_parts[2] = (unsigned char) strlen (vl->plugin_instance);
+  ce->name_parts[3] = (unsigned char) strlen (vl->type);
+  ce->name_parts[4] = (unsigned char) strlen (vl->type_instance);
 
   for (i = 0; i < ds->ds_num; i++)
   {
@@ -214,9 +331,14 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
   if (c_avl_insert (cache_tree, key_copy, ce) != 0)
   {
     sfree (key_copy);
+    cache_free (ce);
     ERROR ("uc_insert: c_avl_insert failed.");
     return (-1);
   }
+  uc_timeout_touch (ce);
+
+  if (ret_rates != NULL)
+    memcpy (ret_rates, ce->values_gauge, ce->values_num * sizeof (gauge_t));
 
   DEBUG ("uc_insert: Added %s to the cache.", key);
   return (0);
@@ -231,84 +353,69 @@ int uc_init (void)
   return (0);
 } /* int uc_init */
 
+/* Entries are only ever removed from the cache here, which is called by a
+ * single thread, so the entries collected below stay valid while the lock is
+ * released to call the "missing" callbacks. */
 int uc_check_timeout (void)
 {
   cdtime_t now;
-  cache_entry_t *ce;
-
-  char **keys = NULL;
-  cdtime_t *keys_time = NULL;
-  cdtime_t *keys_interval = NULL;
-  int keys_len = 0;
+  cache_timeout_list_t *tl;
 
-  char *key;
-  c_avl_iterator_t *iter;
+  struct
+  {
+    cache_entry_t *ce;
+    cdtime_t time;
+    cdtime_t interval;
+  } *expired = NULL;
+  size_t expired_num = 0;
+  size_t expired_size = 0;
 
-  int status;
-  int i;
+  size_t i;
 
   pthread_mutex_lock (&cache_lock);
 
   now = cdtime ();
 
-  /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+  /* Collect the expired entries. Since each list is ordered, only the
+   * expired entries and one more per list are looked at. */
+  for (tl = timeout_lists; tl != NULL; tl = tl->next)
   {
-    char **tmp;
-    cdtime_t *tmp_time;
+    cdtime_t timeout = tl->interval * timeout_g;
 
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
-
-    /* If entry has not been updated, add to `keys' array */
-    tmp = realloc ((void *) keys,
-	(keys_len + 1) * sizeof (char *));
-    if (tmp == NULL)
+    while ((tl->head != NULL) && ((tl->head->last_update + timeout) <= now))
     {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys = tmp;
+      cache_entry_t *ce = tl->head;
 
-    tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_time = tmp_time;
+      if (expired_num >= expired_size)
+      {
+        size_t tmp_size = (expired_size == 0) ? 64 : 2 * expired_size;
+        void *tmp;
+
+        tmp = realloc (expired, tmp_size * sizeof (*expired));
+        if (tmp == NULL)
+        {
+          ERROR ("uc_check_timeout: realloc failed.");
+          break;
+        }
+        expired = tmp;
+        expired_size = tmp_size;
+      }
 
-    tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_interval = tmp_time;
+      /* Taken out of the list; uc_update() puts it back in. */
+      uc_timeout_unlink (ce);
 
-    keys[keys_len] = strdup (key);
-    if (keys[keys_len] == NULL)
-    {
-      ERROR ("uc_check_timeout: strdup failed.");
-      continue;
+      expired[expired_num].ce = ce;
+      expired[expired_num].time = ce->last_time;
+      expired[expired_num].interval = ce->interval;
+      expired_num++;
     }
-    keys_time[keys_len] = ce->last_time;
-    keys_interval[keys_len] = ce->interval;
-
-    keys_len++;
-  } /* while (c_avl_iterator_next) */
+  }
 
-  c_avl_iterator_destroy (iter);
   pthread_mutex_unlock (&cache_lock);
 
-  if (keys_len == 0)
+  if (expired_num == 0)
   {
-    /* realloc() may have been called for these. */
-    sfree (keys);
-    sfree (keys_time);
-    sfree (keys_interval);
+    sfree (expired);
     return (0);
   }
 
@@ -317,7 +424,7 @@ int uc_check_timeout (void)
    * including plugin specific meta data, rates, history, …. This must be done
    * without holding the lock, otherwise we will run into a deadlock if a
    * plugin calls the cache interface. */
-  for (i = 0; i < keys_len; i++)
+  for (i = 0; i < expired_num; i++)
   {
     value_list_t vl = VALUE_LIST_INIT;
 
@@ -325,51 +432,44 @@ int uc_check_timeout (void)
     vl.values_len = 0;
     vl.meta = NULL;
 
-    status = parse_identifier_vl (keys[i], &vl);
-    if (status != 0)
-    {
-      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.", keys[i]);
-      continue;
-    }
-
-    vl.time = keys_time[i];
-    vl.interval = keys_interval[i];
+    uc_name_to_vl (expired[i].ce, &vl);
+    vl.time = expired[i].time;
+    vl.interval = expired[i].interval;
 
     plugin_dispatch_missing (&vl);
-  } /* for (i = 0; i < keys_len; i++) */
+  } /* for (i = 0; i < expired_num; i++) */
 
-  /* Now actually remove all the values from the cache. We don't re-evaluate
-   * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
+  /* Now actually remove the values from the cache. Values which have been
+   * updated in the meantime are back in a timeout list and are kept. */
   pthread_mutex_lock (&cache_lock);
-  for (i = 0; i < keys_len; i++)
+  for (i = 0; i < expired_num; i++)
   {
-    key = NULL;
-    ce = NULL;
+    cache_entry_t *ce = expired[i].ce;
+    char *key = NULL;
+    int status;
+
+    if (ce->timeout_list != NULL)
+      continue;
 
-    status = c_avl_remove (cache_tree, keys[i],
-	(void *) &key, (void *) &ce);
+    status = c_avl_remove (cache_tree, ce->name, (void *) &key, NULL);
     if (status != 0)
     {
-      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", keys[i]);
-      sfree (keys[i]);
+      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", ce->name);
       continue;
     }
 
-    sfree (keys[i]);
     sfree (key);
     cache_free (ce);
-  } /* for (i = 0; i < keys_len; i++) */
+  } /* for (i = 0; i < expired_num; i++) */
   pthread_mutex_unlock (&cache_lock);
 
-  sfree (keys);
-  sfree (keys_time);
-  sfree (keys_interval);
+  sfree (expired);
 
   return (0);
 } /* int uc_check_timeout */
 
-int uc_update (const data_set_t *ds, const value_list_t *vl)
+int uc_update (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates)
 {
   char name[6 * DATA_MAX_NAME_LEN];
   cache_entry_t *ce = NULL;
@@ -387,7 +487,7 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   status = c_avl_get (cache_tree, name, (void *) &ce);
   if (status != 0) /* entry does not yet exist */
   {
-    status = uc_insert (ds, vl, name);
+    status = uc_insert (ds, vl, name, ret_rates);
     pthread_mutex_unlock (&cache_lock);
     return (status);
   }
@@ -471,6 +571,10 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
   ce->last_time = vl->time;
   ce->last_update = cdtime ();
   ce->interval = vl->interval;
+  uc_timeout_touch (ce);
+
+  if (ret_rates != NULL)
+    memcpy (ret_rates, ce->values_gauge, ce->values_num * sizeof (gauge_t));
 
   pthread_mutex_unlock (&cache_lock);
 
@@ -527,6 +631,60 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
   return (status);
 } /* gauge_t *uc_get_rate_by_name */
 
+int uc_get_rate_by_names (char const * const *names, size_t names_num,
+    gauge_t **ret_values, size_t *ret_values_num)
+{
+  size_t i;
+  int status = 0;
+
+  pthread_mutex_lock (&cache_lock);
+
+  for (i = 0; i < names_num; i++)
+  {
+    cache_entry_t *ce = NULL;
+
+    ret_values[i] = NULL;
+    ret_values_num[i] = 0;
+
+    if (c_avl_get (cache_tree, names[i], (void *) &ce) != 0)
+    {
+      DEBUG ("utils_cache: uc_get_rate_by_names: No such value: %s",
+          names[i]);
+      continue;
+    }
+    assert (ce != NULL);
+
+    /* remove missing values from getval */
+    if (ce->state == STATE_MISSING)
+      continue;
+
+    ret_values[i] = malloc (ce->values_num * sizeof (*ret_values[i]));
+    if (ret_values[i] == NULL)
+    {
+      ERROR ("utils_cache: uc_get_rate_by_names: malloc failed.");
+      status = -1;
+      break;
+    }
+    memcpy (ret_values[i], ce->values_gauge,
+        ce->values_num * sizeof (gauge_t));
+    ret_values_num[i] = ce->values_num;
+  }
+
+  pthread_mutex_unlock (&cache_lock);
+
+  if (status != 0)
+  {
+    while (i > 0)
+    {
+      i--;
+      sfree (ret_values[i]);
+      ret_values_num[i] = 0;
+    }
+  }
+
+  return (status);
+} /* int uc_get_rate_by_names */
+
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
 {
   char name[6 * DATA_MAX_NAME_LEN];
@@ -534,6 +692,19 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
   size_t ret_num = 0;
   int status;
 
+  /* Rates computed by plugin_dispatch_values(): no need to take the lock. */
+  if (vl->rates != NULL)
+  {
+    ret = malloc (ds->ds_num * sizeof (*ret));
+    if (ret == NULL)
+    {
+      ERROR ("utils_cache: uc_get_rate: malloc failed.");
+      return (NULL);
+    }
+    memcpy (ret, vl->rates, ds->ds_num * sizeof (*ret));
+    return (ret);
+  }
+
   if (FORMAT_VL (name, sizeof (name), vl) != 0)
   {
     ERROR ("utils_cache: uc_get_rate: FORMAT_VL failed.");
@@ -558,6 +729,53 @@ gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
   return (ret);
 } /* gauge_t *uc_get_rate */
 
+int uc_get_rates (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  cache_entry_t *ce = NULL;
+  int status = 0;
+
+  if (vl->rates != NULL)
+  {
+    memcpy (ret_rates, vl->rates, ds->ds_num * sizeof (*ret_rates));
+    return (0);
+  }
+
+  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  {
+    ERROR ("utils_cache: uc_get_rates: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  pthread_mutex_lock (&cache_lock);
+
+  if (c_avl_get (cache_tree, name, (void *) &ce) != 0)
+  {
+    DEBUG ("utils_cache: uc_get_rates: No such value: %s", name);
+    status = -1;
+  }
+  else if (ce->state == STATE_MISSING)
+  {
+    status = -1;
+  }
+  else if (ce->values_num != ds->ds_num)
+  {
+    ERROR ("utils_cache: uc_get_rates: ds[%s] has %zu values, "
+	"but the cache entry has %zu.",
+	ds->type, ds->ds_num, ce->values_num);
+    status = -1;
+  }
+  else
+  {
+    memcpy (ret_rates, ce->values_gauge, ds->ds_num * sizeof (*ret_rates));
+  }
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return (status);
+} /* int uc_get_rates */
+
 size_t uc_get_size (void) {
   size_t size_arrays = 0;
 
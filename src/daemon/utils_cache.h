@@ -36,9 +36,24 @@
 
 int uc_init (void);
 int uc_check_timeout (void);
-int uc_update (const data_set_t *ds, const value_list_t *vl);
+/* Updates the cache with "vl". If "ret_rates" is not NULL, the new rates are
+ * copied there; it must have room for ds->ds_num values. */
+int uc_update (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates);
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
+/* Looks up "names_num" names while holding the cache lock only once. For each
+ * name, the rates are stored in "ret_values[i]" (which must be freed by the
+ * caller) and their number in "ret_values_num[i]". Names which are not found
+ * yield NULL and zero, respectively. */
+int uc_get_rate_by_names (char const * const *names, size_t names_num,
+    gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
+/* Copies the rates of "vl" to "ret_rates", which must have room for
+ * ds->ds_num values. Within write callbacks, these are the rates attached by
+ * plugin_dispatch_values() and neither the cache lock nor an allocation is
+ * needed. Otherwise the rates are looked up in the cache. */
+int uc_get_rates (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates);
 
 size_t uc_get_size (void);
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
@@ -31,3 +31,25 @@ gauge_t *uc_get_rate (__attribute((unused)) data_set_t const *ds,
 {
   return (NULL);
 }
+
+int uc_get_rates (data_set_t const *ds, value_list_t const *vl,
+                  gauge_t *ret_rates)
+{
+  if (vl->rates == NULL)
+    return (-1);
+
+  memcpy (ret_rates, vl->rates, ds->ds_num * sizeof (*ret_rates));
+  return (0);
+}
+
+int uc_meta_data_add_unsigned_int (const value_list_t *vl,
+                                   const char *key, uint64_t value)
+{
+  return (ENOTSUP);
+}
+
+int uc_meta_data_get_unsigned_int (const value_list_t *vl,
+                                   const char *key, uint64_t *value)
+{
+  return (-ENOENT);
+}
@@ -0,0 +1,142 @@
+/**
+ * collectd - src/daemon/utils_cache_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "plugin.h"
+#include "utils_cache.h"
+
+int timeout_g = 2;
+
+/* Identifiers passed to plugin_dispatch_missing(). */
+static char missing[16][6 * DATA_MAX_NAME_LEN];
+static size_t missing_num = 0;
+
+int plugin_dispatch_missing (const value_list_t *vl)
+{
+  if (missing_num < STATIC_ARRAY_SIZE (missing))
+  {
+    /* Formatting the split identifier checks that it has been split right. */
+    FORMAT_VL (missing[missing_num], sizeof (missing[missing_num]), vl);
+    missing_num++;
+  }
+  return (0);
+}
+
+void plugin_log (int level, char const *format, ...)
+{
+  char buffer[1024];
+  va_list ap;
+
+  va_start (ap, format);
+  vsnprintf (buffer, sizeof (buffer), format, ap);
+  va_end (ap);
+
+  printf ("plugin_log (%i, \"%s\");\n", level, buffer);
+}
+
+cdtime_t plugin_get_interval (void)
+{
+  return TIME_T_TO_CDTIME_T (10);
+}
+
+static int update (char const *plugin_instance, char const *type_instance, /* {{{ */
+    int interval)
+{
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  value_t value = { .gauge = 42.0 };
+  value_list_t vl;
+
+  TESTING_VALUE_LIST (&vl, &value, ds);
+  vl.time = cdtime_mock;
+  vl.interval = TIME_T_TO_CDTIME_T (interval);
+  sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  return (uc_update (ds, &vl, /* ret_rates = */ NULL));
+} /* }}} int update */
+
+DEF_TEST(timeout)
+{
+  cdtime_t start = cdtime_mock;
+
+  CHECK_ZERO (uc_init ());
+  missing_num = 0;
+
+  CHECK_ZERO (update ("", "", 10));
+  CHECK_ZERO (update ("a-b", "", 10));
+  CHECK_ZERO (update ("", "c", 10));
+  CHECK_ZERO (update ("slow", "", 60));
+  EXPECT_EQ_INT (4, (int) uc_get_size ());
+
+  /* Nothing is older than two intervals. */
+  cdtime_mock = start + TIME_T_TO_CDTIME_T (19);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (0, (int) missing_num);
+
+  /* Updating moves an entry's deadline back. */
+  CHECK_ZERO (update ("", "c", 10));
+
+  cdtime_mock = start + TIME_T_TO_CDTIME_T (20);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (2, (int) missing_num);
+  EXPECT_EQ_STR ("example.com/test/gauge", missing[0]);
+  EXPECT_EQ_STR ("example.com/test-a-b/gauge", missing[1]);
+  EXPECT_EQ_INT (2, (int) uc_get_size ());
+
+  /* A changed interval moves an entry to a different list. */
+  cdtime_mock = start + TIME_T_TO_CDTIME_T (30);
+  CHECK_ZERO (update ("slow", "", 10));
+
+  cdtime_mock = start + TIME_T_TO_CDTIME_T (50);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (4, (int) missing_num);
+  EXPECT_EQ_STR ("example.com/test/gauge-c", missing[2]);
+  EXPECT_EQ_STR ("example.com/test-slow/gauge", missing[3]);
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+
+  /* Removed entries can be added again. */
+  CHECK_ZERO (update ("", "", 10));
+  EXPECT_EQ_INT (1, (int) uc_get_size ());
+
+  cdtime_mock = start + TIME_T_TO_CDTIME_T (70);
+  CHECK_ZERO (uc_check_timeout ());
+  EXPECT_EQ_INT (5, (int) missing_num);
+  EXPECT_EQ_INT (0, (int) uc_get_size ());
+
+  cdtime_mock = start;
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(timeout);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
@@ -63,22 +63,150 @@ struct ignorelist_item_s
 {
 #if HAVE_REGEX_H
 	regex_t *rmatch;	/* regular expression entry identification */
+	char *rstring;		/* the expression, for the combined automaton */
 #endif
-	char *smatch;		/* string entry identification */
 	struct ignorelist_item_s *next;
 };
 typedef struct ignorelist_item_s ignorelist_item_t;
 
+/* Open addressing hash table of strings, each with a boolean value. */
+struct ignorelist_table_s
+{
+	char **keys;
+	_Bool *values;
+	size_t size;		/* power of two, or zero */
+	size_t num;
+};
+typedef struct ignorelist_table_s ignorelist_table_t;
+
+/* Number of regex verdicts remembered before the cache is flushed. */
+#define IGNORELIST_VERDICTS_MAX 65536
+
 struct ignorelist_s
 {
 	int ignore;		/* ignore entries */
-	ignorelist_item_t *head;	/* pointer to the first entry */
+	ignorelist_table_t strings;	/* string entries */
+	ignorelist_item_t *head;	/* regex entries */
+#if HAVE_REGEX_H
+	/* All regex entries are combined into one expression, which is compiled
+	 * on the first match after an entry was added. Since device names are
+	 * stable between reads, the result of matching a name is remembered in
+	 * "verdicts". Protected by "lock". */
+	pthread_mutex_t lock;
+	_Bool dirty;
+	_Bool have_combined;
+	regex_t combined;
+	ignorelist_table_t verdicts;
+#endif
 };
 
 /* *** *** *** ********************************************* *** *** *** */
 /* *** *** *** *** *** ***   private functions   *** *** *** *** *** *** */
 /* *** *** *** ********************************************* *** *** *** */
 
+/* FNV-1a */
+static uint32_t ignorelist_hash (const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *str != 0; str++)
+		hash = (hash ^ (uint8_t) *str) * 16777619U;
+
+	return (hash);
+} /* uint32_t ignorelist_hash */
+
+/*
+ * look up key in the table
+ * return its slot or -1 if not found
+ */
+static ssize_t ignorelist_table_lookup (const ignorelist_table_t *t,
+		const char *key)
+{
+	size_t i;
+
+	if (t->num == 0)
+		return (-1);
+
+	for (i = ignorelist_hash (key) & (t->size - 1);
+			t->keys[i] != NULL;
+			i = (i + 1) & (t->size - 1))
+	{
+		if (strcmp (t->keys[i], key) == 0)
+			return ((ssize_t) i);
+	}
+
+	return (-1);
+} /* ssize_t ignorelist_table_lookup */
+
+static void ignorelist_table_put (ignorelist_table_t *t, char *key,
+		_Bool value)
+{
+	size_t i;
+
+	for (i = ignorelist_hash (key) & (t->size - 1);
+			t->keys[i] != NULL;
+			i = (i + 1) & (t->size - 1))
+		/* find a free slot */;
+
+	t->keys[i] = key;
+	t->values[i] = value;
+	t->num++;
+} /* void ignorelist_table_put */
+
+/*
+ * insert a copy of key into the table, growing it if necessary
+ * return 0 for success
+ */
+static int ignorelist_table_insert (ignorelist_table_t *t, const char *key,
+		_Bool value)
+{
+	char *copy;
+
+	/* keep the load factor at or below one half */
+	if ((t->num + 1) * 2 > t->size)
+	{
+		ignorelist_table_t new = { NULL, NULL, 0, 0 };
+		size_t i;
+
+		new.size = (t->size == 0) ? 16 : 2 * t->size;
+		new.keys = calloc (new.size, sizeof (*new.keys));
+		new.values = calloc (new.size, sizeof (*new.values));
+		if ((new.keys == NULL) || (new.values == NULL))
+		{
+			sfree (new.keys);
+			sfree (new.values);
+			return (ENOMEM);
+		}
+
+		for (i = 0; i < t->size; i++)
+			if (t->keys[i] != NULL)
+				ignorelist_table_put (&new, t->keys[i], t->values[i]);
+
+		sfree (t->keys);
+		sfree (t->values);
+		*t = new;
+	}
+
+	copy = strdup (key);
+	if (copy == NULL)
+		return (ENOMEM);
+
+	ignorelist_table_put (t, copy, value);
+	return (0);
+} /* int ignorelist_table_insert */
+
+static void ignorelist_table_clear (ignorelist_table_t *t)
+{
+	size_t i;
+
+	for (i = 0; i < t->size; i++)
+		sfree (t->keys[i]);
+	sfree (t->keys);
+	sfree (t->values);
+	t->size = 0;
+	t->num = 0;
+} /* void ignorelist_table_clear */
+
 static inline void ignorelist_append (ignorelist_t *il, ignorelist_item_t *item)
 {
 	assert ((il != NULL) && (item != NULL));
@@ -101,7 +229,7 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *re_str)
 		return (ENOMEM);
 	}
 
-	status = regcomp (re, re_str, REG_EXTENDED);
+	status = regcomp (re, re_str, REG_EXTENDED | REG_NOSUB);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -121,63 +249,142 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *re_str)
 		return (ENOMEM);
 	}
 	entry->rmatch = re;
+	entry->rstring = sstrdup (re_str);
 
 	ignorelist_append (il, entry);
+
+	pthread_mutex_lock (&il->lock);
+	il->dirty = 1;
+	pthread_mutex_unlock (&il->lock);
 	return (0);
 } /* int ignorelist_append_regex */
 #endif
 
 static int ignorelist_append_string(ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *new;
+	if (ignorelist_table_lookup (&il->strings, entry) >= 0)
+		return (0);
 
-	/* create new entry */
-	if ((new = calloc(1, sizeof (*new))) == NULL )
+	if (ignorelist_table_insert (&il->strings, entry, 1) != 0)
 	{
 		ERROR ("cannot allocate new entry");
 		return (1);
 	}
-	new->smatch = sstrdup(entry);
-
-	/* append new entry */
-	ignorelist_append (il, new);
 
 	return (0);
 } /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
 
 #if HAVE_REGEX_H
 /*
- * check list for entry regex match
- * return 1 if found
+ * combine all regex entries into "(re1)|(re2)|..."
+ * Since every entry leads to the same verdict, the combined expression
+ * matches exactly when one of the entries does. Back-references would be
+ * renumbered by the grouping, so expressions using them are not combined.
+ * must hold il->lock
  */
-static int ignorelist_match_regex (ignorelist_item_t *item, const char *entry)
+static void ignorelist_compile (ignorelist_t *il)
 {
-	assert ((item != NULL) && (item->rmatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	ignorelist_item_t *item;
+	char *pattern;
+	size_t pattern_size = 1;
+	size_t offset = 0;
+	int status;
 
-	/* match regex */
-	if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
-		return (1);
+	if (il->have_combined)
+		regfree (&il->combined);
+	il->have_combined = 0;
+	il->dirty = 0;
+	ignorelist_table_clear (&il->verdicts);
 
-	return (0);
-} /* int ignorelist_match_regex (ignorelist_item_t *item, const char *entry) */
-#endif
+	/* a single expression needs no combining */
+	if ((il->head == NULL) || (il->head->next == NULL))
+		return;
+
+	for (item = il->head; item != NULL; item = item->next)
+	{
+		const char *ptr;
+
+		for (ptr = strchr (item->rstring, '\\'); ptr != NULL;
+				ptr = strchr (ptr + 2, '\\'))
+		{
+			if ((ptr[1] >= '1') && (ptr[1] <= '9'))
+				return;
+			if (ptr[1] == 0)
+				break;
+		}
+
+		pattern_size += strlen (item->rstring) + 3;
+	}
+
+	pattern = malloc (pattern_size);
+	if (pattern == NULL)
+		return;
+
+	for (item = il->head; item != NULL; item = item->next)
+		offset += ssnprintf (pattern + offset, pattern_size - offset,
+				"%s(%s)", (offset == 0) ? "" : "|", item->rstring);
+
+	status = regcomp (&il->combined, pattern, REG_EXTENDED | REG_NOSUB);
+	if (status == 0)
+		il->have_combined = 1;
+	else
+	{
+		DEBUG ("ignorelist_compile: Combining the regular expressions "
+				"failed; matching them one by one.");
+	}
+
+	sfree (pattern);
+} /* void ignorelist_compile */
 
 /*
- * check list for entry string match
- * return 1 if found
+ * check regex entries for entry
+ * return 1 if one matches
  */
-static int ignorelist_match_string (ignorelist_item_t *item, const char *entry)
+static int ignorelist_match_regex (ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->smatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	ssize_t slot;
+	int match = 0;
 
-	if (strcmp (entry, item->smatch) == 0)
-		return (1);
+	pthread_mutex_lock (&il->lock);
 
-	return (0);
-} /* int ignorelist_match_string (ignorelist_item_t *item, const char *entry) */
+	if (il->dirty)
+		ignorelist_compile (il);
 
+	slot = ignorelist_table_lookup (&il->verdicts, entry);
+	if (slot >= 0)
+	{
+		match = il->verdicts.values[slot];
+		pthread_mutex_unlock (&il->lock);
+		return (match);
+	}
+
+	if (il->have_combined)
+	{
+		match = (regexec (&il->combined, entry, 0, NULL, 0) == 0);
+	}
+	else
+	{
+		ignorelist_item_t *item;
+
+		for (item = il->head; item != NULL; item = item->next)
+		{
+			if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
+			{
+				match = 1;
+				break;
+			}
+		}
+	}
+
+	if (il->verdicts.num >= IGNORELIST_VERDICTS_MAX)
+		ignorelist_table_clear (&il->verdicts);
+	/* failing to remember the verdict is not an error */
+	(void) ignorelist_table_insert (&il->verdicts, entry, (_Bool) match);
+
+	pthread_mutex_unlock (&il->lock);
+	return (match);
+} /* int ignorelist_match_regex (ignorelist_t *il, const char *entry) */
+#endif
 
 /* *** *** *** ******************************************** *** *** *** */
 /* *** *** *** *** *** ***   public functions   *** *** *** *** *** *** */
@@ -200,6 +407,9 @@ ignorelist_t *ignorelist_create (int invert)
 	 * ->ignore == 1  =>  ignore
 	 */
 	il->ignore = invert ? 0 : 1;
+#if HAVE_REGEX_H
+	pthread_mutex_init (&il->lock, /* attr = */ NULL);
+#endif
 
 	return (il);
 } /* ignorelist_t *ignorelist_create (int ignore) */
@@ -225,15 +435,19 @@ void ignorelist_free (ignorelist_t *il)
 			sfree (this->rmatch);
 			this->rmatch = NULL;
 		}
+		sfree (this->rstring);
 #endif
-		if (this->smatch != NULL)
-		{
-			sfree (this->smatch);
-			this->smatch = NULL;
-		}
 		sfree (this);
 	}
 
+	ignorelist_table_clear (&il->strings);
+#if HAVE_REGEX_H
+	if (il->have_combined)
+		regfree (&il->combined);
+	ignorelist_table_clear (&il->verdicts);
+	pthread_mutex_destroy (&il->lock);
+#endif
+
 	sfree (il);
 } /* void ignorelist_destroy (ignorelist_t *il) */
 
@@ -304,31 +518,20 @@ int ignorelist_add (ignorelist_t *il, const char *entry)
  */
 int ignorelist_match (ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *traverse;
-
 	/* if no entries, collect all */
-	if ((il == NULL) || (il->head == NULL))
+	if ((il == NULL) || ((il->strings.num == 0) && (il->head == NULL)))
 		return (0);
 
 	if ((entry == NULL) || (strlen (entry) == 0))
 		return (0);
 
-	/* traverse list and check entries */
-	for (traverse = il->head; traverse != NULL; traverse = traverse->next)
-	{
+	if (ignorelist_table_lookup (&il->strings, entry) >= 0)
+		return (il->ignore);
+
 #if HAVE_REGEX_H
-		if (traverse->rmatch != NULL)
-		{
-			if (ignorelist_match_regex (traverse, entry))
-				return (il->ignore);
-		}
-		else
+	if ((il->head != NULL) && ignorelist_match_regex (il, entry))
+		return (il->ignore);
 #endif
-		{
-			if (ignorelist_match_string (traverse, entry))
-				return (il->ignore);
-		}
-	} /* for traverse */
 
 	return (1 - il->ignore);
 } /* int ignorelist_match (ignorelist_t *il, const char *entry) */
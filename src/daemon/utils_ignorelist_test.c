@@ -0,0 +1,134 @@
+/**
+ * collectd - src/daemon/utils_ignorelist_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_ignorelist.h"
+
+#if HAVE_LIBKSTAT
+kstat_ctl_t *kc;
+#endif /* HAVE_LIBKSTAT */
+
+DEF_TEST(strings)
+{
+  ignorelist_t *il;
+
+  CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ 0));
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth0"));
+
+  CHECK_ZERO (ignorelist_add (il, "eth0"));
+  CHECK_ZERO (ignorelist_add (il, "lo"));
+  CHECK_ZERO (ignorelist_add (il, "lo"));
+
+  EXPECT_EQ_INT (1, ignorelist_match (il, "eth0"));
+  EXPECT_EQ_INT (1, ignorelist_match (il, "lo"));
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth1"));
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth"));
+  EXPECT_EQ_INT (0, ignorelist_match (il, ""));
+
+  ignorelist_set_invert (il, /* invert = */ 1);
+  EXPECT_EQ_INT (0, ignorelist_match (il, "eth0"));
+  EXPECT_EQ_INT (1, ignorelist_match (il, "eth1"));
+
+  ignorelist_free (il);
+  return (0);
+}
+
+#if HAVE_REGEX_H
+DEF_TEST(regex)
+{
+  struct {
+    char const *entry;
+    int want;
+  } cases[] = {
+    { "veth1234", 1 },
+    { "docker0", 1 },
+    { "br-5f3a", 1 },
+    { "eth0", 0 },
+    { "xveth", 0 },
+    { "br-", 0 },
+    { "sda1", 1 },
+  };
+  ignorelist_t *il;
+  size_t i;
+  int n;
+
+  CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ 0));
+  CHECK_ZERO (ignorelist_add (il, "/^veth/"));
+  CHECK_ZERO (ignorelist_add (il, "/^(docker|br-[0-9a-f]+)/"));
+  CHECK_ZERO (ignorelist_add (il, "sda1"));
+  OK (ignorelist_add (il, "/[/") != 0);
+
+  /* Twice: once filling the verdict cache, once from the cache. */
+  for (n = 0; n < 2; n++)
+  {
+    for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+    {
+      OK1 (ignorelist_match (il, cases[i].entry) == cases[i].want,
+          cases[i].entry);
+    }
+  }
+
+  /* Adding an entry invalidates the cached verdicts. */
+  CHECK_ZERO (ignorelist_add (il, "/^eth/"));
+  EXPECT_EQ_INT (1, ignorelist_match (il, "eth0"));
+
+  ignorelist_free (il);
+  return (0);
+}
+
+/* Back-references are renumbered when combining expressions, so such lists
+ * must be matched entry by entry. */
+DEF_TEST(backreference)
+{
+  ignorelist_t *il;
+
+  CHECK_NOT_NULL (il = ignorelist_create (/* invert = */ 1));
+  CHECK_ZERO (ignorelist_add (il, "/^lo$/"));
+  CHECK_ZERO (ignorelist_add (il, "/^(ab)\\1$/"));
+
+  EXPECT_EQ_INT (0, ignorelist_match (il, "abab"));
+  EXPECT_EQ_INT (1, ignorelist_match (il, "abcd"));
+  EXPECT_EQ_INT (0, ignorelist_match (il, "lo"));
+
+  ignorelist_free (il);
+  return (0);
+}
+#endif
+
+int main (void)
+{
+  RUN_TEST(strings);
+#if HAVE_REGEX_H
+  RUN_TEST(regex);
+  RUN_TEST(backreference);
+#endif
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -37,6 +37,7 @@
 
 struct cu_match_s
 {
+  char *regex_str;
   regex_t regex;
   regex_t excluderegex;
   int flags;
@@ -250,12 +251,22 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
     return (NULL);
   }
 
+  obj->regex_str = strdup (regex);
+  if (obj->regex_str == NULL)
+  {
+    regfree (&obj->regex);
+    sfree (obj);
+    return (NULL);
+  }
+
   if (excluderegex && strcmp(excluderegex, "") != 0) {
     status = regcomp (&obj->excluderegex, excluderegex, REG_EXTENDED);
     if (status != 0)
     {
 	ERROR ("Compiling the excluding regular expression \"%s\" failed.",
 	       excluderegex);
+	regfree (&obj->regex);
+	sfree (obj->regex_str);
 	sfree (obj);
 	return (NULL);
     }
@@ -314,6 +325,11 @@ void match_destroy (cu_match_t *obj)
     sfree (obj->user_data);
   }
 
+  regfree (&obj->regex);
+  if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX)
+    regfree (&obj->excluderegex);
+
+  sfree (obj->regex_str);
   sfree (obj);
 } /* void match_destroy */
 
@@ -391,4 +407,194 @@ void *match_get_user_data (cu_match_t *obj)
   return (obj->user_data);
 } /* void *match_get_user_data */
 
+const char *match_get_regex (cu_match_t *obj)
+{
+  if (obj == NULL)
+    return (NULL);
+  return (obj->regex_str);
+} /* const char *match_get_regex */
+
+/* Skips the bracket expression starting at regex[0] ('[') and returns the
+ * number of bytes it occupies. */
+static size_t match_skip_bracket (const char *regex)
+{
+  size_t i = 1;
+
+  if (regex[i] == '^')
+    i++;
+  /* A closing bracket right at the beginning is a literal. */
+  if (regex[i] == ']')
+    i++;
+
+  while ((regex[i] != 0) && (regex[i] != ']'))
+  {
+    /* Character classes, equivalence classes and collating symbols. */
+    if ((regex[i] == '[')
+        && ((regex[i + 1] == ':') || (regex[i + 1] == '=')
+          || (regex[i + 1] == '.')))
+    {
+      char delim = regex[i + 1];
+
+      i += 2;
+      while ((regex[i] != 0)
+          && !((regex[i] == delim) && (regex[i + 1] == ']')))
+        i++;
+      if (regex[i] != 0)
+        i += 2;
+      continue;
+    }
+    i++;
+  }
+
+  if (regex[i] == ']')
+    i++;
+  return (i);
+} /* size_t match_skip_bracket */
+
+/* Skips the group starting at regex[0] ('(') and returns the number of bytes
+ * it occupies. */
+static size_t match_skip_group (const char *regex)
+{
+  size_t i = 1;
+  int depth = 1;
+
+  while ((regex[i] != 0) && (depth > 0))
+  {
+    if (regex[i] == '\\')
+    {
+      i += (regex[i + 1] != 0) ? 2 : 1;
+      continue;
+    }
+    else if (regex[i] == '[')
+    {
+      i += match_skip_bracket (regex + i);
+      continue;
+    }
+    else if (regex[i] == '(')
+      depth++;
+    else if (regex[i] == ')')
+      depth--;
+    i++;
+  }
+
+  return (i);
+} /* size_t match_skip_group */
+
+/* Skips an interval expression ("{n,m}") starting at regex[0]. */
+static size_t match_skip_interval (const char *regex)
+{
+  size_t i = 1;
+
+  while ((regex[i] != 0) && (regex[i] != '}'))
+    i++;
+  if (regex[i] == '}')
+    i++;
+  return (i);
+} /* size_t match_skip_interval */
+
+/* Skips a quantifier following an atom, if any. */
+static size_t match_skip_quantifier (const char *regex)
+{
+  if ((regex[0] == '*') || (regex[0] == '+') || (regex[0] == '?'))
+    return (1);
+  else if (regex[0] == '{')
+    return (match_skip_interval (regex));
+  return (0);
+} /* size_t match_skip_quantifier */
+
+size_t match_regex_literal (const char *regex, char *buffer,
+    size_t buffer_size)
+{
+  char run[256];
+  size_t run_len = 0;
+  size_t best_len = 0;
+  size_t i = 0;
+
+  if ((regex == NULL) || (buffer == NULL) || (buffer_size < 2))
+    return (0);
+  buffer[0] = 0;
+
+#define END_RUN() do { \
+  if (run_len > best_len) { \
+    best_len = (run_len < buffer_size) ? run_len : buffer_size - 1; \
+    memcpy (buffer, run, best_len); \
+    buffer[best_len] = 0; \
+  } \
+  run_len = 0; \
+} while (0)
+
+  while (regex[i] != 0)
+  {
+    char c = regex[i];
+
+    if (c == '|')
+    {
+      /* Top-level alternation: no part of the expression is required. */
+      buffer[0] = 0;
+      return (0);
+    }
+    else if ((c == '(') || (c == '['))
+    {
+      /* Groups and bracket expressions are skipped as a whole, including
+       * a quantifier following them. */
+      END_RUN ();
+      i += (c == '(') ? match_skip_group (regex + i)
+        : match_skip_bracket (regex + i);
+      i += match_skip_quantifier (regex + i);
+      continue;
+    }
+    else if ((c == '.') || (c == '^') || (c == '$') || (c == ')')
+        || (c == '*') || (c == '+') || (c == '?') || (c == '{'))
+    {
+      END_RUN ();
+      if (c == '{')
+        i += match_skip_interval (regex + i);
+      else
+        i++;
+      i += match_skip_quantifier (regex + i);
+      continue;
+    }
+    else if (c == '\\')
+    {
+      c = regex[i + 1];
+      /* Back-references and GNU extensions such as \w or \< are not
+       * literals. */
+      if ((c == 0) || isalnum ((unsigned char) c) || (c == '<')
+          || (c == '>') || (c == '`') || (c == '\''))
+      {
+        END_RUN ();
+        i += (c == 0) ? 1 : 2;
+        i += match_skip_quantifier (regex + i);
+        continue;
+      }
+      i += 2;
+    }
+    else
+      i++;
+
+    /* `c' is a literal character. If it is optional, it ends the current
+     * run; if it may be repeated, it is the last character of the run. */
+    if ((regex[i] == '*') || (regex[i] == '?') || (regex[i] == '{'))
+    {
+      END_RUN ();
+      i += match_skip_quantifier (regex + i);
+      continue;
+    }
+
+    if (run_len < sizeof (run))
+      run[run_len++] = c;
+
+    if (regex[i] == '+')
+    {
+      END_RUN ();
+      i++;
+    }
+  }
+  END_RUN ();
+
+#undef END_RUN
+
+  return (best_len);
+} /* size_t match_regex_literal */
+
 /* vim: set sw=2 sts=2 ts=8 : */
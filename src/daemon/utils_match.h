@@ -170,6 +170,32 @@ int match_apply (cu_match_t *obj, const char *str);
  */
 void *match_get_user_data (cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_get_regex
+ *
+ * DESCRIPTION
+ *  Returns the regular expression the object has been created with.
+ */
+const char *match_get_regex (cu_match_t *obj);
+
+/*
+ * NAME
+ *  match_regex_literal
+ *
+ * DESCRIPTION
+ *  Determines a string that appears in every string matched by the extended
+ *  regular expression `regex' and stores it in `buffer'. This can be used to
+ *  rule out lines with strstr(3) before calling regexec(3). The analysis is
+ *  conservative: If it can't find such a string, for example because the
+ *  expression uses alternation, an empty string is stored.
+ *
+ * RETURN VALUE
+ *  The length of the string stored in `buffer'.
+ */
+size_t match_regex_literal (const char *regex, char *buffer,
+    size_t buffer_size);
+
 #endif /* UTILS_MATCH_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -0,0 +1,109 @@
+/**
+ * collectd - src/daemon/utils_match_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+#include "testing.h"
+#include "utils_match.h"
+
+DEF_TEST(regex_literal)
+{
+  struct {
+    const char *regex;
+    const char *want;
+  } cases[] = {
+    {"foo",                         "foo"},
+    {"S=([1-9][0-9]*)",             "S="},
+    {"\\<R=local_user\\>",          "R=local_user"},
+    {"SPAM \\(Score: (-?[0-9]+)\\)", "SPAM (Score: "},
+    {"^kernel: .* oom-killer",      " oom-killer"},
+    {"colou?r",                     "colo"},
+    {"ab*c",                        "a"},
+    {"ab+cdef",                     "cdef"},
+    {"a{2,3}bcd",                   "bcd"},
+    {"x[]a]yz",                     "yz"},
+    {"x[[:digit:]]yz",              "yz"},
+    {"(foo|bar)",                   ""},
+    {"foo|bar",                     ""},
+    {"(foo)?bar",                   "bar"},
+    {"\\1abc",                      "abc"},
+    {"\\.txt$",                     ".txt"},
+    {"",                            ""},
+  };
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++) {
+    char buffer[64];
+    size_t len;
+
+    len = match_regex_literal (cases[i].regex, buffer, sizeof (buffer));
+    EXPECT_EQ_STR(cases[i].want, buffer);
+    EXPECT_EQ_INT((int) strlen (cases[i].want), (int) len);
+  }
+
+  /* The literal is truncated to the buffer size. */
+  {
+    char buffer[4];
+
+    match_regex_literal ("abcdefgh", buffer, sizeof (buffer));
+    EXPECT_EQ_STR("abc", buffer);
+  }
+
+  return 0;
+}
+
+DEF_TEST(match_simple)
+{
+  cu_match_t *m;
+  cu_match_value_t *v;
+
+  CHECK_NOT_NULL (m = match_create_simple ("S=([0-9]+)", "U=root",
+        UTILS_MATCH_DS_TYPE_DERIVE | UTILS_MATCH_CF_DERIVE_ADD));
+  EXPECT_EQ_STR("S=([0-9]+)", match_get_regex (m));
+
+  CHECK_ZERO (match_apply (m, "id=1 S=100"));
+  CHECK_ZERO (match_apply (m, "id=2 U=root S=1000"));
+  CHECK_ZERO (match_apply (m, "id=3 S=23"));
+  CHECK_ZERO (match_apply (m, "no size here"));
+
+  v = match_get_user_data (m);
+  CHECK_NOT_NULL (v);
+  EXPECT_EQ_INT(2, (int) v->values_num);
+  EXPECT_EQ_INT(123, (int) v->value.derive);
+
+  match_destroy (m);
+  return 0;
+}
+
+int main (void)
+{
+  RUN_TEST(regex_literal);
+  RUN_TEST(match_simple);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et : */
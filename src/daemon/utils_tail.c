@@ -34,11 +34,17 @@
 #include "common.h"
 #include "utils_tail.h"
 
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s
 {
 	char  *file;
 	FILE  *fh;
 	struct stat stat;
+
+	/* Used by cu_tail_read() only. */
+	char  *buffer;
+	size_t buffer_fill;
 };
 
 static int cu_tail_reopen (cu_tail_t *obj)
@@ -65,6 +71,8 @@ static int cu_tail_reopen (cu_tail_t *obj)
     if (stat_buf.st_size < obj->stat.st_size)
     {
       INFO ("utils_tail: File `%s' was truncated.", obj->file);
+      /* An incomplete line read before the truncation won't be continued. */
+      obj->buffer_fill = 0;
       status = fseek (obj->fh, 0, SEEK_SET);
       if (status != 0)
       {
@@ -140,6 +148,7 @@ int cu_tail_destroy (cu_tail_t *obj)
 	if (obj->fh != NULL)
 		fclose (obj->fh);
 	free (obj->file);
+	free (obj->buffer);
 	free (obj);
 
 	return (0);
@@ -217,43 +226,143 @@ int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
   return (0);
 } /* int cu_tail_readline */
 
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
+/* Passes the first `len' bytes of the buffer to the callback as one line and
+ * removes them from the buffer. */
+static int cu_tail_flush (cu_tail_t *obj, size_t len, tailfunc_t *callback,
 		void *data)
 {
 	int status;
 
-	while (42)
+	obj->buffer[len] = 0;
+	status = callback (data, obj->buffer, (int) len);
+
+	obj->buffer_fill -= len;
+	if (obj->buffer_fill > 0)
+		memmove (obj->buffer, obj->buffer + len, obj->buffer_fill);
+
+	return (status);
+} /* int cu_tail_flush */
+
+/* Calls the callback for all complete lines in the buffer. Lines are
+ * terminated in place; an incomplete line is moved to the front of the
+ * buffer. */
+static int cu_tail_split_lines (cu_tail_t *obj, tailfunc_t *callback,
+		void *data)
+{
+	char *line = obj->buffer;
+	char *end = obj->buffer + obj->buffer_fill;
+	int status = 0;
+
+	while (line < end)
 	{
-		size_t len;
+		char *newline;
+
+		newline = memchr (line, '\n', (size_t) (end - line));
+		if (newline == NULL)
+			break;
+
+		*newline = 0;
+		status = callback (data, line, (int) (newline - line));
+		line = newline + 1;
 
-		status = cu_tail_readline (obj, buf, buflen);
 		if (status != 0)
-		{
-			ERROR ("utils_tail: cu_tail_read: cu_tail_readline "
-					"failed.");
 			break;
+	}
+
+	obj->buffer_fill = (size_t) (end - line);
+	if ((obj->buffer_fill > 0) && (line != obj->buffer))
+		memmove (obj->buffer, line, obj->buffer_fill);
+
+	return (status);
+} /* int cu_tail_split_lines */
+
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data)
+{
+	int status;
+
+	if (obj->buffer == NULL)
+	{
+		obj->buffer = malloc (CU_TAIL_BUFFER_SIZE);
+		if (obj->buffer == NULL)
+		{
+			ERROR ("utils_tail: cu_tail_read: malloc failed.");
+			return (-1);
 		}
+		obj->buffer_fill = 0;
+	}
 
-		/* check for EOF */
-		if (buf[0] == 0)
-			break;
+	if (obj->fh == NULL)
+	{
+		status = cu_tail_reopen (obj);
+		if (status < 0)
+			return (status);
+	}
+	assert (obj->fh != NULL);
 
-		len = strlen (buf);
-		while (len > 0) {
-			if (buf[len - 1] != '\n')
+	while (42)
+	{
+		ssize_t len;
+
+		/* The buffer is full and doesn't contain a single newline. Pass
+		 * the data on, like fgets(3) would. One byte is reserved for the
+		 * terminating null byte. */
+		if (obj->buffer_fill >= (CU_TAIL_BUFFER_SIZE - 1))
+		{
+			status = cu_tail_flush (obj, obj->buffer_fill, callback, data);
+			if (status != 0)
 				break;
-			buf[len - 1] = '\0';
-			len--;
 		}
 
-		status = callback (data, buf, buflen);
-		if (status != 0)
+		len = read (fileno (obj->fh), obj->buffer + obj->buffer_fill,
+				(CU_TAIL_BUFFER_SIZE - 1) - obj->buffer_fill);
+		if (len < 0)
 		{
-			ERROR ("utils_tail: cu_tail_read: callback returned "
-					"status %i.", status);
-			break;
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			WARNING ("utils_tail: read (%s) failed: %s", obj->file,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			fclose (obj->fh);
+			obj->fh = NULL;
+			return (-1);
+		}
+		else if (len == 0)
+		{
+			/* EOF -> check if the file was moved away and reopen the new
+			 * file if so.. */
+			status = cu_tail_reopen (obj);
+			if (status < 0)
+				return (status);
+			else if (status > 0)
+			{
+				/* file end reached and file not reopened -> nothing more to
+				 * read */
+				status = 0;
+				break;
+			}
+
+			/* The old file won't be continued; pass on its last line
+			 * even though it lacks a newline. */
+			if (obj->buffer_fill > 0)
+			{
+				status = cu_tail_flush (obj, obj->buffer_fill, callback, data);
+				if (status != 0)
+					break;
+			}
+			continue;
 		}
+
+		obj->buffer_fill += (size_t) len;
+		status = cu_tail_split_lines (obj, callback, data);
+		if (status != 0)
+			break;
 	}
 
-	return status;
+	if (status != 0)
+		ERROR ("utils_tail: cu_tail_read: callback returned status %i.",
+				status);
+
+	return (status);
 } /* int cu_tail_read */
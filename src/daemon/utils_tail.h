@@ -35,6 +35,8 @@
 struct cu_tail_s;
 typedef struct cu_tail_s cu_tail_t;
 
+/* Called for each line read by `cu_tail_read'. `buf' is the
+ * null-terminated line without the newline character, `buflen' its length. */
 typedef int tailfunc_t(void *data, char *buf, int buflen);
 
 /*
@@ -76,13 +78,21 @@ int cu_tail_destroy (cu_tail_t *obj);
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
+ *
+ * Reads from the file until eof condition or an error is encountered and
+ * calls `callback' for each complete line. The file is read in large chunks
+ * into a buffer owned by the tail object and lines are split in place, so the
+ * line passed to `callback' is only valid until the callback returns. A line
+ * that has not been terminated by a newline yet is kept until the rest of it
+ * has been written, unless the file is rotated. Lines longer than the
+ * internal buffer are passed to `callback' in pieces.
  *
- * Reads from the file until eof condition or an error is encountered.
+ * Don't mix calls to this function with `cu_tail_readline' on the same
+ * object.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-		void *data);
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data);
 
 #endif /* UTILS_TAIL_H */
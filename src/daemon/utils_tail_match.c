@@ -36,6 +36,8 @@
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
+#include <regex.h>
+
 struct cu_tail_match_simple_s
 {
   char plugin[DATA_MAX_NAME_LEN];
@@ -52,6 +54,9 @@ struct cu_tail_match_match_s
   void *user_data;
   int (*submit) (cu_match_t *match, void *user_data);
   void (*free) (void *user_data);
+
+  /* A string every matching line contains, or an empty string. */
+  char literal[64];
 };
 typedef struct cu_tail_match_match_s cu_tail_match_match_t;
 
@@ -59,10 +64,20 @@ struct cu_tail_match_s
 {
   int flags;
   cu_tail_t *tail;
+  pthread_mutex_t lock;
 
   cdtime_t interval;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* The pre-filter is built lazily after all matches have been added. Lines
+   * are only passed to the regular expressions of the matches whose literal
+   * they contain and, if more than one match remains, to the regular
+   * expressions of all matches combined. */
+  _Bool prefilter_valid;
+  _Bool have_combined;
+  regex_t combined;
+  size_t *candidates;
 };
 
 /*
@@ -107,18 +122,153 @@ static int simple_submit_match (cu_match_t *match, void *user_data)
   return (0);
 } /* int simple_submit_match */
 
+static void tail_match_prefilter_free (cu_tail_match_t *obj)
+{
+  if (obj->have_combined)
+    regfree (&obj->combined);
+  obj->have_combined = 0;
+  sfree (obj->candidates);
+  obj->prefilter_valid = 0;
+} /* void tail_match_prefilter_free */
+
+static int tail_match_prefilter_build (cu_tail_match_t *obj)
+{
+  char *combined = NULL;
+  size_t combined_len = 0;
+  _Bool can_combine = (obj->matches_num > 1);
+  size_t i;
+
+  tail_match_prefilter_free (obj);
+
+  if (obj->matches_num == 0)
+  {
+    obj->prefilter_valid = 1;
+    return (0);
+  }
+
+  obj->candidates = calloc (obj->matches_num, sizeof (*obj->candidates));
+  if (obj->candidates == NULL)
+    return (-1);
+
+  for (i = 0; i < obj->matches_num; i++)
+  {
+    cu_tail_match_match_t *m = obj->matches + i;
+    const char *regex = match_get_regex (m->match);
+
+    if (regex == NULL)
+    {
+      m->literal[0] = 0;
+      can_combine = 0;
+      continue;
+    }
+
+    match_regex_literal (regex, m->literal, sizeof (m->literal));
+
+    /* Group numbers change when combining the expressions, so
+     * back-references can't be combined. */
+    if (can_combine)
+    {
+      const char *ptr;
+
+      for (ptr = regex; *ptr != 0; ptr++)
+      {
+        if ((ptr[0] == '\\') && isdigit ((unsigned char) ptr[1]))
+          can_combine = 0;
+        if ((ptr[0] == '\\') && (ptr[1] != 0))
+          ptr++;
+      }
+    }
+
+    if (can_combine)
+    {
+      size_t len = strlen (regex);
+      char *tmp;
+
+      /* "(" regex ")" "|" plus the terminating null byte */
+      tmp = realloc (combined, combined_len + len + 4);
+      if (tmp == NULL)
+      {
+        can_combine = 0;
+        continue;
+      }
+      combined = tmp;
+
+      if (combined_len > 0)
+        combined[combined_len++] = '|';
+      combined[combined_len++] = '(';
+      memcpy (combined + combined_len, regex, len);
+      combined_len += len;
+      combined[combined_len++] = ')';
+      combined[combined_len] = 0;
+    }
+  }
+
+  if (can_combine && (combined != NULL))
+  {
+    int status = regcomp (&obj->combined, combined,
+        REG_EXTENDED | REG_NEWLINE | REG_NOSUB);
+    obj->have_combined = (status == 0);
+  }
+  sfree (combined);
+
+  obj->prefilter_valid = 1;
+  return (0);
+} /* int tail_match_prefilter_build */
+
 static int tail_callback (void *data, char *buf,
     int __attribute__((unused)) buflen)
 {
   cu_tail_match_t *obj = (cu_tail_match_t *) data;
+  size_t candidates_num = 0;
   size_t i;
 
+  if (!obj->prefilter_valid)
+  {
+    /* No pre-filter available: run all regular expressions. */
+    for (i = 0; i < obj->matches_num; i++)
+      match_apply (obj->matches[i].match, buf);
+    return (0);
+  }
+
   for (i = 0; i < obj->matches_num; i++)
-    match_apply (obj->matches[i].match, buf);
+  {
+    cu_tail_match_match_t *m = obj->matches + i;
+
+    if ((m->literal[0] != 0) && (strstr (buf, m->literal) == NULL))
+      continue;
+    obj->candidates[candidates_num++] = i;
+  }
+
+  if (candidates_num == 0)
+    return (0);
+
+  if ((candidates_num > 1) && obj->have_combined
+      && (regexec (&obj->combined, buf, 0, NULL, /* eflags = */ 0) != 0))
+    return (0);
+
+  for (i = 0; i < candidates_num; i++)
+    match_apply (obj->matches[obj->candidates[i]].match, buf);
 
   return (0);
 } /* int tail_callback */
 
+static int tail_match_read_locked (cu_tail_match_t *obj)
+{
+  int status;
+
+  if (!obj->prefilter_valid && (tail_match_prefilter_build (obj) != 0))
+    ERROR ("tail_match: Building the pre-filter failed.");
+
+  status = cu_tail_read (obj->tail, tail_callback, (void *) obj);
+  if (status != 0)
+  {
+    ERROR ("tail_match: cu_tail_read failed.");
+    return (status);
+  }
+
+  return (0);
+} /* int tail_match_read_locked */
+
 /*
  * Public functions
  */
@@ -136,6 +286,7 @@ cu_tail_match_t *tail_match_create (const char *filename)
     sfree (obj);
     return (NULL);
   }
+  pthread_mutex_init (&obj->lock, /* attr = */ NULL);
 
   return (obj);
 } /* cu_tail_match_t *tail_match_create */
@@ -168,6 +319,9 @@ void tail_match_destroy (cu_tail_match_t *obj)
     match->user_data = NULL;
   }
 
+  tail_match_prefilter_free (obj);
+  pthread_mutex_destroy (&obj->lock);
+
   sfree (obj->matches);
   sfree (obj);
 } /* void tail_match_destroy */
@@ -194,6 +348,9 @@ int tail_match_add_match (cu_tail_match_t *obj, cu_match_t *match,
   temp->user_data = user_data;
   temp->submit = submit_match;
   temp->free = free_user_data;
+  temp->literal[0] = 0;
+
+  obj->prefilter_valid = 0;
 
   return (0);
 } /* int tail_match_add_match */
@@ -242,17 +399,28 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
   return (status);
 } /* int tail_match_add_match_simple */
 
+int tail_match_read_lines (cu_tail_match_t *obj)
+{
+  int status;
+
+  pthread_mutex_lock (&obj->lock);
+  status = tail_match_read_locked (obj);
+  pthread_mutex_unlock (&obj->lock);
+
+  return (status);
+} /* int tail_match_read_lines */
+
 int tail_match_read (cu_tail_match_t *obj)
 {
-  char buffer[4096];
   int status;
   size_t i;
 
-  status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
-      (void *) obj);
+  pthread_mutex_lock (&obj->lock);
+
+  status = tail_match_read_locked (obj);
   if (status != 0)
   {
-    ERROR ("tail_match: cu_tail_read failed.");
+    pthread_mutex_unlock (&obj->lock);
     return (status);
   }
 
@@ -266,6 +434,8 @@ int tail_match_read (cu_tail_match_t *obj)
     (*lt_match->submit) (lt_match->match, lt_match->user_data);
   }
 
+  pthread_mutex_unlock (&obj->lock);
+
   return (0);
 } /* int tail_match_read */
 
@@ -129,4 +129,20 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
 */
 int tail_match_read (cu_tail_match_t *obj);
 
+/*
+ * NAME
+ *   tail_match_read_lines
+ *
+ * DESCRIPTION
+ *   Like `tail_match_read', but only reads new lines and applies the matches
+ *   to them, without calling the submit_match callbacks. This allows reading
+ *   the file as soon as data is appended, e.g. from a thread watching the
+ *   file, while values are still submitted at the configured interval. Both
+ *   functions may be called from different threads.
+ *
+ * RETURN VALUE
+ *   Zero on success, nonzero on failure.
+ */
+int tail_match_read_lines (cu_tail_match_t *obj);
+
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -0,0 +1,486 @@
+/**
+ * collectd - src/daemon/utils_trace.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_trace.h"
+
+#include <pthread.h>
+
+/*
+ * Tracing follows one in "trace_sampling" value lists through the plugin
+ * core. The thread that finishes processing a traced value list stores it in
+ * its own ring buffer. Only the owning thread writes to a ring, so recording
+ * a trace takes no lock; readers copy the entries and use the per-entry
+ * sequence number to skip those overwritten in the meantime.
+ */
+struct trace_entry_s
+{
+  /* Odd while the entry is being written, zero if it was never used. */
+  volatile unsigned long seq;
+  trace_t trace;
+};
+typedef struct trace_entry_s trace_entry_t;
+
+struct trace_total_s
+{
+  uint64_t count;
+  cdtime_t sum;
+};
+typedef struct trace_total_s trace_total_t;
+
+struct trace_thread_s;
+typedef struct trace_thread_s trace_thread_t;
+struct trace_thread_s
+{
+  long counter;
+  cdtime_t read_start;
+  trace_t *current;
+
+  /* Allocated by the first trace_end() of this thread. */
+  trace_entry_t *ring;
+  size_t ring_pos;
+
+  /* Written by the owning thread only. */
+  trace_total_t totals[TRACE_WRITERS_MAX];
+
+  trace_thread_t *next;
+};
+
+static long trace_sampling = 0;
+
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+/* Protects the thread list, the totals below and adding writers. */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_thread_t *trace_threads = NULL;
+static trace_total_t trace_retired[TRACE_WRITERS_MAX];
+static trace_total_t trace_reported[TRACE_WRITERS_MAX];
+
+/* Writers are only ever added, so readers don't need the lock. */
+static char trace_writers[TRACE_WRITERS_MAX][DATA_MAX_NAME_LEN];
+static volatile size_t trace_writers_num = 0;
+
+static void trace_thread_destroy (void *arg) /* {{{ */
+{
+  trace_thread_t *t = arg;
+  trace_thread_t *prev;
+  size_t i;
+
+  if (t == NULL)
+    return;
+
+  pthread_mutex_lock (&trace_lock);
+  if (trace_threads == t)
+    trace_threads = t->next;
+  else
+  {
+    for (prev = trace_threads; prev != NULL; prev = prev->next)
+    {
+      if (prev->next != t)
+        continue;
+      prev->next = t->next;
+      break;
+    }
+  }
+
+  /* Keep the per-writer totals of exiting threads. */
+  for (i = 0; i < TRACE_WRITERS_MAX; i++)
+  {
+    trace_retired[i].count += t->totals[i].count;
+    trace_retired[i].sum += t->totals[i].sum;
+  }
+  pthread_mutex_unlock (&trace_lock);
+
+  sfree (t->current);
+  sfree (t->ring);
+  sfree (t);
+} /* }}} void trace_thread_destroy */
+
+static void trace_key_create (void) /* {{{ */
+{
+  pthread_key_create (&trace_key, trace_thread_destroy);
+} /* }}} void trace_key_create */
+
+static trace_thread_t *trace_thread_get (void) /* {{{ */
+{
+  trace_thread_t *t;
+
+  t = pthread_getspecific (trace_key);
+  if (t != NULL)
+    return (t);
+
+  t = calloc (1, sizeof (*t));
+  if (t == NULL)
+    return (NULL);
+  pthread_setspecific (trace_key, t);
+
+  pthread_mutex_lock (&trace_lock);
+  t->next = trace_threads;
+  trace_threads = t;
+  pthread_mutex_unlock (&trace_lock);
+
+  return (t);
+} /* }}} trace_thread_t *trace_thread_get */
+
+/* Returns the index of "name" in "trace_writers", adding it if necessary, or
+ * -1 if the table is full. */
+static int trace_writer_index (char const *name) /* {{{ */
+{
+  size_t num;
+  size_t i;
+
+  num = trace_writers_num;
+  __sync_synchronize ();
+  for (i = 0; i < num; i++)
+    if (strcmp (name, trace_writers[i]) == 0)
+      return ((int) i);
+
+  pthread_mutex_lock (&trace_lock);
+  for (i = num; i < trace_writers_num; i++)
+  {
+    if (strcmp (name, trace_writers[i]) == 0)
+    {
+      pthread_mutex_unlock (&trace_lock);
+      return ((int) i);
+    }
+  }
+
+  if (trace_writers_num >= TRACE_WRITERS_MAX)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    return (-1);
+  }
+
+  sstrncpy (trace_writers[i], name, sizeof (trace_writers[i]));
+  __sync_synchronize ();
+  trace_writers_num = i + 1;
+  pthread_mutex_unlock (&trace_lock);
+
+  return ((int) i);
+} /* }}} int trace_writer_index */
+
+void trace_init (long sampling) /* {{{ */
+{
+  pthread_once (&trace_key_once, trace_key_create);
+
+  if (sampling < 0)
+    sampling = 0;
+  trace_sampling = sampling;
+} /* }}} void trace_init */
+
+trace_t *trace_sample (value_list_t const *vl) /* {{{ */
+{
+  trace_thread_t *t;
+  trace_t *trace;
+  char identifier[6 * DATA_MAX_NAME_LEN];
+
+  if (trace_sampling <= 0)
+    return (NULL);
+
+  t = trace_thread_get ();
+  if (t == NULL)
+    return (NULL);
+
+  t->counter++;
+  if (t->counter < trace_sampling)
+    return (NULL);
+  t->counter = 0;
+
+  trace = calloc (1, sizeof (*trace));
+  if (trace == NULL)
+    return (NULL);
+
+  trace->stage[TRACE_STAGE_READ] = t->read_start;
+  trace->stage[TRACE_STAGE_ENQUEUE] = cdtime ();
+  if (FORMAT_VL (identifier, sizeof (identifier), vl) == 0)
+    sstrncpy (trace->identifier, identifier, sizeof (trace->identifier));
+
+  return (trace);
+} /* }}} trace_t *trace_sample */
+
+void trace_read_begin (cdtime_t start) /* {{{ */
+{
+  trace_thread_t *t;
+
+  if (trace_sampling <= 0)
+    return;
+
+  t = trace_thread_get ();
+  if (t != NULL)
+    t->read_start = start;
+} /* }}} void trace_read_begin */
+
+void trace_begin (trace_t *trace) /* {{{ */
+{
+  trace_thread_t *t;
+
+  if (trace == NULL)
+    return;
+
+  t = trace_thread_get ();
+  if (t != NULL)
+    t->current = trace;
+} /* }}} void trace_begin */
+
+trace_t *trace_current (void) /* {{{ */
+{
+  trace_thread_t *t;
+
+  if (trace_sampling <= 0)
+    return (NULL);
+
+  t = pthread_getspecific (trace_key);
+  if (t == NULL)
+    return (NULL);
+  return (t->current);
+} /* }}} trace_t *trace_current */
+
+void trace_writer (trace_t *trace, char const *writer, /* {{{ */
+    cdtime_t duration)
+{
+  int index;
+
+  if ((trace == NULL) || (writer == NULL))
+    return;
+
+  index = trace_writer_index (writer);
+  if (index < 0)
+    return;
+
+  /* Never record zero, which means "not called". */
+  trace->writer[index] += (duration > 0) ? duration : 1;
+} /* }}} void trace_writer */
+
+void trace_writer_queued (char const *writer, /* {{{ */
+    cdtime_t duration)
+{
+  trace_thread_t *t;
+  int index;
+
+  if ((trace_sampling <= 0) || (writer == NULL))
+    return;
+
+  index = trace_writer_index (writer);
+  if (index < 0)
+    return;
+
+  t = trace_thread_get ();
+  if (t == NULL)
+    return;
+
+  t->totals[index].count++;
+  t->totals[index].sum += (duration > 0) ? duration : 1;
+} /* }}} void trace_writer_queued */
+
+void trace_end (trace_t *trace) /* {{{ */
+{
+  trace_thread_t *t;
+  trace_entry_t *e;
+  size_t i;
+
+  if (trace == NULL)
+    return;
+
+  t = trace_thread_get ();
+  if (t == NULL)
+  {
+    sfree (trace);
+    return;
+  }
+
+  if (t->current == trace)
+    t->current = NULL;
+
+  if (t->ring == NULL)
+  {
+    t->ring = calloc (TRACE_RING_SIZE, sizeof (*t->ring));
+    if (t->ring == NULL)
+    {
+      sfree (trace);
+      return;
+    }
+  }
+
+  e = t->ring + t->ring_pos;
+  e->seq++;
+  __sync_synchronize ();
+  memcpy (&e->trace, trace, sizeof (e->trace));
+  __sync_synchronize ();
+  e->seq++;
+  t->ring_pos = (t->ring_pos + 1) % TRACE_RING_SIZE;
+
+  for (i = 0; i < TRACE_WRITERS_MAX; i++)
+  {
+    if (trace->writer[i] == 0)
+      continue;
+    t->totals[i].count++;
+    t->totals[i].sum += trace->writer[i];
+  }
+
+  sfree (trace);
+} /* }}} void trace_end */
+
+char const *trace_writer_name (size_t index) /* {{{ */
+{
+  if (index >= trace_writers_num)
+    return (NULL);
+  return (trace_writers[index]);
+} /* }}} char const *trace_writer_name */
+
+static int trace_compare (void const *a, void const *b) /* {{{ */
+{
+  cdtime_t ta = ((trace_t const *) a)->stage[TRACE_STAGE_ENQUEUE];
+  cdtime_t tb = ((trace_t const *) b)->stage[TRACE_STAGE_ENQUEUE];
+
+  if (ta < tb)
+    return (-1);
+  else if (ta > tb)
+    return (1);
+  return (0);
+} /* }}} int trace_compare */
+
+int trace_get (trace_t **ret_traces, size_t *ret_traces_num) /* {{{ */
+{
+  trace_thread_t *t;
+  trace_t *traces;
+  size_t traces_num = 0;
+  size_t rings_num = 0;
+
+  if ((ret_traces == NULL) || (ret_traces_num == NULL))
+    return (EINVAL);
+
+  pthread_mutex_lock (&trace_lock);
+
+  for (t = trace_threads; t != NULL; t = t->next)
+    if (t->ring != NULL)
+      rings_num++;
+
+  if (rings_num == 0)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    *ret_traces = NULL;
+    *ret_traces_num = 0;
+    return (0);
+  }
+
+  traces = calloc (rings_num * TRACE_RING_SIZE, sizeof (*traces));
+  if (traces == NULL)
+  {
+    pthread_mutex_unlock (&trace_lock);
+    return (ENOMEM);
+  }
+
+  /* Threads are only removed with "trace_lock" held, so the rings stay
+   * valid. Their owners keep writing to them, though. */
+  for (t = trace_threads; t != NULL; t = t->next)
+  {
+    size_t i;
+
+    if (t->ring == NULL)
+      continue;
+
+    for (i = 0; i < TRACE_RING_SIZE; i++)
+    {
+      trace_entry_t *e = t->ring + i;
+      unsigned long seq;
+
+      seq = e->seq;
+      __sync_synchronize ();
+      if ((seq == 0) || ((seq % 2) != 0))
+        continue;
+
+      memcpy (traces + traces_num, &e->trace, sizeof (*traces));
+      __sync_synchronize ();
+      if (e->seq != seq)
+        continue;
+
+      traces_num++;
+    }
+  }
+
+  pthread_mutex_unlock (&trace_lock);
+
+  qsort (traces, traces_num, sizeof (*traces), trace_compare);
+
+  *ret_traces = traces;
+  *ret_traces_num = traces_num;
+  return (0);
+} /* }}} int trace_get */
+
+int trace_writer_latency (char const ***ret_names, /* {{{ */
+    cdtime_t **ret_latency, size_t *ret_num)
+{
+  char const **names;
+  cdtime_t *latency;
+  size_t num = 0;
+  size_t i;
+
+  if ((ret_names == NULL) || (ret_latency == NULL) || (ret_num == NULL))
+    return (EINVAL);
+
+  names = calloc (TRACE_WRITERS_MAX, sizeof (*names));
+  latency = calloc (TRACE_WRITERS_MAX, sizeof (*latency));
+  if ((names == NULL) || (latency == NULL))
+  {
+    sfree (names);
+    sfree (latency);
+    return (ENOMEM);
+  }
+
+  pthread_mutex_lock (&trace_lock);
+  for (i = 0; i < trace_writers_num; i++)
+  {
+    trace_total_t total = trace_retired[i];
+    trace_thread_t *t;
+
+    for (t = trace_threads; t != NULL; t = t->next)
+    {
+      total.count += t->totals[i].count;
+      total.sum += t->totals[i].sum;
+    }
+
+    if (total.count <= trace_reported[i].count)
+      continue;
+
+    names[num] = trace_writers[i];
+    latency[num] = (total.sum - trace_reported[i].sum)
+      / (total.count - trace_reported[i].count);
+    num++;
+
+    trace_reported[i] = total;
+  }
+  pthread_mutex_unlock (&trace_lock);
+
+  *ret_names = names;
+  *ret_latency = latency;
+  *ret_num = num;
+  return (0);
+} /* }}} int trace_writer_latency */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
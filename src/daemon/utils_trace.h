@@ -0,0 +1,112 @@
+/**
+ * collectd - src/daemon/utils_trace.h
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#ifndef UTILS_TRACE_H
+#define UTILS_TRACE_H 1
+
+#include "collectd.h"
+#include "plugin.h"
+
+/* Points in the value pipeline at which a traced value list is time
+ * stamped, in this order. */
+enum trace_stage_e
+{
+  TRACE_STAGE_READ,       /* the read callback dispatching it started */
+  TRACE_STAGE_ENQUEUE,    /* plugin_dispatch_values() was called */
+  TRACE_STAGE_DEQUEUE,    /* a write thread took it off the write queue */
+  TRACE_STAGE_PRE_CACHE,  /* the pre-cache chain has finished */
+  TRACE_STAGE_CACHE,      /* the value cache has been updated */
+  TRACE_STAGE_POST_CACHE, /* the post-cache chain (or the writers) finished */
+  TRACE_STAGE_NUM
+};
+
+/* Maximum number of distinct write callbacks that are timed. */
+#define TRACE_WRITERS_MAX 16
+
+/* Number of traces kept by each write thread. */
+#define TRACE_RING_SIZE 256
+
+struct trace_s
+{
+  /* Time stamps, zero if the stage was not reached. */
+  cdtime_t stage[TRACE_STAGE_NUM];
+  /* Time spent in each write callback, indexed like trace_writer_name(). */
+  cdtime_t writer[TRACE_WRITERS_MAX];
+  char identifier[2 * DATA_MAX_NAME_LEN];
+};
+typedef struct trace_s trace_t;
+
+/* Traces one in "sampling" value lists. Zero disables tracing. */
+void trace_init (long sampling);
+
+/* Returns a new trace for "vl" if it has been picked for tracing, NULL
+ * otherwise. Called when a value list is enqueued. */
+trace_t *trace_sample (value_list_t const *vl);
+
+/* Remember when the calling (read) thread started the read callback that
+ * is about to dispatch values. Zero clears the time. */
+void trace_read_begin (cdtime_t start);
+
+/* Makes "trace" the trace of the value list the calling thread processes, so
+ * that plugin_write() can find it. */
+void trace_begin (trace_t *trace);
+
+/* Returns the trace set by trace_begin() or NULL. */
+trace_t *trace_current (void);
+
+/* Adds the time spent in the write callback "writer" to "trace". */
+void trace_writer (trace_t *trace, char const *writer, cdtime_t duration);
+
+/* Adds the time spent in the write callback "writer" to the per-writer
+ * statistics only. Used for writers with a queue of their own, which run
+ * after the trace of the value list has been stored. */
+void trace_writer_queued (char const *writer, cdtime_t duration);
+
+/* Stores "trace" in the calling thread's ring, updates the per-writer
+ * statistics and frees "trace". */
+void trace_end (trace_t *trace);
+
+static inline void trace_stamp (trace_t *trace, int stage)
+{
+  if (trace != NULL)
+    trace->stage[stage] = cdtime ();
+}
+
+/* Returns the name of the write callback with index "index" or NULL. */
+char const *trace_writer_name (size_t index);
+
+/* Copies the traces of all threads into "ret_traces", ordered by the time
+ * they were enqueued. The caller must free "*ret_traces". */
+int trace_get (trace_t **ret_traces, size_t *ret_traces_num);
+
+/* Returns the average time spent in each write callback for the traces
+ * completed since the last call. Writers without new traces are omitted.
+ * The caller must free "*ret_names" and "*ret_latency", but not the names
+ * themselves. */
+int trace_writer_latency (char const ***ret_names, cdtime_t **ret_latency,
+    size_t *ret_num);
+
+#endif /* UTILS_TRACE_H */
@@ -0,0 +1,205 @@
+/**
+ * collectd - src/daemon/utils_trace_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "testing.h"
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_trace.h"
+
+#include <pthread.h>
+
+static void init_value_list (value_list_t *vl, int n) /* {{{ */
+{
+  value_list_t vl_init = VALUE_LIST_INIT;
+
+  *vl = vl_init;
+  sstrncpy (vl->host, "example.com", sizeof (vl->host));
+  sstrncpy (vl->plugin, "test", sizeof (vl->plugin));
+  sstrncpy (vl->type, "gauge", sizeof (vl->type));
+  ssnprintf (vl->type_instance, sizeof (vl->type_instance), "%i", n);
+} /* }}} void init_value_list */
+
+/* Simulates a write thread processing one value list. */
+static void process (trace_t *trace, cdtime_t csv_time) /* {{{ */
+{
+  trace_begin (trace);
+  trace_stamp (trace, TRACE_STAGE_DEQUEUE);
+  trace_writer (trace_current (), "csv", csv_time);
+  trace_writer (trace_current (), "network", TIME_T_TO_CDTIME_T (1));
+  trace_stamp (trace, TRACE_STAGE_POST_CACHE);
+  trace_end (trace);
+} /* }}} void process */
+
+DEF_TEST(sampling)
+{
+  value_list_t vl;
+  trace_t *trace;
+  int traced = 0;
+  int i;
+
+  trace_init (0);
+  init_value_list (&vl, 0);
+  OK (trace_sample (&vl) == NULL);
+
+  trace_init (10);
+  for (i = 0; i < 100; i++)
+  {
+    trace = trace_sample (&vl);
+    if (trace == NULL)
+      continue;
+
+    traced++;
+    EXPECT_EQ_STR ("example.com/test/gauge-0", trace->identifier);
+    EXPECT_EQ_UINT64 (cdtime_mock, trace->stage[TRACE_STAGE_ENQUEUE]);
+    EXPECT_EQ_UINT64 (0, trace->stage[TRACE_STAGE_READ]);
+    sfree (trace);
+  }
+  EXPECT_EQ_INT (10, traced);
+
+  return (0);
+}
+
+DEF_TEST(ring)
+{
+  value_list_t vl;
+  trace_t *traces = NULL;
+  size_t traces_num = 0;
+  size_t i;
+  int n;
+
+  trace_init (1);
+  trace_read_begin (TIME_T_TO_CDTIME_T (1000));
+
+  /* More than fit into the ring: only the most recent ones are kept. */
+  for (n = 0; n < TRACE_RING_SIZE + 10; n++)
+  {
+    trace_t *trace;
+
+    init_value_list (&vl, n);
+    cdtime_mock = TIME_T_TO_CDTIME_T (2000 + n);
+    CHECK_NOT_NULL (trace = trace_sample (&vl));
+    process (trace, TIME_T_TO_CDTIME_T (2));
+  }
+  trace_read_begin (0);
+  OK (trace_current () == NULL);
+
+  CHECK_ZERO (trace_get (&traces, &traces_num));
+  EXPECT_EQ_INT (TRACE_RING_SIZE, (int) traces_num);
+  for (i = 0; i < traces_num; i++)
+  {
+    char want[DATA_MAX_NAME_LEN];
+
+    ssnprintf (want, sizeof (want), "example.com/test/gauge-%i", (int) i + 10);
+    EXPECT_EQ_STR (want, traces[i].identifier);
+    EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (1000),
+        traces[i].stage[TRACE_STAGE_READ]);
+    EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (2010 + i),
+        traces[i].stage[TRACE_STAGE_ENQUEUE]);
+    EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (2), traces[i].writer[0]);
+    EXPECT_EQ_UINT64 (0, traces[i].stage[TRACE_STAGE_CACHE]);
+  }
+  sfree (traces);
+
+  EXPECT_EQ_STR ("csv", trace_writer_name (0));
+  EXPECT_EQ_STR ("network", trace_writer_name (1));
+  OK (trace_writer_name (2) == NULL);
+
+  return (0);
+}
+
+static void *thread_main (void *arg) /* {{{ */
+{
+  value_list_t vl;
+
+  init_value_list (&vl, 0);
+  process (trace_sample (&vl), TIME_T_TO_CDTIME_T (4));
+  return (arg);
+} /* }}} void *thread_main */
+
+DEF_TEST(writer_latency)
+{
+  char const **names = NULL;
+  cdtime_t *latency = NULL;
+  size_t num = 0;
+  pthread_t thread;
+  value_list_t vl;
+
+  trace_init (1);
+
+  /* All traces so far, i.e. those of the "ring" test. */
+  CHECK_ZERO (trace_writer_latency (&names, &latency, &num));
+  EXPECT_EQ_INT (2, (int) num);
+  EXPECT_EQ_STR ("csv", names[0]);
+  EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (2), latency[0]);
+  EXPECT_EQ_STR ("network", names[1]);
+  EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (1), latency[1]);
+  sfree (names);
+  sfree (latency);
+
+  /* Nothing new. */
+  CHECK_ZERO (trace_writer_latency (&names, &latency, &num));
+  EXPECT_EQ_INT (0, (int) num);
+  sfree (names);
+  sfree (latency);
+
+  /* Traces of threads that have exited are still accounted for. */
+  init_value_list (&vl, 0);
+  process (trace_sample (&vl), TIME_T_TO_CDTIME_T (2));
+  CHECK_ZERO (pthread_create (&thread, NULL, thread_main, NULL));
+  CHECK_ZERO (pthread_join (thread, NULL));
+
+  CHECK_ZERO (trace_writer_latency (&names, &latency, &num));
+  EXPECT_EQ_INT (2, (int) num);
+  EXPECT_EQ_STR ("csv", names[0]);
+  EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (3), latency[0]);
+  sfree (names);
+  sfree (latency);
+
+  /* Queued writers are timed after the trace has been stored. */
+  trace_writer_queued ("csv", TIME_T_TO_CDTIME_T (5));
+  trace_writer_queued ("csv", TIME_T_TO_CDTIME_T (7));
+
+  CHECK_ZERO (trace_writer_latency (&names, &latency, &num));
+  EXPECT_EQ_INT (1, (int) num);
+  EXPECT_EQ_STR ("csv", names[0]);
+  EXPECT_EQ_UINT64 (TIME_T_TO_CDTIME_T (6), latency[0]);
+  sfree (names);
+  sfree (latency);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(sampling);
+  RUN_TEST(ring);
+  RUN_TEST(writer_latency);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
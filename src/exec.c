@@ -30,10 +30,12 @@
 #include "common.h"
 #include "plugin.h"
 
+#include "network.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
 
 #include <sys/types.h>
+#include <arpa/inet.h>
 #include <pwd.h>
 #include <grp.h>
 #include <signal.h>
@@ -42,9 +44,13 @@
 
 #define PL_NORMAL        0x01
 #define PL_NOTIF_ACTION  0x02
+#define PL_BINARY        0x04
 
 #define PL_RUNNING       0x10
 
+/* Large enough for the largest part, whose length is a 16 bit field. */
+#define EXEC_BINARY_BUFFER_SIZE 65536
+
 /*
  * Private data types
  */
@@ -76,6 +82,30 @@ typedef struct program_list_and_notification_s
   notification_t n;
 } program_list_and_notification_t;
 
+/*
+ * State of a `BinaryExec' program's output, which uses the parts of the
+ * network plugin's protocol. As in network packets, the identifier, time and
+ * interval persist from one value list to the next, so a program only sends
+ * the parts that changed. The value lists read from one chunk of output are
+ * collected in `vls' and `values' and dispatched with a single call.
+ */
+typedef struct exec_binary_s
+{
+  char buffer[EXEC_BINARY_BUFFER_SIZE];
+  size_t buffer_fill;
+
+  value_list_t vl;
+  int severity;
+
+  value_list_t *vls;
+  size_t vls_num;
+  size_t vls_size;
+
+  value_t *values;
+  size_t values_num;
+  size_t values_size;
+} exec_binary_t;
+
 /*
  * Private variables
  */
@@ -135,6 +165,8 @@ static int exec_config_exec (oconfig_item_t *ci) /* {{{ */
 
   if (strcasecmp ("NotificationExec", ci->key) == 0)
     pl->flags |= PL_NOTIF_ACTION;
+  else if (strcasecmp ("BinaryExec", ci->key) == 0)
+    pl->flags |= PL_NORMAL | PL_BINARY;
   else
     pl->flags |= PL_NORMAL;
 
@@ -253,6 +285,7 @@ static int exec_config (oconfig_item_t *ci) /* {{{ */
   {
     oconfig_item_t *child = ci->children + i;
     if ((strcasecmp ("Exec", child->key) == 0)
+        || (strcasecmp ("BinaryExec", child->key) == 0)
         || (strcasecmp ("NotificationExec", child->key) == 0))
       exec_config_exec (child);
     else
@@ -559,6 +592,282 @@ static int parse_line (char *buffer) /* {{{ */
   }
 } /* int parse_line }}} */
 
+static int exec_binary_string (char const *part, uint16_t part_len, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  size_t len = (size_t) part_len - 4;
+
+  /* The string must be null-terminated and fit into the buffer. */
+  if ((len == 0) || (len > buffer_size) || (part[part_len - 1] != 0))
+    return (-1);
+
+  memcpy (buffer, part + 4, len);
+  return (0);
+} /* int exec_binary_string }}} */
+
+static int exec_binary_number (char const *part, uint16_t part_len, /* {{{ */
+    uint64_t *ret_value)
+{
+  uint64_t tmp;
+
+  if (part_len != 4 + sizeof (tmp))
+    return (-1);
+
+  memcpy (&tmp, part + 4, sizeof (tmp));
+  *ret_value = (uint64_t) ntohll (tmp);
+  return (0);
+} /* int exec_binary_number }}} */
+
+/* Appends a value list with the current identifier and the values of a
+ * `values' part to the batch. */
+static int exec_binary_values (exec_binary_t *eb, /* {{{ */
+    char const *part, uint16_t part_len)
+{
+  char const *types;
+  char const *data;
+  value_list_t *vl;
+  uint16_t tmp16;
+  size_t num;
+  size_t i;
+
+  if (part_len < 6)
+    return (-1);
+
+  memcpy (&tmp16, part + 4, sizeof (tmp16));
+  num = (size_t) ntohs (tmp16);
+  if ((num == 0) || (part_len != 6 + num * (1 + sizeof (value_t))))
+    return (-1);
+
+  if ((eb->vl.host[0] == 0) || (eb->vl.plugin[0] == 0)
+      || (eb->vl.type[0] == 0))
+    return (-1);
+
+  if (eb->vls_num >= eb->vls_size)
+  {
+    size_t new_size = (eb->vls_size == 0) ? 64 : 2 * eb->vls_size;
+    value_list_t *tmp;
+
+    tmp = realloc (eb->vls, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-1);
+    eb->vls = tmp;
+    eb->vls_size = new_size;
+  }
+
+  if ((eb->values_num + num) > eb->values_size)
+  {
+    size_t new_size = (eb->values_size == 0) ? 256 : 2 * eb->values_size;
+    value_t *tmp;
+
+    while (new_size < (eb->values_num + num))
+      new_size *= 2;
+
+    tmp = realloc (eb->values, new_size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-1);
+    eb->values = tmp;
+    eb->values_size = new_size;
+  }
+
+  types = part + 6;
+  data = types + num;
+  for (i = 0; i < num; i++)
+  {
+    value_t *v = eb->values + eb->values_num + i;
+
+    memcpy (v, data + i * sizeof (*v), sizeof (*v));
+    switch (types[i])
+    {
+      case DS_TYPE_COUNTER:
+        v->counter = (counter_t) ntohll (v->counter);
+        break;
+      case DS_TYPE_GAUGE:
+        v->gauge = (gauge_t) ntohd (v->gauge);
+        break;
+      case DS_TYPE_DERIVE:
+        v->derive = (derive_t) ntohll (v->derive);
+        break;
+      case DS_TYPE_ABSOLUTE:
+        v->absolute = (absolute_t) ntohll (v->absolute);
+        break;
+      default:
+        return (-1);
+    }
+  }
+
+  /* `values' may still move; the pointers are set when dispatching. */
+  vl = eb->vls + eb->vls_num;
+  memcpy (vl, &eb->vl, sizeof (*vl));
+  vl->values = NULL;
+  vl->values_len = num;
+
+  eb->vls_num++;
+  eb->values_num += num;
+  return (0);
+} /* int exec_binary_values }}} */
+
+static void exec_binary_dispatch (exec_binary_t *eb) /* {{{ */
+{
+  size_t offset = 0;
+  size_t i;
+
+  if (eb->vls_num == 0)
+    return;
+
+  for (i = 0; i < eb->vls_num; i++)
+  {
+    eb->vls[i].values = eb->values + offset;
+    offset += eb->vls[i].values_len;
+  }
+
+  plugin_dispatch_values_batch (eb->vls, eb->vls_num);
+
+  eb->vls_num = 0;
+  eb->values_num = 0;
+} /* void exec_binary_dispatch }}} */
+
+static int exec_binary_notification (exec_binary_t *eb, /* {{{ */
+    char const *part, uint16_t part_len)
+{
+  notification_t n;
+
+  memset (&n, 0, sizeof (n));
+  if (exec_binary_string (part, part_len, n.message, sizeof (n.message)) != 0)
+    return (-1);
+
+  if ((eb->severity != NOTIF_FAILURE) && (eb->severity != NOTIF_WARNING)
+      && (eb->severity != NOTIF_OKAY))
+    return (-1);
+
+  n.severity = eb->severity;
+  n.time = (eb->vl.time != 0) ? eb->vl.time : cdtime ();
+  sstrncpy (n.host, eb->vl.host, sizeof (n.host));
+  sstrncpy (n.plugin, eb->vl.plugin, sizeof (n.plugin));
+  sstrncpy (n.plugin_instance, eb->vl.plugin_instance,
+      sizeof (n.plugin_instance));
+  sstrncpy (n.type, eb->vl.type, sizeof (n.type));
+  sstrncpy (n.type_instance, eb->vl.type_instance, sizeof (n.type_instance));
+
+  /* Keep the order of values and notifications. */
+  exec_binary_dispatch (eb);
+  plugin_dispatch_notification (&n);
+  return (0);
+} /* int exec_binary_notification }}} */
+
+/*
+ * Handles all complete parts in the buffer and dispatches the value lists
+ * read from them. An incomplete part at the end is kept for the next call.
+ * Returns non-zero if the stream is malformed and can not be continued.
+ */
+static int exec_binary_parse (exec_binary_t *eb, char const *exec) /* {{{ */
+{
+  size_t offset = 0;
+  int status = 0;
+
+  while ((eb->buffer_fill - offset) >= 4)
+  {
+    char const *part = eb->buffer + offset;
+    uint16_t part_type;
+    uint16_t part_len;
+    uint16_t tmp16;
+    uint64_t tmp64 = 0;
+
+    memcpy (&tmp16, part, sizeof (tmp16));
+    part_type = ntohs (tmp16);
+    memcpy (&tmp16, part + 2, sizeof (tmp16));
+    part_len = ntohs (tmp16);
+
+    if (part_len < 4)
+    {
+      status = -1;
+      break;
+    }
+    if (part_len > (eb->buffer_fill - offset))
+      break;
+
+    switch (part_type)
+    {
+      case TYPE_HOST:
+        status = exec_binary_string (part, part_len,
+            eb->vl.host, sizeof (eb->vl.host));
+        break;
+      case TYPE_PLUGIN:
+        status = exec_binary_string (part, part_len,
+            eb->vl.plugin, sizeof (eb->vl.plugin));
+        break;
+      case TYPE_PLUGIN_INSTANCE:
+        status = exec_binary_string (part, part_len,
+            eb->vl.plugin_instance, sizeof (eb->vl.plugin_instance));
+        break;
+      case TYPE_TYPE:
+        status = exec_binary_string (part, part_len,
+            eb->vl.type, sizeof (eb->vl.type));
+        break;
+      case TYPE_TYPE_INSTANCE:
+        status = exec_binary_string (part, part_len,
+            eb->vl.type_instance, sizeof (eb->vl.type_instance));
+        break;
+      case TYPE_TIME:
+        status = exec_binary_number (part, part_len, &tmp64);
+        eb->vl.time = TIME_T_TO_CDTIME_T (tmp64);
+        break;
+      case TYPE_TIME_HR:
+        status = exec_binary_number (part, part_len, &tmp64);
+        eb->vl.time = (cdtime_t) tmp64;
+        break;
+      case TYPE_INTERVAL:
+        status = exec_binary_number (part, part_len, &tmp64);
+        eb->vl.interval = TIME_T_TO_CDTIME_T (tmp64);
+        break;
+      case TYPE_INTERVAL_HR:
+        status = exec_binary_number (part, part_len, &tmp64);
+        eb->vl.interval = (cdtime_t) tmp64;
+        break;
+      case TYPE_VALUES:
+        status = exec_binary_values (eb, part, part_len);
+        break;
+      case TYPE_SEVERITY:
+        status = exec_binary_number (part, part_len, &tmp64);
+        eb->severity = (int) tmp64;
+        break;
+      case TYPE_MESSAGE:
+        status = exec_binary_notification (eb, part, part_len);
+        break;
+      default:
+        /* Skip unknown parts, as the network plugin does. */
+        break;
+    }
+
+    if (status != 0)
+      break;
+    offset += part_len;
+  }
+
+  exec_binary_dispatch (eb);
+
+  if (status != 0)
+  {
+    ERROR ("exec plugin: Program `%s' sent a malformed part at offset %zu.",
+        exec, offset);
+    eb->buffer_fill = 0;
+    return (-1);
+  }
+
+  eb->buffer_fill -= offset;
+  memmove (eb->buffer, eb->buffer + offset, eb->buffer_fill);
+  return (0);
+} /* int exec_binary_parse }}} */
+
+static void exec_binary_destroy (exec_binary_t *eb) /* {{{ */
+{
+  if (eb == NULL)
+    return;
+
+  sfree (eb->vls);
+  sfree (eb->values);
+  sfree (eb);
+} /* void exec_binary_destroy }}} */
+
 static void *exec_read_one (void *arg) /* {{{ */
 {
   program_list_t *pl = (program_list_t *) arg;
@@ -569,10 +878,25 @@ static void *exec_read_one (void *arg) /* {{{ */
   char buffer_err[1024];
   char *pbuffer = buffer;
   char *pbuffer_err = buffer_err;
+  exec_binary_t *eb = NULL;
+
+  if ((pl->flags & PL_BINARY) != 0)
+  {
+    eb = calloc (1, sizeof (*eb));
+    if (eb == NULL)
+    {
+      ERROR ("exec plugin: calloc failed.");
+      pthread_mutex_lock (&pl_lock);
+      pl->flags &= ~PL_RUNNING;
+      pthread_mutex_unlock (&pl_lock);
+      pthread_exit ((void *) 1);
+    }
+  }
 
   status = fork_child (pl, NULL, &fd, &fd_err);
   if (status < 0)
   {
+    exec_binary_destroy (eb);
     /* Reset the "running" flag */
     pthread_mutex_lock (&pl_lock);
     pl->flags &= ~PL_RUNNING;
@@ -605,7 +929,27 @@ static void *exec_read_one (void *arg) /* {{{ */
       break;
     }
 
-    if (FD_ISSET(fd, &copy))
+    if (FD_ISSET(fd, &copy) && (eb != NULL))
+    {
+      len = read (fd, eb->buffer + eb->buffer_fill,
+          sizeof (eb->buffer) - eb->buffer_fill);
+
+      if (len < 0)
+      {
+        if (errno == EAGAIN || errno == EINTR)  continue;
+        break;
+      }
+      else if (len == 0) break;  /* We've reached EOF */
+
+      eb->buffer_fill += (size_t) len;
+      if (exec_binary_parse (eb, pl->exec) != 0)
+      {
+        /* There is no way to find the next part. */
+        kill (pl->pid, SIGTERM);
+        break;
+      }
+    }
+    else if (FD_ISSET(fd, &copy))
     {
       char *pnl;
 
@@ -715,6 +1059,11 @@ static void *exec_read_one (void *arg) /* {{{ */
   if (fd_err >= 0)
     close (fd_err);
 
+  if ((eb != NULL) && (eb->buffer_fill > 0))
+    NOTICE ("exec plugin: Program `%s' exited in the middle of a part.",
+        pl->exec);
+  exec_binary_destroy (eb);
+
   pthread_exit ((void *) 0);
   return (NULL);
 } /* void *exec_read_one }}} */
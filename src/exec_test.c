@@ -0,0 +1,258 @@
+/**
+ * collectd - src/exec_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "exec.c" /* sic */
+#include "testing.h"
+
+/* Value lists dispatched by the code under test. */
+static value_list_t dispatched[16];
+static value_t dispatched_values[16];
+static size_t dispatched_num = 0;
+static int dispatch_calls = 0;
+
+int plugin_dispatch_values_batch (value_list_t const *vls, size_t vls_num)
+{
+  size_t i;
+
+  dispatch_calls++;
+  for (i = 0; i < vls_num; i++)
+  {
+    if (dispatched_num >= STATIC_ARRAY_SIZE (dispatched))
+      break;
+    dispatched[dispatched_num] = vls[i];
+    dispatched_values[dispatched_num] = vls[i].values[0];
+    dispatched_num++;
+  }
+  return (0);
+}
+
+/* The text protocol is not under test. */
+int handle_putval (FILE *fh, char *buffer)
+{
+  return (-1);
+}
+
+int handle_putnotif (FILE *fh, char *buffer)
+{
+  return (-1);
+}
+
+static size_t add_header (char *buffer, uint16_t type, /* {{{ */
+    size_t len)
+{
+  uint16_t tmp;
+
+  tmp = htons (type);
+  memcpy (buffer, &tmp, sizeof (tmp));
+  tmp = htons ((uint16_t) len);
+  memcpy (buffer + 2, &tmp, sizeof (tmp));
+  return (4);
+} /* }}} size_t add_header */
+
+static size_t add_string (char *buffer, uint16_t type, /* {{{ */
+    char const *str)
+{
+  size_t len = strlen (str) + 1;
+
+  add_header (buffer, type, 4 + len);
+  memcpy (buffer + 4, str, len);
+  return (4 + len);
+} /* }}} size_t add_string */
+
+static size_t add_number (char *buffer, uint16_t type, /* {{{ */
+    uint64_t value)
+{
+  uint64_t tmp = htonll (value);
+
+  add_header (buffer, type, 4 + sizeof (tmp));
+  memcpy (buffer + 4, &tmp, sizeof (tmp));
+  return (4 + sizeof (tmp));
+} /* }}} size_t add_number */
+
+static size_t add_value (char *buffer, uint8_t ds_type, /* {{{ */
+    value_t value)
+{
+  uint16_t num = htons (1);
+
+  if (ds_type == DS_TYPE_GAUGE)
+    value.gauge = htond (value.gauge);
+  else
+    value.derive = (derive_t) htonll ((uint64_t) value.derive);
+
+  add_header (buffer, TYPE_VALUES, 6 + 1 + sizeof (value));
+  memcpy (buffer + 4, &num, sizeof (num));
+  buffer[6] = (char) ds_type;
+  memcpy (buffer + 7, &value, sizeof (value));
+  return (7 + sizeof (value));
+} /* }}} size_t add_value */
+
+/* Two value lists: "vl" with its gauge, then the same identifier with type
+ * instance "second" and a derive. */
+static size_t create_stream (char *buffer, const value_list_t *vl) /* {{{ */
+{
+  value_t derive = { .derive = -7 };
+  size_t len = 0;
+
+  len += add_string (buffer + len, TYPE_HOST, vl->host);
+  len += add_string (buffer + len, TYPE_PLUGIN, vl->plugin);
+  len += add_string (buffer + len, TYPE_TYPE, vl->type);
+  len += add_number (buffer + len, TYPE_TIME_HR, vl->time);
+  len += add_number (buffer + len, TYPE_INTERVAL_HR, vl->interval);
+  len += add_value (buffer + len, DS_TYPE_GAUGE, vl->values[0]);
+  len += add_string (buffer + len, TYPE_TYPE_INSTANCE, "second");
+  len += add_value (buffer + len, DS_TYPE_DERIVE, derive);
+
+  return (len);
+} /* }}} size_t create_stream */
+
+static void reset_dispatched (void) /* {{{ */
+{
+  memset (dispatched, 0, sizeof (dispatched));
+  dispatched_num = 0;
+  dispatch_calls = 0;
+} /* }}} void reset_dispatched */
+
+DEF_TEST(parse)
+{
+  value_t value = { .gauge = 42.5 };
+  value_list_t vl;
+  exec_binary_t *eb;
+  size_t len;
+
+  TESTING_VALUE_LIST (&vl, &value, TESTING_DS_GAUGE);
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+
+  CHECK_NOT_NULL (eb = calloc (1, sizeof (*eb)));
+  reset_dispatched ();
+
+  len = create_stream (eb->buffer, &vl);
+  eb->buffer_fill = len;
+  CHECK_ZERO (exec_binary_parse (eb, "test"));
+
+  EXPECT_EQ_INT (0, (int) eb->buffer_fill);
+  EXPECT_EQ_INT (1, dispatch_calls);
+  EXPECT_EQ_INT (2, (int) dispatched_num);
+
+  EXPECT_EQ_STR (vl.host, dispatched[0].host);
+  EXPECT_EQ_STR (vl.plugin, dispatched[0].plugin);
+  EXPECT_EQ_STR (vl.type, dispatched[0].type);
+  EXPECT_EQ_STR ("", dispatched[0].type_instance);
+  EXPECT_EQ_UINT64 (vl.time, dispatched[0].time);
+  EXPECT_EQ_UINT64 (vl.interval, dispatched[0].interval);
+  EXPECT_EQ_DOUBLE (42.5, dispatched_values[0].gauge);
+
+  EXPECT_EQ_STR (vl.host, dispatched[1].host);
+  EXPECT_EQ_STR ("second", dispatched[1].type_instance);
+  EXPECT_EQ_INT (-7, (int) dispatched_values[1].derive);
+
+  exec_binary_destroy (eb);
+  return (0);
+}
+
+/* Output arriving in small chunks: incomplete parts are kept until the rest
+ * has been read. */
+DEF_TEST(partial)
+{
+  char stream[1024];
+  value_t value = { .gauge = 42.5 };
+  value_list_t vl;
+  exec_binary_t *eb;
+  size_t len;
+  size_t i;
+
+  TESTING_VALUE_LIST (&vl, &value, TESTING_DS_GAUGE);
+
+  CHECK_NOT_NULL (eb = calloc (1, sizeof (*eb)));
+  reset_dispatched ();
+
+  len = create_stream (stream, &vl);
+  for (i = 0; i < len; i += 3)
+  {
+    size_t chunk = ((len - i) < 3) ? (len - i) : 3;
+
+    memcpy (eb->buffer + eb->buffer_fill, stream + i, chunk);
+    eb->buffer_fill += chunk;
+    CHECK_ZERO (exec_binary_parse (eb, "test"));
+  }
+
+  EXPECT_EQ_INT (0, (int) eb->buffer_fill);
+  EXPECT_EQ_INT (2, (int) dispatched_num);
+  EXPECT_EQ_STR ("second", dispatched[1].type_instance);
+  EXPECT_EQ_DOUBLE (42.5, dispatched_values[0].gauge);
+
+  exec_binary_destroy (eb);
+  return (0);
+}
+
+DEF_TEST(malformed)
+{
+  value_t value = { .gauge = 1.0 };
+  value_list_t vl;
+  exec_binary_t *eb;
+  size_t len;
+
+  TESTING_VALUE_LIST (&vl, &value, TESTING_DS_GAUGE);
+
+  CHECK_NOT_NULL (eb = calloc (1, sizeof (*eb)));
+
+  /* A part shorter than its header. */
+  eb->buffer_fill = add_header (eb->buffer, TYPE_HOST, 2);
+  EXPECT_EQ_INT (-1, exec_binary_parse (eb, "test"));
+
+  /* A string which is not null-terminated. */
+  len = add_string (eb->buffer, TYPE_HOST, vl.host);
+  eb->buffer[len - 1] = 'x';
+  eb->buffer_fill = len;
+  EXPECT_EQ_INT (-1, exec_binary_parse (eb, "test"));
+
+  /* Values before an identifier. */
+  memset (&eb->vl, 0, sizeof (eb->vl));
+  eb->buffer_fill = add_value (eb->buffer, DS_TYPE_GAUGE, value);
+  EXPECT_EQ_INT (-1, exec_binary_parse (eb, "test"));
+
+  /* Unknown parts are skipped. */
+  reset_dispatched ();
+  len = add_string (eb->buffer, 0x7fff, "ignored");
+  len += create_stream (eb->buffer + len, &vl);
+  eb->buffer_fill = len;
+  CHECK_ZERO (exec_binary_parse (eb, "test"));
+  EXPECT_EQ_INT (2, (int) dispatched_num);
+
+  exec_binary_destroy (eb);
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(parse);
+  RUN_TEST(partial);
+  RUN_TEST(malformed);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -24,11 +24,12 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg(2) */
+
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -45,6 +46,7 @@
 #if HAVE_POLL_H
 # include <poll.h>
 #endif
+#include <fcntl.h>
 
 #include <gm_protocol.h>
 
@@ -62,6 +64,12 @@
 # define BUFF_SIZE 1400
 #endif
 
+/* Number of datagrams read with one recvmmsg(2) call. */
+#define MC_RECEIVE_BATCH 32
+
+/* The staging table is split into this many independently locked shards. */
+#define STAGING_SHARDS 64
+
 struct socket_entry_s
 {
   int                     fd;
@@ -70,13 +78,26 @@ struct socket_entry_s
 };
 typedef struct socket_entry_s socket_entry_t;
 
+struct staging_entry_s;
+typedef struct staging_entry_s staging_entry_t;
 struct staging_entry_s
 {
   char key[2 * DATA_MAX_NAME_LEN];
+  uint32_t hash;
   value_list_t vl;
   int flags;
+  staging_entry_t *next;
 };
-typedef struct staging_entry_s staging_entry_t;
+
+/* One shard of the staging table: a hash table with chained entries. */
+struct staging_shard_s
+{
+  pthread_mutex_t   lock;
+  staging_entry_t **buckets;
+  size_t            buckets_num;
+  size_t            entries_num;
+};
+typedef struct staging_shard_s staging_shard_t;
 
 struct metric_map_s
 {
@@ -94,8 +115,8 @@ static char          *mc_receive_group = NULL;
 #define MC_RECEIVE_PORT_DEFAULT "8649"
 static char          *mc_receive_port = NULL;
 
-static struct pollfd *mc_receive_sockets = NULL;
-static size_t         mc_receive_sockets_num = 0;
+static socket_entry_t *mc_receive_sockets = NULL;
+static size_t          mc_receive_sockets_num = 0;
 
 static socket_entry_t  *mc_send_sockets = NULL;
 static size_t           mc_send_sockets_num = 0;
@@ -103,7 +124,18 @@ static pthread_mutex_t  mc_send_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int            mc_receive_thread_loop    = 0;
 static int            mc_receive_thread_running = 0;
-static pthread_t      mc_receive_thread_id;
+static pthread_t     *mc_receive_thread_ids = NULL;
+static size_t         mc_receive_threads_num = 0;
+static int            mc_receive_threads = 1;
+
+/* Packets read and packets the kernel dropped because the socket buffer was
+ * full. The latter is reported per socket via SO_RXQ_OVFL as a running
+ * total, which is kept in "mc_receive_drops". */
+static _Bool          mc_report_stats = 0;
+static derive_t       stats_packets_received = 0;
+static derive_t       stats_packets_dropped = 0;
+static uint32_t      *mc_receive_drops = NULL;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static metric_map_t metric_map_default[] =
 { /*---------------+-------------+-----------+-------------+------+-----*
@@ -132,82 +164,143 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE (metric_map_default);
 static metric_map_t *metric_map = NULL;
 static size_t        metric_map_len = 0;
 
-static c_avl_tree_t   *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Open addressing hash table over both metric tables, built by gmond_init().
+ * It is not modified afterwards, so the receive threads read it without
+ * locking. */
+static metric_map_t **metric_hash = NULL;
+static size_t         metric_hash_size = 0;
 
-static metric_map_t *metric_lookup (const char *key) /* {{{ */
-{
-  metric_map_t *map;
-  size_t map_len;
-  size_t i;
+static staging_shard_t staging_shards[STAGING_SHARDS];
+static _Bool           staging_initialized = 0;
 
-  /* Search the user-supplied table first.. */
-  map = metric_map;
-  map_len = metric_map_len;
-  for (i = 0; i < map_len; i++)
-    if (strcmp (map[i].ganglia_name, key) == 0)
-      break;
+/* FNV-1a */
+static uint32_t gmond_hash (const char *str) /* {{{ */
+{
+  uint32_t hash = 2166136261U;
 
-  /* .. and fall back to the built-in table if nothing is found. */
-  if (i >= map_len)
+  for (; *str != 0; str++)
   {
-    map = metric_map_default;
-    map_len = metric_map_len_default;
+    hash ^= (uint32_t) (unsigned char) *str;
+    hash *= 16777619U;
+  }
 
-    for (i = 0; i < map_len; i++)
-      if (strcmp (map[i].ganglia_name, key) == 0)
-        break;
+  return (hash);
+} /* }}} uint32_t gmond_hash */
+
+/* Looks up the DS type and ds_index of a map entry. Returns non-zero if the
+ * entry can not be used. */
+static int metric_resolve (metric_map_t *map) /* {{{ */
+{
+  const data_set_t *ds;
+
+  ds = plugin_get_ds (map->type);
+  if (ds == NULL)
+  {
+    WARNING ("gmond plugin: Type not defined: %s", map->type);
+    return (-1);
   }
 
-  if (i >= map_len)
-    return (NULL);
+  if ((map->ds_name == NULL) && (ds->ds_num != 1))
+  {
+    WARNING ("gmond plugin: No data source name defined for metric %s, "
+        "but type %s has more than one data source.",
+        map->ganglia_name, map->type);
+    return (-1);
+  }
 
-  /* Look up the DS type and ds_index. */
-  if (map[i].ds_type < 0) /* {{{ */
+  if (map->ds_name == NULL)
+  {
+    map->ds_index = 0;
+  }
+  else
   {
-    const data_set_t *ds;
+    size_t j;
 
-    ds = plugin_get_ds (map[i].type);
-    if (ds == NULL)
-    {
-      WARNING ("gmond plugin: Type not defined: %s", map[i].type);
-      return (NULL);
-    }
+    for (j = 0; j < ds->ds_num; j++)
+      if (strcasecmp (ds->ds[j].name, map->ds_name) == 0)
+        break;
 
-    if ((map[i].ds_name == NULL) && (ds->ds_num != 1))
+    if (j >= ds->ds_num)
     {
-      WARNING ("gmond plugin: No data source name defined for metric %s, "
-          "but type %s has more than one data source.",
-          map[i].ganglia_name, map[i].type);
-      return (NULL);
+      WARNING ("gmond plugin: There is no data source "
+          "named `%s' in type `%s'.",
+          map->ds_name, ds->type);
+      return (-1);
     }
+    map->ds_index = j;
+  }
 
-    if (map[i].ds_name == NULL)
-    {
-      map[i].ds_index = 0;
-    }
-    else
-    {
-      size_t j;
+  map->ds_type = ds->ds[map->ds_index].type;
+  return (0);
+} /* }}} int metric_resolve */
 
-      for (j = 0; j < ds->ds_num; j++)
-        if (strcasecmp (ds->ds[j].name, map[i].ds_name) == 0)
-          break;
+/* Adds "map" to the hash table unless a metric with the same name is already
+ * present. */
+static void metric_hash_insert (metric_map_t *map) /* {{{ */
+{
+  size_t mask = metric_hash_size - 1;
+  size_t i;
 
-      if (j >= ds->ds_num)
-      {
-        WARNING ("gmond plugin: There is no data source "
-            "named `%s' in type `%s'.",
-            map[i].ds_name, ds->type);
-        return (NULL);
-      }
-      map[i].ds_index = j;
-    }
+  for (i = gmond_hash (map->ganglia_name) & mask;
+      metric_hash[i] != NULL;
+      i = (i + 1) & mask)
+  {
+    if (strcmp (metric_hash[i]->ganglia_name, map->ganglia_name) == 0)
+      return;
+  }
 
-    map[i].ds_type = ds->ds[map[i].ds_index].type;
-  } /* }}} if ((map[i].ds_type < 0) || (map[i].ds_index < 0)) */
+  if (metric_resolve (map) != 0)
+    map->ds_type = -1;
+  metric_hash[i] = map;
+} /* }}} void metric_hash_insert */
 
-  return (map + i);
+static int metric_hash_create (void) /* {{{ */
+{
+  size_t entries_num = metric_map_len + metric_map_len_default;
+  size_t i;
+
+  metric_hash_size = 16;
+  while (metric_hash_size < (2 * entries_num))
+    metric_hash_size *= 2;
+
+  metric_hash = calloc (metric_hash_size, sizeof (*metric_hash));
+  if (metric_hash == NULL)
+  {
+    metric_hash_size = 0;
+    return (ENOMEM);
+  }
+
+  /* The user-supplied table takes precedence over the built-in one. */
+  for (i = 0; i < metric_map_len; i++)
+    metric_hash_insert (metric_map + i);
+  for (i = 0; i < metric_map_len_default; i++)
+    metric_hash_insert (metric_map_default + i);
+
+  return (0);
+} /* }}} int metric_hash_create */
+
+static metric_map_t *metric_lookup (const char *key) /* {{{ */
+{
+  size_t mask = metric_hash_size - 1;
+  size_t i;
+
+  if (metric_hash == NULL)
+    return (NULL);
+
+  for (i = gmond_hash (key) & mask;
+      metric_hash[i] != NULL;
+      i = (i + 1) & mask)
+  {
+    if (strcmp (metric_hash[i]->ganglia_name, key) != 0)
+      continue;
+
+    /* Entries whose type could not be resolved are ignored. */
+    if (metric_hash[i]->ds_type < 0)
+      return (NULL);
+    return (metric_hash[i]);
+  }
+
+  return (NULL);
 } /* }}} metric_map_t *metric_lookup */
 
 static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
@@ -458,32 +551,87 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
   return (0);
 } /* }}} int request_meta_data */
 
-static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
-    const char *name,
-    const char *type, const char *type_instance,
+/* Returns the locked shard responsible for the staging entry of "host",
+ * "type" and "type_instance" and fills in the entry's key and hash. */
+static staging_shard_t *staging_shard_lock (char *key, size_t key_size, /* {{{ */
+    uint32_t *ret_hash,
+    const char *host, const char *type, const char *type_instance)
+{
+  staging_shard_t *shard;
+
+  ssnprintf (key, key_size, "%s/%s/%s", host, type,
+      (type_instance != NULL) ? type_instance : "");
+  *ret_hash = gmond_hash (key);
+
+  shard = staging_shards + (*ret_hash % STAGING_SHARDS);
+  pthread_mutex_lock (&shard->lock);
+  return (shard);
+} /* }}} staging_shard_t *staging_shard_lock */
+
+static int staging_shard_grow (staging_shard_t *shard) /* {{{ */
+{
+  staging_entry_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  buckets_num = (shard->buckets_num == 0) ? 16 : 2 * shard->buckets_num;
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+    return (ENOMEM);
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    while (shard->buckets[i] != NULL)
+    {
+      staging_entry_t *se = shard->buckets[i];
+      size_t index = (se->hash / STAGING_SHARDS) & (buckets_num - 1);
+
+      shard->buckets[i] = se->next;
+      se->next = buckets[index];
+      buckets[index] = se;
+    }
+  }
+
+  sfree (shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+  return (0);
+} /* }}} int staging_shard_grow */
+
+/* Must be called with the shard's lock held, see staging_shard_lock(). */
+static staging_entry_t *staging_entry_get (staging_shard_t *shard, /* {{{ */
+    const char *key, uint32_t hash,
+    const char *host, const char *type, const char *type_instance,
     int values_len)
 {
-  char key[2 * DATA_MAX_NAME_LEN];
   staging_entry_t *se;
-  int status;
+  size_t index;
 
-  if (staging_tree == NULL)
+  if (!staging_initialized)
     return (NULL);
 
-  ssnprintf (key, sizeof (key), "%s/%s/%s", host, type,
-      (type_instance != NULL) ? type_instance : "");
-
-  se = NULL;
-  status = c_avl_get (staging_tree, key, (void *) &se);
-  if (status == 0)
-    return (se);
+  if (shard->buckets_num != 0)
+  {
+    index = (hash / STAGING_SHARDS) & (shard->buckets_num - 1);
+    for (se = shard->buckets[index]; se != NULL; se = se->next)
+      if ((se->hash == hash) && (strcmp (se->key, key) == 0))
+        return (se);
+  }
 
   /* insert new entry */
+  if ((shard->entries_num >= shard->buckets_num)
+      && (staging_shard_grow (shard) != 0))
+  {
+    ERROR ("gmond plugin: Growing the staging table failed.");
+    return (NULL);
+  }
+
   se = calloc (1, sizeof (*se));
   if (se == NULL)
     return (NULL);
 
   sstrncpy (se->key, key, sizeof (se->key));
+  se->hash = hash;
   se->flags = 0;
 
   se->vl.values = (value_t *) calloc (values_len, sizeof (*se->vl.values));
@@ -503,23 +651,53 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     sstrncpy (se->vl.type_instance, type_instance,
         sizeof (se->vl.type_instance));
 
-  status = c_avl_insert (staging_tree, se->key, se);
-  if (status != 0)
-  {
-    ERROR ("gmond plugin: c_avl_insert failed.");
-    sfree (se->vl.values);
-    sfree (se);
-    return (NULL);
-  }
+  index = (hash / STAGING_SHARDS) & (shard->buckets_num - 1);
+  se->next = shard->buckets[index];
+  shard->buckets[index] = se;
+  shard->entries_num++;
 
   return (se);
 } /* }}} staging_entry_t *staging_entry_get */
 
+static void staging_destroy (void) /* {{{ */
+{
+  size_t i;
+  size_t j;
+
+  if (!staging_initialized)
+    return;
+
+  for (i = 0; i < STAGING_SHARDS; i++)
+  {
+    staging_shard_t *shard = staging_shards + i;
+
+    for (j = 0; j < shard->buckets_num; j++)
+    {
+      while (shard->buckets[j] != NULL)
+      {
+        staging_entry_t *se = shard->buckets[j];
+        shard->buckets[j] = se->next;
+        sfree (se->vl.values);
+        sfree (se);
+      }
+    }
+    sfree (shard->buckets);
+    shard->buckets_num = 0;
+    shard->entries_num = 0;
+    pthread_mutex_destroy (&shard->lock);
+  }
+
+  staging_initialized = 0;
+} /* }}} void staging_destroy */
+
 static int staging_entry_update (const char *host, const char *name, /* {{{ */
     const char *type, const char *type_instance,
     size_t ds_index, int ds_type, value_t value)
 {
+  char key[2 * DATA_MAX_NAME_LEN];
+  uint32_t hash;
   const data_set_t *ds;
+  staging_shard_t *shard;
   staging_entry_t *se;
 
   ds = plugin_get_ds (type);
@@ -536,18 +714,20 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
     return (-1);
   }
 
-  pthread_mutex_lock (&staging_lock);
+  shard = staging_shard_lock (key, sizeof (key), &hash,
+      host, type, type_instance);
 
-  se = staging_entry_get (host, name, type, type_instance, ds->ds_num);
+  se = staging_entry_get (shard, key, hash, host, type, type_instance,
+      ds->ds_num);
   if (se == NULL)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     ERROR ("gmond plugin: staging_entry_get failed.");
     return (-1);
   }
   if (se->vl.values_len != ds->ds_num)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
@@ -567,7 +747,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   /* Check if all data sources have been set. If not, return here. */
   if (se->flags != ((0x01 << se->vl.values_len) - 1))
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (0);
   }
 
@@ -577,7 +757,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   {
     /* No meta data has been received for this metric yet. */
     se->flags = 0;
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
 
     request_meta_data (host, name);
     return (0);
@@ -586,7 +766,7 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   plugin_dispatch_values (&se->vl);
 
   se->flags = 0;
-  pthread_mutex_unlock (&staging_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (0);
 } /* }}} int staging_entry_update */
@@ -711,6 +891,9 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
     case gmetadata_full:
     {
       Ganglia_metadatadef msg_meta;
+      char key[2 * DATA_MAX_NAME_LEN];
+      uint32_t hash;
+      staging_shard_t *shard;
       staging_entry_t *se;
       const data_set_t *ds;
       metric_map_t *map;
@@ -738,14 +921,15 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
       DEBUG ("gmond plugin: Received meta data for %s/%s.",
           msg_meta.metric_id.host, msg_meta.metric_id.name);
 
-      pthread_mutex_lock (&staging_lock);
-      se = staging_entry_get (msg_meta.metric_id.host,
-          msg_meta.metric_id.name,
+      shard = staging_shard_lock (key, sizeof (key), &hash,
+          msg_meta.metric_id.host, map->type, map->type_instance);
+      se = staging_entry_get (shard, key, hash,
+          msg_meta.metric_id.host,
           map->type, map->type_instance,
           ds->ds_num);
       if (se != NULL)
         se->vl.interval = TIME_T_TO_CDTIME_T (msg_meta.metric.tmax);
-      pthread_mutex_unlock (&staging_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       if (se == NULL)
       {
@@ -812,71 +996,176 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
   return (0);
 } /* }}} int mc_handle_metric */
 
-static int mc_handle_socket (struct pollfd *p) /* {{{ */
+/* Per-thread receive buffers. */
+struct mc_receiver_s
 {
-  char buffer[BUFF_SIZE];
-  ssize_t buffer_size;
+  struct pollfd *fds;
+  char buffers[MC_RECEIVE_BATCH][BUFF_SIZE];
+  struct iovec iovecs[MC_RECEIVE_BATCH];
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[MC_RECEIVE_BATCH];
+#else
+  struct msghdr msgs[MC_RECEIVE_BATCH];
+#endif
+#ifdef SO_RXQ_OVFL
+  char control[MC_RECEIVE_BATCH][CMSG_SPACE (sizeof (uint32_t))];
+#endif
+};
+typedef struct mc_receiver_s mc_receiver_t;
+
+/* Returns the running total of dropped packets attached to "msg", or zero if
+ * there is none. */
+static uint32_t mc_msg_drops (struct msghdr *msg) /* {{{ */
+{
+#ifdef SO_RXQ_OVFL
+  struct cmsghdr *cmsg;
 
-  if ((p->revents & (POLLIN | POLLPRI)) == 0)
+  for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL; cmsg = CMSG_NXTHDR (msg, cmsg))
   {
-    p->revents = 0;
-    return (-1);
+    uint32_t drops;
+
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SO_RXQ_OVFL))
+      continue;
+
+    memcpy (&drops, CMSG_DATA (cmsg), sizeof (drops));
+    return (drops);
+  }
+#endif
+
+  return (0);
+} /* }}} uint32_t mc_msg_drops */
+
+/* Reads up to MC_RECEIVE_BATCH datagrams from "fd" without blocking. Returns
+ * the number of datagrams read, which are left in r->buffers. */
+static int mc_receive_batch (mc_receiver_t *r, int fd) /* {{{ */
+{
+  int i;
+
+  for (i = 0; i < MC_RECEIVE_BATCH; i++)
+  {
+#if HAVE_RECVMMSG
+    struct msghdr *msg = &r->msgs[i].msg_hdr;
+#else
+    struct msghdr *msg = &r->msgs[i];
+#endif
+
+    memset (msg, 0, sizeof (*msg));
+    r->iovecs[i].iov_base = r->buffers[i];
+    r->iovecs[i].iov_len = sizeof (r->buffers[i]);
+    msg->msg_iov = r->iovecs + i;
+    msg->msg_iovlen = 1;
+#ifdef SO_RXQ_OVFL
+    msg->msg_control = r->control[i];
+    msg->msg_controllen = sizeof (r->control[i]);
+#endif
   }
 
-  buffer_size = recv (p->fd, buffer, sizeof (buffer), /* flags = */ 0);
-  if (buffer_size <= 0)
+#if HAVE_RECVMMSG
+  return (recvmmsg (fd, r->msgs, MC_RECEIVE_BATCH, MSG_DONTWAIT,
+        /* timeout = */ NULL));
+#else
   {
-    char errbuf[1024];
-    ERROR ("gmond plugin: recv failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    p->revents = 0;
-    return (-1);
+    ssize_t status = recvmsg (fd, &r->msgs[0], MSG_DONTWAIT);
+    if (status < 0)
+      return (-1);
+    r->iovecs[0].iov_len = (size_t) status;
+    return (1);
   }
+#endif
+} /* }}} int mc_receive_batch */
 
-  mc_handle_metric (buffer, (size_t) buffer_size);
-  return (0);
+/* Reads and handles datagrams from the socket until none are left. */
+static int mc_handle_socket (mc_receiver_t *r, size_t index) /* {{{ */
+{
+  int fd = r->fds[index].fd;
+
+  while (42)
+  {
+    uint32_t drops = 0;
+    _Bool have_drops = 0;
+    int num;
+    int i;
+
+    num = mc_receive_batch (r, fd);
+    if (num < 0)
+    {
+      char errbuf[1024];
+
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        return (0);
+
+      ERROR ("gmond plugin: recv failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    for (i = 0; i < num; i++)
+    {
+#if HAVE_RECVMMSG
+      struct msghdr *msg = &r->msgs[i].msg_hdr;
+      size_t len = (size_t) r->msgs[i].msg_len;
+#else
+      struct msghdr *msg = &r->msgs[i];
+      size_t len = r->iovecs[i].iov_len;
+#endif
+
+      if (msg->msg_controllen > 0)
+      {
+        drops = mc_msg_drops (msg);
+        have_drops = 1;
+      }
+
+      mc_handle_metric (r->buffers[i], len);
+    }
+
+    if (mc_report_stats)
+    {
+      pthread_mutex_lock (&stats_lock);
+      stats_packets_received += (derive_t) num;
+      /* The running total may be seen out of order by several threads. */
+      if (have_drops && ((int32_t) (drops - mc_receive_drops[index]) > 0))
+      {
+        stats_packets_dropped += (derive_t) (drops - mc_receive_drops[index]);
+        mc_receive_drops[index] = drops;
+      }
+      pthread_mutex_unlock (&stats_lock);
+    }
+
+    if (num < MC_RECEIVE_BATCH)
+      return (0);
+  }
 } /* }}} int mc_handle_socket */
 
 static void *mc_receive_thread (void *arg) /* {{{ */
 {
-  socket_entry_t *mc_receive_socket_entries;
+  mc_receiver_t *r;
   int status;
   size_t i;
 
-  mc_receive_socket_entries = NULL;
-  status = create_sockets (&mc_receive_socket_entries, &mc_receive_sockets_num,
-      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
-      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 1);
-  if (status != 0)
-  {
-    ERROR ("gmond plugin: create_sockets failed.");
-    return ((void *) -1);
-  }
-
-  mc_receive_sockets = (struct pollfd *) calloc (mc_receive_sockets_num,
-      sizeof (*mc_receive_sockets));
-  if (mc_receive_sockets == NULL)
+  r = calloc (1, sizeof (*r));
+  if (r != NULL)
+    r->fds = calloc (mc_receive_sockets_num, sizeof (*r->fds));
+  if ((r == NULL) || (r->fds == NULL))
   {
     ERROR ("gmond plugin: calloc failed.");
-    for (i = 0; i < mc_receive_sockets_num; i++)
-      close (mc_receive_socket_entries[i].fd);
-    free (mc_receive_socket_entries);
-    mc_receive_socket_entries = NULL;
-    mc_receive_sockets_num = 0;
+    if (r != NULL)
+      sfree (r->fds);
+    sfree (r);
     return ((void *) -1);
   }
 
+  /* Every thread polls all sockets; the sockets are non-blocking, so threads
+   * which are woken up without finding a datagram go back to sleep. */
   for (i = 0; i < mc_receive_sockets_num; i++)
   {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
-    mc_receive_sockets[i].events = POLLIN | POLLPRI;
-    mc_receive_sockets[i].revents = 0;
+    r->fds[i].fd = mc_receive_sockets[i].fd;
+    r->fds[i].events = POLLIN | POLLPRI;
+    r->fds[i].revents = 0;
   }
 
   while (mc_receive_thread_loop != 0)
   {
-    status = poll (mc_receive_sockets, mc_receive_sockets_num, -1);
+    status = poll (r->fds, mc_receive_sockets_num, -1);
     if (status <= 0)
     {
       char errbuf[1024];
@@ -889,30 +1178,126 @@ static void *mc_receive_thread (void *arg) /* {{{ */
 
     for (i = 0; i < mc_receive_sockets_num; i++)
     {
-      if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket (mc_receive_sockets + i);
+      if ((r->fds[i].revents & (POLLIN | POLLPRI)) != 0)
+        mc_handle_socket (r, i);
+      r->fds[i].revents = 0;
     }
   } /* while (mc_receive_thread_loop != 0) */
 
-  free (mc_receive_socket_entries);
+  sfree (r->fds);
+  sfree (r);
   return ((void *) 0);
 } /* }}} void *mc_receive_thread */
 
+static void mc_receive_sockets_close (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < mc_receive_sockets_num; i++)
+    close (mc_receive_sockets[i].fd);
+  sfree (mc_receive_sockets);
+  mc_receive_sockets_num = 0;
+  sfree (mc_receive_drops);
+} /* }}} void mc_receive_sockets_close */
+
+static int mc_receive_sockets_open (void) /* {{{ */
+{
+  int status;
+  size_t i;
+
+  status = create_sockets (&mc_receive_sockets, &mc_receive_sockets_num,
+      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
+      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
+      /* listen = */ 1);
+  if (status != 0)
+  {
+    ERROR ("gmond plugin: create_sockets failed.");
+    return (-1);
+  }
+
+  mc_receive_drops = calloc (mc_receive_sockets_num,
+      sizeof (*mc_receive_drops));
+  if (mc_receive_drops == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    mc_receive_sockets_close ();
+    return (-1);
+  }
+
+  for (i = 0; i < mc_receive_sockets_num; i++)
+  {
+    int fd = mc_receive_sockets[i].fd;
+    int flags;
+
+    flags = fcntl (fd, F_GETFL);
+    if ((flags < 0) || (fcntl (fd, F_SETFL, flags | O_NONBLOCK) != 0))
+    {
+      char errbuf[1024];
+      ERROR ("gmond plugin: fcntl failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      mc_receive_sockets_close ();
+      return (-1);
+    }
+
+#ifdef SO_RXQ_OVFL
+    if (mc_report_stats)
+    {
+      int yes = 1;
+
+      status = setsockopt (fd, SOL_SOCKET, SO_RXQ_OVFL,
+          (void *) &yes, sizeof (yes));
+      if (status != 0)
+      {
+        char errbuf[1024];
+        WARNING ("gmond plugin: setsockopt(2) failed: %s",
+                 sstrerror (errno, errbuf, sizeof (errbuf)));
+      }
+    }
+#endif
+  }
+
+  return (0);
+} /* }}} int mc_receive_sockets_open */
+
 static int mc_receive_thread_start (void) /* {{{ */
 {
   int status;
+  int i;
 
   if (mc_receive_thread_running != 0)
     return (-1);
 
+  if (mc_receive_sockets_open () != 0)
+    return (-1);
+
+  mc_receive_thread_ids = calloc ((size_t) mc_receive_threads,
+      sizeof (*mc_receive_thread_ids));
+  if (mc_receive_thread_ids == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    mc_receive_sockets_close ();
+    return (-1);
+  }
+
   mc_receive_thread_loop = 1;
 
-  status = plugin_thread_create (&mc_receive_thread_id, /* attr = */ NULL,
-      mc_receive_thread, /* args = */ NULL);
-  if (status != 0)
+  for (i = 0; i < mc_receive_threads; i++)
+  {
+    status = plugin_thread_create (mc_receive_thread_ids + i,
+        /* attr = */ NULL, mc_receive_thread, /* args = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("gmond plugin: Starting receive thread failed.");
+      break;
+    }
+    mc_receive_threads_num++;
+  }
+
+  if (mc_receive_threads_num == 0)
   {
-    ERROR ("gmond plugin: Starting receive thread failed.");
     mc_receive_thread_loop = 0;
+    sfree (mc_receive_thread_ids);
+    mc_receive_sockets_close ();
     return (-1);
   }
 
@@ -922,26 +1307,63 @@ static int mc_receive_thread_start (void) /* {{{ */
 
 static int mc_receive_thread_stop (void) /* {{{ */
 {
+  size_t i;
+
   if (mc_receive_thread_running == 0)
     return (-1);
 
   mc_receive_thread_loop = 0;
 
-  INFO ("gmond plugin: Stopping receive thread.");
-  pthread_kill (mc_receive_thread_id, SIGTERM);
-  pthread_join (mc_receive_thread_id, /* return value = */ NULL);
-  memset (&mc_receive_thread_id, 0, sizeof (mc_receive_thread_id));
+  INFO ("gmond plugin: Stopping receive threads.");
+  for (i = 0; i < mc_receive_threads_num; i++)
+    pthread_kill (mc_receive_thread_ids[i], SIGTERM);
+  for (i = 0; i < mc_receive_threads_num; i++)
+    pthread_join (mc_receive_thread_ids[i], /* return value = */ NULL);
+  sfree (mc_receive_thread_ids);
+  mc_receive_threads_num = 0;
 
+  mc_receive_sockets_close ();
   mc_receive_thread_running = 0;
 
   return (0);
 } /* }}} int mc_receive_thread_stop */
 
+static int gmond_read (void) /* {{{ */
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+  derive_t received;
+  derive_t dropped;
+
+  pthread_mutex_lock (&stats_lock);
+  received = stats_packets_received;
+  dropped = stats_packets_dropped;
+  pthread_mutex_unlock (&stats_lock);
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "gmond", sizeof (vl.plugin));
+  sstrncpy (vl.type, "packets", sizeof (vl.type));
+
+  values[0].derive = received;
+  sstrncpy (vl.type_instance, "received", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  values[0].derive = dropped;
+  sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+  plugin_dispatch_values (&vl);
+
+  return (0);
+} /* }}} int gmond_read */
+
 /*
  * Config:
  *
  * <Plugin gmond>
  *   MCReceiveFrom "239.2.11.71" "8649"
+ *   ReceiveThreads 1
+ *   ReportStats false
  *   <Metric "load_one">
  *     Type "load"
  *     [TypeInstance "foo"]
@@ -1091,6 +1513,18 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("MCReceiveFrom", child->key) == 0)
       gmond_config_set_address (child, &mc_receive_group, &mc_receive_port);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+    {
+      int tmp = 0;
+
+      if ((cf_util_get_int (child, &tmp) != 0) || (tmp < 1))
+        WARNING ("gmond plugin: The `%s' option needs a positive integer "
+            "argument.", child->key);
+      else
+        mc_receive_threads = tmp;
+    }
+    else if (strcasecmp ("ReportStats", child->key) == 0)
+      cf_util_get_boolean (child, &mc_report_stats);
     else if (strcasecmp ("Metric", child->key) == 0)
       gmond_config_add_metric (child);
     else
@@ -1105,18 +1539,29 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
 
 static int gmond_init (void) /* {{{ */
 {
+  size_t i;
+
   create_sockets (&mc_send_sockets, &mc_send_sockets_num,
       (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
       /* listen = */ 0);
 
-  staging_tree = c_avl_create ((void *) strcmp);
-  if (staging_tree == NULL)
+  if (metric_hash_create () != 0)
   {
-    ERROR ("gmond plugin: c_avl_create failed.");
+    ERROR ("gmond plugin: Creating the metric table failed.");
     return (-1);
   }
 
+  for (i = 0; i < STAGING_SHARDS; i++)
+  {
+    memset (staging_shards + i, 0, sizeof (staging_shards[i]));
+    pthread_mutex_init (&staging_shards[i].lock, /* attr = */ NULL);
+  }
+  staging_initialized = 1;
+
+  if (mc_report_stats)
+    plugin_register_read ("gmond", gmond_read);
+
   mc_receive_thread_start ();
 
   return (0);
@@ -1138,6 +1583,10 @@ static int gmond_shutdown (void) /* {{{ */
   mc_send_sockets_num = 0;
   pthread_mutex_unlock (&mc_send_sockets_lock);
 
+  staging_destroy ();
+  sfree (metric_hash);
+  metric_hash_size = 0;
+
 
   return (0);
 } /* }}} int gmond_shutdown */
@@ -86,6 +86,12 @@
   } while (0)
 
 
+/* The unixsock plugin reads commands into a 1024 byte buffer, including the
+ * trailing "\r\n" and the null byte. Batch commands are split so that each
+ * line fits. */
+#define LCC_COMMAND_LEN 1024
+#define LCC_COMMAND_MAX_LEN (LCC_COMMAND_LEN - 3)
+
 #define LCC_SET_ERRSTR(c, ...) do { \
   snprintf ((c)->errbuf, sizeof ((c)->errbuf), __VA_ARGS__); \
   (c)->errbuf[sizeof ((c)->errbuf) - 1] = 0; \
@@ -742,55 +748,71 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return (0);
 } /* }}} int lcc_getval */
 
-int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+/* Formats the identifier, options and values of "vl" the way the PUTVAL
+ * and PUTVAL_BATCH commands expect them. */
+static int lcc_format_value_list (lcc_connection_t *c, /* {{{ */
+    char *buffer, size_t buffer_size, const lcc_value_list_t *vl)
 {
   char ident_str[6 * LCC_NAME_LEN];
   char ident_esc[12 * LCC_NAME_LEN];
-  char command[1024] = "";
-  lcc_response_t res;
+  size_t offset = 0;
   int status;
   size_t i;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
-      || (vl->values == NULL) || (vl->values_types == NULL))
-  {
-    lcc_set_errno (c, EINVAL);
-    return (-1);
-  }
+  /* Appends to "buffer" and fails instead of truncating the value list. */
+#define LCC_APPENDF(...) do { \
+    status = snprintf (buffer + offset, buffer_size - offset, __VA_ARGS__); \
+    if ((status < 0) || ((size_t) status >= (buffer_size - offset))) \
+    { \
+      lcc_set_errno (c, EMSGSIZE); \
+      return (-1); \
+    } \
+    offset += (size_t) status; \
+  } while (0)
 
   status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
       &vl->identifier);
   if (status != 0)
     return (status);
 
-  SSTRCATF (command, "PUTVAL %s",
-      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+  LCC_APPENDF ("%s", lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
 
   if (vl->interval > 0.0)
-    SSTRCATF (command, " interval=%.3f", vl->interval);
+    LCC_APPENDF (" interval=%.3f", vl->interval);
 
   if (vl->time > 0.0)
-    SSTRCATF (command, " %.3f", vl->time);
+    LCC_APPENDF (" %.3f", vl->time);
   else
-    SSTRCAT (command, " N");
+    LCC_APPENDF (" N");
 
   for (i = 0; i < vl->values_len; i++)
   {
     if (vl->values_types[i] == LCC_TYPE_COUNTER)
-      SSTRCATF (command, ":%"PRIu64, vl->values[i].counter);
+      LCC_APPENDF (":%"PRIu64, vl->values[i].counter);
     else if (vl->values_types[i] == LCC_TYPE_GAUGE)
     {
       if (isnan (vl->values[i].gauge))
-        SSTRCATF (command, ":U");
+        LCC_APPENDF (":U");
       else
-        SSTRCATF (command, ":%g", vl->values[i].gauge);
+        LCC_APPENDF (":%g", vl->values[i].gauge);
     }
     else if (vl->values_types[i] == LCC_TYPE_DERIVE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].derive);
+      LCC_APPENDF (":%"PRIu64, vl->values[i].derive);
     else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].absolute);
+      LCC_APPENDF (":%"PRIu64, vl->values[i].absolute);
 
   } /* for (i = 0; i < vl->values_len; i++) */
+#undef LCC_APPENDF
+
+  return (0);
+} /* }}} int lcc_format_value_list */
+
+/* Sends "command" and fails unless the server reports success. */
+static int lcc_sendreceive_ok (lcc_connection_t *c, /* {{{ */
+    const char *command)
+{
+  lcc_response_t res;
+  int status;
 
   status = lcc_sendreceive (c, command, &res);
   if (status != 0)
@@ -805,8 +827,324 @@ int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
 
   lcc_response_free (&res);
   return (0);
+} /* }}} int lcc_sendreceive_ok */
+
+int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char value_list[LCC_COMMAND_LEN];
+  char command[LCC_COMMAND_LEN];
+  int status;
+
+  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
+      || (vl->values == NULL) || (vl->values_types == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_format_value_list (c, value_list, sizeof (value_list), vl);
+  if (status != 0)
+    return (status);
+
+  status = snprintf (command, sizeof (command), "PUTVAL %s", value_list);
+  if ((status < 0) || ((size_t) status > LCC_COMMAND_MAX_LEN))
+  {
+    lcc_set_errno (c, EMSGSIZE);
+    return (-1);
+  }
+
+  return (lcc_sendreceive_ok (c, command));
 } /* }}} int lcc_putval */
 
+int lcc_putval_batch (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vls, size_t vls_num)
+{
+  char command[LCC_COMMAND_LEN] = "";
+  size_t command_len = 0;
+  size_t i;
+  int status;
+
+  if ((c == NULL) || ((vls == NULL) && (vls_num > 0)))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  for (i = 0; i < vls_num; i++)
+  {
+    char value_list[LCC_COMMAND_LEN];
+    size_t value_list_len;
+
+    if ((vls[i].values_len < 1) || (vls[i].values == NULL)
+        || (vls[i].values_types == NULL))
+    {
+      lcc_set_errno (c, EINVAL);
+      return (-1);
+    }
+
+    status = lcc_format_value_list (c, value_list, sizeof (value_list),
+        vls + i);
+    if (status != 0)
+      return (status);
+    value_list_len = strlen (value_list);
+    if ((strlen ("PUTVAL_BATCH ") + value_list_len) > LCC_COMMAND_MAX_LEN)
+    {
+      lcc_set_errno (c, EMSGSIZE);
+      return (-1);
+    }
+
+    /* Send what we have if this value list would make the command too long
+     * for the server's line buffer. */
+    if ((command_len > 0)
+        && ((command_len + 1 + value_list_len) > LCC_COMMAND_MAX_LEN))
+    {
+      status = lcc_sendreceive_ok (c, command);
+      if (status != 0)
+        return (status);
+      command_len = 0;
+    }
+
+    if (command_len == 0)
+      SSTRCPY (command, "PUTVAL_BATCH");
+    SSTRCATF (command, " %s", value_list);
+    command_len = strlen (command);
+  }
+
+  if (command_len > 0)
+    return (lcc_sendreceive_ok (c, command));
+
+  return (0);
+} /* }}} int lcc_putval_batch */
+
+/* Parses one response line of GETVAL_MULTI, which has the form
+ * "<num> <identifier> <name>=<value> ...". */
+static int lcc_parse_getval_multi_line (char *line, /* {{{ */
+    const char *ident_str, size_t *ret_values_num,
+    gauge_t **ret_values, char ***ret_values_names)
+{
+  gauge_t *values = NULL;
+  char   **values_names = NULL;
+  long     values_num;
+  size_t   ident_len;
+  size_t   i;
+  char    *ptr;
+  char    *endptr;
+  char    *saveptr;
+
+  *ret_values_num = 0;
+  if (ret_values != NULL)
+    *ret_values = NULL;
+  if (ret_values_names != NULL)
+    *ret_values_names = NULL;
+
+  errno = 0;
+  endptr = NULL;
+  values_num = strtol (line, &endptr, 10);
+  if ((errno != 0) || (endptr == line) || (*endptr != ' '))
+    return (EILSEQ);
+
+  /* Identifier not found. */
+  if (values_num <= 0)
+    return (0);
+
+  /* The server echoes the identifier as sent. */
+  ident_len = strlen (ident_str);
+  ptr = endptr + 1;
+  if (strncmp (ptr, ident_str, ident_len) != 0)
+    return (EILSEQ);
+  ptr += ident_len;
+
+  if (ret_values != NULL)
+  {
+    values = calloc ((size_t) values_num, sizeof (*values));
+    if (values == NULL)
+      return (ENOMEM);
+  }
+  if (ret_values_names != NULL)
+  {
+    values_names = calloc ((size_t) values_num, sizeof (*values_names));
+    if (values_names == NULL)
+    {
+      free (values);
+      return (ENOMEM);
+    }
+  }
+
+  i = 0;
+  saveptr = NULL;
+  while ((ptr = strtok_r (ptr, " ", &saveptr)) != NULL)
+  {
+    char *key = ptr;
+    char *value;
+
+    ptr = NULL;
+    if (i >= (size_t) values_num)
+      break;
+
+    value = strchr (key, '=');
+    if (value == NULL)
+      break;
+    *value = 0;
+    value++;
+
+    if (values != NULL)
+    {
+      endptr = NULL;
+      errno = 0;
+      values[i] = strtod (value, &endptr);
+      if ((endptr == value) || (errno != 0))
+        break;
+    }
+
+    if (values_names != NULL)
+    {
+      values_names[i] = strdup (key);
+      if (values_names[i] == NULL)
+        break;
+    }
+
+    i++;
+  }
+
+  if (i != (size_t) values_num)
+  {
+    if (values_names != NULL)
+      for (i = 0; i < (size_t) values_num; i++)
+        free (values_names[i]);
+    free (values_names);
+    free (values);
+    return (EILSEQ);
+  }
+
+  *ret_values_num = (size_t) values_num;
+  if (ret_values != NULL)
+    *ret_values = values;
+  if (ret_values_names != NULL)
+    *ret_values_names = values_names;
+
+  return (0);
+} /* }}} int lcc_parse_getval_multi_line */
+
+/* Sends one GETVAL_MULTI command for the identifiers "first" ... "last - 1"
+ * and stores the results in the corresponding elements of the "ret_*"
+ * arrays. */
+static int lcc_getval_multi_chunk (lcc_connection_t *c, /* {{{ */
+    const char *command, lcc_identifier_t *idents, size_t first, size_t last,
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  lcc_response_t res;
+  size_t i;
+  int status;
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  if (res.lines_num != (last - first))
+  {
+    lcc_set_errno (c, EILSEQ);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  for (i = first; i < last; i++)
+  {
+    char ident_str[6 * LCC_NAME_LEN];
+
+    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
+        idents + i);
+    if (status != 0)
+    {
+      lcc_response_free (&res);
+      return (status);
+    }
+
+    status = lcc_parse_getval_multi_line (res.lines[i - first], ident_str,
+        ret_values_num + i,
+        (ret_values != NULL) ? ret_values + i : NULL,
+        (ret_values_names != NULL) ? ret_values_names + i : NULL);
+    if (status != 0)
+    {
+      lcc_set_errno (c, status);
+      lcc_response_free (&res);
+      return (-1);
+    }
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_getval_multi_chunk */
+
+int lcc_getval_multi (lcc_connection_t *c, /* {{{ */
+    lcc_identifier_t *idents, size_t idents_num,
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names)
+{
+  char command[LCC_COMMAND_LEN] = "";
+  size_t command_len = 0;
+  size_t first = 0;
+  size_t i;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (((idents == NULL) || (ret_values_num == NULL)) && (idents_num > 0))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  for (i = 0; i < idents_num; i++)
+  {
+    ret_values_num[i] = 0;
+    if (ret_values != NULL)
+      ret_values[i] = NULL;
+    if (ret_values_names != NULL)
+      ret_values_names[i] = NULL;
+  }
+
+  for (i = 0; i < idents_num; i++)
+  {
+    char ident_str[6 * LCC_NAME_LEN];
+    char ident_esc[12 * LCC_NAME_LEN];
+
+    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
+        idents + i);
+    if (status != 0)
+      return (status);
+    lcc_strescape (ident_esc, ident_str, sizeof (ident_esc));
+
+    if ((command_len > 0)
+        && ((command_len + 1 + strlen (ident_esc)) > LCC_COMMAND_MAX_LEN))
+    {
+      status = lcc_getval_multi_chunk (c, command, idents, first, i,
+          ret_values_num, ret_values, ret_values_names);
+      if (status != 0)
+        return (status);
+      command_len = 0;
+      first = i;
+    }
+
+    if (command_len == 0)
+      SSTRCPY (command, "GETVAL_MULTI");
+    SSTRCATF (command, " %s", ident_esc);
+    command_len = strlen (command);
+  }
+
+  if (command_len > 0)
+    return (lcc_getval_multi_chunk (c, command, idents, first, idents_num,
+          ret_values_num, ret_values, ret_values_names));
+
+  return (0);
+} /* }}} int lcc_getval_multi */
+
 int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
     lcc_identifier_t *ident, int timeout)
 {
@@ -945,6 +1283,39 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
   return (0);
 } /* }}} int lcc_listval */
 
+int lcc_trace (lcc_connection_t *c, /* {{{ */
+    char ***ret_lines, size_t *ret_lines_num)
+{
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((ret_lines == NULL) || (ret_lines_num == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_sendreceive (c, "TRACE", &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  /* Hand the lines over to the caller. */
+  *ret_lines = res.lines;
+  *ret_lines_num = res.lines_num;
+
+  return (0);
+} /* }}} int lcc_trace */
+
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
   if (c == NULL)
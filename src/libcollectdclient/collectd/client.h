@@ -104,14 +104,32 @@ int lcc_disconnect (lcc_connection_t *c);
 int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
     size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
 
+/* Looks up several identifiers at once. For each identifier "idents[i]", the
+ * number of values is stored in "ret_values_num[i]" and, unless the
+ * respective array is NULL, the values and their names are stored in
+ * "ret_values[i]" and "ret_values_names[i]", like lcc_getval() does. Unknown
+ * identifiers yield zero values. */
+int lcc_getval_multi (lcc_connection_t *c,
+    lcc_identifier_t *idents, size_t idents_num,
+    size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
+
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
+/* Submits "vls_num" value lists using as few PUTVAL_BATCH commands as
+ * possible. */
+int lcc_putval_batch (lcc_connection_t *c,
+    const lcc_value_list_t *vls, size_t vls_num);
+
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
 
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
+/* Fetches the traces of recently dispatched value lists, one line per value
+ * list. The caller must free each line and "*ret_lines". */
+int lcc_trace (lcc_connection_t *c, char ***ret_lines, size_t *ret_lines_num);
+
 /* TODO: putnotif */
 
 const char *lcc_strerror (lcc_connection_t *c);
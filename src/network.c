@@ -24,6 +24,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For sendmmsg(2) */
 
 #include "collectd.h"
 #include "plugin.h"
@@ -109,6 +110,9 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #endif
 struct sockent_client
 {
+	/* Protects `fd' and `addr' against concurrent reconnects. The packets
+	 * are signed / encrypted before this lock is acquired. */
+	pthread_mutex_t lock;
 	int fd;
 	struct sockaddr_storage *addr;
 	socklen_t                addrlen;
@@ -116,7 +120,6 @@ struct sockent_client
 	int security_level;
 	char *username;
 	char *password;
-	gcry_cipher_hd_t cypher;
 	unsigned char password_hash[32];
 #endif
 	cdtime_t next_resolve_reconnect;
@@ -131,7 +134,11 @@ struct sockent_server
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
+	/* Keys derived from the passwords in `userdb', by username. Only the
+	 * dispatch thread uses them, so they need no locking. */
+	c_avl_tree_t *user_keys;
+	time_t user_keys_mtime;
+	cdtime_t user_keys_next_check;
 #endif
 };
 
@@ -154,6 +161,19 @@ typedef struct sockent
 	struct sockent *next;
 } sockent_t;
 
+#if HAVE_LIBGCRYPT
+/* How often the dispatch thread checks whether the AuthFile has changed. */
+# define NETWORK_USER_KEYS_CHECK_INTERVAL TIME_T_TO_CDTIME_T (1)
+
+/* Cipher and HMAC handles with the key of one user already set. */
+struct network_user_key_s
+{
+	gcry_cipher_hd_t cypher; /* AES-256, keyed with SHA-256 (password) */
+	gcry_md_hd_t hmac;       /* HMAC-SHA-256, keyed with the password */
+};
+typedef struct network_user_key_s network_user_key_t;
+#endif
+
 /*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
  * +-------+-----------------------+-------------------------------+
@@ -282,6 +302,7 @@ typedef struct receive_list_entry_s receive_list_entry_t;
 static int network_config_ttl = 0;
 /* Ethernet - (IPv6 + UDP) = 1500 - (40 + 8) = 1452 */
 static size_t network_config_packet_size = 1452;
+static size_t network_config_batch_size = 1;
 static _Bool network_config_forward = 0;
 static _Bool network_config_stats = 0;
 
@@ -305,18 +326,51 @@ static pthread_t receive_thread_id;
 static int       dispatch_thread_running = 0;
 static pthread_t dispatch_thread_id;
 
-/* Buffer in which to-be-sent network packets are constructed. */
-static char            *send_buffer;
-static char            *send_buffer_ptr;
-static int              send_buffer_fill;
-static cdtime_t         send_buffer_last_update;
-static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
-static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Buffer in which to-be-sent network packets are constructed. Every write
+ * thread has a buffer of its own, so that serializing values doesn't
+ * serialize the write threads. A buffer holds up to
+ * `network_config_batch_size' packets; the batch is signed / encrypted and
+ * handed to the kernel once it is full or when the plugin is flushed. The
+ * lock is only contended by network_flush() and network_shutdown(). */
+struct send_buffer_s
+{
+	pthread_mutex_t lock;
+
+	char     *buffer;      /* batch_size * packet_size bytes */
+	size_t   *packets_len; /* length of the completed packets */
+	size_t    packets_num;
+#if HAVE_LIBGCRYPT
+	char     *scratch;     /* signed / encrypted copies of the packets */
+#endif
+
+	/* The packet currently being constructed. */
+	char     *ptr;
+	int       fill;
+	cdtime_t  last_update;
+	value_list_t vl;
+
+	derive_t  values_sent;
+
+	struct send_buffer_s *next;
+};
+typedef struct send_buffer_s send_buffer_t;
+
+static pthread_key_t    send_buffer_key;
+static _Bool            send_buffer_key_valid = 0;
+static send_buffer_t   *send_buffer_list = NULL;
+static pthread_mutex_t  send_buffer_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if HAVE_LIBGCRYPT
+/* AES256 handles used for sending. Every thread has one, so that encrypting
+ * doesn't require a lock. */
+static pthread_key_t  cypher_key;
+static pthread_once_t cypher_key_once = PTHREAD_ONCE_INIT;
+#endif
 
 /* XXX: These counters are incremented from one place only. The spot in which
  * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
+ * dispatch thread, for example) or locked by some lock (a send buffer's lock
+ * for example). Only if neither is true, the stats_lock is acquired. The counters
  * are always read without holding a lock in the hope that writing 8 bytes to
  * memory is an atomic operation. */
 static derive_t stats_octets_rx  = 0;
@@ -521,39 +575,179 @@ static void network_init_gcrypt (void) /* {{{ */
   gcry_control (GCRYCTL_INITIALIZATION_FINISHED);
 } /* }}} void network_init_gcrypt */
 
+static void network_cypher_key_free (void *arg) /* {{{ */
+{
+  gcry_cipher_close ((gcry_cipher_hd_t) arg);
+} /* }}} void network_cypher_key_free */
+
+static void network_cypher_key_create (void) /* {{{ */
+{
+  pthread_key_create (&cypher_key, network_cypher_key_free);
+} /* }}} void network_cypher_key_create */
+
+static void network_user_key_free (network_user_key_t *key) /* {{{ */
+{
+  if (key == NULL)
+    return;
+
+  if (key->cypher != NULL)
+    gcry_cipher_close (key->cypher);
+  if (key->hmac != NULL)
+    gcry_md_close (key->hmac);
+  sfree (key);
+} /* }}} void network_user_key_free */
+
+static void network_user_keys_clear (c_avl_tree_t *tree) /* {{{ */
+{
+  char *username;
+  network_user_key_t *key;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, (void *) &username, (void *) &key) == 0)
+  {
+    sfree (username);
+    network_user_key_free (key);
+  }
+} /* }}} void network_user_keys_clear */
+
+static network_user_key_t *network_user_key_create (const char *secret) /* {{{ */
+{
+  network_user_key_t *key;
+  unsigned char password_hash[32];
+  gcry_error_t err;
+
+  key = calloc (1, sizeof (*key));
+  if (key == NULL)
+    return (NULL);
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, password_hash,
+      secret, strlen (secret));
+
+  err = gcry_cipher_open (&key->cypher,
+      GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
+  if (err == 0)
+    err = gcry_cipher_setkey (key->cypher,
+        password_hash, sizeof (password_hash));
+  if (err != 0)
+  {
+    ERROR ("network plugin: Preparing the AES-256 cipher failed: %s",
+        gcry_strerror (err));
+    network_user_key_free (key);
+    return (NULL);
+  }
+
+  err = gcry_md_open (&key->hmac, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+  if (err == 0)
+    err = gcry_md_setkey (key->hmac, secret, strlen (secret));
+  if (err != 0)
+  {
+    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
+        gcry_strerror (err));
+    network_user_key_free (key);
+    return (NULL);
+  }
+
+  return (key);
+} /* }}} network_user_key_t *network_user_key_create */
+
+/* Returns the prepared keys of "username", deriving them from the AuthFile
+ * on first use. The cache is dropped when the AuthFile's mtime changes,
+ * which is checked at most once per second. Called from the dispatch thread
+ * only. */
+static network_user_key_t *network_get_user_key (sockent_t *se, /* {{{ */
+    const char *username)
+{
+  struct sockent_server *ses = &se->data.server;
+  network_user_key_t *key = NULL;
+  char *secret;
+  char *username_copy;
+  cdtime_t now;
+
+  if ((ses->userdb == NULL) || (username == NULL))
+    return (NULL);
+
+  if (ses->user_keys == NULL)
+  {
+    ses->user_keys = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (ses->user_keys == NULL)
+      return (NULL);
+  }
+
+  now = cdtime ();
+  if (now >= ses->user_keys_next_check)
+  {
+    time_t mtime = fbh_mtime (ses->userdb);
+
+    if (mtime != ses->user_keys_mtime)
+    {
+      network_user_keys_clear (ses->user_keys);
+      ses->user_keys_mtime = mtime;
+    }
+    ses->user_keys_next_check = now + NETWORK_USER_KEYS_CHECK_INTERVAL;
+  }
+
+  if (c_avl_get (ses->user_keys, username, (void *) &key) == 0)
+    return (key);
+
+  secret = fbh_get (ses->userdb, username);
+  if (secret == NULL)
+    return (NULL);
+
+  key = network_user_key_create (secret);
+  sfree (secret);
+  if (key == NULL)
+    return (NULL);
+
+  username_copy = strdup (username);
+  if ((username_copy == NULL)
+      || (c_avl_insert (ses->user_keys, username_copy, key) != 0))
+  {
+    sfree (username_copy);
+    network_user_key_free (key);
+    return (NULL);
+  }
+
+  return (key);
+} /* }}} network_user_key_t *network_get_user_key */
+
 static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
     const void *iv, size_t iv_size, const char *username)
 {
   gcry_error_t err;
   gcry_cipher_hd_t *cyper_ptr;
+  gcry_cipher_hd_t thread_cypher = NULL;
   unsigned char password_hash[32];
 
-  if (se->type == SOCKENT_TYPE_CLIENT)
-  {
-	  cyper_ptr = &se->data.client.cypher;
-	  memcpy (password_hash, se->data.client.password_hash,
-			  sizeof (password_hash));
-  }
-  else
+  if (se->type == SOCKENT_TYPE_SERVER)
   {
-	  char *secret;
-
-	  cyper_ptr = &se->data.server.cypher;
+	  network_user_key_t *key;
 
-	  if (username == NULL)
+	  key = network_get_user_key (se, username);
+	  if (key == NULL)
 		  return (NULL);
 
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
+	  gcry_cipher_reset (key->cypher);
+	  err = gcry_cipher_setiv (key->cypher, iv, iv_size);
+	  if (err != 0)
+	  {
+		  ERROR ("network plugin: gcry_cipher_setiv returned: %s",
+				  gcry_strerror (err));
 		  return (NULL);
+	  }
 
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
-
-	  sfree (secret);
+	  return (key->cypher);
   }
 
+  /* Client sockets are used by all write threads concurrently, so each
+   * thread uses its own handle. */
+  pthread_once (&cypher_key_once, network_cypher_key_create);
+  thread_cypher = pthread_getspecific (cypher_key);
+  cyper_ptr = &thread_cypher;
+  memcpy (password_hash, se->data.client.password_hash,
+		  sizeof (password_hash));
+
   if (*cyper_ptr == NULL)
   {
     err = gcry_cipher_open (cyper_ptr,
@@ -565,6 +759,8 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
       *cyper_ptr = NULL;
       return (NULL);
     }
+    if (cyper_ptr == &thread_cypher)
+      pthread_setspecific (cypher_key, thread_cypher);
   }
   else
   {
@@ -580,6 +776,8 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
         gcry_strerror (err));
     gcry_cipher_close (*cyper_ptr);
     *cyper_ptr = NULL;
+    if (cyper_ptr == &thread_cypher)
+      pthread_setspecific (cypher_key, NULL);
     return (NULL);
   }
 
@@ -590,6 +788,8 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
         gcry_strerror (err));
     gcry_cipher_close (*cyper_ptr);
     *cyper_ptr = NULL;
+    if (cyper_ptr == &thread_cypher)
+      pthread_setspecific (cypher_key, NULL);
     return (NULL);
   }
 
@@ -1037,14 +1237,12 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
+  network_user_key_t *key;
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof (pss.hash)];
 
-  gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -1091,55 +1289,29 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
 
   assert (buffer_offset == pss_head_length);
 
-  /* Query the password */
-  secret = fbh_get (se->data.server.userdb, pss.username);
-  if (secret == NULL)
+  /* Look up the user's HMAC object */
+  key = network_get_user_key (se, pss.username);
+  if (key == NULL)
   {
     ERROR ("network plugin: Unknown user: %s", pss.username);
     sfree (pss.username);
     return (-ENOENT);
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
-        gcry_strerror (err));
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  err = gcry_md_setkey (hd, secret, strlen (secret));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
-    gcry_md_close (hd);
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  gcry_md_write (hd,
+  /* Check the HMAC. Resetting the object keeps the key. */
+  gcry_md_reset (key->hmac);
+  gcry_md_write (key->hmac,
       buffer     + PART_SIGNATURE_SHA256_SIZE,
       buffer_len - PART_SIGNATURE_SHA256_SIZE);
-  hash_ptr = gcry_md_read (hd, GCRY_MD_SHA256);
+  hash_ptr = gcry_md_read (key->hmac, GCRY_MD_SHA256);
   if (hash_ptr == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
   memcpy (hash, hash_ptr, sizeof (hash));
 
-  /* Clean up */
-  gcry_md_close (hd);
-  hd = NULL;
-
   if (memcmp (pss.hash, hash, sizeof (pss.hash)) != 0)
   {
     WARNING ("network plugin: Verifying HMAC-SHA-256 signature failed: "
@@ -1151,7 +1323,6 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
         flags | PP_SIGNED, pss.username);
   }
 
-  sfree (secret);
   sfree (pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1634,9 +1805,8 @@ static void free_sockent_client (struct sockent_client *sec) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (sec->username);
   sfree (sec->password);
-  if (sec->cypher != NULL)
-    gcry_cipher_close (sec->cypher);
 #endif
+  pthread_mutex_destroy (&sec->lock);
 } /* }}} void free_sockent_client */
 
 static void free_sockent_server (struct sockent_server *ses) /* {{{ */
@@ -1656,8 +1826,12 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
+  sfree (ses->userdb);
+  if (ses->user_keys != NULL)
+  {
+    network_user_keys_clear (ses->user_keys);
+    c_avl_destroy (ses->user_keys);
+  }
 #endif
 } /* }}} void free_sockent_server */
 
@@ -2037,11 +2211,14 @@ static sockent_t *sockent_create (int type) /* {{{ */
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
+		se->data.server.user_keys = NULL;
+		se->data.server.user_keys_mtime = 0;
+		se->data.server.user_keys_next_check = 0;
 #endif
 	}
 	else
 	{
+		pthread_mutex_init (&se->data.client.lock, /* attr = */ NULL);
 		se->data.client.fd = -1;
 		se->data.client.addr = NULL;
 		se->data.client.resolve_interval = 0;
@@ -2050,7 +2227,6 @@ static sockent_t *sockent_create (int type) /* {{{ */
 		se->data.client.security_level = SECURITY_LEVEL_NONE;
 		se->data.client.username = NULL;
 		se->data.client.password = NULL;
-		se->data.client.cypher = NULL;
 #endif
 	}
 
@@ -2582,31 +2758,59 @@ static void *receive_thread (void __attribute__((unused)) *arg)
 	return (network_receive () ? (void *) 1 : (void *) 0);
 } /* void *receive_thread */
 
-static void network_init_buffer (void)
+static void network_init_buffer (send_buffer_t *sb) /* {{{ */
 {
-	memset (send_buffer, 0, network_config_packet_size);
-	send_buffer_ptr = send_buffer;
-	send_buffer_fill = 0;
-	send_buffer_last_update = 0;
+	sb->ptr = sb->buffer + (sb->packets_num * network_config_packet_size);
+	memset (sb->ptr, 0, network_config_packet_size);
+	sb->fill = 0;
 
-	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
-} /* int network_init_buffer */
+	memset (&sb->vl, 0, sizeof (sb->vl));
+} /* }}} void network_init_buffer */
 
+/* Sends `packets' to `se' with as few system calls as possible. The caller is
+ * responsible for signing / encrypting the packets. */
 static void network_send_buffer_plain (sockent_t *se, /* {{{ */
-		const char *buffer, size_t buffer_size)
+		struct iovec *packets, size_t packets_num)
 {
+	struct sockent_client *client = &se->data.client;
+	size_t packets_sent = 0;
 	int status;
+#if HAVE_SENDMMSG
+	struct mmsghdr msgs[packets_num];
+	size_t i;
+#endif
 
-	while (42)
+	pthread_mutex_lock (&client->lock);
+
+	while (packets_sent < packets_num)
 	{
 		status = sockent_client_connect (se);
 		if (status != 0)
-			return;
+			break;
+
+#if HAVE_SENDMMSG
+		memset (msgs, 0, sizeof (msgs));
+		for (i = packets_sent; i < packets_num; i++)
+		{
+			msgs[i].msg_hdr.msg_name = client->addr;
+			msgs[i].msg_hdr.msg_namelen = client->addrlen;
+			msgs[i].msg_hdr.msg_iov = packets + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
 
-		status = sendto (se->data.client.fd, buffer, buffer_size,
+		status = sendmmsg (client->fd, msgs + packets_sent,
+				(unsigned int) (packets_num - packets_sent),
+				/* flags = */ 0);
+#else
+		status = sendto (client->fd,
+				packets[packets_sent].iov_base,
+				packets[packets_sent].iov_len,
 				/* flags = */ 0,
-				(struct sockaddr *) se->data.client.addr,
-				se->data.client.addrlen);
+				(struct sockaddr *) client->addr,
+				client->addrlen);
+		if (status >= 0)
+			status = 1;
+#endif
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -2617,11 +2821,13 @@ static void network_send_buffer_plain (sockent_t *se, /* {{{ */
 			ERROR ("network plugin: sendto failed: %s. Closing sending socket.",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 			sockent_client_disconnect (se);
-			return;
+			break;
 		}
 
-		break;
-	} /* while (42) */
+		packets_sent += (size_t) status;
+	} /* while (packets_sent < packets_num) */
+
+	pthread_mutex_unlock (&client->lock);
 } /* }}} void network_send_buffer_plain */
 
 #if HAVE_LIBGCRYPT
@@ -2630,11 +2836,13 @@ static void network_send_buffer_plain (sockent_t *se, /* {{{ */
   buffer_offset += (s); \
 } while (0)
 
-static void network_send_buffer_signed (sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+/* Writes the signed copy of `in_buffer' to `buffer', which must be able to
+ * hold at least BUFF_SIG_SIZE + in_buffer_size bytes. Returns the size of
+ * the signed packet or zero on failure. */
+static size_t network_sign_buffer (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size, char *buffer)
 {
   part_signature_sha256_t ps;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_offset;
   size_t username_len;
 
@@ -2648,7 +2856,7 @@ static void network_send_buffer_signed (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: Creating HMAC object failed: %s",
         gcry_strerror (err));
-    return;
+    return (0);
   }
 
   err = gcry_md_setkey (hd, se->data.client.password,
@@ -2658,7 +2866,7 @@ static void network_send_buffer_signed (sockent_t *se, /* {{{ */
     ERROR ("network plugin: gcry_md_setkey failed: %s",
         gcry_strerror (err));
     gcry_md_close (hd);
-    return;
+    return (0);
   }
 
   username_len = strlen (se->data.client.username);
@@ -2666,7 +2874,8 @@ static void network_send_buffer_signed (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: Username too long: %s",
         se->data.client.username);
-    return;
+    gcry_md_close (hd);
+    return (0);
   }
 
   memcpy (buffer + PART_SIGNATURE_SHA256_SIZE,
@@ -2687,7 +2896,7 @@ static void network_send_buffer_signed (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: gcry_md_read failed.");
     gcry_md_close (hd);
-    return;
+    return (0);
   }
   memcpy (ps.hash, hash, sizeof (ps.hash));
 
@@ -2703,15 +2912,16 @@ static void network_send_buffer_signed (sockent_t *se, /* {{{ */
   gcry_md_close (hd);
   hd = NULL;
 
-  buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
-  network_send_buffer_plain (se, buffer, buffer_offset);
-} /* }}} void network_send_buffer_signed */
+  return (PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size);
+} /* }}} size_t network_sign_buffer */
 
-static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+/* Writes the encrypted copy of `in_buffer' to `buffer', which must be able to
+ * hold at least BUFF_SIG_SIZE + in_buffer_size bytes. Returns the size of
+ * the encrypted packet or zero on failure. */
+static size_t network_encrypt_buffer (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size, char *buffer)
 {
   part_encryption_aes256_t pea;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_size;
   size_t buffer_offset;
   size_t header_size;
@@ -2729,15 +2939,15 @@ static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
   if ((PART_ENCRYPTION_AES256_SIZE + username_len) > BUFF_SIG_SIZE)
   {
     ERROR ("network plugin: Username too long: %s", pea.username);
-    return;
+    return (0);
   }
 
   buffer_size = PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size;
   header_size = PART_ENCRYPTION_AES256_SIZE + username_len
     - sizeof (pea.hash);
 
-  assert (buffer_size <= sizeof (buffer));
-  DEBUG ("network plugin: network_send_buffer_encrypted: "
+  assert (buffer_size <= BUFF_SIG_SIZE + in_buffer_size);
+  DEBUG ("network plugin: network_encrypt_buffer: "
       "buffer_size = %zu;", buffer_size);
 
   pea.head.length = htons ((uint16_t) (PART_ENCRYPTION_AES256_SIZE
@@ -2752,7 +2962,7 @@ static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
 
   /* Initialize the buffer */
   buffer_offset = 0;
-  memset (buffer, 0, sizeof (buffer));
+  memset (buffer, 0, buffer_size);
 
 
   BUFFER_ADD (&pea.head.type, sizeof (pea.head.type));
@@ -2769,7 +2979,7 @@ static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
   cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
       se->data.client.password);
   if (cypher == NULL)
-    return;
+    return (0);
 
   /* Encrypt the buffer in-place */
   err = gcry_cipher_encrypt (cypher,
@@ -2780,31 +2990,67 @@ static void network_send_buffer_encrypted (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: gcry_cipher_encrypt returned: %s",
         gcry_strerror (err));
-    return;
+    return (0);
   }
 
-  /* Send it out without further modifications */
-  network_send_buffer_plain (se, buffer, buffer_size);
-} /* }}} void network_send_buffer_encrypted */
+  return (buffer_size);
+} /* }}} size_t network_encrypt_buffer */
 #undef BUFFER_ADD
 #endif /* HAVE_LIBGCRYPT */
 
-static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
+/* Sends `packets' to all servers. `scratch' must be able to hold
+ * packets_num * (network_config_packet_size + BUFF_SIG_SIZE) bytes and is
+ * used for the signed / encrypted copies of the packets. It may be NULL if
+ * gcrypt support is not available. */
+static void network_send_buffer (struct iovec *packets, /* {{{ */
+    size_t packets_num, char *scratch)
 {
   sockent_t *se;
+  size_t i;
 
-  DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
+  DEBUG ("network plugin: network_send_buffer: packets_num = %zu",
+      packets_num);
 
   for (se = sending_sockets; se != NULL; se = se->next)
   {
 #if HAVE_LIBGCRYPT
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      network_send_buffer_encrypted (se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      network_send_buffer_signed (se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
+    struct iovec secured[packets_num];
+    size_t secured_num = 0;
+
+    if (se->data.client.security_level == SECURITY_LEVEL_NONE)
+    {
+      network_send_buffer_plain (se, packets, packets_num);
+      continue;
+    }
+
+    for (i = 0; i < packets_num; i++)
+    {
+      char *buffer = scratch
+        + (i * (network_config_packet_size + BUFF_SIG_SIZE));
+      size_t buffer_size;
+
+      if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+        buffer_size = network_encrypt_buffer (se,
+            packets[i].iov_base, packets[i].iov_len, buffer);
+      else /* if (se->data.client.security_level == SECURITY_LEVEL_SIGN) */
+        buffer_size = network_sign_buffer (se,
+            packets[i].iov_base, packets[i].iov_len, buffer);
+
+      if (buffer_size == 0)
+        continue;
+
+      secured[secured_num].iov_base = buffer;
+      secured[secured_num].iov_len = buffer_size;
+      secured_num++;
+    }
+
+    if (secured_num > 0)
+      network_send_buffer_plain (se, secured, secured_num);
+#else
+    (void) scratch;
+    (void) i;
+    network_send_buffer_plain (se, packets, packets_num);
 #endif /* HAVE_LIBGCRYPT */
-      network_send_buffer_plain (se, buffer, buffer_len);
   } /* for (sending_sockets) */
 } /* }}} void network_send_buffer */
 
@@ -2878,22 +3124,207 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 	return (buffer - buffer_orig);
 } /* }}} int add_to_buffer */
 
-static void flush_buffer (void)
+static void send_buffer_destroy (send_buffer_t *sb) /* {{{ */
+{
+	if (sb == NULL)
+		return;
+
+	pthread_mutex_destroy (&sb->lock);
+	sfree (sb->buffer);
+	sfree (sb->packets_len);
+#if HAVE_LIBGCRYPT
+	sfree (sb->scratch);
+#endif
+	sfree (sb);
+} /* }}} void send_buffer_destroy */
+
+static send_buffer_t *send_buffer_create (void) /* {{{ */
+{
+	send_buffer_t *sb;
+
+	sb = calloc (1, sizeof (*sb));
+	if (sb == NULL)
+		return (NULL);
+	pthread_mutex_init (&sb->lock, /* attr = */ NULL);
+
+	sb->buffer = malloc (network_config_batch_size
+			* network_config_packet_size);
+	sb->packets_len = calloc (network_config_batch_size,
+			sizeof (*sb->packets_len));
+#if HAVE_LIBGCRYPT
+	sb->scratch = malloc (network_config_batch_size
+			* (network_config_packet_size + BUFF_SIG_SIZE));
+	if (sb->scratch == NULL)
+	{
+		send_buffer_destroy (sb);
+		return (NULL);
+	}
+#endif
+	if ((sb->buffer == NULL) || (sb->packets_len == NULL))
+	{
+		send_buffer_destroy (sb);
+		return (NULL);
+	}
+
+	sb->packets_num = 0;
+	sb->values_sent = 0;
+	sb->last_update = 0;
+	network_init_buffer (sb);
+
+	return (sb);
+} /* }}} send_buffer_t *send_buffer_create */
+
+/* Sends all completed packets and the packet currently being constructed.
+ * The caller must hold `sb->lock'. */
+static void flush_buffer (send_buffer_t *sb) /* {{{ */
+{
+	struct iovec packets[network_config_batch_size];
+	derive_t octets = 0;
+	size_t i;
+
+	if (sb->fill > 0)
+	{
+		sb->packets_len[sb->packets_num] = (size_t) sb->fill;
+		sb->packets_num++;
+		sb->fill = 0;
+	}
+
+	if (sb->packets_num == 0)
+		return;
+
+	DEBUG ("network plugin: flush_buffer: packets_num = %zu",
+			sb->packets_num);
+
+	for (i = 0; i < sb->packets_num; i++)
+	{
+		packets[i].iov_base = sb->buffer + (i * network_config_packet_size);
+		packets[i].iov_len = sb->packets_len[i];
+		octets += (derive_t) sb->packets_len[i];
+	}
+
+#if HAVE_LIBGCRYPT
+	network_send_buffer (packets, sb->packets_num, sb->scratch);
+#else
+	network_send_buffer (packets, sb->packets_num, /* scratch = */ NULL);
+#endif
+
+	pthread_mutex_lock (&stats_lock);
+	stats_octets_tx += octets;
+	stats_packets_tx += (derive_t) sb->packets_num;
+	stats_values_sent += sb->values_sent;
+	pthread_mutex_unlock (&stats_lock);
+
+	sb->values_sent = 0;
+	sb->packets_num = 0;
+	network_init_buffer (sb);
+} /* }}} void flush_buffer */
+
+/* Moves the packets of `sb' to the empty buffer `dst', so that they can be
+ * sent without holding any lock. The caller must hold `sb->lock'. */
+static void send_buffer_move (send_buffer_t *dst, send_buffer_t *sb) /* {{{ */
+{
+	char   *buffer = dst->buffer;
+	size_t *packets_len = dst->packets_len;
+
+	if (sb->fill > 0)
+	{
+		sb->packets_len[sb->packets_num] = (size_t) sb->fill;
+		sb->packets_num++;
+		sb->fill = 0;
+	}
+
+	dst->buffer = sb->buffer;
+	dst->packets_len = sb->packets_len;
+	dst->packets_num = sb->packets_num;
+	dst->values_sent = sb->values_sent;
+
+	sb->buffer = buffer;
+	sb->packets_len = packets_len;
+	sb->packets_num = 0;
+	sb->values_sent = 0;
+	network_init_buffer (sb);
+} /* }}} void send_buffer_move */
+
+/* Completes the packet currently being constructed. The batch is sent once
+ * all of its packets are used up. The caller must hold `sb->lock'. */
+static void send_buffer_next_packet (send_buffer_t *sb) /* {{{ */
+{
+	if (sb->fill > 0)
+	{
+		sb->packets_len[sb->packets_num] = (size_t) sb->fill;
+		sb->packets_num++;
+		sb->fill = 0;
+	}
+
+	if (sb->packets_num >= network_config_batch_size)
+		flush_buffer (sb);
+	else
+		network_init_buffer (sb);
+} /* }}} void send_buffer_next_packet */
+
+/* Called when a write thread exits. */
+static void send_buffer_key_free (void *arg) /* {{{ */
 {
-	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %i",
-			send_buffer_fill);
+	send_buffer_t *sb = arg;
+	send_buffer_t *prev = NULL;
+	send_buffer_t *ptr;
+
+	pthread_mutex_lock (&send_buffer_list_lock);
+	for (ptr = send_buffer_list; ptr != NULL; ptr = ptr->next)
+	{
+		if (ptr == sb)
+			break;
+		prev = ptr;
+	}
+
+	/* Already released by network_shutdown(). */
+	if (ptr == NULL)
+	{
+		pthread_mutex_unlock (&send_buffer_list_lock);
+		return;
+	}
+
+	if (prev == NULL)
+		send_buffer_list = sb->next;
+	else
+		prev->next = sb->next;
+	pthread_mutex_unlock (&send_buffer_list_lock);
+
+	/* No longer reachable by network_flush(). */
+	flush_buffer (sb);
+	send_buffer_destroy (sb);
+} /* }}} void send_buffer_key_free */
+
+/* Returns the calling thread's send buffer, creating it if necessary. */
+static send_buffer_t *send_buffer_get (void) /* {{{ */
+{
+	send_buffer_t *sb;
+
+	sb = pthread_getspecific (send_buffer_key);
+	if (sb != NULL)
+		return (sb);
+
+	sb = send_buffer_create ();
+	if (sb == NULL)
+	{
+		ERROR ("network plugin: Allocating a send buffer failed.");
+		return (NULL);
+	}
 
-	network_send_buffer (send_buffer, (size_t) send_buffer_fill);
+	pthread_mutex_lock (&send_buffer_list_lock);
+	sb->next = send_buffer_list;
+	send_buffer_list = sb;
+	pthread_mutex_unlock (&send_buffer_list_lock);
 
-	stats_octets_tx += ((uint64_t) send_buffer_fill);
-	stats_packets_tx++;
+	pthread_setspecific (send_buffer_key, sb);
 
-	network_init_buffer ();
-}
+	return (sb);
+} /* }}} send_buffer_t *send_buffer_get */
 
 static int network_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
+	send_buffer_t *sb;
 	int status;
 
 	if (!check_send_okay (vl))
@@ -2913,40 +3344,30 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	  return (0);
 	}
 
-	uc_meta_data_add_unsigned_int (vl,
-	    "network:time_sent", (uint64_t) vl->time);
+	sb = send_buffer_get ();
+	if (sb == NULL)
+		return (-1);
 
-	pthread_mutex_lock (&send_buffer_lock);
+	/* "network:time_sent" is only read by check_receive_okay(), so don't
+	 * take the cache lock for it unless this instance also listens. */
+	if (listen_sockets_num > 0)
+		uc_meta_data_add_unsigned_int (vl,
+		    "network:time_sent", (uint64_t) vl->time);
 
-	status = add_to_buffer (send_buffer_ptr,
-			network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-			&send_buffer_vl,
-			ds, vl);
-	if (status >= 0)
-	{
-		/* status == bytes added to the buffer */
-		send_buffer_fill += status;
-		send_buffer_ptr  += status;
-		send_buffer_last_update = cdtime();
+	pthread_mutex_lock (&sb->lock);
 
-		stats_values_sent++;
-	}
-	else
+	status = add_to_buffer (sb->ptr,
+			network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+			&sb->vl,
+			ds, vl);
+	if (status < 0)
 	{
-		flush_buffer ();
+		send_buffer_next_packet (sb);
 
-		status = add_to_buffer (send_buffer_ptr,
-				network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-				&send_buffer_vl,
+		status = add_to_buffer (sb->ptr,
+				network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+				&sb->vl,
 				ds, vl);
-
-		if (status >= 0)
-		{
-			send_buffer_fill += status;
-			send_buffer_ptr  += status;
-
-			stats_values_sent++;
-		}
 	}
 
 	if (status < 0)
@@ -2954,12 +3375,19 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 		ERROR ("network plugin: Unable to append to the "
 				"buffer for some weird reason");
 	}
-	else if ((network_config_packet_size - send_buffer_fill) < 15)
+	else
 	{
-		flush_buffer ();
+		/* status == bytes added to the buffer */
+		sb->fill += status;
+		sb->ptr  += status;
+		sb->last_update = cdtime ();
+		sb->values_sent++;
+
+		if ((network_config_packet_size - sb->fill) < 15)
+			send_buffer_next_packet (sb);
 	}
 
-	pthread_mutex_unlock (&send_buffer_lock);
+	pthread_mutex_unlock (&sb->lock);
 
 	return ((status < 0) ? -1 : 0);
 } /* int network_write */
@@ -3008,6 +3436,22 @@ static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_batch_size (const oconfig_item_t *ci) /* {{{ */
+{
+  int tmp = 0;
+
+  if (cf_util_get_int (ci, &tmp) != 0)
+    return (-1);
+  else if ((tmp >= 1) && (tmp <= 256))
+    network_config_batch_size = (size_t) tmp;
+  else {
+    WARNING ("network plugin: The `SendBatchSize' must be between 1 and 256.");
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_batch_size */
+
 #if HAVE_LIBGCRYPT
 static int network_config_set_security_level (oconfig_item_t *ci, /* {{{ */
     int *retval)
@@ -3235,6 +3679,8 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
     }
     else if (strcasecmp ("MaxPacketSize", child->key) == 0)
       network_config_set_buffer_size (child);
+    else if (strcasecmp ("SendBatchSize", child->key) == 0)
+      network_config_set_batch_size (child);
     else if (strcasecmp ("Forward", child->key) == 0)
       cf_util_get_boolean (child, &network_config_forward);
     else if (strcasecmp ("ReportStats", child->key) == 0)
@@ -3256,6 +3702,10 @@ static int network_notification (const notification_t *n,
   char *buffer_ptr = buffer;
   int   buffer_free = sizeof (buffer);
   int   status;
+  struct iovec packet;
+#if HAVE_LIBGCRYPT
+  char  scratch[network_config_packet_size + BUFF_SIG_SIZE];
+#endif
 
   if (!check_send_notify_okay (n))
     return (0);
@@ -3318,7 +3768,13 @@ static int network_notification (const notification_t *n,
   if (status != 0)
     return (-1);
 
-  network_send_buffer (buffer, sizeof (buffer) - buffer_free);
+  packet.iov_base = buffer;
+  packet.iov_len = sizeof (buffer) - buffer_free;
+#if HAVE_LIBGCRYPT
+  network_send_buffer (&packet, 1, scratch);
+#else
+  network_send_buffer (&packet, 1, /* scratch = */ NULL);
+#endif
 
   return (0);
 } /* int network_notification */
@@ -3352,10 +3808,23 @@ static int network_shutdown (void)
 
 	sockent_destroy (listen_sockets);
 
-	if (send_buffer_fill > 0)
-		flush_buffer ();
+	pthread_mutex_lock (&send_buffer_list_lock);
+	while (send_buffer_list != NULL)
+	{
+		send_buffer_t *sb = send_buffer_list;
+		send_buffer_list = sb->next;
 
-	sfree (send_buffer);
+		pthread_mutex_lock (&sb->lock);
+		flush_buffer (sb);
+		pthread_mutex_unlock (&sb->lock);
+		send_buffer_destroy (sb);
+	}
+	if (send_buffer_key_valid)
+	{
+		pthread_key_delete (send_buffer_key);
+		send_buffer_key_valid = 0;
+	}
+	pthread_mutex_unlock (&send_buffer_list_lock);
 
 	for (se = sending_sockets; se != NULL; se = se->next)
 		sockent_client_disconnect (se);
@@ -3464,13 +3933,12 @@ static int network_init (void)
 
 	plugin_register_shutdown ("network", network_shutdown);
 
-	send_buffer = malloc (network_config_packet_size);
-	if (send_buffer == NULL)
+	if (pthread_key_create (&send_buffer_key, send_buffer_key_free) != 0)
 	{
-		ERROR ("network plugin: malloc failed.");
+		ERROR ("network plugin: pthread_key_create failed.");
 		return (-1);
 	}
-	network_init_buffer ();
+	send_buffer_key_valid = 1;
 
 	/* setup socket(s) and so on */
 	if (sending_sockets != NULL)
@@ -3541,22 +4009,49 @@ static int network_flush (cdtime_t timeout,
 		__attribute__((unused)) const char *identifier,
 		__attribute__((unused)) user_data_t *user_data)
 {
-	pthread_mutex_lock (&send_buffer_lock);
+	send_buffer_t *sb;
+	send_buffer_t *pending = NULL;
+	cdtime_t now = cdtime ();
 
-	if (send_buffer_fill > 0)
+	/* Take the packets out of the buffers and send them after unlocking, so
+	 * that the write threads are not held up by the sockets. */
+	pthread_mutex_lock (&send_buffer_list_lock);
+	for (sb = send_buffer_list; sb != NULL; sb = sb->next)
 	{
-		if (timeout > 0)
+		send_buffer_t *spare;
+
+		pthread_mutex_lock (&sb->lock);
+		if (((sb->packets_num == 0) && (sb->fill <= 0))
+				|| ((timeout != 0) && ((sb->last_update + timeout) > now)))
 		{
-			cdtime_t now = cdtime ();
-			if ((send_buffer_last_update + timeout) > now)
-			{
-				pthread_mutex_unlock (&send_buffer_lock);
-				return (0);
-			}
+			pthread_mutex_unlock (&sb->lock);
+			continue;
 		}
-		flush_buffer ();
+
+		spare = send_buffer_create ();
+		if (spare == NULL)
+		{
+			/* Send while holding the lock rather than not at all. */
+			flush_buffer (sb);
+			pthread_mutex_unlock (&sb->lock);
+			continue;
+		}
+		send_buffer_move (spare, sb);
+		pthread_mutex_unlock (&sb->lock);
+
+		spare->next = pending;
+		pending = spare;
+	}
+	pthread_mutex_unlock (&send_buffer_list_lock);
+
+	while (pending != NULL)
+	{
+		sb = pending;
+		pending = sb->next;
+
+		flush_buffer (sb);
+		send_buffer_destroy (sb);
 	}
-	pthread_mutex_unlock (&send_buffer_lock);
 
 	return (0);
 } /* int network_flush */
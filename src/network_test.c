@@ -0,0 +1,207 @@
+/**
+ * collectd - src/network_test.c
+ * Copyright (C) 2026       agent
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; only version 2.1 of the License is
+ * applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "network.c" /* sic */
+#include "testing.h"
+
+#include <utime.h>
+
+static char auth_file[] = "/tmp/collectd_network_test.XXXXXX";
+
+static int write_auth_file (char const *content, time_t mtime) /* {{{ */
+{
+  struct utimbuf times = { mtime, mtime };
+  FILE *fh;
+
+  fh = fopen (auth_file, "w");
+  if (fh == NULL)
+    return (-1);
+  fputs (content, fh);
+  fclose (fh);
+
+  return (utime (auth_file, &times));
+} /* }}} int write_auth_file */
+
+static sockent_t *create_client (char const *username, /* {{{ */
+    char const *password, int security_level)
+{
+  sockent_t *se;
+
+  se = sockent_create (SOCKENT_TYPE_CLIENT);
+  se->data.client.security_level = security_level;
+  se->data.client.username = strdup (username);
+  se->data.client.password = strdup (password);
+  if (sockent_init_crypto (se) != 0)
+  {
+    sockent_destroy (se);
+    return (NULL);
+  }
+
+  return (se);
+} /* }}} sockent_t *create_client */
+
+static sockent_t *create_server (void) /* {{{ */
+{
+  sockent_t *se;
+
+  se = sockent_create (SOCKENT_TYPE_SERVER);
+  se->data.server.security_level = SECURITY_LEVEL_ENCRYPT;
+  se->data.server.auth_file = strdup (auth_file);
+  if (sockent_init_crypto (se) != 0)
+  {
+    sockent_destroy (se);
+    return (NULL);
+  }
+
+  return (se);
+} /* }}} sockent_t *create_server */
+
+/* Serializes one value list into "buffer" and returns its size. */
+static size_t create_payload (char *buffer, size_t buffer_size) /* {{{ */
+{
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  value_list_t vl_def;
+  value_list_t vl;
+  value_t value = { .gauge = 42.0 };
+  int status;
+
+  TESTING_VALUE_LIST (&vl, &value, ds);
+  /* The receiver drops value lists without a time. */
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+
+  /* Nothing has been sent before, so every part is written. */
+  memset (&vl_def, 0, sizeof (vl_def));
+  status = add_to_buffer (buffer, (int) buffer_size, &vl_def, ds, &vl);
+  if (status < 0)
+    return (0);
+  return ((size_t) status);
+} /* }}} size_t create_payload */
+
+/* Parses a copy of "packet", since decryption happens in place, and returns
+ * the number of value lists dispatched. */
+static int receive (sockent_t *se, char const *packet, size_t packet_size) /* {{{ */
+{
+  char copy[packet_size];
+  derive_t before = stats_values_dispatched;
+
+  memcpy (copy, packet, packet_size);
+  parse_packet (se, copy, packet_size, /* flags = */ 0, /* username = */ NULL);
+
+  return ((int) (stats_values_dispatched - before));
+} /* }}} int receive */
+
+DEF_TEST(encrypted)
+{
+  char payload[1024];
+  char packet[BUFF_SIG_SIZE + sizeof (payload)];
+  size_t payload_size;
+  size_t packet_size;
+  sockent_t *server;
+  sockent_t *alice;
+  sockent_t *mallory;
+  int i;
+
+  CHECK_ZERO (write_auth_file ("alice: secret\n", 1000));
+  CHECK_NOT_NULL (server = create_server ());
+  CHECK_NOT_NULL (alice = create_client ("alice", "secret",
+        SECURITY_LEVEL_ENCRYPT));
+  CHECK_NOT_NULL (mallory = create_client ("alice", "guess",
+        SECURITY_LEVEL_ENCRYPT));
+
+  OK ((payload_size = create_payload (payload, sizeof (payload))) > 0);
+
+  /* More than once, so that the cached key is used. */
+  for (i = 0; i < 3; i++)
+  {
+    OK ((packet_size = network_encrypt_buffer (alice, payload, payload_size,
+            packet)) > 0);
+    EXPECT_EQ_INT (1, receive (server, packet, packet_size));
+  }
+
+  OK ((packet_size = network_encrypt_buffer (mallory, payload, payload_size,
+          packet)) > 0);
+  EXPECT_EQ_INT (0, receive (server, packet, packet_size));
+
+  /* A changed AuthFile replaces the cached keys. */
+  CHECK_ZERO (write_auth_file ("alice: guess\n", 2000));
+  server->data.server.user_keys_next_check = 0;
+  EXPECT_EQ_INT (1, receive (server, packet, packet_size));
+
+  OK ((packet_size = network_encrypt_buffer (alice, payload, payload_size,
+          packet)) > 0);
+  EXPECT_EQ_INT (0, receive (server, packet, packet_size));
+
+  sockent_destroy (mallory);
+  sockent_destroy (alice);
+  sockent_destroy (server);
+  return (0);
+}
+
+DEF_TEST(signed)
+{
+  char payload[1024];
+  char packet[BUFF_SIG_SIZE + sizeof (payload)];
+  size_t payload_size;
+  size_t packet_size;
+  sockent_t *server;
+  sockent_t *alice;
+  int i;
+
+  CHECK_ZERO (write_auth_file ("alice: secret\n", 1000));
+  CHECK_NOT_NULL (server = create_server ());
+  server->data.server.security_level = SECURITY_LEVEL_SIGN;
+  CHECK_NOT_NULL (alice = create_client ("alice", "secret",
+        SECURITY_LEVEL_SIGN));
+
+  OK ((payload_size = create_payload (payload, sizeof (payload))) > 0);
+  OK ((packet_size = network_sign_buffer (alice, payload, payload_size,
+          packet)) > 0);
+
+  for (i = 0; i < 3; i++)
+    EXPECT_EQ_INT (1, receive (server, packet, packet_size));
+
+  /* Corrupt the signature. */
+  packet[PART_SIGNATURE_SHA256_SIZE - 1] ^= 0x01;
+  EXPECT_EQ_INT (0, receive (server, packet, packet_size));
+
+  sockent_destroy (alice);
+  sockent_destroy (server);
+  return (0);
+}
+
+int main (void)
+{
+  int fd;
+
+  fd = mkstemp (auth_file);
+  if (fd < 0)
+    return (1);
+  close (fd);
+
+  RUN_TEST(encrypted);
+  RUN_TEST(signed);
+
+  unlink (auth_file);
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -748,6 +748,7 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 	char  *str_ptr;
 	size_t str_len;
 
+	gauge_t rates_buffer[ds->ds_num];
 	gauge_t *rates = NULL;
 	size_t i;
 
@@ -763,7 +764,6 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE)) {
 			log_err ("c_psql_write: Unknown data source type: %i",
 					ds->ds[i].type);
-			sfree (rates);
 			return NULL;
 		}
 
@@ -771,12 +771,12 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 			status = ssnprintf (str_ptr, str_len,
 					","GAUGE_FORMAT, vl->values[i].gauge);
 		else if (store_rates) {
-			if (rates == NULL)
-				rates = uc_get_rate (ds, vl);
-
 			if (rates == NULL) {
-				log_err ("c_psql_write: Failed to determine rate");
-				return NULL;
+				if (uc_get_rates (ds, vl, rates_buffer) != 0) {
+					log_err ("c_psql_write: Failed to determine rate");
+					return NULL;
+				}
+				rates = rates_buffer;
 			}
 
 			status = ssnprintf (str_ptr, str_len,
@@ -806,8 +806,6 @@ static char *values_to_sqlarray (const data_set_t *ds, const value_list_t *vl,
 		}
 	}
 
-	sfree (rates);
-
 	if (str_len <= 2) {
 		log_err ("c_psql_write: Failed to stringify value list");
 		return NULL;
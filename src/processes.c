@@ -92,6 +92,19 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  if HAVE_LINUX_CONNECTOR_H && HAVE_LINUX_CN_PROC_H
+#    include "utils_avltree.h"
+#    include <sys/socket.h>
+#    include <linux/netlink.h>
+#    include <linux/connector.h>
+#    include <linux/cn_proc.h>
+#    define HAVE_PROC_CONNECTOR 1
+#    if HAVE_LINUX_GENETLINK_H && HAVE_LINUX_TASKSTATS_H
+#      include <linux/genetlink.h>
+#      include <linux/taskstats.h>
+#      define HAVE_TASKSTATS 1
+#    endif
+#  endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -241,6 +254,39 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+
+# if HAVE_PROC_CONNECTOR
+/* Process followed through the netlink proc connector. The list of groups
+ * the process belongs to is determined once and re-evaluated only when the
+ * process calls exec(2) or changes its name. */
+typedef struct ps_pid_s
+{
+	long pid;
+	_Bool classified;
+	unsigned long generation;
+
+	procstat_t **matches;
+	size_t matches_num;
+} ps_pid_t;
+
+static _Bool use_netlink = 0;
+static int cn_sock = -1;
+/* Set when events may have been lost and the pid table has to be rebuilt
+ * from /proc. */
+static _Bool cn_resync = 1;
+static unsigned long cn_generation = 0;
+static c_avl_tree_t *cn_pids = NULL;
+
+static int cn_open (void);
+# endif /* HAVE_PROC_CONNECTOR */
+
+# if HAVE_TASKSTATS
+static int ts_sock = -1;
+static uint16_t ts_family = 0;
+static uint32_t ts_seq = 0;
+
+static int ts_open (void);
+# endif /* HAVE_TASKSTATS */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -391,95 +437,104 @@ static void ps_update_counter (
     *group_counter += *curr_value;
 }
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to the 'instances' of 'ps' (or refresh it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
+	_Bool want_init;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-        _Bool want_init;
+		procstat_entry_t *new;
 
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		new = calloc (1, sizeof (*new));
+		if (new == NULL)
+			return;
+		new->id = entry->id;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		pse = new;
+	}
 
-			new = calloc (1, sizeof (*new));
-			if (new == NULL)
-				return;
-			new->id = entry->id;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+	pse->cswitch_vol   = entry->cswitch_vol;
+	pse->cswitch_invol = entry->cswitch_invol;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	ps->cswitch_vol   += ((pse->cswitch_vol == -1)?0:pse->cswitch_vol);
+	ps->cswitch_invol += ((pse->cswitch_invol == -1)?0:pse->cswitch_invol);
+
+	want_init = (entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0);
+	ps_update_counter (want_init,
+			&ps->vmem_minflt_counter,
+			&pse->vmem_minflt_counter, &pse->vmem_minflt,
+			entry->vmem_minflt_counter, entry->vmem_minflt);
+	ps_update_counter (want_init,
+			&ps->vmem_majflt_counter,
+			&pse->vmem_majflt_counter, &pse->vmem_majflt,
+			entry->vmem_majflt_counter, entry->vmem_majflt);
+
+	want_init = (entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0);
+	ps_update_counter (want_init,
+			&ps->cpu_user_counter,
+			&pse->cpu_user_counter, &pse->cpu_user,
+			entry->cpu_user_counter, entry->cpu_user);
+	ps_update_counter (want_init,
+			&ps->cpu_system_counter,
+			&pse->cpu_system_counter, &pse->cpu_system,
+			entry->cpu_system_counter, entry->cpu_system);
+} /* void ps_list_add_entry */
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+/* add process entry to 'instances' of process 'name' (or refresh it) */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
 
-			pse = new;
-		}
+	if (entry->id == 0)
+		return;
 
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-		pse->cswitch_vol   = entry->cswitch_vol;
-		pse->cswitch_invol = entry->cswitch_invol;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		ps->cswitch_vol   += ((pse->cswitch_vol == -1)?0:pse->cswitch_vol);
-		ps->cswitch_invol += ((pse->cswitch_invol == -1)?0:pse->cswitch_invol);
-
-		want_init = (entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0);
-		ps_update_counter (want_init,
-				&ps->vmem_minflt_counter,
-				&pse->vmem_minflt_counter, &pse->vmem_minflt,
-				entry->vmem_minflt_counter, entry->vmem_minflt);
-		ps_update_counter (want_init,
-				&ps->vmem_majflt_counter,
-				&pse->vmem_majflt_counter, &pse->vmem_majflt,
-				entry->vmem_majflt_counter, entry->vmem_majflt);
-
-		want_init = (entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0);
-		ps_update_counter (want_init,
-				&ps->cpu_user_counter,
-				&pse->cpu_user_counter, &pse->cpu_user,
-				entry->cpu_user_counter, entry->cpu_user);
-		ps_update_counter (want_init,
-				&ps->cpu_system_counter,
-				&pse->cpu_system_counter, &pse->cpu_system,
-				entry->cpu_system_counter, entry->cpu_system);
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
+
+		ps_list_add_entry (ps, entry);
 	}
 }
 
@@ -608,6 +663,16 @@ static int ps_config (oconfig_item_t *ci)
 		{
 			cf_util_get_boolean (c, &report_ctx_switch);
 		}
+		else if (strcasecmp (c->key, "UseNetlink") == 0)
+		{
+#if HAVE_PROC_CONNECTOR
+			cf_util_get_boolean (c, &use_netlink);
+#else
+			WARNING ("processes plugin: The `UseNetlink' option is only "
+					"available on Linux systems with support for the "
+					"netlink proc connector.");
+#endif
+		}
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -652,6 +717,21 @@ static int ps_init (void)
 	pagesize_g = sysconf(_SC_PAGESIZE);
 	DEBUG ("pagesize_g = %li; CONFIG_HZ = %i;",
 			pagesize_g, CONFIG_HZ);
+
+# if HAVE_PROC_CONNECTOR
+	if (use_netlink && (cn_sock < 0) && (cn_open () != 0))
+	{
+		WARNING ("processes plugin: Unable to follow processes through "
+				"the proc connector. Falling back to scanning /proc.");
+		use_netlink = 0;
+	}
+# endif
+# if HAVE_TASKSTATS
+	if (use_netlink && report_ctx_switch && (ts_sock < 0)
+			&& (ts_open () != 0))
+		INFO ("processes plugin: Taskstats are not available. Context "
+				"switches will be read from /proc.");
+# endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && (HAVE_STRUCT_KINFO_PROC_FREEBSD || HAVE_STRUCT_KINFO_PROC_OPENBSD)
@@ -1020,6 +1100,201 @@ static procstat_t *ps_read_io (long pid, procstat_t *ps)
 	return (ps);
 } /* procstat_t *ps_read_io */
 
+#if HAVE_TASKSTATS
+/* Returns the first attribute of type "type" in the attribute stream
+ * "data" or NULL if there is no such attribute. */
+static struct nlattr *ts_attr_find (void *data, size_t data_len, uint16_t type)
+{
+	struct nlattr *na = data;
+
+	while ((data_len >= NLA_HDRLEN)
+			&& (na->nla_len >= NLA_HDRLEN)
+			&& (na->nla_len <= data_len))
+	{
+		size_t step;
+
+		if ((na->nla_type & NLA_TYPE_MASK) == type)
+			return (na);
+
+		step = NLA_ALIGN (na->nla_len);
+		if (step >= data_len)
+			break;
+
+		data_len -= step;
+		na = (struct nlattr *) (((char *) na) + step);
+	}
+
+	return (NULL);
+} /* struct nlattr *ts_attr_find */
+
+/* Sends a generic netlink request with a single attribute and waits for the
+ * matching reply. On success, a pointer to the attributes of the reply is
+ * returned and their size is stored in "ret_len". */
+static void *ts_request (uint16_t type, uint8_t cmd,
+		uint16_t attr_type, void const *attr_data, uint16_t attr_len,
+		char *buffer, size_t buffer_size, size_t *ret_len)
+{
+	struct
+	{
+		struct nlmsghdr n;
+		struct genlmsghdr g;
+		char attr[256];
+	} req;
+	struct nlattr *na;
+	uint32_t seq;
+
+	if (NLA_HDRLEN + attr_len > sizeof (req.attr))
+		return (NULL);
+
+	memset (&req, 0, sizeof (req));
+	seq = ++ts_seq;
+
+	req.n.nlmsg_len = NLMSG_LENGTH (GENL_HDRLEN);
+	req.n.nlmsg_type = type;
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_seq = seq;
+	req.g.cmd = cmd;
+	req.g.version = 1;
+
+	na = (struct nlattr *) req.attr;
+	na->nla_type = attr_type;
+	na->nla_len = NLA_HDRLEN + attr_len;
+	memcpy (req.attr + NLA_HDRLEN, attr_data, attr_len);
+	req.n.nlmsg_len += NLA_ALIGN (na->nla_len);
+
+	if (send (ts_sock, &req, req.n.nlmsg_len, /* flags = */ 0) < 0)
+		return (NULL);
+
+	/* Skip replies to earlier requests that timed out. */
+	while (42)
+	{
+		struct nlmsghdr *nlh = (struct nlmsghdr *) buffer;
+		ssize_t status;
+		size_t len;
+
+		status = recv (ts_sock, buffer, buffer_size, /* flags = */ 0);
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (NULL);
+		}
+		len = (size_t) status;
+
+		if ((len < NLMSG_HDRLEN) || (nlh->nlmsg_len > len))
+			return (NULL);
+		if (nlh->nlmsg_seq != seq)
+			continue;
+
+		if (nlh->nlmsg_type == NLMSG_ERROR)
+		{
+			struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+			if (nlh->nlmsg_len >= NLMSG_LENGTH (sizeof (*err)))
+				errno = -err->error;
+			return (NULL);
+		}
+
+		if (nlh->nlmsg_len < NLMSG_LENGTH (GENL_HDRLEN))
+			return (NULL);
+
+		*ret_len = nlh->nlmsg_len - NLMSG_LENGTH (GENL_HDRLEN);
+		return (((char *) NLMSG_DATA (nlh)) + GENL_HDRLEN);
+	}
+} /* void *ts_request */
+
+static int ts_open (void)
+{
+	struct sockaddr_nl sa = { 0 };
+	struct timeval tv = { 1, 0 };
+	char buffer[1024];
+	void *attrs;
+	size_t attrs_len = 0;
+	struct nlattr *na;
+
+	ts_sock = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (ts_sock < 0)
+		return (-1);
+
+	sa.nl_family = AF_NETLINK;
+	if ((bind (ts_sock, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+			|| (setsockopt (ts_sock, SOL_SOCKET, SO_RCVTIMEO,
+					&tv, sizeof (tv)) != 0))
+	{
+		close (ts_sock);
+		ts_sock = -1;
+		return (-1);
+	}
+
+	attrs = ts_request (GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+			CTRL_ATTR_FAMILY_NAME,
+			TASKSTATS_GENL_NAME, sizeof (TASKSTATS_GENL_NAME),
+			buffer, sizeof (buffer), &attrs_len);
+	if (attrs != NULL)
+		na = ts_attr_find (attrs, attrs_len, CTRL_ATTR_FAMILY_ID);
+	else
+		na = NULL;
+
+	if ((na == NULL) || (na->nla_len < NLA_HDRLEN + sizeof (uint16_t)))
+	{
+		close (ts_sock);
+		ts_sock = -1;
+		return (-1);
+	}
+
+	memcpy (&ts_family, ((char *) na) + NLA_HDRLEN, sizeof (ts_family));
+	return (0);
+} /* int ts_open */
+
+/* Read the context switch counters of all threads of "pid" with a single
+ * taskstats query instead of opening /proc/<pid>/task/<tid>/status for
+ * every thread. */
+static procstat_t *ps_read_taskstats (long pid, procstat_t *ps)
+{
+	char buffer[1024];
+	uint32_t tgid = (uint32_t) pid;
+	void *attrs;
+	size_t attrs_len = 0;
+	struct nlattr *aggr;
+	struct nlattr *na;
+	struct taskstats stats;
+	size_t stats_len;
+
+	if (ts_sock < 0)
+		return (NULL);
+
+	attrs = ts_request (ts_family, TASKSTATS_CMD_GET,
+			TASKSTATS_CMD_ATTR_TGID, &tgid, sizeof (tgid),
+			buffer, sizeof (buffer), &attrs_len);
+	if (attrs == NULL)
+		return (NULL);
+
+	aggr = ts_attr_find (attrs, attrs_len, TASKSTATS_TYPE_AGGR_TGID);
+	if (aggr == NULL)
+		return (NULL);
+
+	na = ts_attr_find (((char *) aggr) + NLA_HDRLEN,
+			aggr->nla_len - NLA_HDRLEN, TASKSTATS_TYPE_STATS);
+	if (na == NULL)
+		return (NULL);
+
+	/* Older kernels send a shorter structure. */
+	stats_len = na->nla_len - NLA_HDRLEN;
+	if (stats_len < offsetof (struct taskstats, nivcsw) + sizeof (stats.nivcsw))
+		return (NULL);
+	if (stats_len > sizeof (stats))
+		stats_len = sizeof (stats);
+
+	memset (&stats, 0, sizeof (stats));
+	memcpy (&stats, ((char *) na) + NLA_HDRLEN, stats_len);
+
+	ps->cswitch_vol = (derive_t) stats.nvcsw;
+	ps->cswitch_invol = (derive_t) stats.nivcsw;
+
+	return (ps);
+} /* procstat_t *ps_read_taskstats */
+#endif /* HAVE_TASKSTATS */
+
 static int ps_read_process (long pid, procstat_t *ps, char *state)
 {
 	char  filename[64];
@@ -1164,7 +1439,15 @@ static int ps_read_process (long pid, procstat_t *ps, char *state)
 
 	if ( report_ctx_switch )
 	{
-		if ( (ps_read_tasks_status(pid, ps)) == NULL)
+		procstat_t *ret = NULL;
+
+#if HAVE_TASKSTATS
+		ret = ps_read_taskstats (pid, ps);
+#endif
+		if (ret == NULL)
+			ret = ps_read_tasks_status (pid, ps);
+
+		if (ret == NULL)
 		{
 			ps->cswitch_vol = -1;
 			ps->cswitch_invol = -1;
@@ -1316,6 +1599,601 @@ static int read_fork_rate (void)
 	ps_submit_fork_rate (value.derive);
 	return (0);
 }
+
+/* Copies the values read by ps_read_process into a procstat_entry_t. */
+static void ps_fill_entry (long pid, procstat_t const *ps,
+		procstat_entry_t *pse)
+{
+	memset (pse, 0, sizeof (*pse));
+	pse->id       = pid;
+	pse->age      = 0;
+
+	pse->num_proc   = ps->num_proc;
+	pse->num_lwp    = ps->num_lwp;
+	pse->vmem_size  = ps->vmem_size;
+	pse->vmem_rss   = ps->vmem_rss;
+	pse->vmem_data  = ps->vmem_data;
+	pse->vmem_code  = ps->vmem_code;
+	pse->stack_size = ps->stack_size;
+
+	pse->vmem_minflt = 0;
+	pse->vmem_minflt_counter = ps->vmem_minflt_counter;
+	pse->vmem_majflt = 0;
+	pse->vmem_majflt_counter = ps->vmem_majflt_counter;
+
+	pse->cpu_user = 0;
+	pse->cpu_user_counter = ps->cpu_user_counter;
+	pse->cpu_system = 0;
+	pse->cpu_system_counter = ps->cpu_system_counter;
+
+	pse->io_rchar = ps->io_rchar;
+	pse->io_wchar = ps->io_wchar;
+	pse->io_syscr = ps->io_syscr;
+	pse->io_syscw = ps->io_syscw;
+
+	pse->cswitch_vol = ps->cswitch_vol;
+	pse->cswitch_invol = ps->cswitch_invol;
+} /* void ps_fill_entry */
+
+#if HAVE_PROC_CONNECTOR
+static int cn_pid_compare (const void *a, const void *b)
+{
+	long pa = *((const long *) a);
+	long pb = *((const long *) b);
+
+	if (pa < pb)
+		return (-1);
+	else if (pa > pb)
+		return (1);
+	return (0);
+} /* int cn_pid_compare */
+
+static void cn_pid_free (ps_pid_t *p)
+{
+	if (p == NULL)
+		return;
+
+	sfree (p->matches);
+	sfree (p);
+} /* void cn_pid_free */
+
+/* Returns the entry of "pid", creating an unclassified one if necessary. */
+static ps_pid_t *cn_pid_get (long pid)
+{
+	ps_pid_t *p = NULL;
+
+	if (c_avl_get (cn_pids, &pid, (void *) &p) == 0)
+		return (p);
+
+	p = calloc (1, sizeof (*p));
+	if (p == NULL)
+	{
+		ERROR ("processes plugin: cn_pid_get: calloc failed.");
+		return (NULL);
+	}
+	p->pid = pid;
+	p->generation = cn_generation;
+
+	if (c_avl_insert (cn_pids, &p->pid, p) != 0)
+	{
+		ERROR ("processes plugin: cn_pid_get: c_avl_insert failed.");
+		sfree (p);
+		return (NULL);
+	}
+
+	return (p);
+} /* ps_pid_t *cn_pid_get */
+
+static void cn_pid_remove (long pid)
+{
+	ps_pid_t *p = NULL;
+
+	if (c_avl_remove (cn_pids, &pid, NULL, (void *) &p) == 0)
+		cn_pid_free (p);
+} /* void cn_pid_remove */
+
+/* A forked process shares its parent's name and command line until it calls
+ * exec(2), so it inherits the parent's classification. */
+static void cn_pid_fork (long parent, long child)
+{
+	ps_pid_t *pp = NULL;
+	ps_pid_t *cp;
+
+	cp = cn_pid_get (child);
+	if (cp == NULL)
+		return;
+
+	cp->classified = 0;
+	cp->matches_num = 0;
+
+	if ((c_avl_get (cn_pids, &parent, (void *) &pp) != 0)
+			|| !pp->classified)
+		return;
+
+	if (pp->matches_num > 0)
+	{
+		procstat_t **tmp;
+
+		tmp = realloc (cp->matches, pp->matches_num * sizeof (*tmp));
+		if (tmp == NULL)
+			return;
+		cp->matches = tmp;
+
+		memcpy (cp->matches, pp->matches, pp->matches_num * sizeof (*tmp));
+		cp->matches_num = pp->matches_num;
+	}
+	cp->classified = 1;
+} /* void cn_pid_fork */
+
+static void cn_handle_event (struct proc_event const *ev)
+{
+	ps_pid_t *p;
+
+	switch (ev->what)
+	{
+		case PROC_EVENT_FORK:
+			/* New threads don't change anything. */
+			if (ev->event_data.fork.child_pid
+					!= ev->event_data.fork.child_tgid)
+				break;
+			cn_pid_fork ((long) ev->event_data.fork.parent_tgid,
+					(long) ev->event_data.fork.child_tgid);
+			break;
+
+		case PROC_EVENT_EXEC:
+			p = cn_pid_get ((long) ev->event_data.exec.process_tgid);
+			if (p != NULL)
+				p->classified = 0;
+			break;
+
+		case PROC_EVENT_COMM:
+			if (ev->event_data.comm.process_pid
+					!= ev->event_data.comm.process_tgid)
+				break;
+			p = cn_pid_get ((long) ev->event_data.comm.process_tgid);
+			if (p != NULL)
+				p->classified = 0;
+			break;
+
+		case PROC_EVENT_EXIT:
+			if (ev->event_data.exit.process_pid
+					!= ev->event_data.exit.process_tgid)
+				break;
+			cn_pid_remove ((long) ev->event_data.exit.process_tgid);
+			break;
+
+		default:
+			break;
+	}
+} /* void cn_handle_event */
+
+/* Processes all pending events without blocking. The number of messages
+ * handled per call is bounded so that a fork storm can't keep the read
+ * thread busy forever; remaining events are handled in the next interval. */
+static int cn_read_events (void)
+{
+	union
+	{
+		struct nlmsghdr n;
+		char buffer[8192];
+	} msg;
+	int i;
+
+	for (i = 0; i < 4096; i++)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t status;
+		int len;
+
+		status = recv (cn_sock, msg.buffer, sizeof (msg.buffer), MSG_DONTWAIT);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (0);
+			if (errno == ENOBUFS)
+			{
+				/* The socket buffer overflowed and events have been
+				 * lost. Rebuild the pid table from /proc. */
+				cn_resync = 1;
+				continue;
+			}
+
+			ERROR ("processes plugin: Reading from the proc connector "
+					"failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		len = (int) status;
+		for (nlh = &msg.n; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len))
+		{
+			struct cn_msg *cn;
+
+			if ((nlh->nlmsg_type == NLMSG_ERROR)
+					|| (nlh->nlmsg_type == NLMSG_NOOP))
+				continue;
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*cn)
+						+ sizeof (struct proc_event)))
+				continue;
+
+			cn = NLMSG_DATA (nlh);
+			if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC))
+				continue;
+
+			cn_handle_event ((struct proc_event *) cn->data);
+		}
+	}
+
+	return (0);
+} /* int cn_read_events */
+
+/* Rebuilds the pid table from /proc and forces all processes to be
+ * classified again. Used on startup and after events have been lost. */
+static int cn_scan_proc (void)
+{
+	c_avl_iterator_t *iter;
+	DIR *proc;
+	struct dirent *ent;
+	long *stale = NULL;
+	size_t stale_num = 0;
+	size_t stale_size = 0;
+	long *pid;
+	ps_pid_t *p;
+	size_t i;
+
+	if ((proc = opendir ("/proc")) == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("Cannot open `/proc': %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	cn_generation++;
+	while ((ent = readdir (proc)) != NULL)
+	{
+		long tmp;
+
+		if (!isdigit (ent->d_name[0]))
+			continue;
+
+		if ((tmp = atol (ent->d_name)) < 1)
+			continue;
+
+		p = cn_pid_get (tmp);
+		if (p == NULL)
+			continue;
+
+		p->generation = cn_generation;
+		p->classified = 0;
+	}
+	closedir (proc);
+
+	/* Remove processes that exited while we weren't listening. */
+	iter = c_avl_get_iterator (cn_pids);
+	while (c_avl_iterator_next (iter, (void *) &pid, (void *) &p) == 0)
+	{
+		if (p->generation == cn_generation)
+			continue;
+
+		if (stale_num >= stale_size)
+		{
+			size_t new_size = (stale_size == 0) ? 64 : 2 * stale_size;
+			long *tmp;
+
+			tmp = realloc (stale, new_size * sizeof (*tmp));
+			if (tmp == NULL)
+				break;
+			stale = tmp;
+			stale_size = new_size;
+		}
+		stale[stale_num++] = *pid;
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; i < stale_num; i++)
+		cn_pid_remove (stale[i]);
+	sfree (stale);
+
+	cn_resync = 0;
+	return (0);
+} /* int cn_scan_proc */
+
+/* Determines the groups a process belongs to. The command line is only read
+ * if a `ProcessMatch' needs it. If /proc cannot be read, which happens right
+ * after fork or exec, the process is left unclassified and tried again on the
+ * next event or read. */
+static void cn_pid_classify (ps_pid_t *p)
+{
+	char filename[64];
+	char name[PROCSTAT_NAME_LEN];
+	char cmdline_buffer[CMDLINE_BUFFER_SIZE];
+	char *cmdline = NULL;
+	_Bool have_cmdline = 0;
+	procstat_t *ps;
+	ssize_t status;
+
+	p->matches_num = 0;
+	p->classified = 0;
+
+	ssnprintf (filename, sizeof (filename), "/proc/%li/comm", p->pid);
+	status = read_file_contents (filename, name, sizeof (name) - 1);
+	if (status <= 0)
+		return;
+	name[status] = 0;
+	if (name[status - 1] == '\n')
+		name[status - 1] = 0;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+#if HAVE_REGEX_H
+		if ((ps->re != NULL) && !have_cmdline)
+		{
+			cmdline = ps_get_cmdline (p->pid, name,
+					cmdline_buffer, sizeof (cmdline_buffer));
+			if (cmdline == NULL)
+			{
+				p->matches_num = 0;
+				return;
+			}
+			have_cmdline = 1;
+		}
+#endif
+
+		if (ps_list_match (name, cmdline, ps) == 0)
+			continue;
+
+		tmp = realloc (p->matches, (p->matches_num + 1) * sizeof (*tmp));
+		if (tmp == NULL)
+			continue;
+		p->matches = tmp;
+		p->matches[p->matches_num++] = ps;
+	}
+
+	p->classified = 1;
+} /* void cn_pid_classify */
+
+static int cn_open (void)
+{
+	struct sockaddr_nl sa;
+	union
+	{
+		struct nlmsghdr n;
+		char buffer[1024];
+	} msg;
+	struct nlmsghdr *nlh;
+	struct cn_msg *cn;
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	int rcvbuf = 4 * 1024 * 1024;
+	struct timeval tv = { 1, 0 };
+	uint32_t seq = (uint32_t) getpid ();
+	_Bool acknowledged = 0;
+	int i;
+	char errbuf[1024];
+
+	cn_sock = socket (PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (cn_sock < 0)
+	{
+		ERROR ("processes plugin: Creating the proc connector socket "
+				"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* A large buffer makes overflows (and the following rescan of /proc)
+	 * less likely on hosts that create many processes. */
+	if (setsockopt (cn_sock, SOL_SOCKET, SO_RCVBUFFORCE,
+				&rcvbuf, sizeof (rcvbuf)) != 0)
+		setsockopt (cn_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+	setsockopt (cn_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	if (bind (cn_sock, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+	{
+		ERROR ("processes plugin: Binding the proc connector socket "
+				"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (cn_sock);
+		cn_sock = -1;
+		return (-1);
+	}
+
+	memset (&msg, 0, sizeof (msg));
+	nlh = &msg.n;
+	nlh->nlmsg_len = NLMSG_LENGTH (sizeof (*cn) + sizeof (op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	cn = NLMSG_DATA (nlh);
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->seq = seq;
+	cn->ack = 0;
+	cn->len = sizeof (op);
+	memcpy (cn->data, &op, sizeof (op));
+
+	if (send (cn_sock, nlh, nlh->nlmsg_len, /* flags = */ 0) < 0)
+	{
+		ERROR ("processes plugin: Subscribing to the proc connector "
+				"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (cn_sock);
+		cn_sock = -1;
+		return (-1);
+	}
+
+	/* Wait for the acknowledgement, which tells us whether we are
+	 * allowed to listen (CAP_NET_ADMIN is required). Old kernels don't
+	 * send one, so give up waiting after a while. */
+	for (i = 0; (i < 16) && !acknowledged; i++)
+	{
+		ssize_t status;
+		int len;
+
+		status = recv (cn_sock, msg.buffer, sizeof (msg.buffer), 0);
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		len = (int) status;
+		for (nlh = &msg.n; NLMSG_OK (nlh, len); nlh = NLMSG_NEXT (nlh, len))
+		{
+			struct proc_event *ev;
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*cn)
+						+ sizeof (struct proc_event)))
+				continue;
+
+			cn = NLMSG_DATA (nlh);
+			ev = (struct proc_event *) cn->data;
+			if ((ev->what != PROC_EVENT_NONE)
+					|| (cn->seq != seq) || (cn->ack != 1))
+				continue;
+
+			if (ev->event_data.ack.err != 0)
+			{
+				ERROR ("processes plugin: The kernel refused the proc "
+						"connector subscription: %s",
+						sstrerror ((int) ev->event_data.ack.err,
+							errbuf, sizeof (errbuf)));
+				close (cn_sock);
+				cn_sock = -1;
+				return (-1);
+			}
+			acknowledged = 1;
+			break;
+		}
+	}
+
+	cn_pids = c_avl_create (cn_pid_compare);
+	if (cn_pids == NULL)
+	{
+		ERROR ("processes plugin: c_avl_create failed.");
+		close (cn_sock);
+		cn_sock = -1;
+		return (-1);
+	}
+	cn_resync = 1;
+
+	return (0);
+} /* int cn_open */
+
+static void cn_close (void)
+{
+	long *pid;
+	ps_pid_t *p;
+
+	if (cn_sock >= 0)
+	{
+		close (cn_sock);
+		cn_sock = -1;
+	}
+
+	if (cn_pids == NULL)
+		return;
+
+	while (c_avl_pick (cn_pids, (void *) &pid, (void *) &p) == 0)
+		cn_pid_free (p);
+	c_avl_destroy (cn_pids);
+	cn_pids = NULL;
+} /* void cn_close */
+
+/* Without a full scan of /proc, the number of processes in each state isn't
+ * known. Report the number of runnable and blocked tasks the kernel keeps
+ * track of instead. */
+static int ps_read_stat_states (void)
+{
+	FILE *proc_stat;
+	char buffer[1024];
+
+	proc_stat = fopen ("/proc/stat", "r");
+	if (proc_stat == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("processes plugin: fopen (/proc/stat) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	while (fgets (buffer, sizeof (buffer), proc_stat) != NULL)
+	{
+		char *fields[3];
+		int fields_num;
+
+		fields_num = strsplit (buffer, fields,
+				STATIC_ARRAY_SIZE (fields));
+		if (fields_num != 2)
+			continue;
+
+		if (strcmp ("procs_running", fields[0]) == 0)
+			ps_submit_state ("running", atof (fields[1]));
+		else if (strcmp ("procs_blocked", fields[0]) == 0)
+			ps_submit_state ("blocked", atof (fields[1]));
+	}
+	fclose (proc_stat);
+
+	return (0);
+} /* int ps_read_stat_states */
+
+/* Reads the processes followed through the proc connector. Only processes
+ * that belong to a configured group are looked at in /proc. */
+static int ps_read_netlink (void)
+{
+	c_avl_iterator_t *iter;
+	long *pid;
+	ps_pid_t *p;
+	procstat_t *ps_ptr;
+
+	if (cn_read_events () != 0)
+		return (-1);
+
+	if (cn_resync)
+	{
+		int status = cn_scan_proc ();
+		if (status != 0)
+			return (status);
+	}
+
+	iter = c_avl_get_iterator (cn_pids);
+	while (c_avl_iterator_next (iter, (void *) &pid, (void *) &p) == 0)
+	{
+		procstat_t ps;
+		procstat_entry_t pse;
+		char state;
+		size_t i;
+
+		if (!p->classified)
+			cn_pid_classify (p);
+
+		if (p->matches_num == 0)
+			continue;
+
+		if (ps_read_process (p->pid, &ps, &state) != 0)
+			continue;
+
+		ps_fill_entry (p->pid, &ps, &pse);
+		for (i = 0; i < p->matches_num; i++)
+			ps_list_add_entry (p->matches[i], &pse);
+	}
+	c_avl_iterator_destroy (iter);
+
+	ps_read_stat_states ();
+
+	for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+		ps_submit_proc_list (ps_ptr);
+
+	read_fork_rate ();
+
+	return (0);
+} /* int ps_read_netlink */
+#endif /* HAVE_PROC_CONNECTOR */
 #endif /*KERNEL_LINUX */
 
 #if KERNEL_SOLARIS
@@ -1833,6 +2711,19 @@ static int ps_read (void)
 	running = sleeping = zombies = stopped = paging = blocked = 0;
 	ps_list_reset ();
 
+#if HAVE_PROC_CONNECTOR
+	if (use_netlink)
+	{
+		if (ps_read_netlink () == 0)
+			return (0);
+
+		WARNING ("processes plugin: Following processes through the "
+				"proc connector failed. Falling back to scanning /proc.");
+		cn_close ();
+		use_netlink = 0;
+	}
+#endif
+
 	if ((proc = opendir ("/proc")) == NULL)
 	{
 		char errbuf[1024];
@@ -1856,35 +2747,7 @@ static int ps_read (void)
 			continue;
 		}
 
-		memset (&pse, 0, sizeof (pse));
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
-
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
-
-		pse.cswitch_vol = ps.cswitch_vol;
-		pse.cswitch_invol = ps.cswitch_invol;
+		ps_fill_entry (pid, &ps, &pse);
 
 		switch (state)
 		{
@@ -2457,9 +3320,28 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+#if HAVE_PROC_CONNECTOR
+static int ps_shutdown (void)
+{
+	cn_close ();
+# if HAVE_TASKSTATS
+	if (ts_sock >= 0)
+	{
+		close (ts_sock);
+		ts_sock = -1;
+	}
+# endif
+
+	return (0);
+} /* int ps_shutdown */
+#endif /* HAVE_PROC_CONNECTOR */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+#if HAVE_PROC_CONNECTOR
+	plugin_register_shutdown ("processes", ps_shutdown);
+#endif
 } /* void module_register */
@@ -37,10 +37,22 @@
 
 #include "cpython.h"
 
+/* Value lists queued for a write callback registered with "batch". */
+typedef struct {
+	pthread_mutex_t lock;
+	value_list_t *vl;           /* Copies, including values and meta data. */
+	const data_set_t **ds;
+	size_t num;
+	size_t size;
+	cdtime_t first;             /* When the oldest queued value list was added. */
+	cdtime_t max_age;
+} cpy_batch_t;
+
 typedef struct cpy_callback_s {
 	char *name;
 	PyObject *callback;
 	PyObject *data;
+	cpy_batch_t *batch;         /* Write callbacks only, may be NULL. */
 	struct cpy_callback_s *next;
 } cpy_callback_t;
 
@@ -144,7 +156,7 @@ static char reg_read_doc[] = "register_read(callback[, interval][, data][, name]
 		"The callback function will be called without parameters, except for\n"
 		"data if it was supplied.";
 
-static char reg_write_doc[] = "register_write(callback[, data][, name]) -> identifier\n"
+static char reg_write_doc[] = "register_write(callback[, data][, name][, batch]) -> identifier\n"
 		"\n"
 		"Register a callback function to receive values dispatched by other plugins.\n"
 		"'callback' is a callable object that will be called every time a value\n"
@@ -156,10 +168,15 @@ static char reg_write_doc[] = "register_write(callback[, data][, name]) -> ident
 		"    Every callback needs a unique identifier, so if you want to\n"
 		"    register this callback multiple time from the same module you need\n"
 		"    to specify a name here.\n"
+		"'batch' is an optional number of value lists to pass to the callback\n"
+		"    at once. Values are queued until this many have been dispatched\n"
+		"    or the oldest one is one interval old. The default, 0, calls\n"
+		"    the callback for every value list.\n"
 		"'identifier' is the full identifier assigned to this callback.\n"
 		"\n"
 		"The callback function will be called with one or two parameters:\n"
-		"values: A Values object which is a copy of the dispatched values.\n"
+		"values: A Values object which is a copy of the dispatched values or,\n"
+		"    if 'batch' was given, a list of such objects.\n"
 		"data: The optional data parameter passed to the register function.\n"
 		"    If the parameter was omitted it will be omitted here, too.";
 
@@ -236,8 +253,81 @@ static cpy_callback_t *cpy_config_callbacks;
 static cpy_callback_t *cpy_init_callbacks;
 static cpy_callback_t *cpy_shutdown_callbacks;
 
+/* Write callbacks with a batch. Like the lists above it is protected by the GIL. */
+static cpy_callback_t *cpy_batch_callbacks;
+
+/* The context of the python plugin, i.e. the options of its LoadPlugin block. */
+static plugin_ctx_t cpy_ctx;
+
+/* Set when the batches are delivered by the "python" flush callback and the
+ * "python/batch" timer. Protected by the GIL. */
+static _Bool cpy_batch_registered;
+
+/* The daemon's threads may call the write, flush, log and notification
+ * callbacks until the very end, i.e. after cpy_shutdown() has finalized the
+ * interpreter. They count themselves in "cpy_active" while they use it, so
+ * that cpy_shutdown() can wait for them, and skip Python afterwards. */
+static pthread_mutex_t cpy_active_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cpy_active_cond = PTHREAD_COND_INITIALIZER;
+static int cpy_active;
+static _Bool cpy_finalized;
+
+static int cpy_enter(void) {
+	pthread_mutex_lock(&cpy_active_lock);
+	if (cpy_finalized) {
+		pthread_mutex_unlock(&cpy_active_lock);
+		return -1;
+	}
+	cpy_active++;
+	pthread_mutex_unlock(&cpy_active_lock);
+	return 0;
+}
+
+static void cpy_leave(void) {
+	pthread_mutex_lock(&cpy_active_lock);
+	cpy_active--;
+	if (cpy_active == 0)
+		pthread_cond_broadcast(&cpy_active_cond);
+	pthread_mutex_unlock(&cpy_active_lock);
+}
+
+static void cpy_batch_free(value_list_t *vl, size_t num) {
+	size_t i;
+
+	for (i = 0; i < num; ++i) {
+		free(vl[i].values);
+		meta_data_destroy(vl[i].meta);
+	}
+}
+
+static void cpy_batch_destroy(cpy_callback_t *c) {
+	cpy_callback_t *prev = NULL, *tmp;
+	cpy_batch_t *b = c->batch;
+
+	for (tmp = cpy_batch_callbacks; tmp; prev = tmp, tmp = tmp->next)
+		if (tmp == c)
+			break;
+	if (tmp != NULL) {
+		if (prev == NULL)
+			cpy_batch_callbacks = tmp->next;
+		else
+			prev->next = tmp->next;
+	}
+
+	/* Batches are delivered by cpy_shutdown() and nothing is queued after
+	 * that, so this is only left if the writer is unregistered. */
+	cpy_batch_free(b->vl, b->num);
+	free(b->vl);
+	free(b->ds);
+	pthread_mutex_destroy(&b->lock);
+	free(b);
+	c->batch = NULL;
+}
+
 static void cpy_destroy_user_data(void *data) {
 	cpy_callback_t *c = data;
+	if (c->batch != NULL)
+		cpy_batch_destroy(c);
 	free(c->name);
 	Py_DECREF(c->callback);
 	Py_XDECREF(c->data);
@@ -354,113 +444,288 @@ static int cpy_read_callback(user_data_t *data) {
 	return 0;
 }
 
-static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+/* Converts a value list into a new Values object. You must hold the GIL to call
+ * this function. Returns NULL, with the exception logged, on error. */
+static Values *cpy_build_values(const data_set_t *ds, const value_list_t *value_list) {
 	size_t i;
-	cpy_callback_t *c = data->data;
-	PyObject *ret, *list, *temp, *dict = NULL;
+	PyObject *list, *temp, *dict = NULL;
 	Values *v;
 
-	CPY_LOCK_THREADS
-		list = PyList_New(value_list->values_len); /* New reference. */
-		if (list == NULL) {
-			cpy_log_exception("write callback");
-			CPY_RETURN_FROM_THREADS 0;
+	list = PyList_New(value_list->values_len); /* New reference. */
+	if (list == NULL) {
+		cpy_log_exception("write callback");
+		return NULL;
+	}
+	for (i = 0; i < value_list->values_len; ++i) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
+			PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
+			PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
+			PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
+			PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
+		} else {
+			Py_BEGIN_ALLOW_THREADS
+			ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
+			Py_END_ALLOW_THREADS
+			Py_DECREF(list);
+			return NULL;
 		}
-		for (i = 0; i < value_list->values_len; ++i) {
-			if (ds->ds[i].type == DS_TYPE_COUNTER) {
-				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].counter));
-			} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
-				PyList_SetItem(list, i, PyFloat_FromDouble(value_list->values[i].gauge));
-			} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-				PyList_SetItem(list, i, PyLong_FromLongLong(value_list->values[i].derive));
-			} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
-				PyList_SetItem(list, i, PyLong_FromUnsignedLongLong(value_list->values[i].absolute));
-			} else {
-				Py_BEGIN_ALLOW_THREADS
-				ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
-				Py_END_ALLOW_THREADS
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
-			}
-			if (PyErr_Occurred() != NULL) {
-				cpy_log_exception("value building for write callback");
-				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
-			}
+		if (PyErr_Occurred() != NULL) {
+			cpy_log_exception("value building for write callback");
+			Py_DECREF(list);
+			return NULL;
 		}
-		dict = PyDict_New();  /* New reference. */
-		if (value_list->meta) {
-			int num;
-			char **table;
-			meta_data_t *meta = value_list->meta;
-
-			num = meta_data_toc(meta, &table);
-			for (i = 0; i < num; ++i) {
-				int type;
-				char *string;
-				int64_t si;
-				uint64_t ui;
-				double d;
-				_Bool b;
-
-				type = meta_data_type(meta, table[i]);
-				if (type == MD_TYPE_STRING) {
-					if (meta_data_get_string(meta, table[i], &string))
-						continue;
-					temp = cpy_string_to_unicode_or_bytes(string);  /* New reference. */
-					free(string);
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_SIGNED_INT) {
-					if (meta_data_get_signed_int(meta, table[i], &si))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &SignedType, PyLong_FromLongLong(si), (void *) 0);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_UNSIGNED_INT) {
-					if (meta_data_get_unsigned_int(meta, table[i], &ui))
-						continue;
-					temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, PyLong_FromUnsignedLongLong(ui), (void *) 0);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_DOUBLE) {
-					if (meta_data_get_double(meta, table[i], &d))
-						continue;
-					temp = PyFloat_FromDouble(d);  /* New reference. */
-					PyDict_SetItemString(dict, table[i], temp);
-					Py_XDECREF(temp);
-				} else if (type == MD_TYPE_BOOLEAN) {
-					if (meta_data_get_boolean(meta, table[i], &b))
-						continue;
-					if (b)
-						PyDict_SetItemString(dict, table[i], Py_True);
-					else
-						PyDict_SetItemString(dict, table[i], Py_False);
-				}
-				free(table[i]);
+	}
+	dict = PyDict_New();  /* New reference. */
+	if (value_list->meta) {
+		int num;
+		char **table;
+		meta_data_t *meta = value_list->meta;
+
+		num = meta_data_toc(meta, &table);
+		for (i = 0; i < num; ++i) {
+			int type;
+			char *string;
+			int64_t si;
+			uint64_t ui;
+			double d;
+			_Bool b;
+
+			type = meta_data_type(meta, table[i]);
+			if (type == MD_TYPE_STRING) {
+				if (meta_data_get_string(meta, table[i], &string))
+					continue;
+				temp = cpy_string_to_unicode_or_bytes(string);  /* New reference. */
+				free(string);
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_SIGNED_INT) {
+				if (meta_data_get_signed_int(meta, table[i], &si))
+					continue;
+				temp = PyObject_CallFunctionObjArgs((void *) &SignedType, PyLong_FromLongLong(si), (void *) 0);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_UNSIGNED_INT) {
+				if (meta_data_get_unsigned_int(meta, table[i], &ui))
+					continue;
+				temp = PyObject_CallFunctionObjArgs((void *) &UnsignedType, PyLong_FromUnsignedLongLong(ui), (void *) 0);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_DOUBLE) {
+				if (meta_data_get_double(meta, table[i], &d))
+					continue;
+				temp = PyFloat_FromDouble(d);  /* New reference. */
+				PyDict_SetItemString(dict, table[i], temp);
+				Py_XDECREF(temp);
+			} else if (type == MD_TYPE_BOOLEAN) {
+				if (meta_data_get_boolean(meta, table[i], &b))
+					continue;
+				if (b)
+					PyDict_SetItemString(dict, table[i], Py_True);
+				else
+					PyDict_SetItemString(dict, table[i], Py_False);
 			}
-			free(table);
+			free(table[i]);
 		}
-		v = (Values *) Values_New(); /* New reference. */
-		sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
-		sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
-		sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
-		sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
-		sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
-		v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
-		v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
-		Py_CLEAR(v->values);
-		v->values = list;
-		Py_CLEAR(v->meta);
-		v->meta = dict;  /* Steals a reference. */
-		ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data, (void *) 0); /* New reference. */
-		Py_XDECREF(v);
-		if (ret == NULL) {
-			cpy_log_exception("write callback");
-		} else {
-			Py_DECREF(ret);
+		free(table);
+	}
+	v = (Values *) Values_New(); /* New reference. */
+	sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
+	sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
+	sstrncpy(v->data.type_instance, value_list->type_instance, sizeof(v->data.type_instance));
+	sstrncpy(v->data.plugin, value_list->plugin, sizeof(v->data.plugin));
+	sstrncpy(v->data.plugin_instance, value_list->plugin_instance, sizeof(v->data.plugin_instance));
+	v->data.time = CDTIME_T_TO_DOUBLE(value_list->time);
+	v->interval = CDTIME_T_TO_DOUBLE(value_list->interval);
+	Py_CLEAR(v->values);
+	v->values = list;
+	Py_CLEAR(v->meta);
+	v->meta = dict;  /* Steals a reference. */
+	return v;
+}
+
+/* Passes the queued value lists to the callback as one list of Values objects
+ * and frees them. You must hold the GIL to call this function. */
+static void cpy_batch_deliver(cpy_callback_t *c, value_list_t *vl, const data_set_t **ds, size_t num) {
+	size_t i;
+	PyObject *ret, *list;
+	Values *v;
+
+	list = PyList_New(0); /* New reference. */
+	if (list == NULL) {
+		cpy_log_exception("write callback");
+		return;
+	}
+	for (i = 0; i < num; ++i) {
+		v = cpy_build_values(ds[i], vl + i); /* New reference. */
+		if (v == NULL)
+			continue;
+		PyList_Append(list, (PyObject *) v);
+		Py_DECREF(v);
+	}
+	ret = PyObject_CallFunctionObjArgs(c->callback, list, c->data, (void *) 0); /* New reference. */
+	Py_DECREF(list);
+	if (ret == NULL) {
+		cpy_log_exception("write callback");
+	} else {
+		Py_DECREF(ret);
+	}
+}
+
+/* Takes all queued value lists out of the batch. The caller must hold
+ * "b->lock" and free the returned arrays. */
+static size_t cpy_batch_take(cpy_batch_t *b, value_list_t **vl, const data_set_t ***ds) {
+	size_t num = b->num;
+
+	*vl = b->vl;
+	*ds = b->ds;
+	b->vl = NULL;
+	b->ds = NULL;
+	b->num = 0;
+	return num;
+}
+
+/* Queues a copy of "value_list" and delivers the batch if it is full or the
+ * oldest value list in it is older than the plugin's interval. Only the
+ * delivery needs the GIL. */
+static int cpy_batch_write(cpy_callback_t *c, const data_set_t *ds, const value_list_t *value_list) {
+	cpy_batch_t *b = c->batch;
+	value_list_t *vl = NULL;
+	const data_set_t **vl_ds = NULL;
+	size_t num = 0;
+	value_list_t copy;
+	cdtime_t now = cdtime();
+
+	copy = *value_list;
+	copy.values = malloc(value_list->values_len * sizeof(*copy.values));
+	if (copy.values == NULL) {
+		ERROR("python plugin: malloc failed.");
+		return -1;
+	}
+	memcpy(copy.values, value_list->values, value_list->values_len * sizeof(*copy.values));
+	copy.meta = (value_list->meta != NULL) ? meta_data_clone(value_list->meta) : NULL;
+
+	pthread_mutex_lock(&b->lock);
+	if (b->vl == NULL) {
+		b->vl = calloc(b->size, sizeof(*b->vl));
+		b->ds = calloc(b->size, sizeof(*b->ds));
+		if ((b->vl == NULL) || (b->ds == NULL)) {
+			sfree(b->vl);
+			sfree(b->ds);
+			pthread_mutex_unlock(&b->lock);
+			ERROR("python plugin: calloc failed.");
+			cpy_batch_free(&copy, 1);
+			return -1;
+		}
+	}
+	if (b->num == 0)
+		b->first = now;
+	b->vl[b->num] = copy;
+	b->ds[b->num] = ds;
+	b->num++;
+	if ((b->num >= b->size) || ((now - b->first) >= b->max_age))
+		num = cpy_batch_take(b, &vl, &vl_ds);
+	pthread_mutex_unlock(&b->lock);
+
+	if (num == 0)
+		return 0;
+
+	CPY_LOCK_THREADS
+		cpy_batch_deliver(c, vl, vl_ds, num);
+	CPY_RELEASE_THREADS
+	cpy_batch_free(vl, num);
+	free(vl);
+	free(vl_ds);
+	return 0;
+}
+
+/* Delivers the batches whose oldest value list is at least "age" old, or has
+ * reached the batch's maximum age. You must hold the GIL to call this
+ * function. */
+static void cpy_batch_deliver_aged(cdtime_t age) {
+	cpy_callback_t *c;
+	cdtime_t now = cdtime();
+
+	for (c = cpy_batch_callbacks; c; c = c->next) {
+		value_list_t *vl = NULL;
+		const data_set_t **ds = NULL;
+		size_t num = 0;
+
+		pthread_mutex_lock(&c->batch->lock);
+		if ((c->batch->num > 0)
+				&& (((now - c->batch->first) >= age)
+					|| ((now - c->batch->first) >= c->batch->max_age)))
+			num = cpy_batch_take(c->batch, &vl, &ds);
+		pthread_mutex_unlock(&c->batch->lock);
+		if (num == 0)
+			continue;
+		cpy_batch_deliver(c, vl, ds, num);
+		cpy_batch_free(vl, num);
+		free(vl);
+		free(ds);
+	}
+}
+
+/* Flush callback "python": delivers the batches older than "timeout", i.e.
+ * all of them when the daemon flushes everything. */
+static int cpy_batch_flush_callback(cdtime_t timeout, const char *id, user_data_t *data) {
+	if (cpy_enter() != 0)
+		return 0;
+	CPY_LOCK_THREADS
+		cpy_batch_deliver_aged(timeout);
+	CPY_RELEASE_THREADS
+	cpy_leave();
+	return 0;
+}
+
+/* Read callback "python/batch": delivers the batches that have reached their
+ * maximum age even if no more value lists arrive. */
+static int cpy_batch_timer_callback(user_data_t *data) {
+	if (cpy_enter() != 0)
+		return 0;
+	CPY_LOCK_THREADS
+		cpy_batch_deliver_aged(/* age = */ (cdtime_t) -1);
+	CPY_RELEASE_THREADS
+	cpy_leave();
+	return 0;
+}
+
+static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+	cpy_callback_t *c = data->data;
+	PyObject *ret;
+	Values *v;
+	int status = 0;
+
+	if (cpy_enter() != 0) {
+		static _Bool complained;
+		if (!complained) {
+			NOTICE("python plugin: Dropping value lists written after the interpreter was shut down.");
+			complained = 1;
+		}
+		return -1;
+	}
+
+	if (c->batch != NULL) {
+		status = cpy_batch_write(c, ds, value_list);
+		cpy_leave();
+		return status;
+	}
+
+	CPY_LOCK_THREADS
+		v = cpy_build_values(ds, value_list); /* New reference. */
+		if (v != NULL) {
+			ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data, (void *) 0); /* New reference. */
+			Py_DECREF(v);
+			if (ret == NULL) {
+				cpy_log_exception("write callback");
+			} else {
+				Py_DECREF(ret);
+			}
 		}
 	CPY_RELEASE_THREADS
+	cpy_leave();
 	return 0;
 }
 
@@ -469,6 +734,9 @@ static int cpy_notification_callback(const notification_t *notification, user_da
 	PyObject *ret, *notify;
 	Notification *n;
 
+	if (cpy_enter() != 0)
+		return 0;
+
 	CPY_LOCK_THREADS
 		notify = Notification_New(); /* New reference. */
 		n = (Notification *) notify;
@@ -488,6 +756,7 @@ static int cpy_notification_callback(const notification_t *notification, user_da
 			Py_DECREF(ret);
 		}
 	CPY_RELEASE_THREADS
+	cpy_leave();
 	return 0;
 }
 
@@ -495,6 +764,9 @@ static void cpy_log_callback(int severity, const char *message, user_data_t *dat
 	cpy_callback_t * c = data->data;
 	PyObject *ret, *text;
 
+	if (cpy_enter() != 0)
+		return;
+
 	CPY_LOCK_THREADS
 	text = cpy_string_to_unicode_or_bytes(message);  /* New reference. */
 	if (c->data == NULL)
@@ -513,12 +785,16 @@ static void cpy_log_callback(int severity, const char *message, user_data_t *dat
 		Py_DECREF(ret);
 	}
 	CPY_RELEASE_THREADS
+	cpy_leave();
 }
 
 static void cpy_flush_callback(int timeout, const char *id, user_data_t *data) {
 	cpy_callback_t * c = data->data;
 	PyObject *ret, *text;
 
+	if (cpy_enter() != 0)
+		return;
+
 	CPY_LOCK_THREADS
 	text = cpy_string_to_unicode_or_bytes(id);
 	if (c->data == NULL)
@@ -532,6 +808,7 @@ static void cpy_flush_callback(int timeout, const char *id, user_data_t *data) {
 		Py_DECREF(ret);
 	}
 	CPY_RELEASE_THREADS
+	cpy_leave();
 }
 
 static PyObject *cpy_register_generic(cpy_callback_t **list_head, PyObject *args, PyObject *kwds) {
@@ -705,8 +982,77 @@ static PyObject *cpy_register_log(PyObject *self, PyObject *args, PyObject *kwds
 }
 
 static PyObject *cpy_register_write(PyObject *self, PyObject *args, PyObject *kwds) {
-	return cpy_register_generic_userdata((void *) plugin_register_write,
-			(void *) cpy_write_callback, args, kwds);
+	char buf[512];
+	cpy_callback_t *c = NULL;
+	user_data_t user_data;
+	plugin_ctx_t old_ctx;
+	int batch = 0;
+	char *name = NULL;
+	PyObject *callback = NULL, *data = NULL;
+	static char *kwlist[] = {"callback", "data", "name", "batch", NULL};
+
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "O|Oeti", kwlist, &callback, &data, NULL, &name, &batch) == 0) return NULL;
+	if (PyCallable_Check(callback) == 0) {
+		PyMem_Free(name);
+		PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+		return NULL;
+	}
+	if (batch < 0) {
+		PyMem_Free(name);
+		PyErr_SetString(PyExc_ValueError, "batch must not be negative.");
+		return NULL;
+	}
+	cpy_build_name(buf, sizeof(buf), callback, name);
+	PyMem_Free(name);
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return PyErr_NoMemory();
+
+	/* Register in the plugin's context even if called from a thread the
+	 * module started itself, so that the WriteThreads and WriteQueue*
+	 * options of the LoadPlugin block apply to all Python writers. */
+	old_ctx = plugin_set_ctx(cpy_ctx);
+	if (batch > 0) {
+		c->batch = calloc(1, sizeof(*c->batch));
+		if (c->batch == NULL) {
+			plugin_set_ctx(old_ctx);
+			free(c);
+			return PyErr_NoMemory();
+		}
+		pthread_mutex_init(&c->batch->lock, NULL);
+		c->batch->size = (size_t) batch;
+		c->batch->max_age = plugin_get_interval();
+	}
+
+	Py_INCREF(callback);
+	Py_XINCREF(data);
+
+	c->name = strdup(buf);
+	c->callback = callback;
+	c->data = data;
+	c->next = NULL;
+	if (c->batch != NULL) {
+		c->next = cpy_batch_callbacks;
+		cpy_batch_callbacks = c;
+	}
+
+	if ((c->batch != NULL) && !cpy_batch_registered) {
+		user_data_t batch_data = { 0 };
+
+		plugin_register_flush("python", cpy_batch_flush_callback, &batch_data);
+		plugin_register_complex_read(/* group = */ "python", "python/batch",
+				cpy_batch_timer_callback, c->batch->max_age, &batch_data);
+		cpy_batch_registered = 1;
+	}
+
+	memset (&user_data, 0, sizeof (user_data));
+	user_data.free_func = cpy_destroy_user_data;
+	user_data.data = c;
+
+	plugin_register_write(buf, cpy_write_callback, &user_data);
+	plugin_set_ctx(old_ctx);
+	return cpy_string_to_unicode_or_bytes(buf);
 }
 
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args, PyObject *kwds) {
@@ -901,10 +1247,22 @@ static int cpy_shutdown(void) {
 	cpy_callback_t *c;
 	PyObject *ret;
 
+	/* From now on, the callbacks skip the interpreter. Wait for those
+	 * still in it before taking the GIL. */
+	pthread_mutex_lock(&cpy_active_lock);
+	cpy_finalized = 1;
+	while (cpy_active > 0)
+		pthread_cond_wait(&cpy_active_cond, &cpy_active_lock);
+	pthread_mutex_unlock(&cpy_active_lock);
+
 	/* This can happen if the module was loaded but not configured. */
 	if (state != NULL)
 		PyEval_RestoreThread(state);
 
+	/* The batches have been delivered by the flush before the shutdown,
+	 * but the write threads may have queued more since. */
+	cpy_batch_deliver_aged(0);
+
 	for (c = cpy_shutdown_callbacks; c; c = c->next) {
 		ret = PyObject_CallFunctionObjArgs(c->callback, c->data, (void *) 0); /* New reference. */
 		if (ret == NULL)
@@ -1123,6 +1481,8 @@ static int cpy_config(oconfig_item_t *ci) {
 
 	if (!Py_IsInitialized() && cpy_init_python()) return 1;
 
+	cpy_ctx = plugin_get_ctx();
+
 	for (i = 0; i < ci->children_num; ++i) {
 		oconfig_item_t *item = ci->children + i;
 
@@ -27,12 +27,64 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+#define RC_DEFAULT_PORT "42217"
+#define RC_DEFAULT_BATCH_SIZE 100
+
+/*
+ * Private data types
+ */
+/* One connection to the daemon. Only one thread at a time may use it. */
+struct rc_conn_s
+{
+  pthread_mutex_t lock;
+  int fd;
+  char rbuf[4096];
+  size_t rbuf_len;
+};
+typedef struct rc_conn_s rc_conn_t;
+
+/* Updates collected by one write thread, sent with one BATCH command. The
+ * offset of each "UPDATE" line is kept so that errors reported by the daemon
+ * can be mapped back to the file. */
+struct rc_batch_s
+{
+  pthread_mutex_t lock;
+
+  char *buffer;
+  size_t buffer_len;
+  size_t buffer_size;
+
+  size_t *commands;
+  size_t commands_num;
+
+  cdtime_t first;
+  cdtime_t timeout;
+
+  struct rc_batch_s *next;
+};
+typedef struct rc_batch_s rc_batch_t;
+
+/* Existence cache entry. Files known to exist are not checked again; files
+ * which do not exist (yet) are checked again after "retry". */
+struct rc_file_s
+{
+  _Bool exists;
+  cdtime_t retry;
+};
+typedef struct rc_file_s rc_file_t;
+
 /*
  * Private variables
  */
@@ -40,6 +92,8 @@ static char *datadir = NULL;
 static char *daemon_address = NULL;
 static _Bool config_create_files = 1;
 static _Bool config_collect_stats = 1;
+static int config_batch_size = RC_DEFAULT_BATCH_SIZE;
+static int config_connections = 1;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -56,12 +110,32 @@ static rrdcreate_config_t rrdcreate_config =
 	/* async = */ 0
 };
 
+/* Parsed from "daemon_address" by rc_init(). "daemon_path" points into
+ * "daemon_address", "daemon_service" into "daemon_node" or to the default
+ * port. */
+static char const *daemon_path = NULL;
+static char *daemon_node = NULL;
+static char const *daemon_service = RC_DEFAULT_PORT;
+
+static rc_conn_t *connections = NULL;
+static size_t connections_num = 0;
+static size_t connections_next = 0;
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t batch_key;
+static _Bool batch_key_valid = 0;
+static rc_batch_t *batch_list = NULL;
+static pthread_mutex_t batch_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static c_avl_tree_t *files = NULL;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Prototypes.
  */
 static int rc_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t __attribute__((unused)) *user_data);
-static int rc_flush (__attribute__((unused)) cdtime_t timeout,
+static int rc_flush (cdtime_t timeout,
     const char *identifier, __attribute__((unused)) user_data_t *ud);
 
 static int value_list_to_string (char *buffer, int buffer_len,
@@ -271,6 +345,18 @@ static int rc_config (oconfig_item_t *ci)
     }
     else if (strcasecmp ("XFF", key) == 0)
       status = rc_config_get_xff (child, &rrdcreate_config.xff);
+    else if (strcasecmp ("BatchSize", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &config_batch_size);
+      if ((status == 0) && (config_batch_size < 1))
+        config_batch_size = 1;
+    }
+    else if (strcasecmp ("Connections", key) == 0)
+    {
+      status = rc_config_get_int_positive (child, &config_connections);
+      if ((status == 0) && (config_connections < 1))
+        config_connections = 1;
+    }
     else
     {
       WARNING ("rrdcached plugin: Ignoring invalid option %s.", key);
@@ -399,11 +485,742 @@ static int rc_read (void)
   return (0);
 } /* int rc_read */
 
+/*
+ * RRD file existence cache
+ */
+static void rc_file_set (char const *filename, _Bool exists, /* {{{ */
+    cdtime_t retry)
+{
+  rc_file_t *f = NULL;
+
+  pthread_mutex_lock (&files_lock);
+  if (c_avl_get (files, filename, (void *) &f) != 0)
+  {
+    char *key = strdup (filename);
+
+    f = calloc (1, sizeof (*f));
+    if ((key == NULL) || (f == NULL) || (c_avl_insert (files, key, f) != 0))
+    {
+      sfree (key);
+      sfree (f);
+      pthread_mutex_unlock (&files_lock);
+      return;
+    }
+  }
+
+  f->exists = exists;
+  f->retry = retry;
+  pthread_mutex_unlock (&files_lock);
+} /* }}} void rc_file_set */
+
+static void rc_file_forget (char const *filename) /* {{{ */
+{
+  char *key = NULL;
+  rc_file_t *f = NULL;
+
+  pthread_mutex_lock (&files_lock);
+  if (c_avl_remove (files, filename, (void *) &key, (void *) &f) == 0)
+  {
+    sfree (key);
+    sfree (f);
+  }
+  pthread_mutex_unlock (&files_lock);
+} /* }}} void rc_file_forget */
+
+/* Makes sure "filename" exists, creating it if necessary. Returns zero if the
+ * update may be sent, greater than zero if the file is being created in the
+ * background and the update has to be dropped, and less than zero on error.
+ * Files are only stat'ed when they are seen for the first time. */
+static int rc_file_check (char const *filename, /* {{{ */
+    data_set_t const *ds, value_list_t const *vl)
+{
+  struct stat statbuf;
+  rc_file_t *f = NULL;
+  cdtime_t now;
+  int status;
+
+  now = cdtime ();
+
+  pthread_mutex_lock (&files_lock);
+  if (c_avl_get (files, filename, (void *) &f) == 0)
+  {
+    _Bool exists = f->exists;
+    cdtime_t retry = f->retry;
+
+    pthread_mutex_unlock (&files_lock);
+    if (exists)
+      return (0);
+    if (now < retry)
+      return (1);
+  }
+  else
+    pthread_mutex_unlock (&files_lock);
+
+  status = stat (filename, &statbuf);
+  if (status == 0)
+  {
+    rc_file_set (filename, /* exists = */ 1, /* retry = */ 0);
+    return (0);
+  }
+
+  if (errno != ENOENT)
+  {
+    char errbuf[1024];
+    ERROR ("rrdcached plugin: stat (%s) failed: %s",
+        filename, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
+        filename);
+    return (-1);
+  }
+
+  if (rrdcreate_config.async)
+  {
+    rc_file_set (filename, /* exists = */ 0, /* retry = */ now + vl->interval);
+    return (1);
+  }
+
+  rc_file_set (filename, /* exists = */ 1, /* retry = */ 0);
+  return (0);
+} /* }}} int rc_file_check */
+
+/*
+ * Connections to the daemon
+ */
+static int rc_parse_address (void) /* {{{ */
+{
+  char *port = NULL;
+
+  if (strncmp ("unix:", daemon_address, strlen ("unix:")) == 0)
+  {
+    daemon_path = daemon_address + strlen ("unix:");
+    return (0);
+  }
+  else if (daemon_address[0] == '/')
+  {
+    daemon_path = daemon_address;
+    return (0);
+  }
+
+  sfree (daemon_node);
+  daemon_node = strdup (daemon_address);
+  if (daemon_node == NULL)
+    return (ENOMEM);
+
+  if (daemon_node[0] == '[')
+  {
+    char *end = strchr (daemon_node, ']');
+
+    if (end == NULL)
+    {
+      ERROR ("rrdcached plugin: Invalid daemon address: %s", daemon_address);
+      return (EINVAL);
+    }
+
+    if (end[1] == ':')
+      port = end + 2;
+    *end = 0;
+    memmove (daemon_node, daemon_node + 1, strlen (daemon_node + 1) + 1);
+  }
+  else
+  {
+    char *colon = strchr (daemon_node, ':');
+
+    /* More than one colon is an IPv6 address without a port. */
+    if ((colon != NULL) && (strchr (colon + 1, ':') == NULL))
+    {
+      *colon = 0;
+      port = colon + 1;
+    }
+  }
+
+  if ((port != NULL) && (port[0] != 0))
+    daemon_service = port;
+
+  return (0);
+} /* }}} int rc_parse_address */
+
+static void rc_conn_close (rc_conn_t *conn) /* {{{ */
+{
+  if (conn->fd >= 0)
+    close (conn->fd);
+  conn->fd = -1;
+  conn->rbuf_len = 0;
+} /* }}} void rc_conn_close */
+
+static int rc_conn_connect (rc_conn_t *conn) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  char errbuf[1024];
+  int status;
+
+  if (conn->fd >= 0)
+    return (0);
+  conn->rbuf_len = 0;
+
+  if (daemon_path != NULL)
+  {
+    struct sockaddr_un sa;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sun_family = AF_UNIX;
+    sstrncpy (sa.sun_path, daemon_path, sizeof (sa.sun_path));
+
+    conn->fd = socket (PF_UNIX, SOCK_STREAM, 0);
+    if (conn->fd < 0)
+    {
+      ERROR ("rrdcached plugin: socket failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    if (connect (conn->fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+    {
+      ERROR ("rrdcached plugin: Connecting to %s failed: %s", daemon_address,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      rc_conn_close (conn);
+      return (-1);
+    }
+
+    return (0);
+  }
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  status = getaddrinfo (daemon_node, daemon_service, &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: getaddrinfo (%s, %s) failed: %s",
+        daemon_node, daemon_service, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    conn->fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (conn->fd < 0)
+      continue;
+
+    if (connect (conn->fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+      break;
+
+    close (conn->fd);
+    conn->fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (conn->fd < 0)
+  {
+    ERROR ("rrdcached plugin: Connecting to %s failed.", daemon_address);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_conn_connect */
+
+/* Reads one line of the daemon's response into "buffer", without the
+ * trailing newline. Overlong lines are truncated. */
+static int rc_conn_read_line (rc_conn_t *conn, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  while (42)
+  {
+    char *eol;
+    ssize_t status;
+
+    eol = memchr (conn->rbuf, '\n', conn->rbuf_len);
+    if (eol != NULL)
+    {
+      size_t len = (size_t) (eol - conn->rbuf);
+
+      sstrncpy (buffer, conn->rbuf,
+          (len < buffer_size) ? (len + 1) : buffer_size);
+      conn->rbuf_len -= len + 1;
+      memmove (conn->rbuf, eol + 1, conn->rbuf_len);
+      return (0);
+    }
+
+    if (conn->rbuf_len >= sizeof (conn->rbuf))
+      return (-1);
+
+    status = recv (conn->fd, conn->rbuf + conn->rbuf_len,
+        sizeof (conn->rbuf) - conn->rbuf_len, /* flags = */ 0);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    if (status <= 0)
+      return (-1);
+
+    conn->rbuf_len += (size_t) status;
+  }
+} /* }}} int rc_conn_read_line */
+
+/* Returns a locked connection. Connections are tried round-robin so that
+ * write threads spread across them; if all are busy, waits for one. */
+static rc_conn_t *rc_conn_acquire (void) /* {{{ */
+{
+  rc_conn_t *conn;
+  size_t start;
+  size_t i;
+
+  pthread_mutex_lock (&connections_lock);
+  start = connections_next;
+  connections_next = (connections_next + 1) % connections_num;
+  pthread_mutex_unlock (&connections_lock);
+
+  for (i = 0; i < connections_num; i++)
+  {
+    conn = connections + ((start + i) % connections_num);
+    if (pthread_mutex_trylock (&conn->lock) == 0)
+      return (conn);
+  }
+
+  conn = connections + start;
+  pthread_mutex_lock (&conn->lock);
+  return (conn);
+} /* }}} rc_conn_t *rc_conn_acquire */
+
+/* Sends "command" and reads the first line of the response. Returns EAGAIN if
+ * the command could not be sent, for example because the daemon closed an
+ * idle connection, so the caller may try again. */
+static int rc_conn_command (rc_conn_t *conn, /* {{{ */
+    char const *command, size_t command_len,
+    char *response, size_t response_size)
+{
+  if (rc_conn_connect (conn) != 0)
+    return (-1);
+
+  if (swrite (conn->fd, command, command_len) != 0)
+  {
+    rc_conn_close (conn);
+    return (EAGAIN);
+  }
+
+  if (rc_conn_read_line (conn, response, response_size) != 0)
+  {
+    ERROR ("rrdcached plugin: Reading the response from %s failed.",
+        daemon_address);
+    rc_conn_close (conn);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rc_conn_command */
+
+/* Copies "filename" to "buffer", escaping spaces and backslashes the way the
+ * daemon expects. Returns the number of bytes written, or zero if "buffer" is
+ * too small or "filename" contains a newline. */
+static size_t rc_escape (char *buffer, size_t buffer_size, /* {{{ */
+    char const *filename)
+{
+  size_t len = 0;
+
+  for (; *filename != 0; filename++)
+  {
+    if (*filename == '\n')
+      return (0);
+
+    if ((*filename == ' ') || (*filename == '\\'))
+    {
+      if ((len + 1) >= buffer_size)
+        return (0);
+      buffer[len++] = '\\';
+    }
+
+    if ((len + 1) >= buffer_size)
+      return (0);
+    buffer[len++] = *filename;
+  }
+
+  buffer[len] = 0;
+  return (len);
+} /* }}} size_t rc_escape */
+
+/*
+ * Batches of updates
+ */
+static rc_batch_t *rc_batch_create (void) /* {{{ */
+{
+  rc_batch_t *b;
+
+  b = calloc (1, sizeof (*b));
+  if (b == NULL)
+    return (NULL);
+
+  b->commands = calloc ((size_t) config_batch_size, sizeof (*b->commands));
+  if (b->commands == NULL)
+  {
+    sfree (b);
+    return (NULL);
+  }
+
+  pthread_mutex_init (&b->lock, /* attr = */ NULL);
+  return (b);
+} /* }}} rc_batch_t *rc_batch_create */
+
+static void rc_batch_destroy (rc_batch_t *b) /* {{{ */
+{
+  if (b == NULL)
+    return;
+
+  pthread_mutex_destroy (&b->lock);
+  sfree (b->buffer);
+  sfree (b->commands);
+  sfree (b);
+} /* }}} void rc_batch_destroy */
+
+static int rc_batch_append (rc_batch_t *b, /* {{{ */
+    char const *filename, char const *values)
+{
+  char escaped[2 * PATH_MAX + 1];
+  size_t escaped_len;
+  size_t needed;
+  int status;
+
+  assert (b->commands_num < (size_t) config_batch_size);
+
+  escaped_len = rc_escape (escaped, sizeof (escaped), filename);
+  if (escaped_len == 0)
+    return (EINVAL);
+
+  /* "UPDATE <file> <values>\n" and a terminating null byte. */
+  needed = strlen ("UPDATE ") + escaped_len + 1 + strlen (values) + 2;
+  if ((b->buffer_len + needed) > b->buffer_size)
+  {
+    size_t new_size = 2 * b->buffer_size;
+    char *tmp;
+
+    if (new_size < (b->buffer_len + needed))
+      new_size = b->buffer_len + needed;
+
+    tmp = realloc (b->buffer, new_size);
+    if (tmp == NULL)
+      return (ENOMEM);
+    b->buffer = tmp;
+    b->buffer_size = new_size;
+  }
+
+  status = ssnprintf (b->buffer + b->buffer_len,
+      b->buffer_size - b->buffer_len, "UPDATE %s %s\n", escaped, values);
+  assert ((status > 0) && ((size_t) status < needed));
+
+  b->commands[b->commands_num] = b->buffer_len;
+  b->commands_num++;
+  b->buffer_len += (size_t) status;
+
+  return (0);
+} /* }}} int rc_batch_append */
+
+/* Logs an error the daemon reported for the "command"th update (counting
+ * from one) and forgets the file in the existence cache: the file may have
+ * been removed, in which case it is created again with the next update. */
+static void rc_batch_error (rc_batch_t const *b, long command, /* {{{ */
+    char const *message)
+{
+  char filename[PATH_MAX];
+  char const *ptr;
+  size_t len = 0;
+  _Bool escape = 0;
+
+  while ((*message == ' ') || (*message == '\t'))
+    message++;
+
+  if ((command < 1) || ((size_t) command > b->commands_num))
+  {
+    ERROR ("rrdcached plugin: %s reported an error: %s",
+        daemon_address, message);
+    return;
+  }
+
+  ptr = b->buffer + b->commands[command - 1] + strlen ("UPDATE ");
+  for (; (*ptr != '\n') && ((len + 1) < sizeof (filename)); ptr++)
+  {
+    if (!escape && (*ptr == '\\'))
+    {
+      escape = 1;
+      continue;
+    }
+    if (!escape && (*ptr == ' '))
+      break;
+
+    filename[len++] = *ptr;
+    escape = 0;
+  }
+  filename[len] = 0;
+
+  ERROR ("rrdcached plugin: Updating \"%s\" failed: %s", filename, message);
+
+  if (config_create_files)
+    rc_file_forget (filename);
+} /* }}} void rc_batch_error */
+
+/* Sends all updates in "b" over "conn". A single update is sent as a plain
+ * UPDATE command, more are sent with one BATCH command. Returns EAGAIN if
+ * nothing was sent, so the caller may try again. */
+static int rc_conn_batch (rc_conn_t *conn, rc_batch_t const *b) /* {{{ */
+{
+  char line[4096];
+  char *message = NULL;
+  long errors;
+  long i;
+  int status;
+
+  if (b->commands_num == 1)
+  {
+    status = rc_conn_command (conn, b->buffer, b->buffer_len,
+        line, sizeof (line));
+    if (status != 0)
+      return (status);
+
+    if (strtol (line, &message, 10) < 0)
+    {
+      rc_batch_error (b, /* command = */ 1, message);
+      return (-1);
+    }
+    return (0);
+  }
+
+  status = rc_conn_command (conn, "BATCH\n", strlen ("BATCH\n"),
+      line, sizeof (line));
+  if (status != 0)
+    return (status);
+
+  if (strtol (line, NULL, 10) != 0)
+  {
+    ERROR ("rrdcached plugin: %s refused the BATCH command: %s",
+        daemon_address, line);
+    return (-1);
+  }
+
+  if ((swrite (conn->fd, b->buffer, b->buffer_len) != 0)
+      || (swrite (conn->fd, ".\n", strlen (".\n")) != 0)
+      || (rc_conn_read_line (conn, line, sizeof (line)) != 0))
+  {
+    ERROR ("rrdcached plugin: Sending %zu updates to %s failed.",
+        b->commands_num, daemon_address);
+    rc_conn_close (conn);
+    return (-1);
+  }
+
+  /* "<number> errors", followed by one "<command> <message>" line each. */
+  errors = strtol (line, NULL, 10);
+  for (i = 0; i < errors; i++)
+  {
+    long command;
+
+    if (rc_conn_read_line (conn, line, sizeof (line)) != 0)
+    {
+      ERROR ("rrdcached plugin: Reading the response from %s failed.",
+          daemon_address);
+      rc_conn_close (conn);
+      return (-1);
+    }
+
+    command = strtol (line, &message, 10);
+    rc_batch_error (b, command, message);
+  }
+
+  return (0);
+} /* }}} int rc_conn_batch */
+
+/* Sends the updates collected in "b" and empties it, whether sending
+ * succeeded or not. Must be called with "b->lock" held. */
+static int rc_batch_send (rc_batch_t *b) /* {{{ */
+{
+  rc_conn_t *conn;
+  int status;
+
+  if ((b->commands_num == 0) || (connections_num == 0))
+  {
+    b->buffer_len = 0;
+    b->commands_num = 0;
+    return (0);
+  }
+
+  conn = rc_conn_acquire ();
+  status = rc_conn_batch (conn, b);
+  if (status == EAGAIN)
+    status = rc_conn_batch (conn, b);
+  pthread_mutex_unlock (&conn->lock);
+
+  if (status == EAGAIN)
+    ERROR ("rrdcached plugin: Sending %zu update(s) to %s failed.",
+        b->commands_num, daemon_address);
+
+  b->buffer_len = 0;
+  b->commands_num = 0;
+  return (status);
+} /* }}} int rc_batch_send */
+
+/* Called when a write thread exits. */
+static void rc_batch_key_free (void *arg) /* {{{ */
+{
+  rc_batch_t *b = arg;
+  rc_batch_t *prev = NULL;
+  rc_batch_t *ptr;
+
+  pthread_mutex_lock (&batch_list_lock);
+  for (ptr = batch_list; ptr != NULL; ptr = ptr->next)
+  {
+    if (ptr == b)
+      break;
+    prev = ptr;
+  }
+
+  /* Already released by rc_shutdown(). */
+  if (ptr == NULL)
+  {
+    pthread_mutex_unlock (&batch_list_lock);
+    return;
+  }
+
+  if (prev == NULL)
+    batch_list = b->next;
+  else
+    prev->next = b->next;
+
+  pthread_mutex_lock (&b->lock);
+  rc_batch_send (b);
+  pthread_mutex_unlock (&b->lock);
+  pthread_mutex_unlock (&batch_list_lock);
+
+  rc_batch_destroy (b);
+} /* }}} void rc_batch_key_free */
+
+/* Returns the calling thread's batch, creating it if necessary. */
+static rc_batch_t *rc_batch_get (void) /* {{{ */
+{
+  rc_batch_t *b;
+
+  b = pthread_getspecific (batch_key);
+  if (b != NULL)
+    return (b);
+
+  b = rc_batch_create ();
+  if (b == NULL)
+  {
+    ERROR ("rrdcached plugin: Allocating a batch failed.");
+    return (NULL);
+  }
+
+  pthread_mutex_lock (&batch_list_lock);
+  b->next = batch_list;
+  batch_list = b;
+  pthread_mutex_unlock (&batch_list_lock);
+
+  pthread_setspecific (batch_key, b);
+
+  return (b);
+} /* }}} rc_batch_t *rc_batch_get */
+
+/* Sends all batches whose oldest update is at least "timeout" old. */
+static int rc_batch_send_all (cdtime_t timeout) /* {{{ */
+{
+  rc_batch_t *b;
+  cdtime_t now;
+  int status = 0;
+
+  now = cdtime ();
+
+  pthread_mutex_lock (&batch_list_lock);
+  for (b = batch_list; b != NULL; b = b->next)
+  {
+    pthread_mutex_lock (&b->lock);
+    if ((b->commands_num > 0)
+        && ((timeout == 0) || ((now - b->first) >= timeout)))
+    {
+      if (rc_batch_send (b) != 0)
+        status = -1;
+    }
+    pthread_mutex_unlock (&b->lock);
+  }
+  pthread_mutex_unlock (&batch_list_lock);
+
+  return (status);
+} /* }}} int rc_batch_send_all */
+
 static int rc_init (void)
 {
+  size_t i;
+
   if (config_collect_stats)
     plugin_register_read ("rrdcached", rc_read);
 
+  if (daemon_address == NULL)
+    return (0);
+
+  if (rc_parse_address () != 0)
+    return (-1);
+
+  /* A local daemon may run in a different working directory, so send it
+   * absolute file names, as librrd does. */
+  if ((daemon_path != NULL) && ((datadir == NULL) || (datadir[0] != '/')))
+  {
+    char cwd[PATH_MAX];
+    char *tmp;
+
+    if (getcwd (cwd, sizeof (cwd)) == NULL)
+    {
+      char errbuf[1024];
+      ERROR ("rrdcached plugin: getcwd failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+
+    if (datadir == NULL)
+      tmp = strdup (cwd);
+    else
+    {
+      size_t tmp_size = strlen (cwd) + strlen (datadir) + 2;
+
+      tmp = malloc (tmp_size);
+      if (tmp != NULL)
+        ssnprintf (tmp, tmp_size, "%s/%s", cwd, datadir);
+    }
+
+    if (tmp == NULL)
+    {
+      ERROR ("rrdcached plugin: strdup failed.");
+      return (-1);
+    }
+    sfree (datadir);
+    datadir = tmp;
+  }
+
+  files = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  connections = calloc ((size_t) config_connections, sizeof (*connections));
+  if ((files == NULL) || (connections == NULL))
+  {
+    ERROR ("rrdcached plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < (size_t) config_connections; i++)
+  {
+    pthread_mutex_init (&connections[i].lock, /* attr = */ NULL);
+    connections[i].fd = -1;
+  }
+  connections_num = (size_t) config_connections;
+
+  if (pthread_key_create (&batch_key, rc_batch_key_free) != 0)
+  {
+    ERROR ("rrdcached plugin: pthread_key_create failed.");
+    return (-1);
+  }
+  batch_key_valid = 1;
+
   return (0);
 } /* int rc_init */
 
@@ -412,10 +1229,10 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
 {
   char filename[PATH_MAX];
   char values[512];
-  char *values_array[2];
+  rc_batch_t *b;
   int status;
 
-  if (daemon_address == NULL)
+  if ((daemon_address == NULL) || (connections_num == 0))
   {
     ERROR ("rrdcached plugin: daemon_address == NULL.");
     plugin_unregister_write ("rrdcached");
@@ -440,93 +1257,138 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
     return (-1);
   }
 
-  values_array[0] = values;
-  values_array[1] = NULL;
-
   if (config_create_files)
   {
-    struct stat statbuf;
-
-    status = stat (filename, &statbuf);
+    status = rc_file_check (filename, ds, vl);
     if (status != 0)
-    {
-      if (errno != ENOENT)
-      {
-        char errbuf[1024];
-        ERROR ("rrdcached plugin: stat (%s) failed: %s",
-            filename, sstrerror (errno, errbuf, sizeof (errbuf)));
-        return (-1);
-      }
-
-      status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
-      if (status != 0)
-      {
-        ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
-            filename);
-        return (-1);
-      }
-      else if (rrdcreate_config.async)
-        return (0);
-    }
+      return ((status < 0) ? -1 : 0);
   }
 
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
+  b = rc_batch_get ();
+  if (b == NULL)
     return (-1);
-  }
 
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
-  if (status != 0)
+  pthread_mutex_lock (&b->lock);
+  if (b->commands_num == 0)
   {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
-    return (-1);
+    b->first = cdtime ();
+    b->timeout = vl->interval;
   }
+  else if (vl->interval < b->timeout)
+    b->timeout = vl->interval;
 
-  return (0);
+  status = rc_batch_append (b, filename, values);
+  if (status != 0)
+    ERROR ("rrdcached plugin: Adding the update for \"%s\" failed.",
+        filename);
+  else if ((b->commands_num >= (size_t) config_batch_size)
+      || ((cdtime () - b->first) >= b->timeout))
+    status = rc_batch_send (b);
+  pthread_mutex_unlock (&b->lock);
+
+  return (status);
 } /* int rc_write */
 
-static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+static int rc_flush (cdtime_t timeout, /* {{{ */
     const char *identifier,
     __attribute__((unused)) user_data_t *ud)
 {
   char filename[PATH_MAX + 1];
+  char escaped[2 * PATH_MAX + 1];
+  char command[2 * PATH_MAX + 16];
+  char response[4096];
+  rc_conn_t *conn;
   int status;
 
+  if (connections_num == 0)
+    return (-1);
+
+  /* Pending updates for the file may be in any batch. */
+  status = rc_batch_send_all ((identifier == NULL) ? timeout : 0);
   if (identifier == NULL)
-    return (EINVAL);
+    return (status);
 
   if (datadir != NULL)
     ssnprintf (filename, sizeof (filename), "%s/%s.rrd", datadir, identifier);
   else
     ssnprintf (filename, sizeof (filename), "%s.rrd", identifier);
 
-  status = rrdc_connect (daemon_address);
+  if (rc_escape (escaped, sizeof (escaped), filename) == 0)
+    return (EINVAL);
+  ssnprintf (command, sizeof (command), "FLUSH %s\n", escaped);
+
+  conn = rc_conn_acquire ();
+  status = rc_conn_command (conn, command, strlen (command),
+      response, sizeof (response));
+  if (status == EAGAIN)
+    status = rc_conn_command (conn, command, strlen (command),
+        response, sizeof (response));
+  pthread_mutex_unlock (&conn->lock);
+
   if (status != 0)
   {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
+    ERROR ("rrdcached plugin: Flushing %s failed.", filename);
     return (-1);
   }
 
-  status = rrdc_flush (filename);
-  if (status != 0)
+  if (strtol (response, NULL, 10) < 0)
   {
-    ERROR ("rrdcached plugin: rrdc_flush (%s) failed with status %i.",
-        filename, status);
+    ERROR ("rrdcached plugin: Flushing %s failed: %s", filename, response);
     return (-1);
   }
-  DEBUG ("rrdcached plugin: rrdc_flush (%s): Success.", filename);
+  DEBUG ("rrdcached plugin: Flushing %s: Success.", filename);
 
   return (0);
 } /* }}} int rc_flush */
 
 static int rc_shutdown (void)
 {
+  size_t i;
+
+  pthread_mutex_lock (&batch_list_lock);
+  while (batch_list != NULL)
+  {
+    rc_batch_t *b = batch_list;
+    batch_list = b->next;
+
+    pthread_mutex_lock (&b->lock);
+    rc_batch_send (b);
+    pthread_mutex_unlock (&b->lock);
+    rc_batch_destroy (b);
+  }
+  if (batch_key_valid)
+  {
+    pthread_key_delete (batch_key);
+    batch_key_valid = 0;
+  }
+  pthread_mutex_unlock (&batch_list_lock);
+
+  for (i = 0; i < connections_num; i++)
+  {
+    rc_conn_close (connections + i);
+    pthread_mutex_destroy (&connections[i].lock);
+  }
+  sfree (connections);
+  connections_num = 0;
+
+  if (files != NULL)
+  {
+    void *key;
+    void *value;
+
+    while (c_avl_pick (files, &key, &value) == 0)
+    {
+      sfree (key);
+      sfree (value);
+    }
+    c_avl_destroy (files);
+    files = NULL;
+  }
+
+  sfree (daemon_node);
+  daemon_path = NULL;
+  daemon_service = RC_DEFAULT_PORT;
+
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
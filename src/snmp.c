@@ -30,12 +30,16 @@
 #include "utils_complain.h"
 
 #include <pthread.h>
+#include <fcntl.h>
 
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
 
 #include <fnmatch.h>
 
+#define CSNMP_DEFAULT_BULK_SIZE 16
+#define CSNMP_DEFAULT_MAX_REQUESTS 4
+
 /*
  * Private data structes
  */
@@ -96,6 +100,24 @@ struct host_definition_s
   cdtime_t interval;
   data_definition_t **data_list;
   int data_list_len;
+
+  /* Number of repetitions in GETBULK requests. Zero means GETNEXT, negative
+   * means the default of the synchronous or asynchronous mode. */
+  int bulk_size;
+
+  /* State of the asynchronous engine. "poll_submitted", "polls_skipped"
+   * and "submit_next" are protected by "engine_lock", the rest is only used
+   * by the engine thread. In asynchronous mode, "complaint" belongs to the
+   * engine thread, too. */
+  _Bool poll_submitted;
+  int polls_skipped;
+  struct host_definition_s *submit_next;
+  _Bool poll_running;
+  int jobs_next;
+  int jobs_running;
+  int jobs_failed;
+  struct csnmp_job_s *jobs;
+  struct host_definition_s *active_next;
 };
 typedef struct host_definition_s host_definition_t;
 
@@ -117,15 +139,69 @@ struct csnmp_table_values_s
 };
 typedef struct csnmp_table_values_s csnmp_table_values_t;
 
+/* State of a table walk, shared by the synchronous and the asynchronous
+ * code. One request is outstanding at a time. */
+struct csnmp_table_walk_s
+{
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+
+  /* Holds the last OID returned by the device for each column (and the
+   * instance column, if any). We use this in the next request to proceed. */
+  oid_t *oid_list;
+  /* Set to false when an OID has left its subtree so we don't re-request it
+   * again. */
+  _Bool *oid_list_todo;
+  size_t oid_list_len;
+
+  /* Columns (indices into oid_list) in the order they were added to the
+   * last request. With GETBULK, the response repeats this order. */
+  size_t *req_columns;
+  size_t req_columns_num;
+
+  /* `value_list_head' and `value_list_tail' implement a linked list for
+   * each value. `instance_list_head' and `instance_list_tail' implement a
+   * linked list of instance names. This is used to jump gaps in the table. */
+  csnmp_list_instances_t *instance_list_head;
+  csnmp_list_instances_t *instance_list_tail;
+  csnmp_table_values_t **value_list_head;
+  csnmp_table_values_t **value_list_tail;
+};
+typedef struct csnmp_table_walk_s csnmp_table_walk_t;
+
+/* One data definition being read by the asynchronous engine. */
+struct csnmp_job_s
+{
+  host_definition_t *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+  csnmp_table_walk_t *walk; /* NULL for single values */
+  struct csnmp_job_s *next;
+};
+typedef struct csnmp_job_s csnmp_job_t;
+
 /*
  * Private variables
  */
 static data_definition_t *data_head = NULL;
 
+/* Asynchronous mode: a single thread polls all hosts. */
+static _Bool csnmp_async = 0;
+static int csnmp_max_requests = CSNMP_DEFAULT_MAX_REQUESTS;
+
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t engine_thread;
+static _Bool engine_running = 0;
+static _Bool engine_stop = 0;
+static int engine_pipe[2] = { -1, -1 };
+static host_definition_t *engine_submitted = NULL;
+
 /*
  * Prototypes
  */
 static int csnmp_read_host (user_data_t *ud);
+static void csnmp_engine_shutdown (void);
 
 /*
  * Private functions
@@ -202,6 +278,10 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
         hd->name);
   }
 
+  /* The engine thread may be using this host: stop it. Host definitions are
+   * only destroyed when shutting down. */
+  csnmp_engine_shutdown ();
+
   csnmp_host_close_session (hd);
 
   sfree (hd->name);
@@ -660,6 +740,7 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
 
   hd->sess_handle = NULL;
   hd->interval = 0;
+  hd->bulk_size = -1;
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -690,6 +771,15 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       status = csnmp_config_add_host_security_level (hd, option);
     else if (strcasecmp ("Context", option->key) == 0)
       status = cf_util_get_string(option, &hd->context);
+    else if (strcasecmp ("BulkSize", option->key) == 0)
+    {
+      status = cf_util_get_int (option, &hd->bulk_size);
+      if ((status == 0) && (hd->bulk_size < 0))
+      {
+        WARNING ("snmp plugin: `BulkSize' must not be negative.");
+        status = -1;
+      }
+    }
     else
     {
       WARNING ("snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.", option->key);
@@ -803,6 +893,17 @@ static int csnmp_config (oconfig_item_t *ci)
       csnmp_config_add_data (child);
     else if (strcasecmp ("Host", child->key) == 0)
       csnmp_config_add_host (child);
+    else if (strcasecmp ("Asynchronous", child->key) == 0)
+      cf_util_get_boolean (child, &csnmp_async);
+    else if (strcasecmp ("MaxRequestsPerHost", child->key) == 0)
+    {
+      if ((cf_util_get_int (child, &csnmp_max_requests) != 0)
+          || (csnmp_max_requests < 1))
+      {
+        WARNING ("snmp plugin: `MaxRequestsPerHost' must be at least 1.");
+        csnmp_max_requests = CSNMP_DEFAULT_MAX_REQUESTS;
+      }
+    }
     else
     {
       WARNING ("snmp plugin: Ignoring unknown config option `%s'.", child->key);
@@ -1140,24 +1241,15 @@ static int csnmp_strvbcopy (char *dst, /* {{{ */
 
 static int csnmp_instance_list_add (csnmp_list_instances_t **head,
     csnmp_list_instances_t **tail,
-    const struct snmp_pdu *res,
+    struct variable_list *vb,
     const host_definition_t *hd, const data_definition_t *dd)
 {
   csnmp_list_instances_t *il;
-  struct variable_list *vb;
   oid_t vb_name;
   int status;
   uint32_t i;
   uint32_t is_matched;
 
-  /* Set vb on the last variable */
-  for (vb = res->variables;
-      (vb != NULL) && (vb->next_variable != NULL);
-      vb = vb->next_variable)
-    /* do nothing */;
-  if (vb == NULL)
-    return (-1);
-
   csnmp_oid_init (&vb_name, vb->name, vb->name_length);
 
   il = calloc (1, sizeof (*il));
@@ -1392,113 +1484,322 @@ static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *dat
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+/* Looks up the data set of "data" and makes sure it matches. */
+static const data_set_t *csnmp_data_get_ds (data_definition_t const *data) /* {{{ */
 {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
-  struct variable_list *vb;
-
   const data_set_t *ds;
 
-  size_t oid_list_len = data->values_len + 1;
-  /* Holds the last OID returned by the device. We use this in the GETNEXT
-   * request to proceed. */
-  oid_t oid_list[oid_list_len];
-  /* Set to false when an OID has left its subtree so we don't re-request it
-   * again. */
-  _Bool oid_list_todo[oid_list_len];
-
-  int status;
-  size_t i;
-
-  /* `value_list_head' and `value_list_tail' implement a linked list for each
-   * value. `instance_list_head' and `instance_list_tail' implement a linked list of
-   * instance names. This is used to jump gaps in the table. */
-  csnmp_list_instances_t *instance_list_head;
-  csnmp_list_instances_t *instance_list_tail;
-  csnmp_table_values_t **value_list_head;
-  csnmp_table_values_t **value_list_tail;
-
-  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
-      host->name, data->name);
-
-  if (host->sess_handle == NULL)
-  {
-    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return (-1);
-  }
-
   ds = plugin_get_ds (data->type);
   if (!ds)
   {
     ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
-    return (-1);
+    return (NULL);
   }
 
   if (ds->ds_num != data->values_len)
   {
     ERROR ("snmp plugin: DataSet `%s' requires %zu values, but config talks about %zu",
         data->type, ds->ds_num, data->values_len);
-    return (-1);
+    return (NULL);
+  }
+
+  return (ds);
+} /* }}} const data_set_t *csnmp_data_get_ds */
+
+/* Returns the number of repetitions to use in GETBULK requests, or zero if
+ * GETNEXT is to be used. */
+static int csnmp_host_bulk_size (host_definition_t const *host) /* {{{ */
+{
+  /* GETBULK was introduced with SNMPv2. */
+  if (host->version == 1)
+    return (0);
+
+  if (host->bulk_size >= 0)
+    return (host->bulk_size);
+
+  return (csnmp_async ? CSNMP_DEFAULT_BULK_SIZE : 0);
+} /* }}} int csnmp_host_bulk_size */
+
+static void csnmp_table_walk_destroy (csnmp_table_walk_t *walk) /* {{{ */
+{
+  size_t i;
+
+  if (walk == NULL)
+    return;
+
+  /* Free all allocated variables here */
+  while (walk->instance_list_head != NULL)
+  {
+    csnmp_list_instances_t *next = walk->instance_list_head->next;
+    sfree (walk->instance_list_head);
+    walk->instance_list_head = next;
   }
+
+  for (i = 0; (walk->value_list_head != NULL)
+      && (i < walk->data->values_len); i++)
+  {
+    while (walk->value_list_head[i] != NULL)
+    {
+      csnmp_table_values_t *next = walk->value_list_head[i]->next;
+      sfree (walk->value_list_head[i]);
+      walk->value_list_head[i] = next;
+    }
+  }
+
+  sfree (walk->value_list_head);
+  sfree (walk->value_list_tail);
+  sfree (walk->oid_list);
+  sfree (walk->oid_list_todo);
+  sfree (walk->req_columns);
+  sfree (walk);
+} /* }}} void csnmp_table_walk_destroy */
+
+static csnmp_table_walk_t *csnmp_table_walk_create (host_definition_t *host, /* {{{ */
+    data_definition_t *data)
+{
+  csnmp_table_walk_t *walk;
+  const data_set_t *ds;
+  size_t oid_list_len;
+  size_t i;
+
+  ds = csnmp_data_get_ds (data);
+  if (ds == NULL)
+    return (NULL);
   assert (data->values_len > 0);
 
-  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  memcpy (oid_list, data->values, data->values_len * sizeof (oid_t));
+  oid_list_len = data->values_len;
   if (data->instance.oid.oid_len > 0)
-    memcpy (oid_list + data->values_len, &data->instance.oid, sizeof (oid_t));
-  else /* no InstanceFrom option specified. */
-    oid_list_len--;
+    oid_list_len++;
 
-  for (i = 0; i < oid_list_len; i++)
-    oid_list_todo[i] = 1;
+  walk = calloc (1, sizeof (*walk));
+  if (walk == NULL)
+  {
+    ERROR ("snmp plugin: csnmp_table_walk_create: calloc failed.");
+    return (NULL);
+  }
+  walk->host = host;
+  walk->data = data;
+  walk->ds = ds;
+  walk->oid_list_len = oid_list_len;
 
   /* We're going to construct n linked lists, one for each "value".
    * value_list_head will contain pointers to the heads of these linked lists,
    * value_list_tail will contain pointers to the tail of the lists. */
-  value_list_head = calloc (data->values_len, sizeof (*value_list_head));
-  value_list_tail = calloc (data->values_len, sizeof (*value_list_tail));
-  if ((value_list_head == NULL) || (value_list_tail == NULL))
+  walk->oid_list = calloc (oid_list_len, sizeof (*walk->oid_list));
+  walk->oid_list_todo = calloc (oid_list_len, sizeof (*walk->oid_list_todo));
+  walk->req_columns = calloc (oid_list_len, sizeof (*walk->req_columns));
+  walk->value_list_head = calloc (data->values_len,
+      sizeof (*walk->value_list_head));
+  walk->value_list_tail = calloc (data->values_len,
+      sizeof (*walk->value_list_tail));
+  if ((walk->oid_list == NULL) || (walk->oid_list_todo == NULL)
+      || (walk->req_columns == NULL)
+      || (walk->value_list_head == NULL) || (walk->value_list_tail == NULL))
+  {
+    ERROR ("snmp plugin: csnmp_table_walk_create: calloc failed.");
+    csnmp_table_walk_destroy (walk);
+    return (NULL);
+  }
+
+  /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
+  memcpy (walk->oid_list, data->values, data->values_len * sizeof (oid_t));
+  if (data->instance.oid.oid_len > 0)
+    memcpy (walk->oid_list + data->values_len, &data->instance.oid,
+        sizeof (oid_t));
+
+  for (i = 0; i < oid_list_len; i++)
+    walk->oid_list_todo[i] = 1;
+
+  return (walk);
+} /* }}} csnmp_table_walk_t *csnmp_table_walk_create */
+
+/* Creates the next GETNEXT or GETBULK request of the walk. Sets "ret_req" to
+ * NULL when all columns have left their subtree. */
+static int csnmp_table_walk_request (csnmp_table_walk_t *walk, /* {{{ */
+    int bulk_size, struct snmp_pdu **ret_req)
+{
+  struct snmp_pdu *req;
+  size_t i;
+
+  *ret_req = NULL;
+
+  req = snmp_pdu_create ((bulk_size > 0) ? SNMP_MSG_GETBULK : SNMP_MSG_GETNEXT);
+  if (req == NULL)
   {
-    ERROR ("snmp plugin: csnmp_read_table: calloc failed.");
-    sfree (value_list_head);
-    sfree (value_list_tail);
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
     return (-1);
   }
 
-  instance_list_head = NULL;
-  instance_list_tail = NULL;
+  if (bulk_size > 0)
+  {
+    req->non_repeaters = 0;
+    req->max_repetitions = bulk_size;
+  }
+
+  walk->req_columns_num = 0;
+  for (i = 0; i < walk->oid_list_len; i++)
+  {
+    /* Do not rerequest already finished OIDs */
+    if (!walk->oid_list_todo[i])
+      continue;
+    walk->req_columns[walk->req_columns_num] = i;
+    walk->req_columns_num++;
+    snmp_add_null_var (req, walk->oid_list[i].oid, walk->oid_list[i].oid_len);
+  }
 
-  status = 0;
-  while (status == 0)
+  if (walk->req_columns_num == 0)
+  {
+    /* The request is still empty - so we are finished */
+    DEBUG ("snmp plugin: all variables have left their subtree");
+    snmp_free_pdu (req);
+    return (0);
+  }
+
+  *ret_req = req;
+  return (0);
+} /* }}} int csnmp_table_walk_request */
+
+/* Adds the variables of a response to the walk's lists. */
+static int csnmp_table_walk_response (csnmp_table_walk_t *walk, /* {{{ */
+    struct snmp_pdu *res)
+{
+  host_definition_t *host = walk->host;
+  data_definition_t *data = walk->data;
+  struct variable_list *vb;
+  size_t vb_index;
+
+  if (res->variables == NULL)
+    return (-1);
+
+  for (vb = res->variables, vb_index = 0; vb != NULL;
+      vb = vb->next_variable, vb_index++)
   {
-    int oid_list_todo_num;
+    /* GETBULK responses repeat the requested columns in order. */
+    size_t i = walk->req_columns[vb_index % walk->req_columns_num];
+
+    /* The column left its subtree earlier in this response. */
+    if (!walk->oid_list_todo[i])
+      continue;
 
-    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
-    if (req == NULL)
+    /* An instance is configured and the res variable we process is the
+     * instance value (last index) */
+    if ((data->instance.oid.oid_len > 0) && (i == data->values_len))
     {
-      ERROR ("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
-    }
+      if ((vb->type == SNMP_ENDOFMIBVIEW)
+          || (snmp_oid_ncompare (data->instance.oid.oid,
+              data->instance.oid.oid_len,
+              vb->name, vb->name_length,
+              data->instance.oid.oid_len) != 0))
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; Instance left its subtree.",
+            host->name, data->name);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
 
-    oid_list_todo_num = 0;
-    for (i = 0; i < oid_list_len; i++)
+      /* Allocate a new `csnmp_list_instances_t', insert the instance name and
+       * add it to the list */
+      if (csnmp_instance_list_add (&walk->instance_list_head,
+            &walk->instance_list_tail, vb, host, data) != 0)
+      {
+        ERROR ("snmp plugin: host %s: csnmp_instance_list_add failed.",
+            host->name);
+        return (-1);
+      }
+    }
+    else /* The variable we are processing is a normal value */
     {
-      /* Do not rerequest already finished OIDs */
-      if (!oid_list_todo[i])
+      csnmp_table_values_t *vt;
+      oid_t vb_name;
+      oid_t suffix;
+      int ret;
+
+      csnmp_oid_init (&vb_name, vb->name, vb->name_length);
+
+      /* Calculate the current suffix. This is later used to check that the
+       * suffix is increasing. This also checks if we left the subtree */
+      ret = csnmp_oid_suffix (&suffix, &vb_name, data->values + i);
+      if (ret != 0)
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
+            "Value probably left its subtree.",
+            host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
         continue;
-      oid_list_todo_num++;
-      snmp_add_null_var (req, oid_list[i].oid, oid_list[i].oid_len);
+      }
+
+      /* Make sure the OIDs returned by the agent are increasing. Otherwise our
+       * table matching algorithm will get confused. */
+      if ((walk->value_list_tail[i] != NULL)
+          && (csnmp_oid_compare (&suffix, &walk->value_list_tail[i]->suffix) <= 0))
+      {
+        DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
+            "Suffix is not increasing.",
+            host->name, data->name, i);
+        walk->oid_list_todo[i] = 0;
+        continue;
+      }
+
+      vt = calloc (1, sizeof (*vt));
+      if (vt == NULL)
+      {
+        ERROR ("snmp plugin: calloc failed.");
+        return (-1);
+      }
+
+      vt->value = csnmp_value_list_to_value (vb, walk->ds->ds[i].type,
+          data->scale, data->shift, host->name, data->name);
+      memcpy (&vt->suffix, &suffix, sizeof (vt->suffix));
+      vt->next = NULL;
+
+      if (walk->value_list_tail[i] == NULL)
+        walk->value_list_head[i] = vt;
+      else
+        walk->value_list_tail[i]->next = vt;
+      walk->value_list_tail[i] = vt;
     }
 
-    if (oid_list_todo_num == 0)
-    {
-      /* The request is still empty - so we are finished */
-      DEBUG ("snmp plugin: all variables have left their subtree");
-      status = 0;
+    /* Copy OID to oid_list[i] */
+    memcpy (walk->oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
+    walk->oid_list[i].oid_len = vb->name_length;
+  } /* for (vb = res->variables ...) */
+
+  return (0);
+} /* }}} int csnmp_table_walk_response */
+
+static int csnmp_table_walk_dispatch (csnmp_table_walk_t *walk) /* {{{ */
+{
+  return (csnmp_dispatch_table (walk->host, walk->data,
+        walk->instance_list_head, walk->value_list_head));
+} /* }}} int csnmp_table_walk_dispatch */
+
+static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+{
+  csnmp_table_walk_t *walk;
+  struct snmp_pdu *req;
+  struct snmp_pdu *res = NULL;
+  int status;
+
+  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
+      host->name, data->name);
+
+  if (host->sess_handle == NULL)
+  {
+    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
+    return (-1);
+  }
+
+  walk = csnmp_table_walk_create (host, data);
+  if (walk == NULL)
+    return (-1);
+
+  status = 0;
+  while (status == 0)
+  {
+    status = csnmp_table_walk_request (walk, csnmp_host_bulk_size (host),
+        &req);
+    if ((status != 0) || (req == NULL))
       break;
-    }
 
     res = NULL;
     status = snmp_sess_synch_response (host->sess_handle, req, &res);
@@ -1512,12 +1813,11 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
           "snmp plugin: host %s: snmp_sess_synch_response failed: %s",
           host->name, (errstr == NULL) ? "Unknown problem" : errstr);
 
+      /* snmp_synch_response already freed our PDU */
       if (res != NULL)
         snmp_free_pdu (res);
       res = NULL;
 
-      /* snmp_synch_response already freed our PDU */
-      req = NULL;
       sfree (errstr);
       csnmp_host_close_session (host);
 
@@ -1525,186 +1825,49 @@ static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
       break;
     }
 
-    status = 0;
-    assert (res != NULL);
     c_release (LOG_INFO, &host->complaint,
         "snmp plugin: host %s: snmp_sess_synch_response successful.",
         host->name);
 
-    vb = res->variables;
-    if (vb == NULL)
-    {
-      status = -1;
-      break;
-    }
-
-    for (vb = res->variables, i = 0; (vb != NULL); vb = vb->next_variable, i++)
-    {
-      /* Calculate value index from todo list */
-      while ((i < oid_list_len) && !oid_list_todo[i])
-        i++;
-
-      /* An instance is configured and the res variable we process is the
-       * instance value (last index) */
-      if ((data->instance.oid.oid_len > 0) && (i == data->values_len))
-      {
-        if ((vb->type == SNMP_ENDOFMIBVIEW)
-            || (snmp_oid_ncompare (data->instance.oid.oid,
-                data->instance.oid.oid_len,
-                vb->name, vb->name_length,
-                data->instance.oid.oid_len) != 0))
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; Instance left its subtree.",
-              host->name, data->name);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Allocate a new `csnmp_list_instances_t', insert the instance name and
-         * add it to the list */
-        if (csnmp_instance_list_add (&instance_list_head, &instance_list_tail,
-              res, host, data) != 0)
-        {
-          ERROR ("snmp plugin: host %s: csnmp_instance_list_add failed.",
-              host->name);
-          status = -1;
-          break;
-        }
-      }
-      else /* The variable we are processing is a normal value */
-      {
-        csnmp_table_values_t *vt;
-        oid_t vb_name;
-        oid_t suffix;
-        int ret;
-
-        csnmp_oid_init (&vb_name, vb->name, vb->name_length);
-
-        /* Calculate the current suffix. This is later used to check that the
-         * suffix is increasing. This also checks if we left the subtree */
-        ret = csnmp_oid_suffix (&suffix, &vb_name, data->values + i);
-        if (ret != 0)
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
-              "Value probably left its subtree.",
-              host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
-
-        /* Make sure the OIDs returned by the agent are increasing. Otherwise our
-         * table matching algorithm will get confused. */
-        if ((value_list_tail[i] != NULL)
-            && (csnmp_oid_compare (&suffix, &value_list_tail[i]->suffix) <= 0))
-        {
-          DEBUG ("snmp plugin: host = %s; data = %s; i = %zu; "
-              "Suffix is not increasing.",
-              host->name, data->name, i);
-          oid_list_todo[i] = 0;
-          continue;
-        }
+    status = csnmp_table_walk_response (walk, res);
 
-        vt = calloc (1, sizeof (*vt));
-        if (vt == NULL)
-        {
-          ERROR ("snmp plugin: calloc failed.");
-          status = -1;
-          break;
-        }
-
-        vt->value = csnmp_value_list_to_value (vb, ds->ds[i].type,
-            data->scale, data->shift, host->name, data->name);
-        memcpy (&vt->suffix, &suffix, sizeof (vt->suffix));
-        vt->next = NULL;
-
-        if (value_list_tail[i] == NULL)
-          value_list_head[i] = vt;
-        else
-          value_list_tail[i]->next = vt;
-        value_list_tail[i] = vt;
-      }
-
-      /* Copy OID to oid_list[i] */
-      memcpy (oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
-
-    } /* for (vb = res->variables ...) */
-
-    if (res != NULL)
-      snmp_free_pdu (res);
+    snmp_free_pdu (res);
     res = NULL;
   } /* while (status == 0) */
 
-  if (res != NULL)
-    snmp_free_pdu (res);
-  res = NULL;
+  if (status == 0)
+    csnmp_table_walk_dispatch (walk);
 
-  if (req != NULL)
-    snmp_free_pdu (req);
-  req = NULL;
+  csnmp_table_walk_destroy (walk);
 
-  if (status == 0)
-    csnmp_dispatch_table (host, data, instance_list_head, value_list_head);
+  return (0);
+} /* int csnmp_read_table */
 
-  /* Free all allocated variables here */
-  while (instance_list_head != NULL)
-  {
-    csnmp_list_instances_t *next = instance_list_head->next;
-    sfree (instance_list_head);
-    instance_list_head = next;
-  }
+static struct snmp_pdu *csnmp_value_request (data_definition_t *data) /* {{{ */
+{
+  struct snmp_pdu *req;
+  size_t i;
 
-  for (i = 0; i < data->values_len; i++)
+  req = snmp_pdu_create (SNMP_MSG_GET);
+  if (req == NULL)
   {
-    while (value_list_head[i] != NULL)
-    {
-      csnmp_table_values_t *next = value_list_head[i]->next;
-      sfree (value_list_head[i]);
-      value_list_head[i] = next;
-    }
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
+    return (NULL);
   }
 
-  sfree (value_list_head);
-  sfree (value_list_tail);
+  for (i = 0; i < data->values_len; i++)
+    snmp_add_null_var (req, data->values[i].oid, data->values[i].oid_len);
 
-  return (0);
-} /* int csnmp_read_table */
+  return (req);
+} /* }}} struct snmp_pdu *csnmp_value_request */
 
-static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+static int csnmp_value_dispatch (host_definition_t *host, /* {{{ */
+    data_definition_t *data, const data_set_t *ds, struct snmp_pdu *res)
 {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res = NULL;
   struct variable_list *vb;
-
-  const data_set_t *ds;
   value_list_t vl = VALUE_LIST_INIT;
-
-  int status;
   size_t i;
 
-  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
-      host->name, data->name);
-
-  if (host->sess_handle == NULL)
-  {
-    DEBUG ("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
-    return (-1);
-  }
-
-  ds = plugin_get_ds (data->type);
-  if (!ds)
-  {
-    ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
-    return (-1);
-  }
-
-  if (ds->ds_num != data->values_len)
-  {
-    ERROR ("snmp plugin: DataSet `%s' requires %zu values, but config talks about %zu",
-        data->type, ds->ds_num, data->values_len);
-    return (-1);
-  }
-
   vl.values_len = ds->ds_num;
   vl.values = malloc (sizeof (*vl.values) * vl.values_len);
   if (vl.values == NULL)
@@ -1724,16 +1887,54 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
 
   vl.interval = host->interval;
 
-  req = snmp_pdu_create (SNMP_MSG_GET);
-  if (req == NULL)
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
   {
-    ERROR ("snmp plugin: snmp_pdu_create failed.");
-    sfree (vl.values);
+#if COLLECT_DEBUG
+    char buffer[1024];
+    snprint_variable (buffer, sizeof (buffer),
+        vb->name, vb->name_length, vb);
+    DEBUG ("snmp plugin: Got this variable: %s", buffer);
+#endif /* COLLECT_DEBUG */
+
+    for (i = 0; i < data->values_len; i++)
+      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
+            vb->name, vb->name_length) == 0)
+        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
+            data->scale, data->shift, host->name, data->name);
+  } /* for (res->variables) */
+
+  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
+  plugin_dispatch_values (&vl);
+  sfree (vl.values);
+
+  return (0);
+} /* }}} int csnmp_value_dispatch */
+
+static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+{
+  struct snmp_pdu *req;
+  struct snmp_pdu *res = NULL;
+
+  const data_set_t *ds;
+
+  int status;
+
+  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
+      host->name, data->name);
+
+  if (host->sess_handle == NULL)
+  {
+    DEBUG ("snmp plugin: csnmp_read_value: host->sess_handle == NULL");
     return (-1);
   }
 
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var (req, data->values[i].oid, data->values[i].oid_len);
+  ds = csnmp_data_get_ds (data);
+  if (ds == NULL)
+    return (-1);
+
+  req = csnmp_value_request (data);
+  if (req == NULL)
+    return (-1);
 
   status = snmp_sess_synch_response (host->sess_handle, req, &res);
 
@@ -1749,37 +1950,477 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
       snmp_free_pdu (res);
 
     sfree (errstr);
-    sfree (vl.values);
     csnmp_host_close_session (host);
 
     return (-1);
   }
 
+  status = csnmp_value_dispatch (host, data, ds, res);
+  snmp_free_pdu (res);
 
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
+  return (status);
+} /* int csnmp_read_value */
+
+/*
+ * Asynchronous engine
+ *
+ * Read callbacks only submit the host to the engine thread, which keeps up to
+ * "MaxRequestsPerHost" requests in flight for each host using net-snmp's
+ * asynchronous API. Every data definition of a host is a "job": a single GET
+ * or a table walk. Values are dispatched as soon as a job completes.
+ */
+static int csnmp_engine_callback (int operation, netsnmp_session *sess,
+    int reqid, netsnmp_pdu *res, void *magic);
+
+static void csnmp_host_poll_continue (host_definition_t *host);
+
+static int csnmp_job_send (csnmp_job_t *job, struct snmp_pdu *req) /* {{{ */
+{
+  host_definition_t *host = job->host;
+
+  if (snmp_sess_async_send (host->sess_handle, req,
+        csnmp_engine_callback, job) == 0)
   {
-#if COLLECT_DEBUG
-    char buffer[1024];
-    snprint_variable (buffer, sizeof (buffer),
-        vb->name, vb->name_length, vb);
-    DEBUG ("snmp plugin: Got this variable: %s", buffer);
-#endif /* COLLECT_DEBUG */
+    char *errstr = NULL;
 
-    for (i = 0; i < data->values_len; i++)
-      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
-            vb->name, vb->name_length) == 0)
-        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
-            data->scale, data->shift, host->name, data->name);
-  } /* for (res->variables) */
+    snmp_sess_error (host->sess_handle, NULL, NULL, &errstr);
+    c_complain (LOG_ERR, &host->complaint,
+        "snmp plugin: host %s: snmp_sess_async_send failed: %s",
+        host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+    sfree (errstr);
 
-  snmp_free_pdu (res);
+    snmp_free_pdu (req);
+    return (-1);
+  }
 
-  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
-  plugin_dispatch_values (&vl);
-  sfree (vl.values);
+  return (0);
+} /* }}} int csnmp_job_send */
+
+static void csnmp_job_destroy (csnmp_job_t *job) /* {{{ */
+{
+  host_definition_t *host = job->host;
+  csnmp_job_t **ptr;
+
+  for (ptr = &host->jobs; *ptr != NULL; ptr = &(*ptr)->next)
+  {
+    if (*ptr == job)
+    {
+      *ptr = job->next;
+      break;
+    }
+  }
+
+  csnmp_table_walk_destroy (job->walk);
+  sfree (job);
+} /* }}} void csnmp_job_destroy */
+
+/* Called when the last response of a job has been handled or the job
+ * failed. Starts the host's next job, if any. */
+static void csnmp_job_finish (csnmp_job_t *job, int status) /* {{{ */
+{
+  host_definition_t *host = job->host;
+
+  if ((status == 0) && (job->walk != NULL))
+    status = csnmp_table_walk_dispatch (job->walk);
+
+  if (status != 0)
+    host->jobs_failed++;
+
+  csnmp_job_destroy (job);
+
+  assert (host->jobs_running > 0);
+  host->jobs_running--;
+  csnmp_host_poll_continue (host);
+} /* }}} void csnmp_job_finish */
+
+static int csnmp_job_start (host_definition_t *host, /* {{{ */
+    data_definition_t *data)
+{
+  csnmp_job_t *job;
+  struct snmp_pdu *req = NULL;
+  int status;
+
+  job = calloc (1, sizeof (*job));
+  if (job == NULL)
+  {
+    ERROR ("snmp plugin: csnmp_job_start: calloc failed.");
+    return (-1);
+  }
+  job->host = host;
+  job->data = data;
+  job->next = host->jobs;
+  host->jobs = job;
+
+  if (data->is_table)
+  {
+    job->walk = csnmp_table_walk_create (host, data);
+    if (job->walk == NULL)
+    {
+      csnmp_job_destroy (job);
+      return (-1);
+    }
+
+    status = csnmp_table_walk_request (job->walk, csnmp_host_bulk_size (host),
+        &req);
+  }
+  else
+  {
+    job->ds = csnmp_data_get_ds (data);
+    if (job->ds != NULL)
+      req = csnmp_value_request (data);
+    status = (req != NULL) ? 0 : -1;
+  }
+
+  if ((status != 0) || (req == NULL))
+  {
+    csnmp_job_destroy (job);
+    return (-1);
+  }
+
+  status = csnmp_job_send (job, req);
+  if (status != 0)
+  {
+    csnmp_job_destroy (job);
+    return (status);
+  }
 
   return (0);
-} /* int csnmp_read_value */
+} /* }}} int csnmp_job_start */
+
+static _Bool csnmp_engine_stopping (void) /* {{{ */
+{
+  _Bool stopping;
+
+  pthread_mutex_lock (&engine_lock);
+  stopping = engine_stop;
+  pthread_mutex_unlock (&engine_lock);
+
+  return (stopping);
+} /* }}} _Bool csnmp_engine_stopping */
+
+/* Starts jobs until the host's limit is reached. Ends the poll once all jobs
+ * are done. */
+static void csnmp_host_poll_continue (host_definition_t *host) /* {{{ */
+{
+  while (!csnmp_engine_stopping ()
+      && (host->jobs_running < csnmp_max_requests)
+      && (host->jobs_next < host->data_list_len))
+  {
+    data_definition_t *data = host->data_list[host->jobs_next];
+
+    host->jobs_next++;
+    if (csnmp_job_start (host, data) == 0)
+      host->jobs_running++;
+    else
+      host->jobs_failed++;
+  }
+
+  if (host->jobs_running == 0)
+    host->poll_running = 0;
+} /* }}} void csnmp_host_poll_continue */
+
+static int csnmp_engine_callback (int operation, /* {{{ */
+    netsnmp_session *sess __attribute__((unused)),
+    int reqid __attribute__((unused)),
+    netsnmp_pdu *res, void *magic)
+{
+  csnmp_job_t *job = magic;
+  host_definition_t *host = job->host;
+  struct snmp_pdu *req = NULL;
+  int status;
+
+  if ((operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE) || (res == NULL))
+  {
+    c_complain (LOG_ERR, &host->complaint,
+        "snmp plugin: host %s: No response for `%s' (operation %i).",
+        host->name, job->data->name, operation);
+    csnmp_job_finish (job, -1);
+    return (1);
+  }
+
+  c_release (LOG_INFO, &host->complaint,
+      "snmp plugin: host %s: Received a response.", host->name);
+
+  if (job->walk == NULL)
+  {
+    csnmp_job_finish (job, csnmp_value_dispatch (host, job->data,
+          job->ds, res));
+    return (1);
+  }
+
+  status = csnmp_table_walk_response (job->walk, res);
+  if (status == 0)
+    status = csnmp_table_walk_request (job->walk,
+        csnmp_host_bulk_size (host), &req);
+  if ((status == 0) && (req != NULL))
+  {
+    status = csnmp_job_send (job, req);
+    if (status == 0)
+      return (1);
+  }
+
+  /* The walk is complete (req == NULL) or failed. */
+  csnmp_job_finish (job, status);
+  return (1);
+} /* }}} int csnmp_engine_callback */
+
+static void csnmp_host_poll_start (host_definition_t *host) /* {{{ */
+{
+  host->poll_running = 1;
+  host->jobs_next = 0;
+  host->jobs_running = 0;
+  host->jobs_failed = 0;
+
+  if (host->sess_handle == NULL)
+    csnmp_host_open_session (host);
+
+  if (host->sess_handle == NULL)
+  {
+    host->poll_running = 0;
+    return;
+  }
+
+  csnmp_host_poll_continue (host);
+} /* }}} void csnmp_host_poll_start */
+
+static void *csnmp_engine_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  host_definition_t *active = NULL;
+  netsnmp_large_fd_set fdset;
+
+  netsnmp_large_fd_set_init (&fdset, FD_SETSIZE);
+
+  while (42)
+  {
+    host_definition_t *submitted;
+    host_definition_t *host;
+    host_definition_t **ptr;
+    struct timeval timeout;
+    int numfds;
+    int block;
+    int status;
+
+    pthread_mutex_lock (&engine_lock);
+    if (engine_stop)
+    {
+      pthread_mutex_unlock (&engine_lock);
+      break;
+    }
+    submitted = engine_submitted;
+    engine_submitted = NULL;
+    pthread_mutex_unlock (&engine_lock);
+
+    while (submitted != NULL)
+    {
+      host = submitted;
+      submitted = host->submit_next;
+      host->submit_next = NULL;
+
+      csnmp_host_poll_start (host);
+      host->active_next = active;
+      active = host;
+    }
+
+    /* Remove hosts whose poll is complete. They may be submitted again
+     * afterwards. */
+    ptr = &active;
+    while (*ptr != NULL)
+    {
+      _Bool done;
+      int skipped;
+
+      host = *ptr;
+      done = !host->poll_running;
+      if (done)
+      {
+        *ptr = host->active_next;
+        host->active_next = NULL;
+
+        /* Like in the synchronous case, reopen the session next time if
+         * nothing could be read. This can't be done from within a
+         * callback. */
+        if ((host->data_list_len > 0)
+            && (host->jobs_failed >= host->data_list_len))
+          csnmp_host_close_session (host);
+      }
+      else
+      {
+        ptr = &host->active_next;
+      }
+
+      pthread_mutex_lock (&engine_lock);
+      skipped = host->polls_skipped;
+      host->polls_skipped = 0;
+      if (done)
+        host->poll_submitted = 0;
+      pthread_mutex_unlock (&engine_lock);
+
+      if (skipped > 0)
+        c_complain (LOG_WARNING, &host->complaint,
+            "snmp plugin: host %s: The previous poll has not finished yet. "
+            "Skipped %i interval(s).", host->name, skipped);
+    }
+
+    NETSNMP_LARGE_FD_ZERO (&fdset);
+    NETSNMP_LARGE_FD_SET (engine_pipe[0], &fdset);
+    numfds = engine_pipe[0] + 1;
+    block = 1;
+    memset (&timeout, 0, sizeof (timeout));
+
+    for (host = active; host != NULL; host = host->active_next)
+      snmp_sess_select_info2 (host->sess_handle, &numfds, &fdset,
+          &timeout, &block);
+
+    /* Nothing to time out: wait for responses or newly submitted hosts. */
+    if (block)
+    {
+      timeout.tv_sec = 1;
+      timeout.tv_usec = 0;
+    }
+
+    status = netsnmp_large_fd_set_select (numfds, &fdset, NULL, NULL,
+        &timeout);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR ("snmp plugin: select failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      sleep (1);
+      continue;
+    }
+
+    if ((status > 0) && NETSNMP_LARGE_FD_ISSET (engine_pipe[0], &fdset))
+    {
+      char buffer[64];
+
+      while (read (engine_pipe[0], buffer, sizeof (buffer)) > 0)
+        /* drain */;
+    }
+
+    /* Callbacks only change the state of their own host, so iterating
+     * over the list is safe. */
+    for (host = active; host != NULL; host = host->active_next)
+    {
+      if (status > 0)
+        snmp_sess_read2 (host->sess_handle, &fdset);
+      snmp_sess_timeout (host->sess_handle);
+    }
+  } /* while (42) */
+
+  /* Shutting down: drop all outstanding requests. */
+  while (active != NULL)
+  {
+    host_definition_t *host = active;
+
+    active = host->active_next;
+    host->active_next = NULL;
+
+    csnmp_host_close_session (host);
+    while (host->jobs != NULL)
+      csnmp_job_destroy (host->jobs);
+    host->poll_running = 0;
+  }
+
+  netsnmp_large_fd_set_cleanup (&fdset);
+  return ((void *) 0);
+} /* }}} void *csnmp_engine_thread */
+
+static int csnmp_engine_start (void) /* {{{ */
+{
+  int status;
+
+  /* engine_lock is held by the caller. */
+  if (engine_running)
+    return (0);
+
+  if (pipe (engine_pipe) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("snmp plugin: pipe failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  fcntl (engine_pipe[0], F_SETFL, fcntl (engine_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl (engine_pipe[1], F_SETFL, fcntl (engine_pipe[1], F_GETFL) | O_NONBLOCK);
+
+  engine_stop = 0;
+  status = plugin_thread_create (&engine_thread, /* attr = */ NULL,
+      csnmp_engine_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("snmp plugin: Starting the engine thread failed.");
+    close (engine_pipe[0]);
+    close (engine_pipe[1]);
+    engine_pipe[0] = engine_pipe[1] = -1;
+    return (-1);
+  }
+
+  engine_running = 1;
+  return (0);
+} /* }}} int csnmp_engine_start */
+
+static void csnmp_engine_shutdown (void) /* {{{ */
+{
+  pthread_mutex_lock (&engine_lock);
+  if (!engine_running)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return;
+  }
+  engine_stop = 1;
+  pthread_mutex_unlock (&engine_lock);
+
+  /* Wake up the engine thread. */
+  (void) write (engine_pipe[1], "", 1);
+  pthread_join (engine_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&engine_lock);
+  engine_running = 0;
+  engine_submitted = NULL;
+  close (engine_pipe[0]);
+  close (engine_pipe[1]);
+  engine_pipe[0] = engine_pipe[1] = -1;
+  pthread_mutex_unlock (&engine_lock);
+} /* }}} void csnmp_engine_shutdown */
+
+/* Hands the host to the engine thread. Returns immediately. */
+static int csnmp_engine_submit (host_definition_t *host) /* {{{ */
+{
+  pthread_mutex_lock (&engine_lock);
+
+  if (engine_stop)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (-1);
+  }
+
+  if (csnmp_engine_start () != 0)
+  {
+    pthread_mutex_unlock (&engine_lock);
+    return (-1);
+  }
+
+  if (host->poll_submitted)
+  {
+    /* Skip this interval. The engine thread complains about it, because
+     * it is the only one using "host->complaint". */
+    host->polls_skipped++;
+  }
+  else
+  {
+    host->poll_submitted = 1;
+    host->submit_next = engine_submitted;
+    engine_submitted = host;
+  }
+  pthread_mutex_unlock (&engine_lock);
+
+  (void) write (engine_pipe[1], "", 1);
+  return (0);
+} /* }}} int csnmp_engine_submit */
 
 static int csnmp_read_host (user_data_t *ud)
 {
@@ -1793,6 +2434,9 @@ static int csnmp_read_host (user_data_t *ud)
   if (host->interval == 0)
     host->interval = plugin_get_interval ();
 
+  if (csnmp_async)
+    return (csnmp_engine_submit (host));
+
   if (host->sess_handle == NULL)
     csnmp_host_open_session (host);
 
@@ -1833,6 +2477,8 @@ static int csnmp_shutdown (void)
 
   /* When we get here, the read threads have been stopped and all the
    * `host_definition_t' will be freed. */
+  csnmp_engine_shutdown ();
+
   DEBUG ("snmp plugin: Destroying all data definitions.");
 
   data_this = data_head;
@@ -0,0 +1,926 @@
+/**
+ * collectd - src/snmp_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+/* The mock library already defines plugin_dispatch_values(); collect the
+ * values dispatched by the plugin under a different name. */
+#define plugin_dispatch_values test_dispatch_values
+
+#include "snmp.c" /* sic */
+#include "testing.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+#define TEST_COMMUNITY "public"
+#define TEST_TIMEOUT 10 /* seconds */
+
+/*
+ * Simulated SNMPv2c agent
+ *
+ * Answers GET, GETNEXT and GETBULK requests from a small, sorted MIB on a
+ * UDP socket bound to the loopback interface. Only the subset of BER used by
+ * net-snmp's requests is understood; anything else is dropped.
+ */
+#define BER_INTEGER      0x02
+#define BER_OCTET_STRING 0x04
+#define BER_OID          0x06
+#define BER_SEQUENCE     0x30
+#define BER_COUNTER32    0x41
+#define BER_NO_SUCH_OBJ  0x80
+#define BER_END_OF_MIB   0x82
+#define PDU_GET          0xa0
+#define PDU_GETNEXT      0xa1
+#define PDU_RESPONSE     0xa2
+#define PDU_GETBULK      0xa5
+
+#define AGENT_MAX_OID 32
+#define AGENT_MAX_VBS 64
+#define AGENT_BUFSIZE 1500
+
+typedef struct
+{
+  uint32_t oid[AGENT_MAX_OID];
+  size_t oid_len;
+} agent_oid_t;
+
+typedef struct
+{
+  agent_oid_t name;
+  uint8_t type;
+  uint32_t num;
+  char const *str;
+} agent_entry_t;
+
+#define IF_COLUMN(col, row) { { 1, 3, 6, 1, 2, 1, 2, 2, 1, col, row }, 11 }
+
+/* Sorted by OID. */
+static agent_entry_t agent_mib[] = {
+  { IF_COLUMN (2, 1), BER_OCTET_STRING, 0, "lo" },
+  { IF_COLUMN (2, 2), BER_OCTET_STRING, 0, "eth0" },
+  { IF_COLUMN (2, 3), BER_OCTET_STRING, 0, "eth1" },
+  { IF_COLUMN (10, 1), BER_COUNTER32, 100, NULL },
+  { IF_COLUMN (10, 2), BER_COUNTER32, 200, NULL },
+  { IF_COLUMN (10, 3), BER_COUNTER32, 300, NULL },
+  { IF_COLUMN (16, 1), BER_COUNTER32, 1000, NULL },
+  { IF_COLUMN (16, 2), BER_COUNTER32, 2000, NULL },
+  { IF_COLUMN (16, 3), BER_COUNTER32, 3000, NULL },
+  { { { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 5, 1 }, 11 }, BER_INTEGER, 42, NULL }
+};
+
+static int agent_fd = -1;
+static pthread_t agent_thread;
+static pthread_mutex_t agent_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t agent_cond = PTHREAD_COND_INITIALIZER;
+static _Bool agent_stop = 0;
+static _Bool agent_pause = 0;
+static _Bool agent_paused = 0;
+/* Requests answered, by PDU type. */
+static int agent_get = 0;
+static int agent_getnext = 0;
+static int agent_getbulk = 0;
+
+/* Output buffer. Constructed types are written back to front so that every
+ * length is known when its header is written. */
+typedef struct
+{
+  uint8_t data[AGENT_BUFSIZE];
+  size_t pos; /* start of the encoded data */
+} ber_buffer_t;
+
+static int ber_prepend (ber_buffer_t *b, void const *data, size_t len) /* {{{ */
+{
+  if (len > b->pos)
+    return (-1);
+  b->pos -= len;
+  memcpy (b->data + b->pos, data, len);
+  return (0);
+} /* }}} int ber_prepend */
+
+/* Prepends the header of a TLV whose content ends at "end". */
+static int ber_prepend_header (ber_buffer_t *b, uint8_t type, /* {{{ */
+    size_t end)
+{
+  size_t len = end - b->pos;
+  uint8_t hdr[4];
+  size_t hdr_len;
+
+  hdr[0] = type;
+  if (len < 0x80)
+  {
+    hdr[1] = (uint8_t) len;
+    hdr_len = 2;
+  }
+  else if (len < 0x100)
+  {
+    hdr[1] = 0x81;
+    hdr[2] = (uint8_t) len;
+    hdr_len = 3;
+  }
+  else
+  {
+    hdr[1] = 0x82;
+    hdr[2] = (uint8_t) (len >> 8);
+    hdr[3] = (uint8_t) len;
+    hdr_len = 4;
+  }
+
+  return (ber_prepend (b, hdr, hdr_len));
+} /* }}} int ber_prepend_header */
+
+static int ber_prepend_uint (ber_buffer_t *b, uint8_t type, /* {{{ */
+    uint32_t value)
+{
+  size_t end = b->pos;
+  uint8_t byte;
+
+  do
+  {
+    byte = (uint8_t) (value & 0xff);
+    if (ber_prepend (b, &byte, 1) != 0)
+      return (-1);
+    value >>= 8;
+  } while (value != 0);
+
+  /* Keep the value positive. */
+  if (byte & 0x80)
+  {
+    byte = 0;
+    if (ber_prepend (b, &byte, 1) != 0)
+      return (-1);
+  }
+
+  return (ber_prepend_header (b, type, end));
+} /* }}} int ber_prepend_uint */
+
+static int ber_prepend_oid (ber_buffer_t *b, agent_oid_t const *o) /* {{{ */
+{
+  size_t end = b->pos;
+  size_t i;
+
+  if (o->oid_len < 2)
+    return (-1);
+
+  for (i = o->oid_len; i >= 2; i--)
+  {
+    uint32_t sub = (i == 2) ? (40 * o->oid[0] + o->oid[1]) : o->oid[i - 1];
+    uint8_t byte = (uint8_t) (sub & 0x7f);
+
+    if (ber_prepend (b, &byte, 1) != 0)
+      return (-1);
+    for (sub >>= 7; sub != 0; sub >>= 7)
+    {
+      byte = (uint8_t) (0x80 | (sub & 0x7f));
+      if (ber_prepend (b, &byte, 1) != 0)
+        return (-1);
+    }
+  }
+
+  return (ber_prepend_header (b, BER_OID, end));
+} /* }}} int ber_prepend_oid */
+
+/* Reads the header of a TLV at "*pos" and advances "*pos" to its content. */
+static int ber_read_header (uint8_t const *buf, size_t size, /* {{{ */
+    size_t *pos, uint8_t *ret_type, size_t *ret_len)
+{
+  size_t len;
+
+  if (*pos + 2 > size)
+    return (-1);
+  *ret_type = buf[(*pos)++];
+  len = buf[(*pos)++];
+  if (len & 0x80)
+  {
+    size_t n = len & 0x7f;
+
+    if ((n == 0) || (n > 2) || (*pos + n > size))
+      return (-1);
+    for (len = 0; n > 0; n--)
+      len = (len << 8) | buf[(*pos)++];
+  }
+  if (*pos + len > size)
+    return (-1);
+
+  *ret_len = len;
+  return (0);
+} /* }}} int ber_read_header */
+
+static int ber_read_int (uint8_t const *buf, size_t size, /* {{{ */
+    size_t *pos, int32_t *ret_value)
+{
+  uint8_t type;
+  size_t len;
+  int32_t value;
+  size_t i;
+
+  if ((ber_read_header (buf, size, pos, &type, &len) != 0)
+      || (type != BER_INTEGER) || (len == 0) || (len > 4))
+    return (-1);
+
+  value = (buf[*pos] & 0x80) ? -1 : 0;
+  for (i = 0; i < len; i++)
+    value = (int32_t) (((uint32_t) value << 8) | buf[*pos + i]);
+  *pos += len;
+
+  *ret_value = value;
+  return (0);
+} /* }}} int ber_read_int */
+
+static int ber_read_oid (uint8_t const *buf, size_t len, /* {{{ */
+    agent_oid_t *o)
+{
+  uint32_t sub = 0;
+  size_t i;
+
+  if (len == 0)
+    return (-1);
+
+  o->oid_len = 0;
+  for (i = 0; i < len; i++)
+  {
+    sub = (sub << 7) | (buf[i] & 0x7f);
+    if (buf[i] & 0x80)
+      continue;
+
+    if (o->oid_len == 0)
+    {
+      o->oid[0] = (sub < 80) ? (sub / 40) : 2;
+      o->oid[1] = sub - 40 * o->oid[0];
+      o->oid_len = 2;
+    }
+    else
+    {
+      if (o->oid_len >= AGENT_MAX_OID)
+        return (-1);
+      o->oid[o->oid_len++] = sub;
+    }
+    sub = 0;
+  }
+
+  return (0);
+} /* }}} int ber_read_oid */
+
+static int agent_oid_compare (agent_oid_t const *a, agent_oid_t const *b)
+{
+  size_t i;
+
+  for (i = 0; (i < a->oid_len) && (i < b->oid_len); i++)
+    if (a->oid[i] != b->oid[i])
+      return ((a->oid[i] < b->oid[i]) ? -1 : 1);
+
+  if (a->oid_len == b->oid_len)
+    return (0);
+  return ((a->oid_len < b->oid_len) ? -1 : 1);
+}
+
+static agent_entry_t const *agent_lookup (agent_oid_t const *name, /* {{{ */
+    _Bool next)
+{
+  size_t i;
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (agent_mib); i++)
+  {
+    int cmp = agent_oid_compare (&agent_mib[i].name, name);
+
+    if ((cmp == 0) && !next)
+      return (agent_mib + i);
+    if (cmp > 0)
+      return (next ? (agent_mib + i) : NULL);
+  }
+
+  return (NULL);
+} /* }}} agent_entry_t const *agent_lookup */
+
+/* A variable binding of the response. "entry" is NULL for exceptions, in
+ * which case "name" and "exception" are used. */
+typedef struct
+{
+  agent_entry_t const *entry;
+  agent_oid_t name;
+  uint8_t exception;
+} agent_vb_t;
+
+static int agent_prepend_vb (ber_buffer_t *b, agent_vb_t const *vb) /* {{{ */
+{
+  size_t end = b->pos;
+  int status;
+
+  if (vb->entry == NULL)
+    status = ber_prepend_header (b, vb->exception, b->pos);
+  else if (vb->entry->type == BER_OCTET_STRING)
+  {
+    size_t value_end = b->pos;
+
+    status = ber_prepend (b, vb->entry->str, strlen (vb->entry->str));
+    if (status == 0)
+      status = ber_prepend_header (b, BER_OCTET_STRING, value_end);
+  }
+  else
+    status = ber_prepend_uint (b, vb->entry->type, vb->entry->num);
+
+  if (status == 0)
+    status = ber_prepend_oid (b, (vb->entry != NULL)
+        ? &vb->entry->name : &vb->name);
+  if (status == 0)
+    status = ber_prepend_header (b, BER_SEQUENCE, end);
+
+  return (status);
+} /* }}} int agent_prepend_vb */
+
+static void agent_next (agent_vb_t *vb, agent_oid_t const *name) /* {{{ */
+{
+  vb->entry = agent_lookup (name, /* next = */ 1);
+  vb->name = *name;
+  vb->exception = BER_END_OF_MIB;
+} /* }}} void agent_next */
+
+/* Handles one request. Returns the size of the response written to "ret",
+ * or zero if the request is to be dropped. */
+static size_t agent_handle (uint8_t const *req, size_t req_size, /* {{{ */
+    uint8_t *ret, size_t ret_size)
+{
+  agent_vb_t vbs[AGENT_MAX_VBS];
+  agent_oid_t names[AGENT_MAX_VBS];
+  size_t names_num = 0;
+  size_t vbs_num = 0;
+  ber_buffer_t b;
+  uint8_t type;
+  uint8_t pdu_type;
+  size_t len;
+  size_t pos = 0;
+  size_t end;
+  size_t reqid_pos;
+  size_t reqid_len;
+  int32_t version;
+  int32_t a;
+  int32_t c;
+  size_t i;
+
+  /* Message header: version, community. */
+  if ((ber_read_header (req, req_size, &pos, &type, &len) != 0)
+      || (type != BER_SEQUENCE)
+      || (ber_read_int (req, req_size, &pos, &version) != 0)
+      || (version != 1 /* SNMPv2c */)
+      || (ber_read_header (req, req_size, &pos, &type, &len) != 0)
+      || (type != BER_OCTET_STRING)
+      || (len != strlen (TEST_COMMUNITY))
+      || (memcmp (req + pos, TEST_COMMUNITY, len) != 0))
+    return (0);
+  pos += len;
+
+  /* PDU: request ID, error status / non-repeaters, error index /
+   * max-repetitions, variable bindings. */
+  if (ber_read_header (req, req_size, &pos, &pdu_type, &len) != 0)
+    return (0);
+  reqid_pos = pos;
+  if (ber_read_int (req, req_size, &pos, &a) != 0)
+    return (0);
+  reqid_len = pos - reqid_pos;
+  if ((ber_read_int (req, req_size, &pos, &a) != 0)
+      || (ber_read_int (req, req_size, &pos, &c) != 0)
+      || (ber_read_header (req, req_size, &pos, &type, &len) != 0)
+      || (type != BER_SEQUENCE))
+    return (0);
+
+  end = pos + len;
+  while (pos < end)
+  {
+    if ((names_num >= AGENT_MAX_VBS)
+        || (ber_read_header (req, end, &pos, &type, &len) != 0)
+        || (type != BER_SEQUENCE))
+      return (0);
+    if ((ber_read_header (req, end, &pos, &type, &len) != 0)
+        || (type != BER_OID)
+        || (ber_read_oid (req + pos, len, names + names_num) != 0))
+      return (0);
+    pos += len;
+    /* Skip the (NULL) value. */
+    if (ber_read_header (req, end, &pos, &type, &len) != 0)
+      return (0);
+    pos += len;
+    names_num++;
+  }
+
+  if (pdu_type == PDU_GET)
+  {
+    for (i = 0; i < names_num; i++)
+    {
+      vbs[i].entry = agent_lookup (names + i, /* next = */ 0);
+      vbs[i].name = names[i];
+      vbs[i].exception = BER_NO_SUCH_OBJ;
+    }
+    vbs_num = names_num;
+  }
+  else if (pdu_type == PDU_GETNEXT)
+  {
+    for (i = 0; i < names_num; i++)
+      agent_next (vbs + i, names + i);
+    vbs_num = names_num;
+  }
+  else if (pdu_type == PDU_GETBULK)
+  {
+    size_t non_repeaters = (a < 0) ? 0 : (size_t) a;
+    int32_t r;
+
+    if (non_repeaters > names_num)
+      non_repeaters = names_num;
+    for (i = 0; i < non_repeaters; i++)
+      agent_next (vbs + vbs_num++, names + i);
+
+    for (r = 0; r < c; r++)
+    {
+      _Bool all_end = 1;
+
+      if (vbs_num + (names_num - non_repeaters) > AGENT_MAX_VBS)
+        break;
+      for (i = non_repeaters; i < names_num; i++)
+      {
+        agent_next (vbs + vbs_num, names + i);
+        if (vbs[vbs_num].entry != NULL)
+        {
+          names[i] = vbs[vbs_num].entry->name;
+          all_end = 0;
+        }
+        vbs_num++;
+      }
+      if (all_end)
+        break;
+    }
+  }
+  else
+    return (0);
+
+  /* Build the response back to front. */
+  memset (&b, 0, sizeof (b));
+  b.pos = sizeof (b.data);
+
+  for (i = vbs_num; i > 0; i--)
+    if (agent_prepend_vb (&b, vbs + i - 1) != 0)
+      return (0);
+  if ((ber_prepend_header (&b, BER_SEQUENCE, sizeof (b.data)) != 0)
+      || (ber_prepend_uint (&b, BER_INTEGER, 0) != 0) /* error index */
+      || (ber_prepend_uint (&b, BER_INTEGER, 0) != 0) /* error status */
+      || (ber_prepend (&b, req + reqid_pos, reqid_len) != 0)
+      || (ber_prepend_header (&b, PDU_RESPONSE, sizeof (b.data)) != 0))
+    return (0);
+  end = b.pos;
+  if ((ber_prepend (&b, TEST_COMMUNITY, strlen (TEST_COMMUNITY)) != 0)
+      || (ber_prepend_header (&b, BER_OCTET_STRING, end) != 0)
+      || (ber_prepend_uint (&b, BER_INTEGER, 1) != 0)
+      || (ber_prepend_header (&b, BER_SEQUENCE, sizeof (b.data)) != 0))
+    return (0);
+
+  len = sizeof (b.data) - b.pos;
+  if (len > ret_size)
+    return (0);
+  memcpy (ret, b.data + b.pos, len);
+
+  pthread_mutex_lock (&agent_lock);
+  if (pdu_type == PDU_GET)
+    agent_get++;
+  else if (pdu_type == PDU_GETNEXT)
+    agent_getnext++;
+  else
+    agent_getbulk++;
+  pthread_mutex_unlock (&agent_lock);
+
+  return (len);
+} /* }}} size_t agent_handle */
+
+static void *agent_main (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (42)
+  {
+    struct pollfd pfd = { agent_fd, POLLIN, 0 };
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof (peer);
+    uint8_t req[AGENT_BUFSIZE];
+    uint8_t res[AGENT_BUFSIZE];
+    ssize_t req_size;
+    size_t res_size;
+
+    /* While paused, requests queue up in the socket. */
+    pthread_mutex_lock (&agent_lock);
+    while (agent_pause && !agent_stop)
+    {
+      agent_paused = 1;
+      pthread_cond_broadcast (&agent_cond);
+      pthread_cond_wait (&agent_cond, &agent_lock);
+    }
+    agent_paused = 0;
+    if (agent_stop)
+    {
+      pthread_mutex_unlock (&agent_lock);
+      break;
+    }
+    pthread_mutex_unlock (&agent_lock);
+
+    if (poll (&pfd, 1, /* timeout = */ 100) <= 0)
+      continue;
+
+    req_size = recvfrom (agent_fd, req, sizeof (req), /* flags = */ 0,
+        (struct sockaddr *) &peer, &peer_len);
+    if (req_size <= 0)
+      continue;
+
+    res_size = agent_handle (req, (size_t) req_size, res, sizeof (res));
+    if (res_size > 0)
+      sendto (agent_fd, res, res_size, /* flags = */ 0,
+          (struct sockaddr *) &peer, peer_len);
+  }
+
+  return ((void *) 0);
+} /* }}} void *agent_main */
+
+/* Starts the agent and returns its port. */
+static int agent_start (void) /* {{{ */
+{
+  struct sockaddr_in sa;
+  socklen_t sa_len = sizeof (sa);
+
+  agent_fd = socket (AF_INET, SOCK_DGRAM, 0);
+  if (agent_fd < 0)
+    return (-1);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  sa.sin_port = 0;
+  if ((bind (agent_fd, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+      || (getsockname (agent_fd, (struct sockaddr *) &sa, &sa_len) != 0)
+      || (pthread_create (&agent_thread, NULL, agent_main, NULL) != 0))
+  {
+    close (agent_fd);
+    agent_fd = -1;
+    return (-1);
+  }
+
+  return ((int) ntohs (sa.sin_port));
+} /* }}} int agent_start */
+
+static void agent_stop_thread (void)
+{
+  pthread_mutex_lock (&agent_lock);
+  agent_stop = 1;
+  pthread_cond_broadcast (&agent_cond);
+  pthread_mutex_unlock (&agent_lock);
+
+  pthread_join (agent_thread, NULL);
+  close (agent_fd);
+  agent_fd = -1;
+}
+
+/* Stops answering requests. Returns once the agent has noticed. */
+static void agent_set_paused (_Bool pause)
+{
+  pthread_mutex_lock (&agent_lock);
+  agent_pause = pause;
+  pthread_cond_broadcast (&agent_cond);
+  while (pause && !agent_paused)
+    pthread_cond_wait (&agent_cond, &agent_lock);
+  pthread_mutex_unlock (&agent_lock);
+}
+
+static void agent_reset_counters (void)
+{
+  pthread_mutex_lock (&agent_lock);
+  agent_get = agent_getnext = agent_getbulk = 0;
+  pthread_mutex_unlock (&agent_lock);
+}
+
+/*
+ * Plugin infrastructure
+ */
+static data_source_t dsrc_gauge[] = {
+  { "value", DS_TYPE_GAUGE, 0.0, NAN }
+};
+static data_set_t ds_gauge = { "gauge", 1, dsrc_gauge };
+
+static data_source_t dsrc_if_octets[] = {
+  { "rx", DS_TYPE_COUNTER, 0.0, NAN },
+  { "tx", DS_TYPE_COUNTER, 0.0, NAN }
+};
+static data_set_t ds_if_octets = { "if_octets", 2, dsrc_if_octets };
+
+const data_set_t *plugin_get_ds (const char *name)
+{
+  if (strcmp (name, ds_gauge.type) == 0)
+    return (&ds_gauge);
+  if (strcmp (name, ds_if_octets.type) == 0)
+    return (&ds_if_octets);
+  return (NULL);
+}
+
+/* Value lists dispatched by the code under test. The asynchronous engine
+ * dispatches from its own thread. */
+typedef struct
+{
+  char host[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  char type_instance[DATA_MAX_NAME_LEN];
+  value_t values[2];
+} dispatched_t;
+
+static dispatched_t dispatched[16];
+static size_t dispatched_num = 0;
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dispatch_cond = PTHREAD_COND_INITIALIZER;
+
+int test_dispatch_values (value_list_t const *vl)
+{
+  dispatched_t *d;
+
+  pthread_mutex_lock (&dispatch_lock);
+  if (dispatched_num >= STATIC_ARRAY_SIZE (dispatched))
+  {
+    pthread_mutex_unlock (&dispatch_lock);
+    return (-1);
+  }
+
+  d = dispatched + dispatched_num;
+  sstrncpy (d->host, vl->host, sizeof (d->host));
+  sstrncpy (d->type, vl->type, sizeof (d->type));
+  sstrncpy (d->type_instance, vl->type_instance, sizeof (d->type_instance));
+  memcpy (d->values, vl->values,
+      vl->values_len * sizeof (vl->values[0]));
+  dispatched_num++;
+
+  pthread_cond_broadcast (&dispatch_cond);
+  pthread_mutex_unlock (&dispatch_lock);
+  return (0);
+}
+
+/* Waits until "num" value lists have been dispatched. */
+static void wait_dispatched (size_t num)
+{
+  struct timespec deadline;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += TEST_TIMEOUT;
+
+  pthread_mutex_lock (&dispatch_lock);
+  while (dispatched_num < num)
+    if (pthread_cond_timedwait (&dispatch_cond, &dispatch_lock,
+          &deadline) != 0)
+      break;
+  pthread_mutex_unlock (&dispatch_lock);
+}
+
+static void reset_dispatched (void)
+{
+  pthread_mutex_lock (&dispatch_lock);
+  memset (dispatched, 0, sizeof (dispatched));
+  dispatched_num = 0;
+  pthread_mutex_unlock (&dispatch_lock);
+}
+
+static dispatched_t *find_dispatched (char const *type_instance)
+{
+  size_t i;
+
+  for (i = 0; i < dispatched_num; i++)
+    if (strcmp (dispatched[i].type_instance, type_instance) == 0)
+      return (dispatched + i);
+  return (NULL);
+}
+
+/*
+ * Configuration, equivalent to:
+ *
+ *   <Data "load">
+ *     Type "gauge"
+ *     Table false
+ *     Instance "load"
+ *     Values "1.3.6.1.4.1.2021.10.1.5.1"
+ *   </Data>
+ *   <Data "traffic">
+ *     Type "if_octets"
+ *     Table true
+ *     Instance "IF-MIB::ifDescr"
+ *     Values "IF-MIB::ifInOctets" "IF-MIB::ifOutOctets"
+ *   </Data>
+ *   <Host "agent">
+ *     Address "udp:127.0.0.1:<port>"
+ *     Community "public"
+ *     Collect "load" "traffic"
+ *   </Host>
+ */
+static oid const oid_load[] = { 1, 3, 6, 1, 4, 1, 2021, 10, 1, 5, 1 };
+static oid const oid_if_descr[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 2 };
+static oid const oid_if_in[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 10 };
+static oid const oid_if_out[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 16 };
+
+static data_definition_t *create_data (char const *name, /* {{{ */
+    char const *type, size_t values_len)
+{
+  data_definition_t *dd;
+
+  dd = calloc (1, sizeof (*dd));
+  assert (dd != NULL);
+  dd->name = strdup (name);
+  dd->type = strdup (type);
+  dd->values = calloc (values_len, sizeof (*dd->values));
+  dd->values_len = values_len;
+  dd->scale = 1.0;
+  dd->shift = 0.0;
+
+  /* csnmp_shutdown() frees the data definitions. */
+  dd->next = data_head;
+  data_head = dd;
+
+  return (dd);
+} /* }}} data_definition_t *create_data */
+
+static host_definition_t *create_host (int port) /* {{{ */
+{
+  host_definition_t *hd;
+  data_definition_t *dd;
+  char address[64];
+
+  ssnprintf (address, sizeof (address), "udp:127.0.0.1:%i", port);
+
+  hd = calloc (1, sizeof (*hd));
+  assert (hd != NULL);
+  hd->name = strdup ("agent");
+  hd->address = strdup (address);
+  hd->version = 2;
+  hd->community = strdup (TEST_COMMUNITY);
+  hd->interval = TIME_T_TO_CDTIME_T (10);
+  hd->bulk_size = -1;
+  C_COMPLAIN_INIT (&hd->complaint);
+
+  hd->data_list = calloc (2, sizeof (*hd->data_list));
+  assert (hd->data_list != NULL);
+
+  dd = create_data ("load", "gauge", 1);
+  sstrncpy (dd->instance.string, "load", sizeof (dd->instance.string));
+  csnmp_oid_init (dd->values, oid_load, STATIC_ARRAY_SIZE (oid_load));
+  hd->data_list[hd->data_list_len++] = dd;
+
+  dd = create_data ("traffic", "if_octets", 2);
+  dd->is_table = 1;
+  csnmp_oid_init (&dd->instance.oid, oid_if_descr,
+      STATIC_ARRAY_SIZE (oid_if_descr));
+  csnmp_oid_init (dd->values + 0, oid_if_in, STATIC_ARRAY_SIZE (oid_if_in));
+  csnmp_oid_init (dd->values + 1, oid_if_out, STATIC_ARRAY_SIZE (oid_if_out));
+  hd->data_list[hd->data_list_len++] = dd;
+
+  return (hd);
+} /* }}} host_definition_t *create_host */
+
+static host_definition_t *host;
+
+static int check_dispatched (void) /* {{{ */
+{
+  struct {
+    char const *type_instance;
+    uint64_t rx;
+    uint64_t tx;
+  } cases[] = {
+    { "lo", 100, 1000 },
+    { "eth0", 200, 2000 },
+    { "eth1", 300, 3000 },
+  };
+  dispatched_t *d;
+  size_t i;
+
+  EXPECT_EQ_UINT64 (4, (uint64_t) dispatched_num);
+
+  CHECK_NOT_NULL (d = find_dispatched ("load"));
+  EXPECT_EQ_STR ("agent", d->host);
+  EXPECT_EQ_STR ("gauge", d->type);
+  EXPECT_EQ_DOUBLE (42.0, d->values[0].gauge);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    CHECK_NOT_NULL (d = find_dispatched (cases[i].type_instance));
+    EXPECT_EQ_STR ("if_octets", d->type);
+    EXPECT_EQ_UINT64 (cases[i].rx, (uint64_t) d->values[0].counter);
+    EXPECT_EQ_UINT64 (cases[i].tx, (uint64_t) d->values[1].counter);
+  }
+
+  return (0);
+} /* }}} int check_dispatched */
+
+DEF_TEST(read_getnext)
+{
+  user_data_t ud = { host, NULL };
+
+  csnmp_async = 0;
+  host->bulk_size = -1;
+  reset_dispatched ();
+  agent_reset_counters ();
+
+  CHECK_ZERO (csnmp_read_host (&ud));
+  CHECK_ZERO (check_dispatched ());
+
+  /* One GET for the scalar; the table has three rows, the fourth GETNEXT
+   * leaves the subtree. */
+  EXPECT_EQ_INT (1, agent_get);
+  EXPECT_EQ_INT (4, agent_getnext);
+  EXPECT_EQ_INT (0, agent_getbulk);
+
+  return (0);
+}
+
+DEF_TEST(read_getbulk)
+{
+  user_data_t ud = { host, NULL };
+
+  csnmp_async = 0;
+  host->bulk_size = 2;
+  reset_dispatched ();
+  agent_reset_counters ();
+
+  CHECK_ZERO (csnmp_read_host (&ud));
+  CHECK_ZERO (check_dispatched ());
+
+  /* Two rows per request. */
+  EXPECT_EQ_INT (1, agent_get);
+  EXPECT_EQ_INT (0, agent_getnext);
+  EXPECT_EQ_INT (2, agent_getbulk);
+
+  host->bulk_size = -1;
+  return (0);
+}
+
+DEF_TEST(read_async)
+{
+  user_data_t ud = { host, NULL };
+
+  csnmp_async = 1;
+  reset_dispatched ();
+  agent_reset_counters ();
+
+  /* Hold the responses so that the poll is still running when the next
+   * interval comes around. */
+  agent_set_paused (1);
+  CHECK_ZERO (csnmp_read_host (&ud));
+
+  pthread_mutex_lock (&engine_lock);
+  OK (host->poll_submitted);
+  pthread_mutex_unlock (&engine_lock);
+
+  /* Skipping an interval is not a read error. */
+  CHECK_ZERO (csnmp_read_host (&ud));
+
+  agent_set_paused (0);
+  wait_dispatched (4);
+  CHECK_ZERO (check_dispatched ());
+
+  /* The default bulk size covers the whole table in one request. */
+  EXPECT_EQ_INT (1, agent_get);
+  EXPECT_EQ_INT (0, agent_getnext);
+  EXPECT_EQ_INT (1, agent_getbulk);
+
+  csnmp_async = 0;
+  return (0);
+}
+
+int main (void)
+{
+  int port;
+
+  port = agent_start ();
+  OK1 (port > 0, "agent_start ()");
+  if (port <= 0)
+    END_TEST;
+
+  CHECK_ZERO (csnmp_init ());
+  host = create_host (port);
+
+  RUN_TEST(read_getnext);
+  RUN_TEST(read_getbulk);
+  RUN_TEST(read_async);
+
+  csnmp_host_definition_destroy (host);
+  csnmp_shutdown ();
+  agent_stop_thread ();
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
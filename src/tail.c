@@ -29,8 +29,14 @@
 #include "plugin.h"
 #include "utils_tail_match.h"
 
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+# include <poll.h>
+#endif
+
 /*
  *  <Plugin tail>
+ *    UseInotify true
  *    <File "/var/log/exim4/mainlog">
  *	Instance "exim"
  *      Interval 60
@@ -57,9 +63,35 @@ struct ctail_config_match_s
 typedef struct ctail_config_match_s ctail_config_match_t;
 
 static cu_tail_match_t **tail_match_list = NULL;
+static char **tail_match_list_files = NULL;
 static size_t tail_match_list_num = 0;
 static cdtime_t tail_match_list_intervals[255];
 
+#if HAVE_SYS_INOTIFY_H
+/* A file watched by the inotify thread. The file itself is watched for
+ * modifications and its directory for the creation of a new file with the
+ * same name, i.e. log rotation. */
+struct ctail_watch_s
+{
+  cu_tail_match_t *tm;
+  char *file;
+  char *dir;
+  const char *base;
+  int wd;
+  int dir_wd;
+  _Bool dirty;
+};
+typedef struct ctail_watch_s ctail_watch_t;
+
+static _Bool use_inotify = 0;
+static int inotify_fd = -1;
+static ctail_watch_t *watch_list = NULL;
+static size_t watch_list_num = 0;
+static pthread_t inotify_thread;
+static _Bool inotify_thread_running = 0;
+static _Bool inotify_thread_shutdown = 0;
+#endif /* HAVE_SYS_INOTIFY_H */
+
 static int ctail_config_add_match_dstype (ctail_config_match_t *cm,
     oconfig_item_t *ci)
 {
@@ -279,17 +311,41 @@ static int ctail_config_add_file (oconfig_item_t *ci)
   {
     cu_tail_match_t **temp;
 
+    char **files;
+    char *file;
+
+    file = strdup (ci->values[0].value.string);
+    if (file == NULL)
+    {
+      ERROR ("tail plugin: strdup failed.");
+      tail_match_destroy (tm);
+      return (-1);
+    }
+
+    files = realloc (tail_match_list_files,
+        sizeof (char *) * (tail_match_list_num + 1));
+    if (files == NULL)
+    {
+      ERROR ("tail plugin: realloc failed.");
+      sfree (file);
+      tail_match_destroy (tm);
+      return (-1);
+    }
+    tail_match_list_files = files;
+
     temp = realloc (tail_match_list,
         sizeof (cu_tail_match_t *) * (tail_match_list_num + 1));
     if (temp == NULL)
     {
       ERROR ("tail plugin: realloc failed.");
+      sfree (file);
       tail_match_destroy (tm);
       return (-1);
     }
 
     tail_match_list = temp;
     tail_match_list[tail_match_list_num] = tm;
+    tail_match_list_files[tail_match_list_num] = file;
     tail_match_list_intervals[tail_match_list_num] = interval;
     tail_match_list_num++;
   }
@@ -307,6 +363,15 @@ static int ctail_config (oconfig_item_t *ci)
 
     if (strcasecmp ("File", option->key) == 0)
       ctail_config_add_file (option);
+    else if (strcasecmp ("UseInotify", option->key) == 0)
+    {
+#if HAVE_SYS_INOTIFY_H
+      cf_util_get_boolean (option, &use_inotify);
+#else
+      WARNING ("tail plugin: The `UseInotify' option is not supported "
+          "on this system and will be ignored.");
+#endif
+    }
     else
     {
       WARNING ("tail plugin: Option `%s' not allowed here.", option->key);
@@ -330,6 +395,235 @@ static int ctail_read (user_data_t *ud)
   return (0);
 } /* int ctail_read */
 
+#if HAVE_SYS_INOTIFY_H
+static void ctail_watch_file (ctail_watch_t *w)
+{
+  int wd;
+
+  wd = inotify_add_watch (inotify_fd, w->file,
+      IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+  if (wd < 0)
+  {
+    /* The file doesn't exist (yet). We'll be notified by the directory
+     * watch when it is created. */
+    if ((errno != ENOENT) && (w->wd >= 0))
+    {
+      char errbuf[1024];
+      WARNING ("tail plugin: inotify_add_watch (%s) failed: %s", w->file,
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+  }
+  w->wd = wd;
+} /* void ctail_watch_file */
+
+static void ctail_inotify_handle_event (const struct inotify_event *ev)
+{
+  size_t i;
+
+  if (ev->mask & IN_Q_OVERFLOW)
+  {
+    for (i = 0; i < watch_list_num; i++)
+      watch_list[i].dirty = 1;
+    return;
+  }
+
+  for (i = 0; i < watch_list_num; i++)
+  {
+    ctail_watch_t *w = watch_list + i;
+
+    if ((w->wd >= 0) && (ev->wd == w->wd))
+    {
+      w->dirty = 1;
+
+      /* The file has been rotated. The remaining data is read from the old
+       * file before the new one is opened, see cu_tail_read(). */
+      if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED))
+      {
+        if (!(ev->mask & IN_IGNORED))
+          inotify_rm_watch (inotify_fd, w->wd);
+        w->wd = -1;
+        ctail_watch_file (w);
+      }
+    }
+    else if ((ev->wd == w->dir_wd) && (ev->len > 0)
+        && (ev->mask & (IN_CREATE | IN_MOVED_TO))
+        && (strcmp (ev->name, w->base) == 0))
+    {
+      w->dirty = 1;
+      ctail_watch_file (w);
+    }
+  }
+} /* void ctail_inotify_handle_event */
+
+/* Reads files as soon as data is appended to them. Values are still
+ * dispatched by ctail_read() at the configured interval. */
+static void *ctail_inotify_thread (void __attribute__((unused)) *arg)
+{
+  union
+  {
+    struct inotify_event ev;
+    char buffer[16 * (sizeof (struct inotify_event) + NAME_MAX + 1)];
+  } events;
+
+  while (!inotify_thread_shutdown)
+  {
+    struct pollfd pfd = { inotify_fd, POLLIN, 0 };
+    ssize_t len;
+    char *ptr;
+    size_t i;
+    int status;
+
+    status = poll (&pfd, 1, /* timeout = */ 1000);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+        continue;
+
+      ERROR ("tail plugin: poll failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+    else if (status == 0)
+      continue;
+
+    len = read (inotify_fd, events.buffer, sizeof (events.buffer));
+    if (len <= 0)
+      continue;
+
+    for (ptr = events.buffer; ptr < events.buffer + len;)
+    {
+      const struct inotify_event *ev = (const struct inotify_event *) ptr;
+
+      ctail_inotify_handle_event (ev);
+      ptr += sizeof (*ev) + ev->len;
+    }
+
+    /* Handle all events first so that a file is read only once, no matter
+     * how many events have been queued for it. */
+    for (i = 0; i < watch_list_num; i++)
+    {
+      if (!watch_list[i].dirty)
+        continue;
+      watch_list[i].dirty = 0;
+      tail_match_read_lines (watch_list[i].tm);
+    }
+  }
+
+  return (NULL);
+} /* void *ctail_inotify_thread */
+
+static void ctail_inotify_stop (void)
+{
+  size_t i;
+
+  if (inotify_thread_running)
+  {
+    inotify_thread_shutdown = 1;
+    pthread_join (inotify_thread, /* retval = */ NULL);
+    inotify_thread_running = 0;
+  }
+
+  for (i = 0; i < watch_list_num; i++)
+  {
+    sfree (watch_list[i].file);
+    sfree (watch_list[i].dir);
+  }
+  sfree (watch_list);
+  watch_list_num = 0;
+
+  if (inotify_fd >= 0)
+  {
+    close (inotify_fd);
+    inotify_fd = -1;
+  }
+} /* void ctail_inotify_stop */
+
+static int ctail_inotify_start (void)
+{
+  size_t i;
+  int status;
+
+  inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tail plugin: inotify_init1 failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  watch_list = calloc (tail_match_list_num, sizeof (*watch_list));
+  if (watch_list == NULL)
+  {
+    ERROR ("tail plugin: calloc failed.");
+    ctail_inotify_stop ();
+    return (-1);
+  }
+
+  for (i = 0; i < tail_match_list_num; i++)
+  {
+    ctail_watch_t *w = watch_list + watch_list_num;
+    char *slash;
+
+    w->tm = tail_match_list[i];
+    w->file = strdup (tail_match_list_files[i]);
+    w->dir = strdup (tail_match_list_files[i]);
+    if ((w->file == NULL) || (w->dir == NULL))
+    {
+      ERROR ("tail plugin: strdup failed.");
+      sfree (w->file);
+      sfree (w->dir);
+      continue;
+    }
+
+    slash = strrchr (w->dir, '/');
+    if (slash == NULL)
+    {
+      w->base = w->file;
+      sstrncpy (w->dir, ".", strlen (w->dir) + 1);
+    }
+    else
+    {
+      w->base = w->file + (slash - w->dir) + 1;
+      if (slash == w->dir)
+        slash[1] = 0;
+      else
+        slash[0] = 0;
+    }
+
+    w->wd = 0;
+    ctail_watch_file (w);
+
+    w->dir_wd = inotify_add_watch (inotify_fd, w->dir,
+        IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+    if (w->dir_wd < 0)
+    {
+      char errbuf[1024];
+      WARNING ("tail plugin: inotify_add_watch (%s) failed: %s. "
+          "Rotation of `%s' will only be noticed at the next interval.",
+          w->dir, sstrerror (errno, errbuf, sizeof (errbuf)), w->file);
+    }
+
+    watch_list_num++;
+  }
+
+  inotify_thread_shutdown = 0;
+  status = plugin_thread_create (&inotify_thread, /* attr = */ NULL,
+      ctail_inotify_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("tail plugin: plugin_thread_create failed.");
+    ctail_inotify_stop ();
+    return (-1);
+  }
+  inotify_thread_running = 1;
+
+  return (0);
+} /* int ctail_inotify_start */
+#endif /* HAVE_SYS_INOTIFY_H */
+
 static int ctail_init (void)
 {
   char str[255];
@@ -351,6 +645,14 @@ static int ctail_init (void)
     plugin_register_complex_read (NULL, str, ctail_read, tail_match_list_intervals[i], &ud);
   }
 
+#if HAVE_SYS_INOTIFY_H
+  /* Fall back to reading the files at the configured interval only. */
+  if (use_inotify && !inotify_thread_running
+      && (ctail_inotify_start () != 0))
+    WARNING ("tail plugin: Watching files with inotify failed. Files will "
+        "be read at the configured interval only.");
+#endif
+
   return (0);
 } /* int ctail_init */
 
@@ -358,12 +660,18 @@ static int ctail_shutdown (void)
 {
   size_t i;
 
+#if HAVE_SYS_INOTIFY_H
+  ctail_inotify_stop ();
+#endif
+
   for (i = 0; i < tail_match_list_num; i++)
   {
     tail_match_destroy (tail_match_list[i]);
     tail_match_list[i] = NULL;
+    sfree (tail_match_list_files[i]);
   }
   sfree (tail_match_list);
+  sfree (tail_match_list_files);
   tail_match_list_num = 0;
 
   return (0);
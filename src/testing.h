@@ -113,4 +113,24 @@ static int check_count__ = 0;
   OK1(status_ == 0L, #expr); \
 } while (0)
 
+/* Fixtures for tests that handle value lists. Like the checks above, they
+ * are macros, so testing.h can be included before plugin.h. */
+
+/* The "gauge" type from types.db. */
+#define TESTING_DS_GAUGE (&(data_set_t) { "gauge", 1, \
+  (data_source_t[]) { { "value", DS_TYPE_GAUGE, 0.0, NAN } } })
+
+/* Initializes "vl" with one value per data source of "ds", host
+ * "example.com", plugin "test" and the type of "ds". Tests set any other
+ * field they check. */
+#define TESTING_VALUE_LIST(vl, vals, ds) do { \
+  value_list_t vl_init__ = VALUE_LIST_INIT; \
+  *(vl) = vl_init__; \
+  (vl)->values = (vals); \
+  (vl)->values_len = (ds)->ds_num; \
+  sstrncpy ((vl)->host, "example.com", sizeof ((vl)->host)); \
+  sstrncpy ((vl)->plugin, "test", sizeof ((vl)->plugin)); \
+  sstrncpy ((vl)->type, (ds)->type, sizeof ((vl)->type)); \
+} while (0)
+
 #endif /* TESTING_H */
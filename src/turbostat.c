@@ -42,6 +42,7 @@
 
 #include <asm/msr-index.h>
 #include <cpuid.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_CAPABILITY_H
 #include <sys/capability.h>
 #endif /* HAVE_SYS_CAPABILITY_H */
@@ -139,6 +140,13 @@ static double rapl_energy_units;
 					/* 0x642 MSR_PP1_POLICY */
 #define	TJMAX_DEFAULT	100
 
+/*
+ * If set, the CPUs of each package are read by a thread of its own, pinned
+ * to that package, and all packages are read at the same time. Otherwise the
+ * read thread migrates from one CPU to the next.
+ */
+static _Bool config_parallel_read;
+
 static cpu_set_t *cpu_present_set, *cpu_affinity_set, *cpu_saved_affinity_set;
 static size_t cpu_present_setsize, cpu_affinity_setsize, cpu_saved_affinity_setsize;
 
@@ -150,6 +158,7 @@ static struct thread_data {
 	unsigned int smi_count;
 	unsigned int cpu_id;
 	unsigned int flags;
+	cdtime_t sampled;	/* when the TSC was read */
 #define CPU_IS_FIRST_THREAD_IN_CORE	0x2
 #define CPU_IS_FIRST_CORE_IN_PACKAGE	0x4
 } *thread_delta, *thread_even, *thread_odd;
@@ -215,6 +224,37 @@ static struct topology {
 
 static cdtime_t time_even, time_odd, time_delta;
 
+/*
+ * MSR devices, indexed by CPU id, kept open between reads
+ */
+static int *msr_fds;
+static size_t msr_fds_num;
+
+/*
+ * Sampling threads, one per package, used if config_parallel_read is set
+ */
+struct pkg_reader {
+	pthread_t thread;
+	unsigned int package_id;
+	cpu_set_t *cpus;
+	size_t cpus_size;
+	unsigned long round;
+	_Bool running;
+};
+
+static struct pkg_reader *pkg_readers;
+static unsigned int pkg_readers_num;
+static unsigned int pkg_readers_busy;
+static unsigned long pkg_readers_round;
+static int pkg_readers_status;
+static _Bool pkg_readers_shutdown;
+static struct thread_data *pkg_readers_thread_base;
+static struct core_data *pkg_readers_core_base;
+static struct pkg_data *pkg_readers_pkg_base;
+static pthread_mutex_t pkg_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pkg_readers_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pkg_readers_done = PTHREAD_COND_INITIALIZER;
+
 static const char *config_keys[] =
 {
 	"CoreCstates",
@@ -224,6 +264,7 @@ static const char *config_keys[] =
 	"PackageThermalManagement",
 	"TCCActivationTemp",
 	"RunningAveragePowerLimit",
+	"ParallelRead",
 };
 static const int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -231,32 +272,33 @@ static const int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
  *  MSR Manipulation helpers *
  *****************************/
 
+/*
+ * Migrate the current thread to the given CPU before doing multiple reads
+ * Otherwise, we would lose time calling functions on another CPU
+ *
+ * Changes the scheduling affinity of the current thread
+ */
+static int __attribute__((warn_unused_result))
+migrate_to_cpu(unsigned int cpu)
+{
+	CPU_ZERO_S(cpu_affinity_setsize, cpu_affinity_set);
+	CPU_SET_S(cpu, cpu_affinity_setsize, cpu_affinity_set);
+	if (sched_setaffinity(0, cpu_affinity_setsize, cpu_affinity_set) == -1) {
+		ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
+		return -1;
+	}
+	return 0;
+}
+
 /*
  * Open a MSR device for reading
- * Can change the scheduling affinity of the current process if multiple_read is 1
  */
 static int __attribute__((warn_unused_result))
-open_msr(unsigned int cpu, _Bool multiple_read)
+open_msr(unsigned int cpu)
 {
 	char pathname[32];
 	int fd;
 
-	/*
-	 * If we need to do multiple read, let's migrate to the CPU
-	 * Otherwise, we would lose time calling functions on another CPU
-	 *
-	 * If we are not yet initialized (cpu_affinity_setsize = 0),
-	 * we need to skip this optimisation.
-	 */
-	if (multiple_read && cpu_affinity_setsize) {
-		CPU_ZERO_S(cpu_affinity_setsize, cpu_affinity_set);
-		CPU_SET_S(cpu, cpu_affinity_setsize, cpu_affinity_set);
-		if (sched_setaffinity(0, cpu_affinity_setsize, cpu_affinity_set) == -1) {
-			ERROR("turbostat plugin: Could not migrate to CPU %d", cpu);
-			return -1;
-		}
-	}
-
 	ssnprintf(pathname, sizeof(pathname), "/dev/cpu/%d/msr", cpu);
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0) {
@@ -294,7 +336,7 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
 	ssize_t retval;
 	int fd;
 
-	fd = open_msr(cpu, 0);
+	fd = open_msr(cpu);
 	if (fd < 0)
 		return fd;
 	retval = read_msr(fd, offset, msr);
@@ -302,6 +344,47 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
 	return retval;
 }
 
+/*
+ * Open the MSR devices of all present CPUs, to be kept open until the
+ * buffers are freed
+ */
+static int __attribute__((warn_unused_result))
+open_all_msr(void)
+{
+	unsigned int cpu;
+
+	msr_fds_num = topology.max_cpu_id + 1;
+	msr_fds = calloc(msr_fds_num, sizeof(*msr_fds));
+	if (msr_fds == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		msr_fds_num = 0;
+		return -1;
+	}
+
+	for (cpu = 0; cpu < msr_fds_num; ++cpu) {
+		msr_fds[cpu] = -1;
+		if (!CPU_ISSET_S(cpu, cpu_present_setsize, cpu_present_set))
+			continue;
+		msr_fds[cpu] = open_msr(cpu);
+		if (msr_fds[cpu] < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+close_all_msr(void)
+{
+	size_t i;
+
+	for (i = 0; i < msr_fds_num; ++i)
+		if (msr_fds[i] >= 0)
+			close(msr_fds[i]);
+	free(msr_fds);
+	msr_fds = NULL;
+	msr_fds_num = 0;
+}
+
 
 /********************************
  * Raw data acquisition (1 CPU) *
@@ -313,7 +396,8 @@ get_msr(unsigned int cpu, off_t offset, unsigned long long *msr)
  * Core data is shared for all threads in one core: extracted only for the first thread
  * Package data is shared for all core in one package: extracted only for the first thread of the first core
  *
- * Side effect: migrates to the targeted CPU
+ * Side effect: migrates to the targeted CPU, unless the CPUs are read by
+ * the per-package threads
  */
 static int __attribute__((warn_unused_result))
 get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
@@ -323,9 +407,14 @@ get_counters(struct thread_data *t, struct core_data *c, struct pkg_data *p)
 	int msr_fd;
 	int retval = 0;
 
-	msr_fd = open_msr(cpu, 1);
-	if (msr_fd < 0)
-		return msr_fd;
+	if (!config_parallel_read && migrate_to_cpu(cpu) < 0)
+		return -1;
+
+	if (cpu >= msr_fds_num || msr_fds[cpu] < 0) {
+		ERROR("turbostat plugin: MSR device of CPU %u is not open", cpu);
+		return -1;
+	}
+	msr_fd = msr_fds[cpu];
 
 #define READ_MSR(msr, dst)						\
 do {									\
@@ -337,6 +426,7 @@ do {									\
 } while (0)
 
 	READ_MSR(MSR_IA32_TSC, &t->tsc);
+	t->sampled = cdtime();
 
 	READ_MSR(MSR_IA32_APERF, &t->aperf);
 	READ_MSR(MSR_IA32_MPERF, &t->mperf);
@@ -407,7 +497,6 @@ do {									\
 	}
 
 out:
-	close(msr_fd);
 	return retval;
 }
 
@@ -641,42 +730,62 @@ cpu_is_not_present(unsigned int cpu)
 }
 
 /*
- * Loop on all CPUs in topological order
+ * Loop on all CPUs of one package in topological order
  *
  * Skip non-present cpus
  * Return the error code at the first error or 0
  */
 static int __attribute__((warn_unused_result))
-for_all_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
-	struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base)
+for_package_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
+	struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base,
+	unsigned int pkg_no)
 {
 	int retval;
-	unsigned int pkg_no, core_no, thread_no;
+	unsigned int core_no, thread_no;
 
-	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
-		for (core_no = 0; core_no < topology.num_cores; ++core_no) {
-			for (thread_no = 0; thread_no < topology.num_threads; ++thread_no) {
-				struct thread_data *t;
-				struct core_data *c;
-				struct pkg_data *p;
+	for (core_no = 0; core_no < topology.num_cores; ++core_no) {
+		for (thread_no = 0; thread_no < topology.num_threads; ++thread_no) {
+			struct thread_data *t;
+			struct core_data *c;
+			struct pkg_data *p;
 
-				t = GET_THREAD(thread_base, thread_no, core_no, pkg_no);
+			t = GET_THREAD(thread_base, thread_no, core_no, pkg_no);
 
-				if (cpu_is_not_present(t->cpu_id))
-					continue;
+			if (cpu_is_not_present(t->cpu_id))
+				continue;
 
-				c = GET_CORE(core_base, core_no, pkg_no);
-				p = GET_PKG(pkg_base, pkg_no);
+			c = GET_CORE(core_base, core_no, pkg_no);
+			p = GET_PKG(pkg_base, pkg_no);
 
-				retval = func(t, c, p);
-				if (retval)
-					return retval;
-			}
+			retval = func(t, c, p);
+			if (retval)
+				return retval;
 		}
 	}
 	return 0;
 }
 
+/*
+ * Loop on all CPUs in topological order
+ *
+ * Skip non-present cpus
+ * Return the error code at the first error or 0
+ */
+static int __attribute__((warn_unused_result))
+for_all_cpus(int (func)(struct thread_data *, struct core_data *, struct pkg_data *),
+	struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base)
+{
+	int retval;
+	unsigned int pkg_no;
+
+	for (pkg_no = 0; pkg_no < topology.num_packages; ++pkg_no) {
+		retval = for_package_cpus(func, thread_base, core_base, pkg_base, pkg_no);
+		if (retval)
+			return retval;
+	}
+	return 0;
+}
+
 /*
  * Dedicated loop: Extract every data evolution for all CPU
  *
@@ -745,6 +854,30 @@ for_all_cpus_delta(const struct thread_data *thread_new_base, const struct core_
 }
 
 
+/*
+ * Time elapsed between reading the first and the last CPU of one sample
+ */
+static cdtime_t
+sampling_skew(const struct thread_data *thread_base)
+{
+	cdtime_t first = 0, last = 0;
+	unsigned int i, total_threads;
+
+	total_threads = topology.num_threads * topology.num_cores * topology.num_packages;
+	for (i = 0; i < total_threads; ++i) {
+		const struct thread_data *t = thread_base + i;
+
+		if (cpu_is_not_present(t->cpu_id))
+			continue;
+		if (first == 0 || t->sampled < first)
+			first = t->sampled;
+		if (t->sampled > last)
+			last = t->sampled;
+	}
+	return last - first;
+}
+
+
 /***************
  * CPU Probing *
  ***************/
@@ -1244,6 +1377,152 @@ err:
 }
 
 
+/*******************************************
+ * Parallel data acquisition (1 thread per *
+ * package)                                *
+ *******************************************/
+
+/*
+ * Pin the thread to the CPUs of its package, so that the MSR reads stay
+ * within the package, and read the package whenever a new round starts
+ */
+static void *
+pkg_reader_main(void *arg)
+{
+	struct pkg_reader *r = arg;
+	int status;
+
+	status = pthread_setaffinity_np(pthread_self(), r->cpus_size, r->cpus);
+	if (status != 0)
+		WARNING("turbostat plugin: Unable to pin the sampling thread "
+			"to package %u", r->package_id);
+
+	pthread_mutex_lock(&pkg_readers_lock);
+	while (42) {
+		struct thread_data *thread_base;
+		struct core_data *core_base;
+		struct pkg_data *pkg_base;
+
+		while (!pkg_readers_shutdown && r->round == pkg_readers_round)
+			pthread_cond_wait(&pkg_readers_start, &pkg_readers_lock);
+		if (pkg_readers_shutdown)
+			break;
+
+		r->round = pkg_readers_round;
+		thread_base = pkg_readers_thread_base;
+		core_base = pkg_readers_core_base;
+		pkg_base = pkg_readers_pkg_base;
+		pthread_mutex_unlock(&pkg_readers_lock);
+
+		status = for_package_cpus(get_counters, thread_base, core_base,
+					  pkg_base, r->package_id);
+
+		pthread_mutex_lock(&pkg_readers_lock);
+		if (status != 0)
+			pkg_readers_status = status;
+		pkg_readers_busy--;
+		if (pkg_readers_busy == 0)
+			pthread_cond_signal(&pkg_readers_done);
+	}
+	pthread_mutex_unlock(&pkg_readers_lock);
+	return NULL;
+}
+
+static void
+stop_pkg_readers(void)
+{
+	unsigned int i;
+
+	if (pkg_readers == NULL)
+		return;
+
+	pthread_mutex_lock(&pkg_readers_lock);
+	pkg_readers_shutdown = 1;
+	pthread_cond_broadcast(&pkg_readers_start);
+	pthread_mutex_unlock(&pkg_readers_lock);
+
+	for (i = 0; i < topology.num_packages; ++i) {
+		if (pkg_readers[i].running)
+			pthread_join(pkg_readers[i].thread, NULL);
+		if (pkg_readers[i].cpus != NULL)
+			CPU_FREE(pkg_readers[i].cpus);
+	}
+	free(pkg_readers);
+	pkg_readers = NULL;
+	pkg_readers_num = 0;
+	pkg_readers_shutdown = 0;
+}
+
+/*
+ * Start one sampling thread for every package with at least one present CPU
+ */
+static int __attribute__((warn_unused_result))
+start_pkg_readers(void)
+{
+	unsigned int i, cpu;
+
+	pkg_readers = calloc(topology.num_packages, sizeof(*pkg_readers));
+	if (pkg_readers == NULL) {
+		ERROR("turbostat plugin: calloc failed");
+		return -1;
+	}
+
+	for (i = 0; i < topology.num_packages; ++i) {
+		struct pkg_reader *r = pkg_readers + i;
+
+		r->package_id = i;
+		r->round = pkg_readers_round;
+		if (allocate_cpu_set(&r->cpus, &r->cpus_size) != 0) {
+			stop_pkg_readers();
+			return -1;
+		}
+		for (cpu = 0; cpu <= topology.max_cpu_id; ++cpu)
+			if (!cpu_is_not_present(cpu) && topology.cpus[cpu].package_id == i)
+				CPU_SET_S(cpu, r->cpus_size, r->cpus);
+		if (CPU_COUNT_S(r->cpus_size, r->cpus) == 0)
+			continue;
+
+		if (plugin_thread_create(&r->thread, NULL, pkg_reader_main, r) != 0) {
+			ERROR("turbostat plugin: Unable to start the sampling thread "
+			      "of package %u", i);
+			stop_pkg_readers();
+			return -1;
+		}
+		r->running = 1;
+		pkg_readers_num++;
+	}
+	return 0;
+}
+
+/*
+ * Read all CPUs, either from the read thread or by the per-package threads,
+ * which read their packages concurrently
+ */
+static int __attribute__((warn_unused_result))
+read_all_cpus(struct thread_data *thread_base, struct core_data *core_base, struct pkg_data *pkg_base)
+{
+	int retval;
+
+	if (!config_parallel_read)
+		return for_all_cpus(get_counters, thread_base, core_base, pkg_base);
+
+	pthread_mutex_lock(&pkg_readers_lock);
+	pkg_readers_thread_base = thread_base;
+	pkg_readers_core_base = core_base;
+	pkg_readers_pkg_base = pkg_base;
+	pkg_readers_status = 0;
+	pkg_readers_busy = pkg_readers_num;
+	pkg_readers_round++;
+	pthread_cond_broadcast(&pkg_readers_start);
+	while (pkg_readers_busy > 0)
+		pthread_cond_wait(&pkg_readers_done, &pkg_readers_lock);
+	retval = pkg_readers_status;
+	pthread_mutex_unlock(&pkg_readers_lock);
+
+	return retval;
+}
+
+
 /************************
  * Main alloc/init/free *
  ************************/
@@ -1340,6 +1619,9 @@ free_all_buffers(void)
 	allocated = 0;
 	initialized = 0;
 
+	stop_pkg_readers();
+	close_all_msr();
+
 	CPU_FREE(cpu_present_set);
 	cpu_present_set = NULL;
 	cpu_present_setsize = 0;
@@ -1400,6 +1682,9 @@ static int setup_all_buffers(void)
 	initialize_counters();
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, EVEN_COUNTERS));
 	DO_OR_GOTO_ERR(for_all_cpus(set_temperature_target, ODD_COUNTERS));
+	DO_OR_GOTO_ERR(open_all_msr());
+	if (config_parallel_read)
+		DO_OR_GOTO_ERR(start_pkg_readers());
 
 	allocated = 1;
 	return 0;
@@ -1436,7 +1721,7 @@ turbostat_read(void)
 	}
 
 	if (!initialized) {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+		if ((ret = read_all_cpus(EVEN_COUNTERS)) < 0)
 			goto out;
 		time_even = cdtime();
 		is_even = 1;
@@ -1446,7 +1731,7 @@ turbostat_read(void)
 	}
 
 	if (is_even) {
-		if ((ret = for_all_cpus(get_counters, ODD_COUNTERS)) < 0)
+		if ((ret = read_all_cpus(ODD_COUNTERS)) < 0)
 			goto out;
 		time_odd = cdtime();
 		is_even = 0;
@@ -1455,8 +1740,10 @@ turbostat_read(void)
 			goto out;
 		if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
 			goto out;
+		turbostat_submit(NULL, "duration", "sampling_skew",
+				 CDTIME_T_TO_DOUBLE(sampling_skew(thread_odd)));
 	} else {
-		if ((ret = for_all_cpus(get_counters, EVEN_COUNTERS)) < 0)
+		if ((ret = read_all_cpus(EVEN_COUNTERS)) < 0)
 			goto out;
 		time_even = cdtime();
 		is_even = 1;
@@ -1465,6 +1752,8 @@ turbostat_read(void)
 			goto out;
 		if ((ret = for_all_cpus(submit_counters, DELTA_COUNTERS)) < 0)
 			goto out;
+		turbostat_submit(NULL, "duration", "sampling_skew",
+				 CDTIME_T_TO_DOUBLE(sampling_skew(thread_even)));
 	}
 	ret = 0;
 out:
@@ -1610,6 +1899,8 @@ turbostat_config(const char *key, const char *value)
 			return -1;
 		}
 		tcc_activation_temp = (unsigned int) tmp_val;
+	} else if (strcasecmp("ParallelRead", key) == 0) {
+		config_parallel_read = IS_TRUE(value);
 	} else {
 		ERROR("turbostat plugin: Invalid configuration option '%s'",
 		      key);
@@ -1618,8 +1909,16 @@ turbostat_config(const char *key, const char *value)
 	return 0;
 }
 
+static int
+turbostat_shutdown(void)
+{
+	free_all_buffers();
+	return 0;
+}
+
 void module_register(void)
 {
 	plugin_register_init(PLUGIN_NAME, turbostat_init);
+	plugin_register_shutdown(PLUGIN_NAME, turbostat_shutdown);
 	plugin_register_config(PLUGIN_NAME, turbostat_config, config_keys, config_keys_num);
 }
@@ -35,6 +35,7 @@
 #include "utils_cmd_listval.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
+#include "utils_cmd_trace.h"
 
 /* Folks without pthread will need to disable this plugin. */
 #include <pthread.h>
@@ -44,12 +45,26 @@
 
 #include <grp.h>
 
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+# include <poll.h>
+#endif
+
 #ifndef UNIX_PATH_MAX
 # define UNIX_PATH_MAX sizeof (((struct sockaddr_un *)0)->sun_path)
 #endif
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
 
+/* Size of the per-client input buffer used by the event-driven server. This
+ * is also the maximum length of a single command line. */
+#define US_CLIENT_BUFFER_SIZE 65536
+
+/* Responses are sent as soon as this many bytes have accumulated. A worker
+ * whose response buffer has grown beyond this size, e.g. because of a large
+ * LISTVAL, releases it after the client has been served. */
+#define US_RESPONSE_BUFFER_SIZE 65536
+
 /*
  * Private variables
  */
@@ -59,7 +74,8 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"WorkerThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -74,6 +90,37 @@ static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
 
+/* If greater than zero, connections are multiplexed with epoll(7) and
+ * commands are handled by a fixed pool of worker threads instead of one
+ * thread per connection. */
+static int worker_threads_num = 0;
+
+#if HAVE_SYS_EPOLL_H
+struct us_client_s;
+typedef struct us_client_s us_client_t;
+struct us_client_s
+{
+	int fd;
+
+	char   buffer[US_CLIENT_BUFFER_SIZE];
+	size_t buffer_fill;
+
+	us_client_t *next; /* in the work queue */
+};
+
+static int epoll_fd = -1;
+
+static pthread_t *worker_threads = NULL;
+static int        worker_threads_started = 0;
+
+/* Clients with pending input, handed from the server thread to the
+ * workers. */
+static us_client_t    *work_head = NULL;
+static us_client_t    *work_tail = NULL;
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_cond = PTHREAD_COND_INITIALIZER;
+#endif /* HAVE_SYS_EPOLL_H */
+
 /*
  * Functions
  */
@@ -188,6 +235,62 @@ static int us_open_socket (void)
 	return (0);
 } /* int us_open_socket */
 
+/* Executes one command line. "buffer" holds the complete line, "command" is
+ * the (already split off) first field. Responses are written to "fhout".
+ * Returns non-zero if the connection should be closed. */
+static int us_handle_command (FILE *fhout, char *buffer, const char *command)
+{
+	if (strcasecmp (command, "getval") == 0)
+	{
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "getval_multi") == 0)
+	{
+		handle_getval_multi (fhout, buffer);
+	}
+	else if (strcasecmp (command, "getthreshold") == 0)
+	{
+		handle_getthreshold (fhout, buffer);
+	}
+	else if (strcasecmp (command, "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "putval_batch") == 0)
+	{
+		handle_putval_batch (fhout, buffer);
+	}
+	else if (strcasecmp (command, "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (command, "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (command, "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else if (strcasecmp (command, "trace") == 0)
+	{
+		handle_trace (fhout, buffer);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", command) < 0)
+		{
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fileno (fhout),
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* int us_handle_command */
+
 static void *us_handle_client (void *arg)
 {
 	int fdin;
@@ -291,50 +394,467 @@ static void *us_handle_client (void *arg)
 			return ((void *) 1);
 		}
 
-		if (strcasecmp (fields[0], "getval") == 0)
+		if (us_handle_command (fhout, buffer, fields[0]) != 0)
+			break;
+	} /* while (fgets) */
+
+	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
+	fclose (fhin);
+	fclose (fhout);
+
+	pthread_exit ((void *) 0);
+	return ((void *) 0);
+} /* void *us_handle_client */
+
+#if HAVE_SYS_EPOLL_H
+static void us_client_close (us_client_t *c) /* {{{ */
+{
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", c->fd);
+	/* Closing the descriptor removes it from the epoll set. */
+	close (c->fd);
+	sfree (c);
+} /* }}} void us_client_close */
+
+/* Responses of all commands read in one go are collected in memory, so that
+ * flushing after each command does not cause a system call. */
+struct us_response_s
+{
+	FILE  *fh;
+	char  *buffer;
+	size_t size;
+	size_t peak;
+};
+typedef struct us_response_s us_response_t;
+
+static int us_response_open (us_response_t *r) /* {{{ */
+{
+	memset (r, 0, sizeof (*r));
+	r->fh = open_memstream (&r->buffer, &r->size);
+	if (r->fh == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: open_memstream failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	return (0);
+} /* }}} int us_response_open */
+
+static void us_response_close (us_response_t *r) /* {{{ */
+{
+	if (r->fh != NULL)
+		fclose (r->fh);
+	sfree (r->buffer);
+	memset (r, 0, sizeof (*r));
+} /* }}} void us_response_close */
+
+/* Writes "buffer" completely to the non-blocking socket "fd". */
+static int us_client_write (int fd, const char *buffer, size_t size) /* {{{ */
+{
+	while (size > 0)
+	{
+		ssize_t status = write (fd, buffer, size);
+		if (status < 0)
 		{
-			handle_getval (fhout, buffer);
+			char errbuf[1024];
+			struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				/* The client is slow to read its responses. */
+				if (poll (&pfd, 1, /* timeout = */ 10000) > 0)
+					continue;
+				errno = ETIMEDOUT;
+			}
+
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "getthreshold") == 0)
+
+		buffer += status;
+		size -= (size_t) status;
+	}
+
+	return (0);
+} /* }}} int us_client_write */
+
+/* Sends the responses accumulated in "r" to the client and empties "r". */
+static int us_response_send (us_client_t *c, us_response_t *r) /* {{{ */
+{
+	fflush (r->fh);
+	if (r->size > r->peak)
+		r->peak = r->size;
+	if (r->size == 0)
+		return (0);
+
+	rewind (r->fh);
+	return (us_client_write (c->fd, r->buffer, r->size));
+} /* }}} int us_response_send */
+
+/* Executes all complete lines in the client's input buffer and moves a
+ * trailing partial line to the beginning of the buffer. Responses are
+ * accumulated in "r" and sent whenever they exceed
+ * US_RESPONSE_BUFFER_SIZE. Returns non-zero if the connection should be
+ * closed. */
+static int us_client_process_lines (us_client_t *c, us_response_t *r) /* {{{ */
+{
+	char *line = c->buffer;
+	char *end = c->buffer + c->buffer_fill;
+
+	while (line < end)
+	{
+		char *eol;
+		char command[64];
+		size_t len;
+		size_t i;
+
+		eol = memchr (line, '\n', (size_t) (end - line));
+		if (eol == NULL)
+			break;
+		*eol = 0;
+
+		len = (size_t) (eol - line);
+		while ((len > 0) && (line[len - 1] == '\r'))
+			line[--len] = 0;
+
+		/* Skip leading whitespace and extract the command name. */
+		while ((*line == ' ') || (*line == '\t'))
+			line++;
+		for (i = 0; (i < sizeof (command) - 1)
+				&& (line[i] != 0) && (line[i] != ' ') && (line[i] != '\t'); i++)
+			command[i] = line[i];
+		command[i] = 0;
+
+		if ((command[0] != 0)
+				&& (us_handle_command (r->fh, line, command) != 0))
+			return (-1);
+
+		if ((ftell (r->fh) >= US_RESPONSE_BUFFER_SIZE)
+				&& (us_response_send (c, r) != 0))
+			return (-1);
+
+		line = eol + 1;
+	}
+
+	c->buffer_fill = (size_t) (end - line);
+	if ((c->buffer_fill > 0) && (line != c->buffer))
+		memmove (c->buffer, line, c->buffer_fill);
+
+	if (c->buffer_fill >= sizeof (c->buffer))
+	{
+		fprintf (r->fh, "-1 Line too long\n");
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int us_client_process_lines */
+
+/* Reads everything currently available from the client, executes all
+ * complete commands and sends the accumulated responses, usually with a
+ * single write(2). Returns non-zero if the connection should be closed. */
+static int us_client_handle_input (us_client_t *c, us_response_t *r) /* {{{ */
+{
+	_Bool done = 0;
+	int status = 0;
+
+	rewind (r->fh);
+
+	while (!done)
+	{
+		ssize_t bytes = read (c->fd, c->buffer + c->buffer_fill,
+				sizeof (c->buffer) - c->buffer_fill);
+		if (bytes < 0)
 		{
-			handle_getthreshold (fhout, buffer);
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+
+			WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			done = 1;
 		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+		else if (bytes == 0)
 		{
-			handle_putval (fhout, buffer);
+			/* EOF: execute what we have, including a last line without a
+			 * newline, and close the connection. us_client_process_lines()
+			 * made sure there is room for the newline. */
+			if (c->buffer_fill > 0)
+				c->buffer[c->buffer_fill++] = '\n';
+			status = -1;
+			done = 1;
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+		else
 		{
-			handle_listval (fhout, buffer);
+			c->buffer_fill += (size_t) bytes;
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+
+		if (us_client_process_lines (c, r) != 0)
 		{
-			handle_putnotif (fhout, buffer);
+			status = -1;
+			done = 1;
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+	}
+
+	if (us_response_send (c, r) != 0)
+		status = -1;
+
+	return (status);
+} /* }}} int us_client_handle_input */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	us_response_t r;
+
+	if (us_response_open (&r) != 0)
+		return ((void *) 1);
+
+	while (42)
+	{
+		us_client_t *c;
+		struct epoll_event ev;
+		int status;
+
+		pthread_mutex_lock (&work_lock);
+		while ((loop != 0) && (work_head == NULL))
+			pthread_cond_wait (&work_cond, &work_lock);
+
+		if (loop == 0)
 		{
-			handle_flush (fhout, buffer);
+			pthread_mutex_unlock (&work_lock);
+			break;
 		}
-		else
+
+		c = work_head;
+		work_head = c->next;
+		if (work_head == NULL)
+			work_tail = NULL;
+		c->next = NULL;
+		pthread_mutex_unlock (&work_lock);
+
+		status = us_client_handle_input (c, &r);
+
+		/* Give back the memory of an unusually large response. */
+		if (r.peak > US_RESPONSE_BUFFER_SIZE)
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
+			us_response_close (&r);
+			if (us_response_open (&r) != 0)
 			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
+				us_client_close (c);
+				return ((void *) 1);
 			}
 		}
-	} /* while (fgets) */
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+		if (status != 0)
+		{
+			us_client_close (c);
+			continue;
+		}
 
-	pthread_exit ((void *) 0);
+		/* Re-arm the one-shot event for this client. */
+		memset (&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.ptr = c;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: epoll_ctl failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			us_client_close (c);
+		}
+	}
+
+	us_response_close (&r);
 	return ((void *) 0);
-} /* void *us_handle_client */
+} /* }}} void *us_worker_thread */
+
+static void us_queue_client (us_client_t *c) /* {{{ */
+{
+	pthread_mutex_lock (&work_lock);
+	if (work_tail == NULL)
+		work_head = c;
+	else
+		work_tail->next = c;
+	work_tail = c;
+	pthread_cond_signal (&work_cond);
+	pthread_mutex_unlock (&work_lock);
+} /* }}} void us_queue_client */
+
+static int us_accept_client (void) /* {{{ */
+{
+	us_client_t *c;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept (sock_fd, NULL, NULL);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+			return (0);
+
+		ERROR ("unixsock plugin: accept failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK) != 0)
+	{
+		char errbuf[1024];
+		WARNING ("unixsock plugin: fcntl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (0);
+	}
+
+	c = calloc (1, sizeof (*c));
+	if (c == NULL)
+	{
+		WARNING ("unixsock plugin: calloc failed.");
+		close (fd);
+		return (0);
+	}
+	c->fd = fd;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = c;
+	if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		char errbuf[1024];
+		WARNING ("unixsock plugin: epoll_ctl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		us_client_close (c);
+		return (0);
+	}
+
+	DEBUG ("unixsock plugin: Accepted connection on fd #%i", fd);
+	return (0);
+} /* }}} int us_accept_client */
+
+/* Event-driven replacement for the accept loop in us_server_thread(): all
+ * connections are watched with a single epoll instance and ready
+ * connections are handed to the worker threads. */
+static int us_server_loop_epoll (void) /* {{{ */
+{
+	struct epoll_event ev;
+	int status = 0;
+	int i;
+
+	epoll_fd = epoll_create (/* size hint = */ 64);
+	if (epoll_fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: epoll_create failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; /* the listening socket */
+	if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock_fd, &ev) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: epoll_ctl failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (epoll_fd);
+		epoll_fd = -1;
+		return (-1);
+	}
+
+	worker_threads = calloc ((size_t) worker_threads_num,
+			sizeof (*worker_threads));
+	if (worker_threads == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		close (epoll_fd);
+		epoll_fd = -1;
+		return (-1);
+	}
+
+	for (i = 0; i < worker_threads_num; i++)
+	{
+		if (plugin_thread_create (&worker_threads[i], NULL,
+					us_worker_thread, NULL) != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+		worker_threads_started++;
+	}
+
+	if (worker_threads_started == 0)
+		status = -1;
+
+	while ((loop != 0) && (status == 0))
+	{
+		struct epoll_event events[64];
+		int events_num;
+
+		events_num = epoll_wait (epoll_fd, events,
+				STATIC_ARRAY_SIZE (events), /* timeout = */ 1000);
+		if (events_num < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("unixsock plugin: epoll_wait failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			break;
+		}
+
+		for (i = 0; i < events_num; i++)
+		{
+			if (events[i].data.ptr == NULL)
+			{
+				if (us_accept_client () != 0)
+					status = -1;
+				continue;
+			}
+
+			us_queue_client (events[i].data.ptr);
+		}
+	} /* while (loop) */
+
+	/* Stop the workers. Connections which are not queued right now are
+	 * leaked deliberately: the daemon is shutting down. */
+	pthread_mutex_lock (&work_lock);
+	loop = 0;
+	pthread_cond_broadcast (&work_cond);
+	pthread_mutex_unlock (&work_lock);
+
+	for (i = 0; i < worker_threads_started; i++)
+		pthread_join (worker_threads[i], NULL);
+	worker_threads_started = 0;
+	sfree (worker_threads);
+
+	while (work_head != NULL)
+	{
+		us_client_t *next = work_head->next;
+		us_client_close (work_head);
+		work_head = next;
+	}
+	work_tail = NULL;
+
+	close (epoll_fd);
+	epoll_fd = -1;
+
+	return (status);
+} /* }}} int us_server_loop_epoll */
+#endif /* HAVE_SYS_EPOLL_H */
 
 static void *us_server_thread (void __attribute__((unused)) *arg)
 {
@@ -349,6 +869,20 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 	if (us_open_socket () != 0)
 		pthread_exit ((void *) 1);
 
+#if HAVE_SYS_EPOLL_H
+	if (worker_threads_num > 0)
+	{
+		if (us_server_loop_epoll () != 0)
+		{
+			close (sock_fd);
+			sock_fd = -1;
+			pthread_attr_destroy (&th_attr);
+			pthread_exit ((void *) 1);
+		}
+		loop = 0;
+	}
+#endif
+
 	while (loop != 0)
 	{
 		DEBUG ("unixsock plugin: Calling accept..");
@@ -441,6 +975,25 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 0)
+		{
+			WARNING ("unixsock plugin: WorkerThreads must not be negative.");
+			return (1);
+		}
+#if !HAVE_SYS_EPOLL_H
+		if (tmp > 0)
+		{
+			WARNING ("unixsock plugin: The WorkerThreads option requires "
+					"epoll(7), which is not available on this system. "
+					"Using one thread per connection.");
+			tmp = 0;
+		}
+#endif
+		worker_threads_num = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -164,4 +164,175 @@ int handle_getval (FILE *fh, char *buffer)
   return (0);
 } /* int handle_getval */
 
+/* GETVAL_MULTI <Identifier> [<Identifier> ...]
+ *
+ * Looks up all identifiers with a single pass over the value cache. The
+ * status line is followed by one line per identifier, in the order given:
+ * "<num> <identifier> <name>=<value> ...", where <num> is the number of
+ * values or -1 if the identifier could not be found. */
+int handle_getval_multi (FILE *fh, char *buffer)
+{
+  char *command;
+  char **identifiers = NULL;
+  const data_set_t **data_sets = NULL;
+  gauge_t **values = NULL;
+  size_t *values_num = NULL;
+  size_t identifiers_num = 0;
+  size_t identifiers_size = 0;
+
+  int status;
+  size_t i;
+  size_t j;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  DEBUG ("utils_cmd_getval: handle_getval_multi (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("GETVAL_MULTI", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    return (-1);
+  }
+
+#define GETVAL_MULTI_FREE do { \
+  if (values != NULL) \
+    for (i = 0; i < identifiers_num; i++) \
+      sfree (values[i]); \
+  sfree (identifiers); \
+  sfree (data_sets); \
+  sfree (values); \
+  sfree (values_num); \
+} while (0)
+
+  while (*buffer != 0)
+  {
+    char *identifier = NULL;
+
+    status = parse_string (&buffer, &identifier);
+    if (status != 0)
+    {
+      GETVAL_MULTI_FREE;
+      print_to_socket (fh, "-1 Cannot parse identifier.\n");
+      return (-1);
+    }
+    assert (identifier != NULL);
+
+    if (identifiers_num >= identifiers_size)
+    {
+      size_t new_size = (identifiers_size == 0) ? 16 : 2 * identifiers_size;
+      char **tmp = realloc (identifiers, new_size * sizeof (*identifiers));
+      if (tmp == NULL)
+      {
+        GETVAL_MULTI_FREE;
+        print_to_socket (fh, "-1 realloc failed.\n");
+        return (-1);
+      }
+      identifiers = tmp;
+      identifiers_size = new_size;
+    }
+    identifiers[identifiers_num] = identifier;
+    identifiers_num++;
+  }
+
+  if (identifiers_num == 0)
+  {
+    print_to_socket (fh, "-1 No identifiers given.\n");
+    return (-1);
+  }
+
+  data_sets = calloc (identifiers_num, sizeof (*data_sets));
+  values = calloc (identifiers_num, sizeof (*values));
+  values_num = calloc (identifiers_num, sizeof (*values_num));
+  if ((data_sets == NULL) || (values == NULL) || (values_num == NULL))
+  {
+    GETVAL_MULTI_FREE;
+    print_to_socket (fh, "-1 calloc failed.\n");
+    return (-1);
+  }
+
+  /* Resolve the data sets first, so that the cache lock is held only for
+   * the actual lookups. */
+  for (i = 0; i < identifiers_num; i++)
+  {
+    char identifier_copy[6 * DATA_MAX_NAME_LEN];
+    char *hostname;
+    char *plugin;
+    char *plugin_instance;
+    char *type;
+    char *type_instance;
+
+    /* Overlong identifiers cannot exist and are reported as not found,
+     * rather than truncated into some other identifier. */
+    if (strlen (identifiers[i]) >= sizeof (identifier_copy))
+      continue;
+
+    sstrncpy (identifier_copy, identifiers[i], sizeof (identifier_copy));
+    status = parse_identifier (identifier_copy, &hostname,
+        &plugin, &plugin_instance,
+        &type, &type_instance);
+    if (status != 0)
+      continue;
+
+    data_sets[i] = plugin_get_ds (type);
+  }
+
+  status = uc_get_rate_by_names ((char const * const *) identifiers,
+      identifiers_num, values, values_num);
+  if (status != 0)
+  {
+    GETVAL_MULTI_FREE;
+    print_to_socket (fh, "-1 Error reading values from cache.\n");
+    return (-1);
+  }
+
+  status = fprintf (fh, "%zu Identifier%s requested\n", identifiers_num,
+      (identifiers_num == 1) ? "" : "s");
+  for (i = 0; (i < identifiers_num) && (status >= 0); i++)
+  {
+    const data_set_t *ds = data_sets[i];
+
+    if ((ds == NULL) || (values[i] == NULL) || (ds->ds_num != values_num[i]))
+    {
+      status = fprintf (fh, "-1 %s\n", identifiers[i]);
+      continue;
+    }
+
+    status = fprintf (fh, "%zu %s", values_num[i], identifiers[i]);
+    for (j = 0; (j < values_num[i]) && (status >= 0); j++)
+    {
+      if (isnan (values[i][j]))
+        status = fprintf (fh, " %s=NaN", ds->ds[j].name);
+      else
+        status = fprintf (fh, " %s=%e", ds->ds[j].name, values[i][j]);
+    }
+    if (status >= 0)
+      status = fprintf (fh, "\n");
+  }
+
+  GETVAL_MULTI_FREE;
+#undef GETVAL_MULTI_FREE
+
+  if (status < 0)
+  {
+    char errbuf[1024];
+    WARNING ("handle_getval_multi: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  fflush (fh);
+
+  return (0);
+} /* int handle_getval_multi */
+
 /* vim: set sw=2 sts=2 ts=8 : */
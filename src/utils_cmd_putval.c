@@ -227,6 +227,240 @@ int handle_putval (FILE *fh, char *buffer)
 	return (0);
 } /* int handle_putval */
 
+/* Parses "identifier" into "vl" and looks up its data set. "ds" and
+ * "ds_type" cache the last data set, so that consecutive value lists of the
+ * same type don't need another lookup. Returns an error message or NULL. */
+static const char *putval_batch_identifier (value_list_t *vl, /* {{{ */
+		const char *identifier, const data_set_t **ds)
+{
+	char identifier_copy[6 * DATA_MAX_NAME_LEN];
+	char *hostname;
+	char *plugin;
+	char *plugin_instance;
+	char *type;
+	char *type_instance;
+	int status;
+
+	if (strlen (identifier) >= sizeof (identifier_copy))
+		return ("Identifier too long.");
+
+	sstrncpy (identifier_copy, identifier, sizeof (identifier_copy));
+	status = parse_identifier (identifier_copy, &hostname,
+			&plugin, &plugin_instance,
+			&type, &type_instance);
+	if (status != 0)
+		return ("Cannot parse identifier.");
+
+	if ((strlen (hostname) >= sizeof (vl->host))
+			|| (strlen (plugin) >= sizeof (vl->plugin))
+			|| ((plugin_instance != NULL)
+				&& (strlen (plugin_instance) >= sizeof (vl->plugin_instance)))
+			|| ((type_instance != NULL)
+				&& (strlen (type_instance) >= sizeof (vl->type_instance))))
+		return ("Identifier too long.");
+
+	if ((*ds == NULL) || (strcmp ((*ds)->type, type) != 0))
+	{
+		*ds = plugin_get_ds (type);
+		if (*ds == NULL)
+			return ("Type isn't defined.");
+	}
+
+	sstrncpy (vl->host, hostname, sizeof (vl->host));
+	sstrncpy (vl->plugin, plugin, sizeof (vl->plugin));
+	sstrncpy (vl->plugin_instance,
+			(plugin_instance != NULL) ? plugin_instance : "",
+			sizeof (vl->plugin_instance));
+	sstrncpy (vl->type, type, sizeof (vl->type));
+	sstrncpy (vl->type_instance,
+			(type_instance != NULL) ? type_instance : "",
+			sizeof (vl->type_instance));
+	vl->interval = 0;
+	vl->values_len = (*ds)->ds_num;
+
+	return (NULL);
+} /* }}} const char *putval_batch_identifier */
+
+/* PUTVAL_BATCH <Identifier> [<OptionList>] <Valuelist> [...] [<Identifier> ...]
+ *
+ * Like PUTVAL, but takes any number of identifiers, each followed by its
+ * options and value lists. Tokens containing a slash start a new value list.
+ * The whole command is parsed before anything is dispatched; the value lists
+ * are then handed to the daemon with a single plugin_dispatch_values_batch()
+ * call. */
+int handle_putval_batch (FILE *fh, char *buffer) /* {{{ */
+{
+	char *command = NULL;
+	const char *error = NULL;
+	const data_set_t *ds = NULL;
+	value_list_t vl = VALUE_LIST_INIT;
+	_Bool have_identifier = 0;
+	int status;
+
+	value_list_t *vls = NULL;
+	size_t vls_num = 0;
+	size_t vls_size = 0;
+
+	/* All values are stored in one array; the value lists reference it
+	 * after parsing is complete. */
+	value_t *values = NULL;
+	size_t values_num = 0;
+	size_t values_size = 0;
+
+	/* Values of the current value list, as parsed by parse_values(). */
+	value_t *scratch = NULL;
+	size_t scratch_size = 0;
+
+	size_t i;
+
+	DEBUG ("utils_cmd_putval: handle_putval_batch (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	status = parse_string (&buffer, &command);
+	if ((status != 0) || (strcasecmp ("PUTVAL_BATCH", command) != 0))
+	{
+		if (fprintf (fh, "-1 Cannot parse command.\n") >= 0)
+			fflush (fh);
+		return (-1);
+	}
+
+	while ((*buffer != 0) && (error == NULL))
+	{
+		char *string = NULL;
+		char *value  = NULL;
+
+		status = parse_option (&buffer, &string, &value);
+		if (status < 0)
+		{
+			error = "Misformatted option.";
+			break;
+		}
+		else if (status == 0)
+		{
+			if (!have_identifier)
+				error = "Option before the first identifier.";
+			else
+				set_option (&vl, string, value);
+			continue;
+		}
+
+		status = parse_string (&buffer, &string);
+		if (status != 0)
+		{
+			error = "Misformatted value.";
+			break;
+		}
+
+		if (strchr (string, '/') != NULL)
+		{
+			error = putval_batch_identifier (&vl, string, &ds);
+			if ((error == NULL) && (ds->ds_num > scratch_size))
+			{
+				value_t *tmp = realloc (scratch, ds->ds_num * sizeof (*scratch));
+				if (tmp == NULL)
+					error = "realloc failed.";
+				else
+				{
+					scratch = tmp;
+					scratch_size = ds->ds_num;
+				}
+			}
+			vl.values = scratch;
+			have_identifier = (error == NULL);
+			continue;
+		}
+
+		if (!have_identifier)
+		{
+			error = "Value before the first identifier.";
+			break;
+		}
+
+		status = parse_values (string, &vl, ds);
+		if (status != 0)
+		{
+			error = "Parsing the values string failed.";
+			break;
+		}
+
+		if (vls_num >= vls_size)
+		{
+			size_t new_size = (vls_size == 0) ? 64 : 2 * vls_size;
+			value_list_t *tmp = realloc (vls, new_size * sizeof (*vls));
+			if (tmp == NULL)
+			{
+				error = "realloc failed.";
+				break;
+			}
+			vls = tmp;
+			vls_size = new_size;
+		}
+
+		if (values_num + vl.values_len > values_size)
+		{
+			size_t new_size = (values_size == 0) ? 256 : 2 * values_size;
+			value_t *tmp;
+
+			while (new_size < values_num + vl.values_len)
+				new_size *= 2;
+			tmp = realloc (values, new_size * sizeof (*values));
+			if (tmp == NULL)
+			{
+				error = "realloc failed.";
+				break;
+			}
+			values = tmp;
+			values_size = new_size;
+		}
+
+		memcpy (values + values_num, scratch,
+				vl.values_len * sizeof (*values));
+		values_num += vl.values_len;
+
+		memcpy (vls + vls_num, &vl, sizeof (vl));
+		vls_num++;
+	} /* while (*buffer != 0) */
+
+	sfree (scratch);
+
+	if (error != NULL)
+	{
+		sfree (vls);
+		sfree (values);
+		if (fprintf (fh, "-1 %s\n", error) >= 0)
+			fflush (fh);
+		return (-1);
+	}
+
+	/* "values" won't move anymore: point the value lists to it. */
+	values_num = 0;
+	for (i = 0; i < vls_num; i++)
+	{
+		vls[i].values = values + values_num;
+		values_num += vls[i].values_len;
+	}
+
+	status = plugin_dispatch_values_batch (vls, vls_num);
+
+	sfree (vls);
+	sfree (values);
+
+	if (fprintf (fh, "%s: %zu %s been dispatched.\n",
+				(status == 0) ? "0 Success" : "-1 Error",
+				vls_num - (size_t) status,
+				((vls_num - (size_t) status) == 1)
+				? "value has" : "values have") < 0)
+	{
+		char errbuf[1024];
+		WARNING ("handle_putval_batch: failed to write to socket #%i: %s",
+				fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fflush (fh);
+
+	return ((status == 0) ? 0 : -1);
+} /* }}} int handle_putval_batch */
+
 int create_putval (char *ret, size_t ret_len, /* {{{ */
 	const data_set_t *ds, const value_list_t *vl)
 {
@@ -32,6 +32,7 @@
 #include "plugin.h"
 
 int handle_putval (FILE *fh, char *buffer);
+int handle_putval_batch (FILE *fh, char *buffer);
 
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
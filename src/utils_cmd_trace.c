@@ -0,0 +1,151 @@
+/**
+ * collectd - src/utils_cmd_trace.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_trace.h"
+#include "utils_parse_option.h"
+#include "utils_trace.h"
+
+#define print_to_socket(fh, ...) \
+  do { \
+    if (fprintf (fh, __VA_ARGS__) < 0) { \
+      char errbuf[1024]; \
+      WARNING ("handle_trace: failed to write to socket #%i: %s", \
+          fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+      sfree (traces); \
+      return (-1); \
+    } \
+    fflush(fh); \
+  } while (0)
+
+/* Names of the durations between consecutive stages, i.e. "stage_names[i]"
+ * is the time from stage i to stage i + 1. */
+static char const *stage_names[TRACE_STAGE_NUM - 1] = {
+  "read", "queue", "pre_cache", "cache", "post_cache"
+};
+
+/* Formats one trace as "<time> <identifier> <stage>=<seconds> ...". */
+static void format_trace (char *buffer, size_t buffer_size, /* {{{ */
+    trace_t const *trace)
+{
+  size_t offset;
+  size_t i;
+  int status;
+
+  status = ssnprintf (buffer, buffer_size, "%.3f %s",
+      CDTIME_T_TO_DOUBLE (trace->stage[TRACE_STAGE_ENQUEUE]),
+      trace->identifier);
+  if ((status < 0) || ((size_t) status >= buffer_size))
+    return;
+  offset = (size_t) status;
+
+#define BUFFER_ADD(...) do { \
+  status = ssnprintf (buffer + offset, buffer_size - offset, __VA_ARGS__); \
+  if ((status < 0) || ((size_t) status >= buffer_size - offset)) \
+    return; \
+  offset += (size_t) status; \
+} while (0)
+
+  for (i = 0; i < TRACE_STAGE_NUM - 1; i++)
+  {
+    if ((trace->stage[i] == 0) || (trace->stage[i + 1] == 0))
+      continue;
+    BUFFER_ADD (" %s=%.6f", stage_names[i],
+        CDTIME_T_TO_DOUBLE (trace->stage[i + 1] - trace->stage[i]));
+  }
+
+  for (i = 0; i < TRACE_WRITERS_MAX; i++)
+  {
+    char const *name;
+
+    if (trace->writer[i] == 0)
+      continue;
+    name = trace_writer_name (i);
+    if (name == NULL)
+      continue;
+    BUFFER_ADD (" write:%s=%.6f", name, CDTIME_T_TO_DOUBLE (trace->writer[i]));
+  }
+
+#undef BUFFER_ADD
+} /* }}} void format_trace */
+
+int handle_trace (FILE *fh, char *buffer)
+{
+  char *command;
+  trace_t *traces = NULL;
+  size_t traces_num = 0;
+  size_t i;
+  int status;
+
+  DEBUG ("utils_cmd_trace: handle_trace (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("TRACE", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    return (-1);
+  }
+
+  if (*buffer != 0)
+  {
+    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    return (-1);
+  }
+
+  status = trace_get (&traces, &traces_num);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 trace_get failed.\n");
+    return (-1);
+  }
+
+  print_to_socket (fh, "%zu Trace%s found\n",
+      traces_num, (traces_num == 1) ? "" : "s");
+  for (i = 0; i < traces_num; i++)
+  {
+    char line[1024];
+
+    format_trace (line, sizeof (line), traces + i);
+    print_to_socket (fh, "%s\n", line);
+  }
+
+  sfree (traces);
+  return (0);
+} /* int handle_trace */
+
+/* vim: set sw=2 sts=2 ts=8 : */
@@ -273,4 +273,19 @@ char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
   return (value_copy);
 } /* }}} char *fbh_get */
 
+time_t fbh_mtime (fbhash_t *h) /* {{{ */
+{
+  time_t mtime;
+
+  if (h == NULL)
+    return (0);
+
+  pthread_mutex_lock (&h->lock);
+  fbh_check_file (h);
+  mtime = h->mtime;
+  pthread_mutex_unlock (&h->lock);
+
+  return (mtime);
+} /* }}} time_t fbh_mtime */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
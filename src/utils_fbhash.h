@@ -47,6 +47,11 @@ void fbh_destroy (fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get (fbhash_t *h, const char *key);
 
+/* Re-reads the file if it has changed and returns the modification time of
+ * the data currently held. Callers caching values derived from `fbh_get' can
+ * use this to tell when to drop them. */
+time_t fbh_mtime (fbhash_t *h);
+
 #endif /* UTILS_FBHASH_H */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
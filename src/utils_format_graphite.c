@@ -28,59 +28,13 @@
 #include "utils_format_graphite.h"
 #include "utils_cache.h"
 
+#include <pthread.h>
+
 #define GRAPHITE_FORBIDDEN " \t\"\\:!/()\n\r"
 
 /* Utils functions to format data sets in graphite format.
  * Largely taken from write_graphite.c as it remains the same formatting */
 
-static int gr_format_values (char *ret, size_t ret_len,
-        int ds_num, const data_set_t *ds, const value_list_t *vl,
-        gauge_t const *rates)
-{
-    size_t offset = 0;
-    int status;
-
-    assert (0 == strcmp (ds->type, vl->type));
-
-    memset (ret, 0, ret_len);
-
-#define BUFFER_ADD(...) do { \
-    status = ssnprintf (ret + offset, ret_len - offset, \
-            __VA_ARGS__); \
-    if (status < 1) \
-    { \
-        return (-1); \
-    } \
-    else if (((size_t) status) >= (ret_len - offset)) \
-    { \
-        return (-1); \
-    } \
-    else \
-    offset += ((size_t) status); \
-} while (0)
-
-    if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
-        BUFFER_ADD (GAUGE_FORMAT, vl->values[ds_num].gauge);
-    else if (rates != NULL)
-        BUFFER_ADD ("%f", rates[ds_num]);
-    else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
-        BUFFER_ADD ("%llu", vl->values[ds_num].counter);
-    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
-        BUFFER_ADD ("%"PRIi64, vl->values[ds_num].derive);
-    else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
-        BUFFER_ADD ("%"PRIu64, vl->values[ds_num].absolute);
-    else
-    {
-        ERROR ("gr_format_values plugin: Unknown data source type: %i",
-                ds->ds[ds_num].type);
-        return (-1);
-    }
-
-#undef BUFFER_ADD
-
-    return (0);
-}
-
 static void gr_copy_escape_part (char *dst, const char *src, size_t dst_len,
     char escape_char)
 {
@@ -182,77 +136,389 @@ static void escape_graphite_string (char *buffer, char escape_char)
 		*head = escape_char;
 }
 
-int format_graphite (char *buffer, size_t buffer_size,
+/* Writes the decimal representation of `value' to the end of `buffer' and
+ * returns a pointer to the first digit. */
+static char *gr_uint64_to_string (char *buffer, size_t buffer_size,
+        uint64_t value)
+{
+    char *ptr = buffer + buffer_size;
+
+    do
+    {
+        *(--ptr) = (char) ('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+
+    return (ptr);
+}
+
+/* Formats the value of data source `ds_num' without calling printf for
+ * anything but rates. Returns the length of the result or -1. */
+static int gr_format_value (char *ret, size_t ret_len, size_t ds_num,
+        const data_set_t *ds, const value_list_t *vl, gauge_t const *rates)
+{
+    char temp[32];
+    char *str;
+    _Bool negative = 0;
+    uint64_t number;
+    size_t len;
+
+    if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
+        return (format_gauge (ret, ret_len, vl->values[ds_num].gauge));
+    else if (rates != NULL)
+    {
+        int status = ssnprintf (ret, ret_len, "%f", rates[ds_num]);
+        if ((status < 1) || (((size_t) status) >= ret_len))
+            return (-1);
+        return (status);
+    }
+    else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
+        number = (uint64_t) vl->values[ds_num].counter;
+    else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
+    {
+        derive_t d = vl->values[ds_num].derive;
+        negative = (d < 0);
+        number = negative ? ((uint64_t) (-(d + 1))) + 1 : (uint64_t) d;
+    }
+    else if (ds->ds[ds_num].type == DS_TYPE_ABSOLUTE)
+        number = (uint64_t) vl->values[ds_num].absolute;
+    else
+    {
+        ERROR ("gr_format_values plugin: Unknown data source type: %i",
+                ds->ds[ds_num].type);
+        return (-1);
+    }
+
+    str = gr_uint64_to_string (temp, sizeof (temp), number);
+    if (negative)
+        *(--str) = '-';
+
+    len = (size_t) ((temp + sizeof (temp)) - str);
+    if (len >= ret_len)
+        return (-1);
+    memcpy (ret, str, len);
+    ret[len] = 0;
+    return ((int) len);
+}
+
+/* Appends "<path> <value> <time>\r\n" to `buffer'. */
+static int gr_format_line (char *buffer, size_t buffer_size,
+        size_t *ret_pos, char const *path, size_t path_len, size_t ds_num,
+        const data_set_t *ds, const value_list_t *vl, gauge_t const *rates)
+{
+    char values[512];
+    char temp[32];
+    char *timestamp;
+    size_t timestamp_len;
+    size_t message_len;
+    size_t pos = *ret_pos;
+    int status;
+
+    /* Convert the values to an ASCII representation and put that into
+     * `values'. */
+    status = gr_format_value (values, sizeof (values), ds_num, ds, vl, rates);
+    if (status < 0)
+    {
+        ERROR ("format_graphite: error with gr_format_values");
+        return (status);
+    }
+
+    timestamp = gr_uint64_to_string (temp, sizeof (temp),
+            (uint64_t) ((unsigned int) CDTIME_T_TO_TIME_T (vl->time)));
+    timestamp_len = (size_t) ((temp + sizeof (temp)) - timestamp);
+
+    /* Append it in case we got multiple data set */
+    message_len = path_len + 1 + ((size_t) status) + 1 + timestamp_len + 2;
+    if ((pos + message_len) >= buffer_size)
+    {
+        ERROR ("format_graphite: target buffer too small");
+        return (-ENOMEM);
+    }
+
+    memcpy (buffer + pos, path, path_len);
+    pos += path_len;
+    buffer[pos++] = ' ';
+    memcpy (buffer + pos, values, (size_t) status);
+    pos += (size_t) status;
+    buffer[pos++] = ' ';
+    memcpy (buffer + pos, timestamp, timestamp_len);
+    pos += timestamp_len;
+    buffer[pos++] = '\r';
+    buffer[pos++] = '\n';
+
+    *ret_pos = pos;
+    return (0);
+}
+
+/* Builds the escaped metric path of data source `ds_num'. Returns the length
+ * of the path or less than zero on error. */
+static int gr_format_path (char *ret, size_t ret_len,
+        const data_set_t *ds, const value_list_t *vl, size_t ds_num,
+        char const *prefix, char const *postfix, char const escape_char,
+        unsigned int flags)
+{
+    char const *ds_name = NULL;
+    int status;
+
+    if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
+        || (ds->ds_num > 1))
+      ds_name = ds->ds[ds_num].name;
+
+    /* Copy the identifier to `key' and escape it. */
+    status = gr_format_name (ret, (int) ret_len, vl, ds_name,
+                prefix, postfix, escape_char, flags);
+    if (status != 0)
+    {
+        ERROR ("format_graphite: error with gr_format_name");
+        return (status);
+    }
+
+    escape_graphite_string (ret, escape_char);
+    return ((int) strlen (ret));
+}
+
+/*
+ * The metric paths of a value list only change when the identifier does.
+ * The cache maps an identifier to the paths of all its data sources. It is
+ * direct mapped: an entry is replaced when another identifier hashes to the
+ * same slot, which bounds its size.
+ */
+struct graphite_cache_entry_s
+{
+    uint32_t hash;
+    char    *key;
+    size_t   key_len;
+    size_t   ds_num;
+    /* The paths of all data sources, each terminated by a null byte. */
+    char    *paths;
+};
+typedef struct graphite_cache_entry_s graphite_cache_entry_t;
+
+struct graphite_cache_s
+{
+    pthread_mutex_t lock;
+    graphite_cache_entry_t *entries;
+    size_t entries_num;
+};
+
+graphite_cache_t *graphite_cache_create (size_t size)
+{
+    graphite_cache_t *cache;
+
+    if (size == 0)
+        return (NULL);
+
+    cache = calloc (1, sizeof (*cache));
+    if (cache == NULL)
+        return (NULL);
+
+    cache->entries = calloc (size, sizeof (*cache->entries));
+    if (cache->entries == NULL)
+    {
+        sfree (cache);
+        return (NULL);
+    }
+    cache->entries_num = size;
+    pthread_mutex_init (&cache->lock, /* attr = */ NULL);
+
+    return (cache);
+}
+
+void graphite_cache_destroy (graphite_cache_t *cache)
+{
+    size_t i;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < cache->entries_num; i++)
+    {
+        sfree (cache->entries[i].key);
+        sfree (cache->entries[i].paths);
+    }
+    sfree (cache->entries);
+    pthread_mutex_destroy (&cache->lock);
+    sfree (cache);
+}
+
+/* Copies the identifier fields of `vl' to `key', separated by null bytes,
+ * and returns their FNV-1a hash. */
+static uint32_t gr_cache_key (char *key, size_t *ret_key_len,
+        value_list_t const *vl)
+{
+    char const *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+        vl->type, vl->type_instance };
+    uint32_t hash = 2166136261U;
+    size_t key_len = 0;
+    size_t i;
+
+    for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+    {
+        char const *src = fields[i];
+
+        /* The fields are at most DATA_MAX_NAME_LEN bytes long, including the
+         * null byte, so `key' can't overflow. */
+        do
+        {
+            key[key_len++] = *src;
+            hash = (hash ^ (uint8_t) *src) * 16777619U;
+        } while (*(src++) != 0);
+    }
+
+    *ret_key_len = key_len;
+    return (hash);
+}
+
+/* Formats the paths of all data sources and stores them in `entry'. */
+static int gr_cache_fill (graphite_cache_entry_t *entry,
+        const data_set_t *ds, const value_list_t *vl,
+        char const *prefix, char const *postfix, char const escape_char,
+        unsigned int flags)
+{
+    char path[10*DATA_MAX_NAME_LEN];
+    char *paths = NULL;
+    size_t paths_len = 0;
+    size_t i;
+
+    for (i = 0; i < ds->ds_num; i++)
+    {
+        char *tmp;
+        int len;
+
+        len = gr_format_path (path, sizeof (path), ds, vl, i,
+                prefix, postfix, escape_char, flags);
+        if (len < 0)
+        {
+            sfree (paths);
+            return (len);
+        }
+
+        tmp = realloc (paths, paths_len + ((size_t) len) + 1);
+        if (tmp == NULL)
+        {
+            sfree (paths);
+            return (-ENOMEM);
+        }
+        paths = tmp;
+        memcpy (paths + paths_len, path, ((size_t) len) + 1);
+        paths_len += ((size_t) len) + 1;
+    }
+
+    sfree (entry->paths);
+    entry->paths = paths;
+    entry->ds_num = ds->ds_num;
+    return (0);
+}
+
+int format_graphite_cached (graphite_cache_t *cache,
+    char *buffer, size_t buffer_size,
     data_set_t const *ds, value_list_t const *vl,
     char const *prefix, char const *postfix, char const escape_char,
     unsigned int flags)
 {
+    graphite_cache_entry_t *entry = NULL;
+    char key[5 * DATA_MAX_NAME_LEN];
+    size_t key_len = 0;
+    uint32_t hash = 0;
     int status = 0;
     size_t i;
-    int buffer_pos = 0;
+    size_t buffer_pos = 0;
 
+    gauge_t rates_buffer[ds->ds_num];
     gauge_t *rates = NULL;
-    if (flags & GRAPHITE_STORE_RATES)
-      rates = uc_get_rate (ds, vl);
+    if ((flags & GRAPHITE_STORE_RATES)
+            && (uc_get_rates (ds, vl, rates_buffer) == 0))
+        rates = rates_buffer;
 
-    for (i = 0; i < ds->ds_num; i++)
+    assert (0 == strcmp (ds->type, vl->type));
+
+    if (cache != NULL)
     {
-        char const *ds_name = NULL;
-        char        key[10*DATA_MAX_NAME_LEN];
-        char        values[512];
-        size_t      message_len;
-        char        message[1024];
-
-        if ((flags & GRAPHITE_ALWAYS_APPEND_DS)
-            || (ds->ds_num > 1))
-          ds_name = ds->ds[i].name;
-
-        /* Copy the identifier to `key' and escape it. */
-        status = gr_format_name (key, sizeof (key), vl, ds_name,
-                    prefix, postfix, escape_char, flags);
-        if (status != 0)
+        hash = gr_cache_key (key, &key_len, vl);
+
+        pthread_mutex_lock (&cache->lock);
+        entry = cache->entries + (hash % cache->entries_num);
+        if ((entry->key == NULL) || (entry->hash != hash)
+                || (entry->key_len != key_len)
+                || (memcmp (entry->key, key, key_len) != 0)
+                || (entry->ds_num != ds->ds_num))
         {
-            ERROR ("format_graphite: error with gr_format_name");
-            sfree (rates);
-            return (status);
+            char *new_key = malloc (key_len);
+
+            status = -ENOMEM;
+            if (new_key != NULL)
+                status = gr_cache_fill (entry, ds, vl,
+                        prefix, postfix, escape_char, flags);
+            if (status != 0)
+            {
+                /* Don't leave an entry with mismatching paths behind. */
+                sfree (new_key);
+                sfree (entry->key);
+                sfree (entry->paths);
+                pthread_mutex_unlock (&cache->lock);
+                return (status);
+            }
+
+            memcpy (new_key, key, key_len);
+            sfree (entry->key);
+            entry->key = new_key;
+            entry->key_len = key_len;
+            entry->hash = hash;
         }
 
-        escape_graphite_string (key, escape_char);
-        /* Convert the values to an ASCII representation and put that into
-         * `values'. */
-        status = gr_format_values (values, sizeof (values), i, ds, vl, rates);
-        if (status != 0)
+        /* Keep the lock while the paths are in use. */
         {
-            ERROR ("format_graphite: error with gr_format_values");
-            sfree (rates);
-            return (status);
-        }
-
-        /* Compute the graphite command */
-        message_len = (size_t) ssnprintf (message, sizeof (message),
-                "%s %s %u\r\n",
-                key,
-                values,
-                (unsigned int) CDTIME_T_TO_TIME_T (vl->time));
-        if (message_len >= sizeof (message)) {
-            ERROR ("format_graphite: message buffer too small: "
-                    "Need %zu bytes.", message_len + 1);
-            sfree (rates);
-            return (-ENOMEM);
+            char const *path = entry->paths;
+
+            for (i = 0; i < ds->ds_num; i++)
+            {
+                size_t path_len = strlen (path);
+
+                status = gr_format_line (buffer, buffer_size, &buffer_pos,
+                        path, path_len, i, ds, vl, rates);
+                if (status != 0)
+                    break;
+                path += path_len + 1;
+            }
         }
-
-        /* Append it in case we got multiple data set */
-        if ((buffer_pos + message_len) >= buffer_size)
+        pthread_mutex_unlock (&cache->lock);
+    }
+    else
+    {
+        for (i = 0; i < ds->ds_num; i++)
         {
-            ERROR ("format_graphite: target buffer too small");
-            sfree (rates);
-            return (-ENOMEM);
+            char path[10*DATA_MAX_NAME_LEN];
+            int path_len;
+
+            path_len = gr_format_path (path, sizeof (path), ds, vl, i,
+                    prefix, postfix, escape_char, flags);
+            if (path_len < 0)
+            {
+                status = path_len;
+                break;
+            }
+
+            status = gr_format_line (buffer, buffer_size, &buffer_pos,
+                    path, (size_t) path_len, i, ds, vl, rates);
+            if (status != 0)
+                break;
         }
-        memcpy((void *) (buffer + buffer_pos), message, message_len);
-        buffer_pos += message_len;
     }
-    sfree (rates);
-    return (status);
+
+    if (status != 0)
+        return (status);
+
+    buffer[buffer_pos] = '\0';
+    return (0);
+} /* int format_graphite_cached */
+
+int format_graphite (char *buffer, size_t buffer_size,
+    data_set_t const *ds, value_list_t const *vl,
+    char const *prefix, char const *postfix, char const escape_char,
+    unsigned int flags)
+{
+    return (format_graphite_cached (/* cache = */ NULL, buffer, buffer_size,
+                ds, vl, prefix, postfix, escape_char, flags));
 } /* int format_graphite */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
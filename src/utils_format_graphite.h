@@ -35,4 +35,20 @@ int format_graphite (char *buffer,
     const char *postfix, const char escape_char,
     unsigned int flags);
 
+/* Caches the metric paths of recently formatted identifiers. A cache must
+ * only be used with one set of prefix, postfix, escape char and flags. */
+#define GRAPHITE_CACHE_DEFAULT_SIZE 8192
+
+struct graphite_cache_s;
+typedef struct graphite_cache_s graphite_cache_t;
+
+graphite_cache_t *graphite_cache_create (size_t size);
+void graphite_cache_destroy (graphite_cache_t *cache);
+
+int format_graphite_cached (graphite_cache_t *cache, char *buffer,
+    size_t buffer_size, const data_set_t *ds,
+    const value_list_t *vl, const char *prefix,
+    const char *postfix, const char escape_char,
+    unsigned int flags);
+
 #endif /* UTILS_FORMAT_GRAPHITE_H */
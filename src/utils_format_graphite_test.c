@@ -0,0 +1,188 @@
+/**
+ * collectd - src/utils_format_graphite_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_format_graphite.h"
+
+static data_source_t dsrc_octets[] = {
+  { "rx", DS_TYPE_DERIVE, 0.0, NAN },
+  { "tx", DS_TYPE_DERIVE, 0.0, NAN }
+};
+static data_set_t ds_octets = { "if_octets", 2, dsrc_octets };
+
+DEF_TEST(format)
+{
+  struct {
+    char const *prefix;
+    char const *postfix;
+    unsigned int flags;
+    char const *want;
+  } cases[] = {
+    { NULL, NULL, 0,
+      "example_com.test-eth0.if_octets.rx -42 1000\r\n"
+      "example_com.test-eth0.if_octets.tx 9223372036854775807 1000\r\n" },
+    { "collectd.", ".dc1", GRAPHITE_SEPARATE_INSTANCES,
+      "collectd.example_com.dc1.test.eth0.if_octets.rx -42 1000\r\n"
+      "collectd.example_com.dc1.test.eth0.if_octets.tx 9223372036854775807 1000\r\n" },
+  };
+  graphite_cache_t *cache;
+  value_t values[2];
+  value_list_t vl;
+  size_t i;
+
+  values[0].derive = -42;
+  values[1].derive = INT64_MAX;
+  TESTING_VALUE_LIST (&vl, values, &ds_octets);
+  vl.time = TIME_T_TO_CDTIME_T (1000);
+  sstrncpy (vl.plugin_instance, "eth0", sizeof (vl.plugin_instance));
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (cases); i++)
+  {
+    char buffer[1024];
+    int n;
+
+    CHECK_NOT_NULL (cache = graphite_cache_create (16));
+    CHECK_ZERO (format_graphite (buffer, sizeof (buffer), &ds_octets, &vl,
+          cases[i].prefix, cases[i].postfix, '_', cases[i].flags));
+    EXPECT_EQ_STR (cases[i].want, buffer);
+
+    /* Twice: once filling the cache, once from the cache. */
+    for (n = 0; n < 2; n++)
+    {
+      memset (buffer, 0, sizeof (buffer));
+      CHECK_ZERO (format_graphite_cached (cache, buffer, sizeof (buffer),
+            &ds_octets, &vl, cases[i].prefix, cases[i].postfix, '_',
+            cases[i].flags));
+      EXPECT_EQ_STR (cases[i].want, buffer);
+    }
+    graphite_cache_destroy (cache);
+  }
+
+  return (0);
+}
+
+DEF_TEST(escape)
+{
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  char buffer[1024];
+  value_t value = { .gauge = 0.5 };
+  value_list_t vl;
+
+  TESTING_VALUE_LIST (&vl, &value, ds);
+  sstrncpy (vl.plugin_instance, "a b/c:d", sizeof (vl.plugin_instance));
+  sstrncpy (vl.type_instance, "x.y", sizeof (vl.type_instance));
+
+  CHECK_ZERO (format_graphite (buffer, sizeof (buffer), ds, &vl,
+        NULL, NULL, '_', GRAPHITE_ALWAYS_APPEND_DS));
+  EXPECT_EQ_STR ("example_com.test-a_b_c_d.gauge-x_y.value 0.5 0\r\n",
+      buffer);
+
+  return (0);
+}
+
+/* Many identifiers in a small cache, so that entries are replaced. The
+ * output must not depend on the cache. */
+DEF_TEST(cache_replacement)
+{
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  graphite_cache_t *cache;
+  value_t value;
+  value_list_t vl;
+  int i;
+
+  CHECK_NOT_NULL (cache = graphite_cache_create (7));
+  TESTING_VALUE_LIST (&vl, &value, ds);
+
+  for (i = 0; i < 10000; i++)
+  {
+    char want[1024];
+    char got[1024];
+
+    value.gauge = ((double) i) / 4.0;
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance), "ti%i", i % 50);
+    ssnprintf (vl.host, sizeof (vl.host), "host%i", i % 3);
+
+    CHECK_ZERO (format_graphite (want, sizeof (want), ds, &vl,
+          "p.", NULL, '_', 0));
+    CHECK_ZERO (format_graphite_cached (cache, got, sizeof (got),
+          ds, &vl, "p.", NULL, '_', 0));
+    if (strcmp (want, got) != 0)
+      EXPECT_EQ_STR (want, got);
+  }
+
+  graphite_cache_destroy (cache);
+  return (0);
+}
+
+/* Rates attached by plugin_dispatch_values() are used for non-gauge data
+ * sources. */
+DEF_TEST(store_rates)
+{
+  char buffer[1024];
+  value_t values[2] = { { .derive = 1000 }, { .derive = 2000 } };
+  gauge_t rates[2] = { 12.5, 25.0 };
+  value_list_t vl;
+
+  TESTING_VALUE_LIST (&vl, values, &ds_octets);
+  vl.rates = rates;
+
+  CHECK_ZERO (format_graphite (buffer, sizeof (buffer), &ds_octets, &vl,
+        NULL, NULL, '_', GRAPHITE_STORE_RATES));
+  EXPECT_EQ_STR ("example_com.test.if_octets.rx 12.500000 0\r\n"
+      "example_com.test.if_octets.tx 25.000000 0\r\n",
+      buffer);
+
+  return (0);
+}
+
+DEF_TEST(buffer_too_small)
+{
+  char buffer[48];
+  value_t values[2] = { { .derive = 1 }, { .derive = 2 } };
+  value_list_t vl;
+
+  TESTING_VALUE_LIST (&vl, values, &ds_octets);
+  EXPECT_EQ_INT (-ENOMEM, format_graphite (buffer, sizeof (buffer),
+        &ds_octets, &vl, NULL, NULL, '_', 0));
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(format);
+  RUN_TEST(escape);
+  RUN_TEST(cache_replacement);
+  RUN_TEST(store_rates);
+  RUN_TEST(buffer_too_small);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
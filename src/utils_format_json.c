@@ -28,9 +28,12 @@
 #include "plugin.h"
 #include "common.h"
 
+#include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_format_json.h"
 
+#include <pthread.h>
+
 static int json_escape_string (char *buffer, size_t buffer_size, /* {{{ */
     const char *string)
 {
@@ -77,159 +80,6 @@ static int json_escape_string (char *buffer, size_t buffer_size, /* {{{ */
   return (0);
 } /* }}} int json_escape_string */
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
-{
-  size_t offset = 0;
-  size_t i;
-  gauge_t *rates = NULL;
-
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
-  {
-    if (i > 0)
-      BUFFER_ADD (",");
-
-    if (ds->ds[i].type == DS_TYPE_GAUGE)
-    {
-      if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, vl->values[i].gauge);
-      else
-        BUFFER_ADD ("null");
-    }
-    else if (store_rates)
-    {
-      if (rates == NULL)
-        rates = uc_get_rate (ds, vl);
-      if (rates == NULL)
-      {
-        WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return (-1);
-      }
-
-      if(isfinite (rates[i]))
-        BUFFER_ADD (JSON_GAUGE_FORMAT, rates[i]);
-      else
-        BUFFER_ADD ("null");
-    }
-    else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
-    else
-    {
-      ERROR ("format_json: Unknown data source type: %i",
-          ds->ds[i].type);
-      sfree (rates);
-      return (-1);
-    }
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
-  return (0);
-} /* }}} int values_to_json */
-
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
-{
-  size_t offset = 0;
-  size_t i;
-
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
-  {
-    if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dstypes_to_json */
-
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds)
-{
-  size_t offset = 0;
-  size_t i;
-
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
-  {
-    if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
-
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
-
-  return (0);
-} /* }}} int dsnames_to_json */
-
 static int meta_data_keys_to_json (char *buffer, size_t buffer_size, /* {{{ */
     meta_data_t *meta, char **keys, size_t keys_num)
 {
@@ -333,53 +183,387 @@ static int meta_data_to_json (char *buffer, size_t buffer_size, /* {{{ */
   return status;
 } /* }}} int meta_data_to_json */
 
+/*
+ * Streaming output: The functions below append to `buffer' at `*offset'.
+ * They fail with -ENOMEM if the result, including the terminating null byte,
+ * doesn't fit into `buffer_size' bytes.
+ */
+static int json_add_mem (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, const char *data, size_t data_len)
+{
+  if (data_len >= (buffer_size - *offset))
+    return (-ENOMEM);
+
+  memcpy (buffer + *offset, data, data_len);
+  *offset += data_len;
+  buffer[*offset] = 0;
+  return (0);
+} /* }}} int json_add_mem */
+
+/* Same escaping as json_escape_string(), but copies runs of characters that
+ * need no escaping in one go. */
+static int json_add_escaped (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, const char *string)
+{
+  size_t pos = *offset;
+
+  if (pos + 1 >= buffer_size)
+    return (-ENOMEM);
+  buffer[pos++] = '"';
+
+  while (*string != 0)
+  {
+    size_t len = 0;
+
+    while ((string[len] != 0) && (string[len] != '"')
+        && (string[len] != '\\') && (string[len] > 0x1F))
+      len++;
+
+    if (len > 0)
+    {
+      if (pos + len >= buffer_size)
+        return (-ENOMEM);
+      memcpy (buffer + pos, string, len);
+      pos += len;
+      string += len;
+      continue;
+    }
+
+    if (pos + 2 >= buffer_size)
+      return (-ENOMEM);
+    if ((*string == '"') || (*string == '\\'))
+    {
+      buffer[pos++] = '\\';
+      buffer[pos++] = *string;
+    }
+    else
+      buffer[pos++] = '?';
+    string++;
+  }
+
+  if (pos + 1 >= buffer_size)
+    return (-ENOMEM);
+  buffer[pos++] = '"';
+  buffer[pos] = 0;
+
+  *offset = pos;
+  return (0);
+} /* }}} int json_add_escaped */
+
+/* Writes the decimal representation of `value' to the end of `buffer' and
+ * returns a pointer to the first digit. */
+static char *json_uint64_to_string (char *buffer, size_t buffer_size, /* {{{ */
+    uint64_t value)
+{
+  char *ptr = buffer + buffer_size;
+
+  do
+  {
+    *(--ptr) = (char) ('0' + (value % 10));
+    value /= 10;
+  } while (value != 0);
+
+  return (ptr);
+} /* }}} char *json_uint64_to_string */
+
+static int json_add_uint64 (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, uint64_t value)
+{
+  char temp[24];
+  char *str;
+
+  str = json_uint64_to_string (temp, sizeof (temp), value);
+  return (json_add_mem (buffer, buffer_size, offset,
+        str, (size_t) ((temp + sizeof (temp)) - str)));
+} /* }}} int json_add_uint64 */
+
+static int json_add_int64 (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, int64_t value)
+{
+  char temp[24];
+  char *str;
+
+  if (value >= 0)
+    return (json_add_uint64 (buffer, buffer_size, offset, (uint64_t) value));
+
+  str = json_uint64_to_string (temp, sizeof (temp),
+      ((uint64_t) (-(value + 1))) + 1);
+  *(--str) = '-';
+  return (json_add_mem (buffer, buffer_size, offset,
+        str, (size_t) ((temp + sizeof (temp)) - str)));
+} /* }}} int json_add_int64 */
+
+static int json_add_gauge (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, gauge_t value)
+{
+  char temp[64];
+  int len;
+
+  if (!isfinite (value))
+    return (json_add_mem (buffer, buffer_size, offset, "null", 4));
+
+  /* The comparison is resolved at compile time. */
+  if (strcmp (JSON_GAUGE_FORMAT, GAUGE_FORMAT) == 0)
+    len = format_gauge (temp, sizeof (temp), value);
+  else
+    len = ssnprintf (temp, sizeof (temp), JSON_GAUGE_FORMAT, value);
+  if ((len < 0) || (((size_t) len) >= sizeof (temp)))
+    return (-ENOMEM);
+
+  return (json_add_mem (buffer, buffer_size, offset, temp, (size_t) len));
+} /* }}} int json_add_gauge */
+
+/* Same as "%.3f" with CDTIME_T_TO_DOUBLE (t). */
+static int json_add_time (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *offset, cdtime_t t)
+{
+  char temp[64];
+  double seconds = CDTIME_T_TO_DOUBLE (t);
+  double millis = seconds * 1000.0;
+  double fraction;
+  uint64_t ms;
+  char *str;
+  size_t len;
+
+  /* The error of `millis' is below 0.001 in this range. Close to a tie,
+   * let printf do the rounding. */
+  fraction = millis - floor (millis);
+  if ((seconds >= 1e12) || (fabs (fraction - 0.5) < 0.01))
+  {
+    len = (size_t) ssnprintf (temp, sizeof (temp), "%.3f", seconds);
+    if (len >= sizeof (temp))
+      return (-ENOMEM);
+    return (json_add_mem (buffer, buffer_size, offset, temp, len));
+  }
+
+  ms = (uint64_t) floor (millis);
+  if (fraction > 0.5)
+    ms++;
+
+  str = json_uint64_to_string (temp, sizeof (temp) - 4, ms / 1000);
+  temp[sizeof (temp) - 4] = '.';
+  temp[sizeof (temp) - 3] = (char) ('0' + ((ms / 100) % 10));
+  temp[sizeof (temp) - 2] = (char) ('0' + ((ms / 10) % 10));
+  temp[sizeof (temp) - 1] = (char) ('0' + (ms % 10));
+
+  return (json_add_mem (buffer, buffer_size, offset,
+        str, (size_t) ((temp + sizeof (temp)) - str)));
+} /* }}} int json_add_time */
+
+#define JSON_ADD_STR(str) do { \
+  status = json_add_mem (buffer, buffer_size, &offset, (str), strlen (str)); \
+  if (status != 0) \
+    return (status); \
+} while (0)
+
+static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *ret_offset, const data_set_t *ds, const value_list_t *vl,
+    int store_rates)
+{
+  size_t offset = *ret_offset;
+  size_t i;
+  gauge_t rates_buffer[ds->ds_num];
+  gauge_t *rates = NULL;
+  int status = 0;
+
+  JSON_ADD_STR ("[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+    {
+      status = json_add_mem (buffer, buffer_size, &offset, ",", 1);
+      if (status != 0)
+        break;
+    }
+
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      status = json_add_gauge (buffer, buffer_size, &offset,
+          vl->values[i].gauge);
+    else if (store_rates)
+    {
+      if (rates == NULL)
+      {
+        if (uc_get_rates (ds, vl, rates_buffer) != 0)
+        {
+          WARNING ("utils_format_json: uc_get_rates failed.");
+          return (-1);
+        }
+        rates = rates_buffer;
+      }
+
+      status = json_add_gauge (buffer, buffer_size, &offset, rates[i]);
+    }
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      status = json_add_uint64 (buffer, buffer_size, &offset,
+          (uint64_t) vl->values[i].counter);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      status = json_add_int64 (buffer, buffer_size, &offset,
+          (int64_t) vl->values[i].derive);
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      status = json_add_uint64 (buffer, buffer_size, &offset,
+          (uint64_t) vl->values[i].absolute);
+    else
+    {
+      ERROR ("format_json: Unknown data source type: %i",
+          ds->ds[i].type);
+      status = -1;
+    }
+
+    if (status != 0)
+      break;
+  } /* for ds->ds_num */
+  if (status != 0)
+    return (status);
+  JSON_ADD_STR ("]");
+
+  *ret_offset = offset;
+  return (0);
+} /* }}} int values_to_json */
+
+/*
+ * The "dstypes" and "dsnames" members only depend on the data set, so they
+ * are formatted once per data set and kept in `ds_fragments', keyed by the
+ * type name. Entries are never removed, so they can be used after the lock
+ * has been released.
+ */
+struct json_ds_fragment_s
+{
+  const data_set_t *ds;
+  size_t fragment_len;
+  char fragment[];
+};
+typedef struct json_ds_fragment_s json_ds_fragment_t;
+
+static c_avl_tree_t *ds_fragments = NULL;
+static pthread_mutex_t ds_fragments_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int ds_fragment_format (char *buffer, size_t buffer_size, /* {{{ */
+    size_t *ret_offset, const data_set_t *ds)
+{
+  size_t offset = *ret_offset;
+  size_t i;
+  int status;
+
+  JSON_ADD_STR (",\"dstypes\":[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+      JSON_ADD_STR (",");
+    JSON_ADD_STR ("\"");
+    JSON_ADD_STR (DS_TYPE_TO_STRING (ds->ds[i].type));
+    JSON_ADD_STR ("\"");
+  }
+  JSON_ADD_STR ("],\"dsnames\":[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+      JSON_ADD_STR (",");
+    JSON_ADD_STR ("\"");
+    JSON_ADD_STR (ds->ds[i].name);
+    JSON_ADD_STR ("\"");
+  }
+  JSON_ADD_STR ("]");
+
+  *ret_offset = offset;
+  return (0);
+} /* }}} int ds_fragment_format */
+
+static json_ds_fragment_t *ds_fragment_get (const data_set_t *ds) /* {{{ */
+{
+  json_ds_fragment_t *frag = NULL;
+  char temp[4096];
+  size_t len = 0;
+  char *key;
+
+  pthread_mutex_lock (&ds_fragments_lock);
+
+  if (ds_fragments == NULL)
+  {
+    ds_fragments = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (ds_fragments == NULL)
+    {
+      pthread_mutex_unlock (&ds_fragments_lock);
+      return (NULL);
+    }
+  }
+
+  if (c_avl_get (ds_fragments, ds->type, (void *) &frag) == 0)
+  {
+    pthread_mutex_unlock (&ds_fragments_lock);
+    /* The data set may have been replaced. Don't use the cache then. */
+    return ((frag->ds == ds) ? frag : NULL);
+  }
+
+  if (ds_fragment_format (temp, sizeof (temp), &len, ds) != 0)
+  {
+    pthread_mutex_unlock (&ds_fragments_lock);
+    return (NULL);
+  }
+
+  frag = malloc (sizeof (*frag) + len + 1);
+  key = strdup (ds->type);
+  if ((frag == NULL) || (key == NULL))
+  {
+    pthread_mutex_unlock (&ds_fragments_lock);
+    sfree (frag);
+    sfree (key);
+    return (NULL);
+  }
+  frag->ds = ds;
+  frag->fragment_len = len;
+  memcpy (frag->fragment, temp, len + 1);
+
+  if (c_avl_insert (ds_fragments, key, frag) != 0)
+  {
+    pthread_mutex_unlock (&ds_fragments_lock);
+    sfree (frag);
+    sfree (key);
+    return (NULL);
+  }
+
+  pthread_mutex_unlock (&ds_fragments_lock);
+  return (frag);
+} /* }}} json_ds_fragment_t *ds_fragment_get */
+
+
 static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
                 const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[512];
+  json_ds_fragment_t *frag;
   size_t offset = 0;
   int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   /* All value lists have a leading comma. The first one will be replaced with
    * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
+  JSON_ADD_STR (",{\"values\":");
 
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  status = values_to_json (buffer, buffer_size, &offset, ds, vl, store_rates);
   if (status != 0)
     return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
 
-  status = dstypes_to_json (temp, sizeof (temp), ds);
+  frag = ds_fragment_get (ds);
+  if (frag != NULL)
+    status = json_add_mem (buffer, buffer_size, &offset,
+        frag->fragment, frag->fragment_len);
+  else
+    status = ds_fragment_format (buffer, buffer_size, &offset, ds);
   if (status != 0)
     return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
 
-  status = dsnames_to_json (temp, sizeof (temp), ds);
+  JSON_ADD_STR (",\"time\":");
+  status = json_add_time (buffer, buffer_size, &offset, vl->time);
+  if (status != 0)
+    return (status);
+  JSON_ADD_STR (",\"interval\":");
+  status = json_add_time (buffer, buffer_size, &offset, vl->interval);
   if (status != 0)
     return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
-
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
 
 #define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = json_escape_string (temp, sizeof (temp), (value)); \
+  JSON_ADD_STR (",\"" key "\":"); \
+  status = json_add_escaped (buffer, buffer_size, &offset, (value)); \
   if (status != 0) \
     return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
 } while (0)
 
   BUFFER_ADD_KEYVAL ("host", vl->host);
@@ -390,41 +574,46 @@ static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
 
   if (vl->meta != NULL)
   {
-    char meta_buffer[buffer_size];
-    memset (meta_buffer, 0, sizeof (meta_buffer));
-    status = meta_data_to_json (meta_buffer, sizeof (meta_buffer), vl->meta);
+    JSON_ADD_STR (",\"meta\":");
+    status = meta_data_to_json (buffer + offset, buffer_size - offset,
+        vl->meta);
     if (status != 0)
       return (status);
-
-    BUFFER_ADD (",\"meta\":%s", meta_buffer);
+    offset += strlen (buffer + offset);
   } /* if (vl->meta != NULL) */
 
-  BUFFER_ADD ("}");
+  JSON_ADD_STR ("}");
 
 #undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
 
   DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
 
   return (0);
 } /* }}} int value_list_to_json */
 
+#undef JSON_ADD_STR
+
 static int format_json_value_list_nocheck (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free,
     const data_set_t *ds, const value_list_t *vl,
     int store_rates, size_t temp_size)
 {
-  char temp[temp_size];
+  size_t len;
   int status;
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  /* Format in place. On failure, the buffer is terminated where it was
+   * before. */
+  status = value_list_to_json (buffer + (*ret_buffer_fill), temp_size,
+      ds, vl, store_rates);
   if (status != 0)
+  {
+    buffer[*ret_buffer_fill] = 0;
     return (status);
-  temp_size = strlen (temp);
+  }
+  len = strlen (buffer + (*ret_buffer_fill));
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  (*ret_buffer_fill) += len;
+  (*ret_buffer_free) -= len;
 
   return (0);
 } /* }}} int format_json_value_list_nocheck */
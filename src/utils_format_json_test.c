@@ -0,0 +1,296 @@
+/**
+ * collectd - src/utils_format_json_test.c
+ * Copyright (C) 2026       agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *   agent <agent at local>
+ */
+
+#include "common.h" /* for STATIC_ARRAY_SIZE */
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils_format_json.h"
+
+/* The straight-forward snprintf() implementation the formatter used to be.
+ * The output of format_json_value_list() must not differ from it. */
+static int reference_escape (char *buffer, size_t buffer_size, /* {{{ */
+    const char *string)
+{
+  size_t pos = 0;
+
+  buffer[pos++] = '"';
+  for (; *string != 0; string++)
+  {
+    if (pos + 3 >= buffer_size)
+      return (-1);
+    if ((*string == '"') || (*string == '\\'))
+    {
+      buffer[pos++] = '\\';
+      buffer[pos++] = *string;
+    }
+    else if (*string <= 0x1F)
+      buffer[pos++] = '?';
+    else
+      buffer[pos++] = *string;
+  }
+  buffer[pos++] = '"';
+  buffer[pos] = 0;
+  return (0);
+} /* }}} int reference_escape */
+
+static int reference_format (char *buffer, size_t buffer_size, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
+{
+  char temp[512];
+  size_t offset = 0;
+  size_t i;
+
+#define REF_ADD(...) do { \
+  int status = snprintf (buffer + offset, buffer_size - offset, __VA_ARGS__); \
+  if ((status < 0) || ((size_t) status >= buffer_size - offset)) \
+    return (-1); \
+  offset += (size_t) status; \
+} while (0)
+
+  REF_ADD (",{\"values\":[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+      REF_ADD (",");
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+    {
+      if (isfinite (vl->values[i].gauge))
+        REF_ADD (JSON_GAUGE_FORMAT, vl->values[i].gauge);
+      else
+        REF_ADD ("null");
+    }
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      REF_ADD ("%llu", vl->values[i].counter);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      REF_ADD ("%"PRIi64, vl->values[i].derive);
+    else
+      REF_ADD ("%"PRIu64, vl->values[i].absolute);
+  }
+  REF_ADD ("],\"dstypes\":[");
+  for (i = 0; i < ds->ds_num; i++)
+    REF_ADD ("%s\"%s\"", (i > 0) ? "," : "", DS_TYPE_TO_STRING (ds->ds[i].type));
+  REF_ADD ("],\"dsnames\":[");
+  for (i = 0; i < ds->ds_num; i++)
+    REF_ADD ("%s\"%s\"", (i > 0) ? "," : "", ds->ds[i].name);
+  REF_ADD ("]");
+
+  REF_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
+  REF_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+
+#define REF_ADD_KEYVAL(key, value) do { \
+  if (reference_escape (temp, sizeof (temp), (value)) != 0) \
+    return (-1); \
+  REF_ADD (",\"%s\":%s", (key), temp); \
+} while (0)
+
+  REF_ADD_KEYVAL ("host", vl->host);
+  REF_ADD_KEYVAL ("plugin", vl->plugin);
+  REF_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
+  REF_ADD_KEYVAL ("type", vl->type);
+  REF_ADD_KEYVAL ("type_instance", vl->type_instance);
+  REF_ADD ("}");
+
+#undef REF_ADD_KEYVAL
+#undef REF_ADD
+
+  return (0);
+} /* }}} int reference_format */
+
+static data_source_t dsrc_mixed[] = {
+  { "rx", DS_TYPE_DERIVE, 0.0, NAN },
+  { "tx", DS_TYPE_COUNTER, 0.0, NAN },
+  { "abs", DS_TYPE_ABSOLUTE, 0.0, NAN },
+  { "g", DS_TYPE_GAUGE, 0.0, NAN }
+};
+static data_set_t ds_mixed = { "mixed", 4, dsrc_mixed };
+
+/* Formats `vl' with both implementations and returns non-zero if they
+ * differ. */
+static int compare_with_reference (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  char want[4096];
+  char got[4096];
+  size_t fill = 0;
+  size_t free = sizeof (got);
+  int status;
+
+  if (reference_format (want, sizeof (want), ds, vl) != 0)
+    return (-1);
+
+  memset (got, 0, sizeof (got));
+  status = format_json_value_list (got, &fill, &free, ds, vl,
+      /* store rates = */ 0);
+  if ((status != 0) || (strcmp (want, got) != 0) || (fill != strlen (got)))
+  {
+    printf ("# want: %s\n#  got: %s (status %i)\n", want, got, status);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int compare_with_reference */
+
+DEF_TEST(value_list)
+{
+  char buffer[1024];
+  size_t fill = 0;
+  size_t free = sizeof (buffer);
+  value_t values[4];
+  value_list_t vl;
+
+  values[0].derive = -42;
+  values[1].counter = 18446744073709551615ULL;
+  values[2].absolute = 0;
+  values[3].gauge = 0.25;
+  TESTING_VALUE_LIST (&vl, values, &ds_mixed);
+  vl.time = TIME_T_TO_CDTIME_T (1000) + MS_TO_CDTIME_T (125);
+  vl.interval = TIME_T_TO_CDTIME_T (10);
+  sstrncpy (vl.type_instance, "quote\"back\\slash\ttab",
+      sizeof (vl.type_instance));
+
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &free));
+  CHECK_ZERO (format_json_value_list (buffer, &fill, &free,
+        &ds_mixed, &vl, /* store rates = */ 0));
+  CHECK_ZERO (format_json_finalize (buffer, &fill, &free));
+
+  EXPECT_EQ_STR ("[{\"values\":[-42,18446744073709551615,0,0.25],"
+      "\"dstypes\":[\"derive\",\"counter\",\"absolute\",\"gauge\"],"
+      "\"dsnames\":[\"rx\",\"tx\",\"abs\",\"g\"],"
+      "\"time\":1000.125,\"interval\":10.000,"
+      "\"host\":\"example.com\",\"plugin\":\"test\","
+      "\"plugin_instance\":\"\",\"type\":\"mixed\","
+      "\"type_instance\":\"quote\\\"back\\\\slash?tab\"}]", buffer);
+  EXPECT_EQ_INT (strlen (buffer), fill);
+
+  return (0);
+}
+
+DEF_TEST(gauge)
+{
+  double special[] = { 0.0, -0.0, 1.0, -1.0, 0.1, 0.2 + 0.1, 1.0 / 3.0,
+    1e-4, 9.9999e-5, 1e-5, 123456789012345.0, 999999999999999.0, 1e15,
+    1e16, 1e300, -1e-300, 4.9e-324, 0.5, 1.5, 2.5, 1234.5678,
+    1.000001, 1.0000001, 12345.678901234, 0.000123, NAN, INFINITY,
+    -INFINITY, 3.14159, 100.0, 42.125 };
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  value_list_t vl;
+  value_t value;
+  unsigned int seed = 1;
+  size_t i;
+
+  TESTING_VALUE_LIST (&vl, &value, ds);
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (special); i++)
+  {
+    value.gauge = special[i];
+    OK1 (compare_with_reference (ds, &vl) == 0, "special value");
+  }
+
+  /* Values with few decimal places, as most metrics have, and arbitrary
+   * doubles of all magnitudes. */
+  for (i = 0; i < 100000; i++)
+  {
+    double scale = pow (10.0, (double) (rand_r (&seed) % 24) - 8.0);
+    double d = (double) (rand_r (&seed) % 2000001 - 1000000);
+
+    if ((i % 2) == 0)
+      value.gauge = d / pow (10.0, (double) (rand_r (&seed) % 7));
+    else
+      value.gauge = d * scale / 1e6 + ((double) rand_r (&seed)) / RAND_MAX;
+
+    if (compare_with_reference (ds, &vl) != 0)
+      OK1 (0, "random value");
+  }
+  OK1 (1, "random values");
+
+  return (0);
+}
+
+DEF_TEST(time)
+{
+  const data_set_t *ds = TESTING_DS_GAUGE;
+  value_list_t vl;
+  value_t value;
+  unsigned int seed = 2;
+  size_t i;
+
+  value.gauge = 1.0;
+  TESTING_VALUE_LIST (&vl, &value, ds);
+
+  for (i = 0; i < 100000; i++)
+  {
+    vl.time = (cdtime_t) rand_r (&seed);
+    vl.time = (vl.time << 31) | (cdtime_t) rand_r (&seed);
+    vl.interval = (cdtime_t) rand_r (&seed);
+    if ((i % 3) == 0)
+      vl.time = TIME_T_TO_CDTIME_T (1000000000) + MS_TO_CDTIME_T (i % 1000);
+
+    if (compare_with_reference (ds, &vl) != 0)
+      OK1 (0, "random time");
+  }
+  OK1 (1, "random times");
+
+  return (0);
+}
+
+DEF_TEST(buffer_too_small)
+{
+  char buffer[128];
+  size_t fill = 0;
+  size_t free = sizeof (buffer);
+  size_t old_fill;
+  value_t values[4] = { { .derive = 1 }, { .counter = 2 },
+    { .absolute = 3 }, { .gauge = 4.0 } };
+  value_list_t vl;
+
+  TESTING_VALUE_LIST (&vl, values, &ds_mixed);
+
+  CHECK_ZERO (format_json_initialize (buffer, &fill, &free));
+  memcpy (buffer, ",{}", 4);
+  fill = 3;
+  free -= 3;
+  old_fill = fill;
+
+  EXPECT_EQ_INT (-ENOMEM, format_json_value_list (buffer, &fill, &free,
+        &ds_mixed, &vl, /* store rates = */ 0));
+  EXPECT_EQ_INT (old_fill, fill);
+  EXPECT_EQ_STR (",{}", buffer);
+
+  return (0);
+}
+
+int main (void)
+{
+  RUN_TEST(value_list);
+  RUN_TEST(gauge);
+  RUN_TEST(time);
+  RUN_TEST(buffer_too_small);
+
+  END_TEST;
+}
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
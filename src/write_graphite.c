@@ -38,6 +38,9 @@
   *     Protocol "udp"
   *     LogSendErrors true
   *     Prefix "collectd"
+  *     SendQueueSize 262144
+  *     SpillQueueSize 4194304
+  *     ReportStats false
   *   </Carbon>
   * </Plugin>
   */
@@ -55,6 +58,7 @@
 #include <pthread.h>
 
 #include <netdb.h>
+#include <sys/uio.h>
 
 #define WG_DEFAULT_NODE "localhost"
 #define WG_DEFAULT_SERVICE "2003"
@@ -65,11 +69,29 @@
 /* Ethernet - (IPv6 + TCP) = 1500 - (40 + 32) = 1428 */
 #define WG_SEND_BUF_SIZE 1428
 
+#define WG_DEFAULT_SEND_QUEUE_SIZE  262144
+#define WG_DEFAULT_SPILL_QUEUE_SIZE 4194304
+#define WG_SPILL_CHUNK_SIZE 65536
+#define WG_SEND_IOV_MAX 16
+
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (1)
+#define WG_MAX_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T (64)
 
 /*
  * Private variables
  */
+/* Part of the spill queue. Write threads append at `fill', the sender thread
+ * consumes from `sent'. */
+struct wg_spill_chunk
+{
+    size_t size;
+    size_t fill;
+    size_t sent;
+    struct wg_spill_chunk *next;
+    char   data[];
+};
+typedef struct wg_spill_chunk wg_spill_chunk_t;
+
 struct wg_callback
 {
     int      sock_fd;
@@ -85,29 +107,54 @@ struct wg_callback
     char     escape_char;
 
     unsigned int format_flags;
-
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
-    cdtime_t send_buf_init_time;
-
-    pthread_mutex_t send_lock;
+    graphite_cache_t *path_cache;
+
+    /* Formatted lines waiting to be sent. Write threads append to the ring
+     * buffer and never touch the socket. Lines which don't fit into the ring
+     * go to the spill queue, which is limited to `spill_limit' bytes. Once
+     * the spill queue is in use, all lines go there until the sender thread
+     * has drained it, so that the order of the lines is preserved. */
+    pthread_mutex_t queue_lock;
+    pthread_cond_t  queue_cond;
+    char    *ring;
+    size_t   ring_size;
+    size_t   ring_tail;
+    size_t   ring_fill;
+    wg_spill_chunk_t *spill_head;
+    wg_spill_chunk_t *spill_tail;
+    size_t   spill_fill;
+    size_t   spill_limit;
+    cdtime_t queue_init_time;
+    _Bool    flush_requested;
+    c_complain_t drop_complaint;
+
+    pthread_t sender_thread;
+    _Bool    sender_running;
+    _Bool    sender_stop;
+
+    /* Statistics, protected by queue_lock. */
+    _Bool    report_stats;
+    derive_t stats_bytes_sent;
+    derive_t stats_lines_dropped;
+
+    /* Connection state. Only used by the sender thread once it is running. */
     c_complain_t init_complaint;
     cdtime_t last_connect_time;
+    cdtime_t reconnect_backoff;
+    _Bool    send_partial;
 
     /* Force reconnect useful for load balanced environments */
     cdtime_t last_reconnect_time;
     cdtime_t reconnect_interval;
-    _Bool reconnect_interval_reached;
 };
 
 /* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
- * than cb->reconnect_interval. Must hold cb->send_lock when calling. */
+ * than cb->reconnect_interval. Only called by the sender thread. */
 static void wg_force_reconnect_check (struct wg_callback *cb)
 {
     cdtime_t now;
 
-    if (cb->reconnect_interval == 0)
+    if ((cb->reconnect_interval == 0) || (cb->sock_fd < 0))
         return;
 
     /* check if address changes if addr_timeout */
@@ -118,80 +165,18 @@ static void wg_force_reconnect_check (struct wg_callback *cb)
     /* here we should close connection on next */
     close (cb->sock_fd);
     cb->sock_fd = -1;
-    cb->last_reconnect_time = now;
-    cb->reconnect_interval_reached = 1;
 
     INFO ("write_graphite plugin: Connection closed after %.3f seconds.",
           CDTIME_T_TO_DOUBLE (now - cb->last_reconnect_time));
+
+    cb->last_reconnect_time = now;
+    /* Don't wait for the backoff when reconnecting on purpose. */
+    cb->last_connect_time = 0;
 }
 
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
-{
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
-}
-
-static int wg_send_buffer (struct wg_callback *cb)
-{
-    ssize_t status = 0;
-
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
-    if (status != 0)
-    {
-        if (cb->log_send_errors)
-        {
-            char errbuf[1024];
-            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
-                    cb->node, cb->service, cb->protocol,
-                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
-        }
-
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
-
-        return (-1);
-    }
-
-    return (0);
-}
-
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
-{
-    int status;
-
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
-
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
-    {
-        cdtime_t now;
-
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
-    }
-
-    if (cb->send_buf_fill == 0)
-    {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
-    }
-
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
-
-    return (status);
-}
-
 static int wg_callback_init (struct wg_callback *cb)
 {
     struct addrinfo ai_hints;
@@ -205,10 +190,10 @@ static int wg_callback_init (struct wg_callback *cb)
     if (cb->sock_fd > 0)
         return (0);
 
-    /* Don't try to reconnect too often. By default, one reconnection attempt
-     * is made per second. */
+    /* Don't try to reconnect too often. The interval between two attempts
+     * starts at one second and doubles with every failed attempt. */
     now = cdtime ();
-    if ((now - cb->last_connect_time) < WG_MIN_RECONNECT_INTERVAL)
+    if ((now - cb->last_connect_time) < cb->reconnect_backoff)
         return (EAGAIN);
     cb->last_connect_time = now;
 
@@ -230,6 +215,9 @@ static int wg_callback_init (struct wg_callback *cb)
     {
         ERROR ("write_graphite plugin: getaddrinfo (%s, %s, %s) failed: %s",
                 cb->node, cb->service, cb->protocol, gai_strerror (status));
+        cb->reconnect_backoff *= 2;
+        if (cb->reconnect_backoff > WG_MAX_RECONNECT_INTERVAL)
+            cb->reconnect_backoff = WG_MAX_RECONNECT_INTERVAL;
         return (-1);
     }
 
@@ -269,6 +257,9 @@ static int wg_callback_init (struct wg_callback *cb)
         c_complain (LOG_ERR, &cb->init_complaint,
                   "write_graphite plugin: Connecting to %s:%s via %s failed. "
                   "The last error was: %s", cb->node, cb->service, cb->protocol, connerr);
+        cb->reconnect_backoff *= 2;
+        if (cb->reconnect_backoff > WG_MAX_RECONNECT_INTERVAL)
+            cb->reconnect_backoff = WG_MAX_RECONNECT_INTERVAL;
         return (-1);
     }
     else
@@ -278,29 +269,441 @@ static int wg_callback_init (struct wg_callback *cb)
                 cb->node, cb->service, cb->protocol);
     }
 
-    /* wg_force_reconnect_check does not flush the buffer before closing a
-     * sending socket, so only call wg_reset_buffer() if the socket was closed
-     * for a different reason (tracked in cb->reconnect_interval_reached). */
-    if (!cb->reconnect_interval_reached || (cb->send_buf_free == 0))
-        wg_reset_buffer (cb);
+    cb->reconnect_backoff = WG_MIN_RECONNECT_INTERVAL;
+    if (cb->reconnect_interval > 0)
+        cb->last_reconnect_time = now;
+
+    return (0);
+}
+
+static int wg_sender_start (struct wg_callback *cb);
+
+/* Returns the number of bytes waiting to be sent. Must hold cb->queue_lock. */
+static size_t wg_queue_length (struct wg_callback const *cb)
+{
+    return (cb->ring_fill + cb->spill_fill);
+}
+
+/* Must hold cb->queue_lock. */
+static int wg_spill_append (struct wg_callback *cb,
+        char const *message, size_t message_len)
+{
+    wg_spill_chunk_t *chunk = cb->spill_tail;
+
+    if ((chunk == NULL) || ((chunk->size - chunk->fill) < message_len))
+    {
+        size_t size = WG_SPILL_CHUNK_SIZE;
+
+        if (size < message_len)
+            size = message_len;
+
+        chunk = malloc (sizeof (*chunk) + size);
+        if (chunk == NULL)
+            return (ENOMEM);
+        chunk->size = size;
+        chunk->fill = 0;
+        chunk->sent = 0;
+        chunk->next = NULL;
+
+        if (cb->spill_tail == NULL)
+            cb->spill_head = chunk;
+        else
+            cb->spill_tail->next = chunk;
+        cb->spill_tail = chunk;
+    }
+
+    memcpy (chunk->data + chunk->fill, message, message_len);
+    chunk->fill += message_len;
+    cb->spill_fill += message_len;
+
+    return (0);
+}
+
+/* Appends formatted lines to the send queue. This never blocks on the
+ * network; if both the ring buffer and the spill queue are full, the lines
+ * are dropped. */
+static int wg_queue_append (struct wg_callback *cb,
+        char const *message, size_t message_len)
+{
+    size_t queue_len;
+    int status = 0;
+
+    pthread_mutex_lock (&cb->queue_lock);
+
+    if (!cb->sender_running && (wg_sender_start (cb) != 0))
+    {
+        pthread_mutex_unlock (&cb->queue_lock);
+        return (-1);
+    }
+
+    queue_len = wg_queue_length (cb);
+    if (queue_len == 0)
+        cb->queue_init_time = cdtime ();
+
+    if ((cb->spill_head == NULL)
+            && ((cb->ring_size - cb->ring_fill) >= message_len))
+    {
+        size_t head = (cb->ring_tail + cb->ring_fill) % cb->ring_size;
+        size_t first = cb->ring_size - head;
+
+        if (first > message_len)
+            first = message_len;
+
+        memcpy (cb->ring + head, message, first);
+        memcpy (cb->ring, message + first, message_len - first);
+        cb->ring_fill += message_len;
+    }
+    else if ((cb->spill_fill + message_len) <= cb->spill_limit)
+        status = wg_spill_append (cb, message, message_len);
     else
-        cb->reconnect_interval_reached = 0;
+        status = ENOBUFS;
+
+    if (status != 0)
+    {
+        char const *ptr;
+
+        for (ptr = message; (ptr = memchr (ptr, '\n',
+                        message_len - (ptr - message))) != NULL; ptr++)
+            cb->stats_lines_dropped++;
 
+        c_complain (LOG_WARNING, &cb->drop_complaint,
+                "write_graphite plugin: The send queue for %s:%s (%s) is "
+                "full. Dropping values.",
+                cb->node, cb->service, cb->protocol);
+    }
+    else
+    {
+        c_release (LOG_INFO, &cb->drop_complaint,
+                "write_graphite plugin: The send queue for %s:%s (%s) "
+                "accepts values again.",
+                cb->node, cb->service, cb->protocol);
+    }
+
+    /* Wake up the sender once there is enough data for a full packet. */
+    if ((queue_len < WG_SEND_BUF_SIZE)
+            && (wg_queue_length (cb) >= WG_SEND_BUF_SIZE))
+        pthread_cond_signal (&cb->queue_cond);
+
+    pthread_mutex_unlock (&cb->queue_lock);
+
+    return (status);
+}
+
+/* Points `iov' at the queued data, oldest first, and returns the number of
+ * elements used. Must hold cb->queue_lock. The memory stays valid after
+ * releasing the lock until the sender calls wg_queue_consume(), because
+ * write threads only ever append. */
+static int wg_queue_peek (struct wg_callback *cb,
+        struct iovec *iov, int iov_max)
+{
+    wg_spill_chunk_t *chunk;
+    int iov_num = 0;
+
+    assert (iov_max >= 3);
+
+    if (cb->ring_fill > 0)
+    {
+        size_t first = cb->ring_size - cb->ring_tail;
+
+        if (first > cb->ring_fill)
+            first = cb->ring_fill;
+
+        iov[iov_num].iov_base = cb->ring + cb->ring_tail;
+        iov[iov_num].iov_len = first;
+        iov_num++;
+
+        if (first < cb->ring_fill)
+        {
+            iov[iov_num].iov_base = cb->ring;
+            iov[iov_num].iov_len = cb->ring_fill - first;
+            iov_num++;
+        }
+    }
+
+    for (chunk = cb->spill_head;
+            (chunk != NULL) && (iov_num < iov_max);
+            chunk = chunk->next)
+    {
+        if (chunk->fill == chunk->sent)
+            continue;
+
+        iov[iov_num].iov_base = chunk->data + chunk->sent;
+        iov[iov_num].iov_len = chunk->fill - chunk->sent;
+        iov_num++;
+    }
+
+    return (iov_num);
+}
+
+/* Removes `len' bytes from the front of the queue. Must hold
+ * cb->queue_lock. */
+static void wg_queue_consume (struct wg_callback *cb, size_t len)
+{
+    size_t n;
+
+    n = (len < cb->ring_fill) ? len : cb->ring_fill;
+    cb->ring_tail = (cb->ring_tail + n) % cb->ring_size;
+    cb->ring_fill -= n;
+    len -= n;
+
+    while ((len > 0) && (cb->spill_head != NULL))
+    {
+        wg_spill_chunk_t *chunk = cb->spill_head;
+
+        n = chunk->fill - chunk->sent;
+        if (n > len)
+            n = len;
+        chunk->sent += n;
+        cb->spill_fill -= n;
+        len -= n;
+
+        if (chunk->sent < chunk->fill)
+            break;
+
+        cb->spill_head = chunk->next;
+        if (cb->spill_head == NULL)
+            cb->spill_tail = NULL;
+        sfree (chunk);
+    }
+
+    if (cb->ring_fill == 0)
+        cb->ring_tail = 0;
+}
+
+/* Drops the remainder of a line whose beginning was sent over a connection
+ * that has since failed. Must hold cb->queue_lock. */
+static void wg_queue_discard_line (struct wg_callback *cb)
+{
+    struct iovec iov[WG_SEND_IOV_MAX];
+    size_t len = 0;
+    int iov_num;
+    int i;
+
+    iov_num = wg_queue_peek (cb, iov, STATIC_ARRAY_SIZE (iov));
+    for (i = 0; i < iov_num; i++)
+    {
+        char *eol = memchr (iov[i].iov_base, '\n', iov[i].iov_len);
+
+        if (eol != NULL)
+        {
+            len += (size_t) (eol - (char *) iov[i].iov_base) + 1;
+            break;
+        }
+        len += iov[i].iov_len;
+    }
+
+    wg_queue_consume (cb, len);
+}
+
+/* Sends (part of) the data referenced by `iov'. Returns the number of bytes
+ * sent or -1 on failure. */
+static ssize_t wg_send_iov (struct wg_callback *cb,
+        struct iovec *iov, int iov_num)
+{
+    ssize_t status;
+
+    if (strcasecmp ("tcp", cb->protocol) == 0)
+    {
+        do
+            status = writev (cb->sock_fd, iov, iov_num);
+        while ((status < 0) && (errno == EINTR));
+    }
+    else
+    {
+        /* Each datagram has to consist of complete lines. */
+        char buffer[WG_SEND_BUF_SIZE];
+        size_t buffer_fill = 0;
+        size_t len;
+        int i;
+
+        for (i = 0; (i < iov_num) && (buffer_fill < sizeof (buffer)); i++)
+        {
+            len = iov[i].iov_len;
+            if (len > (sizeof (buffer) - buffer_fill))
+                len = sizeof (buffer) - buffer_fill;
+            memcpy (buffer + buffer_fill, iov[i].iov_base, len);
+            buffer_fill += len;
+        }
+
+        for (len = buffer_fill; len > 0; len--)
+            if (buffer[len - 1] == '\n')
+                break;
+        if (len == 0)
+            len = buffer_fill;
+
+        do
+            status = send (cb->sock_fd, buffer, len, /* flags = */ 0);
+        while ((status < 0) && (errno == EINTR));
+    }
+
+    if (status < 0)
+    {
+        if (cb->log_send_errors)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: send to %s:%s (%s) failed with status %zi (%s)",
+                    cb->node, cb->service, cb->protocol,
+                    status, sstrerror (errno, errbuf, sizeof (errbuf)));
+        }
+
+        close (cb->sock_fd);
+        cb->sock_fd = -1;
+
+        return (-1);
+    }
+
+    /* Remember whether we stopped in the middle of a line. */
+    if (status > 0)
+    {
+        size_t offset = (size_t) status;
+        int i;
+
+        for (i = 0; i < iov_num; i++)
+        {
+            if (offset <= iov[i].iov_len)
+            {
+                cb->send_partial =
+                    (((char *) iov[i].iov_base)[offset - 1] != '\n');
+                break;
+            }
+            offset -= iov[i].iov_len;
+        }
+    }
+
+    return (status);
+}
+
+static void *wg_sender_thread (void *arg)
+{
+    struct wg_callback *cb = arg;
+    _Bool final_attempt = 0;
+
+    pthread_mutex_lock (&cb->queue_lock);
+    while (42)
+    {
+        struct iovec iov[WG_SEND_IOV_MAX];
+        int iov_num;
+        ssize_t status;
+        size_t queue_len;
+
+        queue_len = wg_queue_length (cb);
+        if (queue_len == 0)
+        {
+            cb->flush_requested = 0;
+            if (cb->sender_stop)
+                break;
+        }
+
+        if (!cb->sender_stop && !cb->flush_requested
+                && (queue_len < WG_SEND_BUF_SIZE))
+        {
+            pthread_cond_wait (&cb->queue_cond, &cb->queue_lock);
+            continue;
+        }
+
+        /* Make one last connection attempt before giving up. */
+        if (cb->sender_stop && !final_attempt)
+        {
+            final_attempt = 1;
+            cb->last_connect_time = 0;
+        }
+
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        if (!cb->send_partial)
+            wg_force_reconnect_check (cb);
+        status = (ssize_t) wg_callback_init (cb);
+
+        pthread_mutex_lock (&cb->queue_lock);
+
+        if (status != 0)
+        {
+            struct timespec ts;
+
+            if (cb->sender_stop)
+                break;
+
+            /* An error message has already been printed. Wait for the
+             * next connection attempt; values queue up in the meantime. */
+            CDTIME_T_TO_TIMESPEC (cb->last_connect_time
+                    + cb->reconnect_backoff, &ts);
+            pthread_cond_timedwait (&cb->queue_cond, &cb->queue_lock, &ts);
+            continue;
+        }
+
+        iov_num = wg_queue_peek (cb, iov, STATIC_ARRAY_SIZE (iov));
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        status = wg_send_iov (cb, iov, iov_num);
+
+        pthread_mutex_lock (&cb->queue_lock);
+        if (status > 0)
+        {
+            wg_queue_consume (cb, (size_t) status);
+            cb->stats_bytes_sent += (derive_t) status;
+        }
+        else if ((status < 0) && cb->send_partial)
+        {
+            /* The receiver only got the beginning of the current line. */
+            wg_queue_discard_line (cb);
+            cb->send_partial = 0;
+        }
+    } /* while (42) */
+
+    /* Anything still queued can't be sent anymore. */
+    if (wg_queue_length (cb) > 0)
+        WARNING ("write_graphite plugin: Discarding %zu bytes queued for "
+                "%s:%s (%s).", wg_queue_length (cb),
+                cb->node, cb->service, cb->protocol);
+    pthread_mutex_unlock (&cb->queue_lock);
+
+    return ((void *) 0);
+}
+
+/* Starts the sender thread. Must hold cb->queue_lock. The thread is started
+ * lazily because the daemon may fork after the configuration was read. */
+static int wg_sender_start (struct wg_callback *cb)
+{
+    int status;
+
+    if (cb->sender_running)
+        return (0);
+
+    status = plugin_thread_create (&cb->sender_thread, /* attr = */ NULL,
+            wg_sender_thread, cb);
+    if (status != 0)
+    {
+        char errbuf[1024];
+        ERROR ("write_graphite plugin: Starting the sender thread failed: %s",
+                sstrerror (errno, errbuf, sizeof (errbuf)));
+        return (-1);
+    }
+
+    cb->sender_running = 1;
     return (0);
 }
 
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
+    wg_spill_chunk_t *chunk;
 
     if (data == NULL)
         return;
 
     cb = data;
 
-    pthread_mutex_lock (&cb->send_lock);
+    /* The sender thread sends whatever is queued before it exits. */
+    pthread_mutex_lock (&cb->queue_lock);
+    cb->sender_stop = 1;
+    pthread_cond_signal (&cb->queue_cond);
+    pthread_mutex_unlock (&cb->queue_lock);
 
-    wg_flush_nolock (/* timeout = */ 0, cb);
+    if (cb->sender_running)
+    {
+        pthread_join (cb->sender_thread, /* retval = */ NULL);
+        cb->sender_running = 0;
+    }
 
     if (cb->sock_fd >= 0)
     {
@@ -308,6 +711,14 @@ static void wg_callback_free (void *data)
         cb->sock_fd = -1;
     }
 
+    while ((chunk = cb->spill_head) != NULL)
+    {
+        cb->spill_head = chunk->next;
+        sfree (chunk);
+    }
+    sfree(cb->ring);
+    graphite_cache_destroy (cb->path_cache);
+
     sfree(cb->name);
     sfree(cb->node);
     sfree(cb->protocol);
@@ -315,7 +726,8 @@ static void wg_callback_free (void *data)
     sfree(cb->prefix);
     sfree(cb->postfix);
 
-    pthread_mutex_destroy (&cb->send_lock);
+    pthread_cond_destroy (&cb->queue_cond);
+    pthread_mutex_destroy (&cb->queue_lock);
 
     sfree(cb);
 }
@@ -325,81 +737,69 @@ static int wg_flush (cdtime_t timeout,
         user_data_t *user_data)
 {
     struct wg_callback *cb;
-    int status;
 
     if (user_data == NULL)
         return (-EINVAL);
 
     cb = user_data->data;
 
-    pthread_mutex_lock (&cb->send_lock);
+    pthread_mutex_lock (&cb->queue_lock);
 
-    if (cb->sock_fd < 0)
+    DEBUG ("write_graphite plugin: wg_flush: timeout = %.3f; "
+            "queue_length = %zu;",
+            CDTIME_T_TO_DOUBLE (timeout),
+            wg_queue_length (cb));
+
+    /* timeout == 0  => flush unconditionally */
+    if ((wg_queue_length (cb) > 0)
+            && ((timeout == 0)
+                || ((cb->queue_init_time + timeout) <= cdtime ())))
     {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
+        cb->flush_requested = 1;
+        pthread_cond_signal (&cb->queue_cond);
     }
 
-    status = wg_flush_nolock (timeout, cb);
-    pthread_mutex_unlock (&cb->send_lock);
+    pthread_mutex_unlock (&cb->queue_lock);
 
-    return (status);
+    return (0);
 }
 
-static int wg_send_message (char const *message, struct wg_callback *cb)
+static int wg_stats_read (user_data_t *user_data)
 {
-    int status;
-    size_t message_len;
-
-    message_len = strlen (message);
-
-    pthread_mutex_lock (&cb->send_lock);
-
-    wg_force_reconnect_check (cb);
-
-    if (cb->sock_fd < 0)
-    {
-        status = wg_callback_init (cb);
-        if (status != 0)
-        {
-            /* An error message has already been printed. */
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
-        }
-    }
-
-    if (message_len >= cb->send_buf_free)
-    {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
-        if (status != 0)
-        {
-            pthread_mutex_unlock (&cb->send_lock);
-            return (status);
-        }
-    }
-
-    /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
-
-    /* `message_len + 1' because `message_len' does not include the
-     * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
-            message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
-
-    DEBUG ("write_graphite plugin: [%s]:%s (%s) buf %zu/%zu (%.1f %%) \"%s\"",
-            cb->node, cb->service, cb->protocol,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
-            message);
-
-    pthread_mutex_unlock (&cb->send_lock);
+    struct wg_callback *cb = user_data->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    gauge_t queue_length;
+    derive_t bytes_sent;
+    derive_t lines_dropped;
+
+    pthread_mutex_lock (&cb->queue_lock);
+    queue_length = (gauge_t) wg_queue_length (cb);
+    bytes_sent = cb->stats_bytes_sent;
+    lines_dropped = cb->stats_lines_dropped;
+    pthread_mutex_unlock (&cb->queue_lock);
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_graphite", sizeof (vl.plugin));
+    sstrncpy (vl.plugin_instance, (cb->name != NULL) ? cb->name : cb->node,
+            sizeof (vl.plugin_instance));
+
+    values[0].gauge = queue_length;
+    sstrncpy (vl.type, "bytes", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "queued", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = bytes_sent;
+    sstrncpy (vl.type, "total_bytes", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "sent", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = lines_dropped;
+    sstrncpy (vl.type, "total_values", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
 
     return (0);
 }
@@ -417,14 +817,13 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
         return -1;
     }
 
-    memset (buffer, 0, sizeof (buffer));
-    status = format_graphite (buffer, sizeof (buffer), ds, vl,
-            cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
+    status = format_graphite_cached (cb->path_cache, buffer, sizeof (buffer),
+            ds, vl, cb->prefix, cb->postfix, cb->escape_char, cb->format_flags);
     if (status != 0) /* error message has been printed already. */
         return (status);
 
-    /* Send the message to graphite */
-    status = wg_send_message (buffer, cb);
+    /* Hand the lines to the sender thread. */
+    status = wg_queue_append (cb, buffer, strlen (buffer));
     if (status != 0) /* error message has been printed already. */
         return (status);
 
@@ -478,6 +877,28 @@ static int config_set_char (char *dest,
     return (0);
 }
 
+static int config_set_size (size_t *dest, size_t min,
+        oconfig_item_t *ci)
+{
+    int tmp = 0;
+    int status;
+
+    status = cf_util_get_int (ci, &tmp);
+    if (status != 0)
+        return (status);
+
+    if ((tmp < 0) || ((size_t) tmp < min))
+    {
+        ERROR ("write_graphite plugin: The \"%s\" option must be at "
+                "least %zu.", ci->key, min);
+        return (-1);
+    }
+
+    *dest = (size_t) tmp;
+
+    return (0);
+}
+
 static int wg_config_node (oconfig_item_t *ci)
 {
     struct wg_callback *cb;
@@ -499,12 +920,15 @@ static int wg_config_node (oconfig_item_t *ci)
     cb->protocol = strdup (WG_DEFAULT_PROTOCOL);
     cb->last_reconnect_time = cdtime();
     cb->reconnect_interval = 0;
-    cb->reconnect_interval_reached = 0;
+    cb->reconnect_backoff = WG_MIN_RECONNECT_INTERVAL;
     cb->log_send_errors = WG_DEFAULT_LOG_SEND_ERRORS;
     cb->prefix = NULL;
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->format_flags = GRAPHITE_STORE_RATES;
+    cb->ring_size = WG_DEFAULT_SEND_QUEUE_SIZE;
+    cb->spill_limit = WG_DEFAULT_SPILL_QUEUE_SIZE;
+    cb->report_stats = 0;
 
     /* FIXME: Legacy configuration syntax. */
     if (strcasecmp ("Carbon", ci->key) != 0)
@@ -517,8 +941,10 @@ static int wg_config_node (oconfig_item_t *ci)
         }
     }
 
-    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    pthread_mutex_init (&cb->queue_lock, /* attr = */ NULL);
+    pthread_cond_init (&cb->queue_cond, /* attr = */ NULL);
     C_COMPLAIN_INIT (&cb->init_complaint);
+    C_COMPLAIN_INIT (&cb->drop_complaint);
 
     for (i = 0; i < ci->children_num; i++)
     {
@@ -559,6 +985,12 @@ static int wg_config_node (oconfig_item_t *ci)
                     GRAPHITE_ALWAYS_APPEND_DS);
         else if (strcasecmp ("EscapeCharacter", child->key) == 0)
             config_set_char (&cb->escape_char, child);
+        else if (strcasecmp ("SendQueueSize", child->key) == 0)
+            status = config_set_size (&cb->ring_size, WG_SEND_BUF_SIZE, child);
+        else if (strcasecmp ("SpillQueueSize", child->key) == 0)
+            status = config_set_size (&cb->spill_limit, 0, child);
+        else if (strcasecmp ("ReportStats", child->key) == 0)
+            cf_util_get_boolean (child, &cb->report_stats);
         else
         {
             ERROR ("write_graphite plugin: Invalid configuration "
@@ -570,6 +1002,26 @@ static int wg_config_node (oconfig_item_t *ci)
             break;
     }
 
+    if (status == 0)
+    {
+        cb->ring = malloc (cb->ring_size);
+        if (cb->ring == NULL)
+        {
+            ERROR ("write_graphite plugin: malloc failed.");
+            status = -1;
+        }
+    }
+
+    if (status == 0)
+    {
+        cb->path_cache = graphite_cache_create (GRAPHITE_CACHE_DEFAULT_SIZE);
+        if (cb->path_cache == NULL)
+        {
+            ERROR ("write_graphite plugin: graphite_cache_create failed.");
+            status = -1;
+        }
+    }
+
     if (status != 0)
     {
         wg_callback_free (cb);
@@ -592,6 +1044,10 @@ static int wg_config_node (oconfig_item_t *ci)
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
 
+    if (cb->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                wg_stats_read, /* interval = */ 0, &user_data);
+
     return (0);
 }
 
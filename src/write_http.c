@@ -27,6 +27,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
 #include "utils_format_json.h"
 
 #if HAVE_PTHREAD_H
@@ -35,13 +36,52 @@
 
 #include <curl/curl.h>
 
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_BUFFER_SIZE
 # define WRITE_HTTP_DEFAULT_BUFFER_SIZE 4096
 #endif
 
+#define WH_DEFAULT_MAX_REQUESTS    4
+#define WH_DEFAULT_SEND_QUEUE_SIZE 64
+#define WH_DEFAULT_RETRY_QUEUE_SIZE 16
+
+#define WH_MIN_RETRY_INTERVAL TIME_T_TO_CDTIME_T (1)
+#define WH_MAX_RETRY_INTERVAL TIME_T_TO_CDTIME_T (64)
+
+/* How long the sender waits for network activity before it checks for new
+ * requests, in milliseconds. */
+#define WH_POLL_INTERVAL_MS 100
+
 /*
  * Private variables
  */
+/* A filled send buffer on its way to the server. */
+struct wh_request_s
+{
+        char  *buffer;     /* the send buffer, as formatted */
+        size_t buffer_fill;
+        char  *body;       /* what is posted: `buffer' or a compressed copy */
+        size_t body_size;
+
+        cdtime_t retry_time;
+
+        struct wh_request_s *next;
+};
+typedef struct wh_request_s wh_request_t;
+
+/* A curl handle of the sender thread. Handles are reused, so that libcurl
+ * can keep the connections to the server alive. */
+struct wh_slot_s
+{
+        CURL *curl;
+        wh_request_t *request;
+        char curl_errbuf[CURL_ERROR_SIZE];
+};
+typedef struct wh_slot_s wh_slot_t;
+
 struct wh_callback_s
 {
         char *name;
@@ -60,6 +100,7 @@ struct wh_callback_s
         long sslversion;
         _Bool store_rates;
         _Bool log_http_error;
+        _Bool compress;
         int   low_speed_limit;
         time_t low_speed_time;
         int timeout;
@@ -68,10 +109,14 @@ struct wh_callback_s
 #define WH_FORMAT_JSON    1
         int format;
 
-        CURL *curl;
         struct curl_slist *headers;
-        char curl_errbuf[CURL_ERROR_SIZE];
+        /* `headers' plus "Content-Encoding", for requests whose body has
+         * actually been compressed. */
+        struct curl_slist *headers_gzip;
 
+        /* The buffer the write threads are formatting into. When it is full,
+         * it is handed to the sender thread and replaced by an unused
+         * buffer, so formatting doesn't wait for the HTTP request. */
         char  *send_buffer;
         size_t send_buffer_size;
         size_t send_buffer_free;
@@ -79,18 +124,41 @@ struct wh_callback_s
         cdtime_t send_buffer_init_time;
 
         pthread_mutex_t send_lock;
+
+        /* Requests waiting for the sender thread. Failed requests are retried
+         * from the retry queue. Both queues are bounded; when one is full,
+         * its oldest request is dropped. Protected by queue_lock. */
+        pthread_mutex_t queue_lock;
+        pthread_cond_t  queue_cond;
+        wh_request_t   *send_queue_head;
+        wh_request_t   *send_queue_tail;
+        int             send_queue_length;
+        int             send_queue_size;
+        wh_request_t   *retry_queue_head;
+        wh_request_t   *retry_queue_tail;
+        int             retry_queue_length;
+        int             retry_queue_size;
+        char          **free_buffers;
+        int             free_buffers_num;
+        c_complain_t    drop_complaint;
+
+        pthread_t sender_thread;
+        _Bool     sender_running;
+        _Bool     sender_stop;
+
+        /* Only used by the sender thread. */
+        CURLM     *multi;
+        wh_slot_t *slots;
+        int        slots_num;
+        cdtime_t   retry_interval;
 };
 typedef struct wh_callback_s wh_callback_t;
 
-static void wh_log_http_error (wh_callback_t *cb)
+static void wh_log_http_error (wh_callback_t *cb, long http_code)
 {
         if (!cb->log_http_error)
                 return;
 
-        long http_code = 0;
-
-        curl_easy_getinfo (cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
-
         if (http_code != 200)
                 INFO ("write_http plugin: HTTP Error code: %lu", http_code);
 }
@@ -110,31 +178,171 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
         }
 } /* }}} wh_reset_buffer */
 
+static void wh_request_free (wh_callback_t *cb, wh_request_t *req) /* {{{ */
+{
+        if (req == NULL)
+                return;
+
+        if (req->body != req->buffer)
+                sfree (req->body);
+
+        /* Keep a few buffers around so the write threads don't have to
+         * allocate a new one every time. Must hold cb->queue_lock. */
+        if (cb->free_buffers_num < cb->slots_num + 1)
+        {
+                cb->free_buffers[cb->free_buffers_num] = req->buffer;
+                cb->free_buffers_num++;
+        }
+        else
+        {
+                sfree (req->buffer);
+        }
+
+        sfree (req);
+} /* }}} void wh_request_free */
+
+/* Appends `req' to a queue, dropping the oldest request if the queue is
+ * full. Must hold cb->queue_lock. */
+static void wh_queue_append (wh_callback_t *cb, /* {{{ */
+                wh_request_t **head, wh_request_t **tail, int *length,
+                int size, wh_request_t *req)
+{
+        req->next = NULL;
+        if (*tail == NULL)
+                *head = req;
+        else
+                (*tail)->next = req;
+        *tail = req;
+        (*length)++;
+
+        if (*length <= size)
+        {
+                c_release (LOG_INFO, &cb->drop_complaint,
+                                "write_http plugin: <%s> Queue no longer full.",
+                                cb->location);
+                return;
+        }
+
+        req = *head;
+        *head = req->next;
+        (*length)--;
+
+        c_complain (LOG_WARNING, &cb->drop_complaint,
+                        "write_http plugin: <%s> Queue is full, dropping "
+                        "buffered values.", cb->location);
+        wh_request_free (cb, req);
+} /* }}} void wh_queue_append */
+
+/* Hands the current send buffer to the sender thread and replaces it with
+ * an unused one. Must hold cb->send_lock. */
 static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
 {
-        int status = 0;
+        wh_request_t *req;
+        char *buffer = NULL;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
-        status = curl_easy_perform (cb->curl);
+        req = calloc (1, sizeof (*req));
+        if (req == NULL)
+        {
+                ERROR ("write_http plugin: calloc failed.");
+                return (-1);
+        }
 
-        wh_log_http_error (cb);
+        pthread_mutex_lock (&cb->queue_lock);
+        if (cb->free_buffers_num > 0)
+        {
+                cb->free_buffers_num--;
+                buffer = cb->free_buffers[cb->free_buffers_num];
+        }
+        pthread_mutex_unlock (&cb->queue_lock);
 
-        if (status != CURLE_OK)
+        if (buffer == NULL)
         {
-                ERROR ("write_http plugin: curl_easy_perform failed with "
-                                "status %i: %s",
-                                status, cb->curl_errbuf);
+                buffer = malloc (cb->send_buffer_size);
+                if (buffer == NULL)
+                {
+                        ERROR ("write_http plugin: malloc(%zu) failed.",
+                                        cb->send_buffer_size);
+                        sfree (req);
+                        return (-1);
+                }
         }
-        return (status);
+
+        req->buffer = cb->send_buffer;
+        req->buffer_fill = cb->send_buffer_fill;
+        req->body = req->buffer;
+        req->body_size = req->buffer_fill;
+
+        cb->send_buffer = buffer;
+        wh_reset_buffer (cb);
+
+        pthread_mutex_lock (&cb->queue_lock);
+        wh_queue_append (cb, &cb->send_queue_head, &cb->send_queue_tail,
+                        &cb->send_queue_length, cb->send_queue_size, req);
+        pthread_cond_signal (&cb->queue_cond);
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        return (0);
 } /* }}} wh_send_buffer */
 
-static int wh_callback_init (wh_callback_t *cb) /* {{{ */
+#if HAVE_ZLIB_H
+/* Replaces the body of `req' with a gzip compressed copy. */
+static int wh_compress_request (wh_request_t *req) /* {{{ */
 {
-        if (cb->curl != NULL)
-                return (0);
+        z_stream stream;
+        char *body;
+        size_t body_size;
+        int status;
+
+        memset (&stream, 0, sizeof (stream));
+        /* 16 + MAX_WBITS selects the gzip format. */
+        status = deflateInit2 (&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                        16 + MAX_WBITS, /* memLevel = */ 8,
+                        Z_DEFAULT_STRATEGY);
+        if (status != Z_OK)
+        {
+                ERROR ("write_http plugin: deflateInit2 failed with "
+                                "status %i.", status);
+                return (-1);
+        }
 
-        cb->curl = curl_easy_init ();
-        if (cb->curl == NULL)
+        body_size = deflateBound (&stream, (uLong) req->buffer_fill);
+        body = malloc (body_size);
+        if (body == NULL)
+        {
+                ERROR ("write_http plugin: malloc(%zu) failed.", body_size);
+                deflateEnd (&stream);
+                return (-1);
+        }
+
+        stream.next_in = (Bytef *) req->buffer;
+        stream.avail_in = (uInt) req->buffer_fill;
+        stream.next_out = (Bytef *) body;
+        stream.avail_out = (uInt) body_size;
+
+        status = deflate (&stream, Z_FINISH);
+        if (status != Z_STREAM_END)
+        {
+                ERROR ("write_http plugin: deflate failed with status %i.",
+                                status);
+                deflateEnd (&stream);
+                sfree (body);
+                return (-1);
+        }
+
+        req->body = body;
+        req->body_size = (size_t) stream.total_out;
+        deflateEnd (&stream);
+
+        return (0);
+} /* }}} int wh_compress_request */
+#endif
+
+static int wh_slot_init (wh_callback_t *cb, wh_slot_t *slot) /* {{{ */
+{
+        CURL *curl;
+
+        curl = curl_easy_init ();
+        if (curl == NULL)
         {
                 ERROR ("curl plugin: curl_easy_init failed.");
                 return (-1);
@@ -142,83 +350,393 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 
         if (cb->low_speed_limit > 0 && cb->low_speed_time > 0)
         {
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_LIMIT,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_LIMIT,
                                   (long) (cb->low_speed_limit * cb->low_speed_time));
-                curl_easy_setopt (cb->curl, CURLOPT_LOW_SPEED_TIME,
+                curl_easy_setopt (curl, CURLOPT_LOW_SPEED_TIME,
                                   (long) cb->low_speed_time);
         }
 
 #ifdef HAVE_CURLOPT_TIMEOUT_MS
         if (cb->timeout > 0)
-                curl_easy_setopt (cb->curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
+                curl_easy_setopt (curl, CURLOPT_TIMEOUT_MS, (long) cb->timeout);
 #endif
 
-        curl_easy_setopt (cb->curl, CURLOPT_NOSIGNAL, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
-
-        cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
-        if (cb->format == WH_FORMAT_JSON)
-                cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
-        else
-                cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
-        cb->headers = curl_slist_append (cb->headers, "Expect:");
-        curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, cb->headers);
+        curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt (curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+#if LIBCURL_VERSION_NUM >= 0x071900
+        curl_easy_setopt (curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
 
-        curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-        curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
-        curl_easy_setopt (cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt (cb->curl, CURLOPT_MAXREDIRS, 50L);
+        curl_easy_setopt (curl, CURLOPT_ERRORBUFFER, slot->curl_errbuf);
+        curl_easy_setopt (curl, CURLOPT_URL, cb->location);
+        curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt (curl, CURLOPT_MAXREDIRS, 50L);
+        curl_easy_setopt (curl, CURLOPT_PRIVATE, (void *) slot);
 
         if (cb->user != NULL)
         {
 #ifdef HAVE_CURLOPT_USERNAME
-                curl_easy_setopt (cb->curl, CURLOPT_USERNAME, cb->user);
-                curl_easy_setopt (cb->curl, CURLOPT_PASSWORD,
+                curl_easy_setopt (curl, CURLOPT_USERNAME, cb->user);
+                curl_easy_setopt (curl, CURLOPT_PASSWORD,
                         (cb->pass == NULL) ? "" : cb->pass);
 #else
-                size_t credentials_size;
-
-                credentials_size = strlen (cb->user) + 2;
-                if (cb->pass != NULL)
-                        credentials_size += strlen (cb->pass);
-
-                cb->credentials = malloc (credentials_size);
-                if (cb->credentials == NULL)
-                {
-                        ERROR ("curl plugin: malloc failed.");
-                        return (-1);
-                }
-
-                ssnprintf (cb->credentials, credentials_size, "%s:%s",
-                                cb->user, (cb->pass == NULL) ? "" : cb->pass);
-                curl_easy_setopt (cb->curl, CURLOPT_USERPWD, cb->credentials);
+                curl_easy_setopt (curl, CURLOPT_USERPWD, cb->credentials);
 #endif
-                curl_easy_setopt (cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+                curl_easy_setopt (curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
         }
 
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
-        curl_easy_setopt (cb->curl, CURLOPT_SSL_VERIFYHOST,
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYPEER, (long) cb->verify_peer);
+        curl_easy_setopt (curl, CURLOPT_SSL_VERIFYHOST,
                         cb->verify_host ? 2L : 0L);
-        curl_easy_setopt (cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
+        curl_easy_setopt (curl, CURLOPT_SSLVERSION, cb->sslversion);
         if (cb->cacert != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAINFO, cb->cacert);
+                curl_easy_setopt (curl, CURLOPT_CAINFO, cb->cacert);
         if (cb->capath != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_CAPATH, cb->capath);
+                curl_easy_setopt (curl, CURLOPT_CAPATH, cb->capath);
 
         if (cb->clientkey != NULL && cb->clientcert != NULL)
         {
-            curl_easy_setopt (cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-            curl_easy_setopt (cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+            curl_easy_setopt (curl, CURLOPT_SSLKEY, cb->clientkey);
+            curl_easy_setopt (curl, CURLOPT_SSLCERT, cb->clientcert);
 
             if (cb->clientkeypass != NULL)
-                curl_easy_setopt (cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+                curl_easy_setopt (curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
         }
 
-        wh_reset_buffer (cb);
+        slot->curl = curl;
+        slot->request = NULL;
+
+        return (0);
+} /* }}} int wh_slot_init */
+
+static int wh_callback_init (wh_callback_t *cb) /* {{{ */
+{
+        int i;
+
+        /* The easy handles are created one by one below, so that a failed
+         * attempt can be resumed on the next write. */
+        if (cb->multi == NULL)
+        {
+                cb->multi = curl_multi_init ();
+                if (cb->multi == NULL)
+                {
+                        ERROR ("write_http plugin: curl_multi_init failed.");
+                        return (-1);
+                }
+
+                cb->headers = curl_slist_append (cb->headers, "Accept:  */*");
+                if (cb->format == WH_FORMAT_JSON)
+                        cb->headers = curl_slist_append (cb->headers, "Content-Type: application/json");
+                else
+                        cb->headers = curl_slist_append (cb->headers, "Content-Type: text/plain");
+                cb->headers = curl_slist_append (cb->headers, "Expect:");
+
+                if (cb->compress)
+                {
+                        struct curl_slist *h;
+
+                        for (h = cb->headers; h != NULL; h = h->next)
+                                cb->headers_gzip = curl_slist_append (cb->headers_gzip, h->data);
+                        cb->headers_gzip = curl_slist_append (cb->headers_gzip, "Content-Encoding: gzip");
+                }
+
+#ifndef HAVE_CURLOPT_USERNAME
+                if (cb->user != NULL)
+                {
+                        size_t credentials_size;
+
+                        credentials_size = strlen (cb->user) + 2;
+                        if (cb->pass != NULL)
+                                credentials_size += strlen (cb->pass);
+
+                        cb->credentials = malloc (credentials_size);
+                        if (cb->credentials == NULL)
+                        {
+                                ERROR ("curl plugin: malloc failed.");
+                                return (-1);
+                        }
+
+                        ssnprintf (cb->credentials, credentials_size, "%s:%s",
+                                        cb->user, (cb->pass == NULL) ? "" : cb->pass);
+                }
+#endif
+        }
+
+        for (i = 0; i < cb->slots_num; i++)
+        {
+                if (cb->slots[i].curl != NULL)
+                        continue;
+                if (wh_slot_init (cb, cb->slots + i) != 0)
+                        return (-1);
+        }
 
         return (0);
 } /* }}} int wh_callback_init */
 
+/* Returns the next request that is ready to be sent, or NULL. Retries come
+ * first, because they contain older values. Must hold cb->queue_lock. */
+static wh_request_t *wh_queue_next (wh_callback_t *cb, /* {{{ */
+                cdtime_t now)
+{
+        wh_request_t *req;
+
+        /* When shutting down, failed requests get one last attempt right
+         * away. */
+        if ((cb->retry_queue_head != NULL)
+                        && (cb->sender_stop
+                                || (cb->retry_queue_head->retry_time <= now)))
+        {
+                req = cb->retry_queue_head;
+                cb->retry_queue_head = req->next;
+                if (cb->retry_queue_head == NULL)
+                        cb->retry_queue_tail = NULL;
+                cb->retry_queue_length--;
+        }
+        else if (cb->send_queue_head != NULL)
+        {
+                req = cb->send_queue_head;
+                cb->send_queue_head = req->next;
+                if (cb->send_queue_head == NULL)
+                        cb->send_queue_tail = NULL;
+                cb->send_queue_length--;
+        }
+        else
+        {
+                return (NULL);
+        }
+
+        req->next = NULL;
+        return (req);
+} /* }}} wh_request_t *wh_queue_next */
+
+static void wh_request_start (wh_callback_t *cb, /* {{{ */
+                wh_slot_t *slot, wh_request_t *req)
+{
+#if HAVE_ZLIB_H
+        if (cb->compress && (req->body == req->buffer))
+        {
+                if (wh_compress_request (req) != 0)
+                {
+                        /* Better send the values uncompressed than lose
+                         * them. */
+                        WARNING ("write_http plugin: <%s> Sending request "
+                                        "uncompressed.", cb->location);
+                }
+        }
+#endif
+
+        slot->request = req;
+        slot->curl_errbuf[0] = 0;
+
+        /* Only claim gzip if the body actually is. */
+        if ((req->body != req->buffer) && (cb->headers_gzip != NULL))
+                curl_easy_setopt (slot->curl, CURLOPT_HTTPHEADER, cb->headers_gzip);
+        else
+                curl_easy_setopt (slot->curl, CURLOPT_HTTPHEADER, cb->headers);
+        curl_easy_setopt (slot->curl, CURLOPT_POSTFIELDS, req->body);
+        curl_easy_setopt (slot->curl, CURLOPT_POSTFIELDSIZE,
+                        (long) req->body_size);
+        curl_multi_add_handle (cb->multi, slot->curl);
+} /* }}} void wh_request_start */
+
+static void wh_request_done (wh_callback_t *cb, /* {{{ */
+                wh_slot_t *slot, CURLcode result)
+{
+        wh_request_t *req = slot->request;
+        long http_code = 0;
+        _Bool retry = 0;
+
+        curl_multi_remove_handle (cb->multi, slot->curl);
+        slot->request = NULL;
+
+        if (result == CURLE_OK)
+        {
+                curl_easy_getinfo (slot->curl, CURLINFO_RESPONSE_CODE,
+                                &http_code);
+                wh_log_http_error (cb, http_code);
+
+                /* Retry when the server is (temporarily) unable to handle
+                 * the request. Other errors won't go away by resending. */
+                if ((http_code >= 500) || (http_code == 429))
+                        retry = 1;
+        }
+        else
+        {
+                ERROR ("write_http plugin: curl_easy_perform failed with "
+                                "status %i: %s",
+                                result, slot->curl_errbuf);
+                retry = 1;
+        }
+
+        pthread_mutex_lock (&cb->queue_lock);
+        if (!retry)
+        {
+                cb->retry_interval = WH_MIN_RETRY_INTERVAL;
+                wh_request_free (cb, req);
+        }
+        else if (cb->sender_stop || (cb->retry_queue_size == 0))
+        {
+                WARNING ("write_http plugin: <%s> Dropping %zu bytes of "
+                                "values after a failed request.",
+                                cb->location, req->buffer_fill);
+                wh_request_free (cb, req);
+        }
+        else
+        {
+                req->retry_time = cdtime () + cb->retry_interval;
+                cb->retry_interval *= 2;
+                if (cb->retry_interval > WH_MAX_RETRY_INTERVAL)
+                        cb->retry_interval = WH_MAX_RETRY_INTERVAL;
+
+                wh_queue_append (cb, &cb->retry_queue_head,
+                                &cb->retry_queue_tail,
+                                &cb->retry_queue_length,
+                                cb->retry_queue_size, req);
+        }
+        pthread_mutex_unlock (&cb->queue_lock);
+} /* }}} void wh_request_done */
+
+/* Waits up to `timeout_ms' for network activity on the running requests. */
+static void wh_multi_wait (wh_callback_t *cb, int timeout_ms) /* {{{ */
+{
+#if LIBCURL_VERSION_NUM >= 0x071c00
+        curl_multi_wait (cb->multi, /* extra_fds = */ NULL, 0,
+                        timeout_ms, /* numfds = */ NULL);
+#else
+        fd_set fdread;
+        fd_set fdwrite;
+        fd_set fdexcep;
+        int maxfd = -1;
+        struct timeval tv;
+
+        FD_ZERO (&fdread);
+        FD_ZERO (&fdwrite);
+        FD_ZERO (&fdexcep);
+        curl_multi_fdset (cb->multi, &fdread, &fdwrite, &fdexcep, &maxfd);
+
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        if (maxfd >= 0)
+                select (maxfd + 1, &fdread, &fdwrite, &fdexcep, &tv);
+        else
+                nanosleep (&(struct timespec) { tv.tv_sec, tv.tv_usec * 1000 }, NULL);
+#endif
+} /* }}} void wh_multi_wait */
+
+static void *wh_sender_thread (void *arg) /* {{{ */
+{
+        wh_callback_t *cb = arg;
+
+        while (42)
+        {
+                CURLMsg *msg;
+                int msgs_left;
+                int running = 0;
+                int busy;
+                int i;
+
+                pthread_mutex_lock (&cb->queue_lock);
+                while (42)
+                {
+                        wh_slot_t *slot = NULL;
+                        wh_request_t *req;
+
+                        busy = 0;
+                        for (i = 0; i < cb->slots_num; i++)
+                        {
+                                if (cb->slots[i].request != NULL)
+                                        busy++;
+                                else if (slot == NULL)
+                                        slot = cb->slots + i;
+                        }
+
+                        req = (slot != NULL) ? wh_queue_next (cb, cdtime ()) : NULL;
+                        if (req != NULL)
+                        {
+                                pthread_mutex_unlock (&cb->queue_lock);
+                                wh_request_start (cb, slot, req);
+                                pthread_mutex_lock (&cb->queue_lock);
+                                continue;
+                        }
+
+                        if (busy > 0)
+                                break;
+
+                        /* Nothing in flight and nothing ready to be sent. */
+                        if (cb->sender_stop)
+                                break;
+
+                        if (cb->retry_queue_head != NULL)
+                        {
+                                struct timespec ts;
+
+                                CDTIME_T_TO_TIMESPEC (cb->retry_queue_head->retry_time, &ts);
+                                pthread_cond_timedwait (&cb->queue_cond,
+                                                &cb->queue_lock, &ts);
+                        }
+                        else
+                        {
+                                pthread_cond_wait (&cb->queue_cond,
+                                                &cb->queue_lock);
+                        }
+                }
+
+                pthread_mutex_unlock (&cb->queue_lock);
+
+                /* Only reached when stopping and all queues are empty. */
+                if (busy == 0)
+                        break;
+
+                curl_multi_perform (cb->multi, &running);
+                while ((msg = curl_multi_info_read (cb->multi, &msgs_left)) != NULL)
+                {
+                        wh_slot_t *slot = NULL;
+
+                        if (msg->msg != CURLMSG_DONE)
+                                continue;
+
+                        curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE,
+                                        (char **) &slot);
+                        wh_request_done (cb, slot, msg->data.result);
+                }
+
+                if (running > 0)
+                        wh_multi_wait (cb, WH_POLL_INTERVAL_MS);
+        } /* while (42) */
+
+        return ((void *) 0);
+} /* }}} void *wh_sender_thread */
+
+/* Starts the sender thread. The thread is started lazily because the daemon
+ * may fork after the configuration was read. Must hold cb->send_lock. */
+static int wh_sender_start (wh_callback_t *cb) /* {{{ */
+{
+        int status;
+
+        if (cb->sender_running)
+                return (0);
+
+        status = wh_callback_init (cb);
+        if (status != 0)
+        {
+                ERROR ("write_http plugin: wh_callback_init failed.");
+                return (-1);
+        }
+
+        status = plugin_thread_create (&cb->sender_thread, /* attr = */ NULL,
+                        wh_sender_thread, cb);
+        if (status != 0)
+        {
+                char errbuf[1024];
+                ERROR ("write_http plugin: Starting the sender thread failed: %s",
+                                sstrerror (errno, errbuf, sizeof (errbuf)));
+                return (-1);
+        }
+
+        cb->sender_running = 1;
+        return (0);
+} /* }}} int wh_sender_start */
+
 static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
 {
         int status;
@@ -247,7 +765,6 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 }
 
                 status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else if (cb->format == WH_FORMAT_JSON)
         {
@@ -269,7 +786,6 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 }
 
                 status = wh_send_buffer (cb);
-                wh_reset_buffer (cb);
         }
         else
         {
@@ -279,6 +795,9 @@ static int wh_flush_nolock (cdtime_t timeout, wh_callback_t *cb) /* {{{ */
                 return (-1);
         }
 
+        if (status != 0)
+                wh_reset_buffer (cb);
+
         return (status);
 } /* }}} wh_flush_nolock */
 
@@ -296,12 +815,11 @@ static int wh_flush (cdtime_t timeout, /* {{{ */
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
+        if (!cb->sender_running)
         {
-                status = wh_callback_init (cb);
+                status = wh_sender_start (cb);
                 if (status != 0)
                 {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
                         pthread_mutex_unlock (&cb->send_lock);
                         return (-1);
                 }
@@ -313,21 +831,63 @@ static int wh_flush (cdtime_t timeout, /* {{{ */
         return (status);
 } /* }}} int wh_flush */
 
+static void wh_request_list_free (wh_callback_t *cb, wh_request_t *req) /* {{{ */
+{
+        while (req != NULL)
+        {
+                wh_request_t *next = req->next;
+                wh_request_free (cb, req);
+                req = next;
+        }
+} /* }}} void wh_request_list_free */
+
 static void wh_callback_free (void *data) /* {{{ */
 {
         wh_callback_t *cb;
+        int i;
 
         if (data == NULL)
                 return;
 
         cb = data;
 
-        wh_flush_nolock (/* timeout = */ 0, cb);
+        /* Hand the last values to the sender thread and wait for it to
+         * finish the outstanding requests. */
+        if (cb->sender_running)
+        {
+                wh_flush_nolock (/* timeout = */ 0, cb);
+
+                pthread_mutex_lock (&cb->queue_lock);
+                cb->sender_stop = 1;
+                pthread_cond_signal (&cb->queue_cond);
+                pthread_mutex_unlock (&cb->queue_lock);
+
+                pthread_join (cb->sender_thread, /* retval = */ NULL);
+                cb->sender_running = 0;
+        }
+
+        pthread_mutex_lock (&cb->queue_lock);
+        wh_request_list_free (cb, cb->send_queue_head);
+        wh_request_list_free (cb, cb->retry_queue_head);
+        cb->send_queue_head = cb->send_queue_tail = NULL;
+        cb->retry_queue_head = cb->retry_queue_tail = NULL;
+        pthread_mutex_unlock (&cb->queue_lock);
+
+        for (i = 0; (cb->slots != NULL) && (i < cb->slots_num); i++)
+        {
+                if (cb->slots[i].curl == NULL)
+                        continue;
+                if (cb->multi != NULL && cb->slots[i].request != NULL)
+                        curl_multi_remove_handle (cb->multi, cb->slots[i].curl);
+                curl_easy_cleanup (cb->slots[i].curl);
+                cb->slots[i].curl = NULL;
+        }
+        sfree (cb->slots);
 
-        if (cb->curl != NULL)
+        if (cb->multi != NULL)
         {
-                curl_easy_cleanup (cb->curl);
-                cb->curl = NULL;
+                curl_multi_cleanup (cb->multi);
+                cb->multi = NULL;
         }
 
         if (cb->headers != NULL)
@@ -336,6 +896,20 @@ static void wh_callback_free (void *data) /* {{{ */
                 cb->headers = NULL;
         }
 
+        if (cb->headers_gzip != NULL)
+        {
+                curl_slist_free_all (cb->headers_gzip);
+                cb->headers_gzip = NULL;
+        }
+
+        for (i = 0; i < cb->free_buffers_num; i++)
+                sfree (cb->free_buffers[i]);
+        sfree (cb->free_buffers);
+
+        pthread_cond_destroy (&cb->queue_cond);
+        pthread_mutex_destroy (&cb->queue_lock);
+        pthread_mutex_destroy (&cb->send_lock);
+
         sfree (cb->name);
         sfree (cb->location);
         sfree (cb->user);
@@ -397,12 +971,11 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
+        if (!cb->sender_running)
         {
-                status = wh_callback_init (cb);
+                status = wh_sender_start (cb);
                 if (status != 0)
                 {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
                         pthread_mutex_unlock (&cb->send_lock);
                         return (-1);
                 }
@@ -445,12 +1018,11 @@ static int wh_write_json (const data_set_t *ds, const value_list_t *vl, /* {{{ *
 
         pthread_mutex_lock (&cb->send_lock);
 
-        if (cb->curl == NULL)
+        if (!cb->sender_running)
         {
-                status = wh_callback_init (cb);
+                status = wh_sender_start (cb);
                 if (status != 0)
                 {
-                        ERROR ("write_http plugin: wh_callback_init failed.");
                         pthread_mutex_unlock (&cb->send_lock);
                         return (-1);
                 }
@@ -581,9 +1153,17 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         cb->timeout = 0;
         cb->log_http_error = 0;
         cb->headers = NULL;
-
+        cb->headers_gzip = NULL;
+        cb->compress = 0;
+        cb->slots_num = WH_DEFAULT_MAX_REQUESTS;
+        cb->send_queue_size = WH_DEFAULT_SEND_QUEUE_SIZE;
+        cb->retry_queue_size = WH_DEFAULT_RETRY_QUEUE_SIZE;
+        cb->retry_interval = WH_MIN_RETRY_INTERVAL;
+        C_COMPLAIN_INIT (&cb->drop_complaint);
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+        pthread_mutex_init (&cb->queue_lock, /* attr = */ NULL);
+        pthread_cond_init (&cb->queue_cond, /* attr = */ NULL);
 
         cf_util_get_string (ci, &cb->name);
 
@@ -662,6 +1242,26 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
                         status = cf_util_get_boolean (child, &cb->log_http_error);
                 else if (strcasecmp ("Header", child->key) == 0)
                         status = wh_config_append_string ("Header", &cb->headers, child);
+                else if (strcasecmp ("MaxConcurrentRequests", child->key) == 0)
+                        status = cf_util_get_int (child, &cb->slots_num);
+                else if (strcasecmp ("SendQueueSize", child->key) == 0)
+                        status = cf_util_get_int (child, &cb->send_queue_size);
+                else if (strcasecmp ("RetryQueueSize", child->key) == 0)
+                        status = cf_util_get_int (child, &cb->retry_queue_size);
+                else if (strcasecmp ("Compress", child->key) == 0)
+                {
+                        status = cf_util_get_boolean (child, &cb->compress);
+#if !HAVE_ZLIB_H
+                        if ((status == 0) && cb->compress)
+                        {
+                                WARNING ("write_http plugin: collectd was "
+                                                "built without zlib support. "
+                                                "Ignoring the \"Compress\" "
+                                                "option.");
+                                cb->compress = 0;
+                        }
+#endif
+                }
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -690,6 +1290,33 @@ static int wh_config_node (oconfig_item_t *ci) /* {{{ */
         if (cb->low_speed_limit > 0)
                 cb->low_speed_time = CDTIME_T_TO_TIME_T(plugin_get_interval());
 
+        if (cb->slots_num < 1)
+        {
+                WARNING ("write_http plugin: MaxConcurrentRequests must be at "
+                                "least 1. Setting it to %i.",
+                                WH_DEFAULT_MAX_REQUESTS);
+                cb->slots_num = WH_DEFAULT_MAX_REQUESTS;
+        }
+        if (cb->send_queue_size < 1)
+        {
+                WARNING ("write_http plugin: SendQueueSize must be at "
+                                "least 1. Setting it to %i.",
+                                WH_DEFAULT_SEND_QUEUE_SIZE);
+                cb->send_queue_size = WH_DEFAULT_SEND_QUEUE_SIZE;
+        }
+        if (cb->retry_queue_size < 0)
+                cb->retry_queue_size = 0;
+
+        cb->slots = calloc ((size_t) cb->slots_num, sizeof (*cb->slots));
+        cb->free_buffers = calloc ((size_t) cb->slots_num + 1,
+                        sizeof (*cb->free_buffers));
+        if ((cb->slots == NULL) || (cb->free_buffers == NULL))
+        {
+                ERROR ("write_http plugin: calloc failed.");
+                wh_callback_free (cb);
+                return (-1);
+        }
+
         /* Determine send_buffer_size. */
         cb->send_buffer_size = WRITE_HTTP_DEFAULT_BUFFER_SIZE;
         if (buffer_size >= 1024)
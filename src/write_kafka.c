@@ -33,6 +33,7 @@
 #include "utils_format_graphite.h"
 #include "utils_format_json.h"
 #include "utils_crc32.h"
+#include "utils_complain.h"
 
 #include <stdint.h>
 #include <librdkafka/rdkafka.h>
@@ -46,6 +47,7 @@ struct kafka_topic_context {
 #define KAFKA_FORMAT_GRAPHITE    2
     uint8_t                      format;
     unsigned int                 graphite_flags;
+    graphite_cache_t            *graphite_cache;
     _Bool                        store_rates;
     rd_kafka_topic_conf_t       *conf;
     rd_kafka_topic_t            *topic;
@@ -57,8 +59,29 @@ struct kafka_topic_context {
     char                         escape_char;
     char                        *topic_name;
     pthread_mutex_t              lock;
+
+    /* Value lists are collected into one Kafka message until batch_size
+     * value lists have been added, the buffer is full or batch_linger has
+     * passed. The buffer is handed to librdkafka, which frees it. */
+    int                          batch_size;
+    size_t                       batch_bytes;
+    cdtime_t                     batch_linger;
+    char                        *batch;
+    size_t                       batch_fill;
+    size_t                       batch_free;
+    int                          batch_values;
+    cdtime_t                     batch_init_time;
+
+    _Bool                        report_stats;
+    c_complain_t                 queue_complaint;
+    derive_t                     stats_values_dropped;
+    derive_t                     stats_messages_dropped;
 };
 
+/* Room reserved for one formatted value list. Before a value list is added
+ * to a batch, at least this much space must be left. */
+#define KAFKA_FORMAT_BUFFER_SIZE 8192
+
 static int kafka_handle(struct kafka_topic_context *);
 static int kafka_write(const data_set_t *, const value_list_t *, user_data_t *);
 static int32_t kafka_partition(const rd_kafka_topic_t *, const void *, size_t,
@@ -142,83 +165,280 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
-static int kafka_write(const data_set_t *ds, /* {{{ */
-          const value_list_t *vl,
-          user_data_t *ud)
+static int kafka_batch_init(struct kafka_topic_context *ctx) /* {{{ */
 {
-    int      status = 0;
+    size_t size = (ctx->batch_size > 1) ? ctx->batch_bytes
+                                        : KAFKA_FORMAT_BUFFER_SIZE;
+
+    ctx->batch = malloc(size);
+    if (ctx->batch == NULL) {
+        ERROR("write_kafka plugin: malloc(%zu) failed.", size);
+        return ENOMEM;
+    }
+
+    ctx->batch[0] = 0;
+    ctx->batch_fill = 0;
+    ctx->batch_free = size;
+    ctx->batch_values = 0;
+    ctx->batch_init_time = cdtime();
+
+    if (ctx->format == KAFKA_FORMAT_JSON)
+        format_json_initialize(ctx->batch, &ctx->batch_fill, &ctx->batch_free);
+
+    return 0;
+} /* }}} int kafka_batch_init */
+
+/* Hands the current batch to librdkafka. Must hold ctx->lock. */
+static int kafka_batch_send(struct kafka_topic_context *ctx) /* {{{ */
+{
+    char    *buffer = ctx->batch;
+    size_t   blen = ctx->batch_fill;
     void    *key;
-    size_t   keylen = 0;
-    char     buffer[8192];
-    size_t   bfree = sizeof(buffer);
-    size_t   bfill = 0;
-    size_t   blen = 0;
-    struct   kafka_topic_context  *ctx = ud->data;
+    size_t   keylen;
+    int      status;
 
-    if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
-        return EINVAL;
+    if (ctx->batch == NULL || ctx->batch_values == 0)
+        return 0;
 
-    pthread_mutex_lock (&ctx->lock);
-    status = kafka_handle(ctx);
-    pthread_mutex_unlock (&ctx->lock);
-    if( status != 0 )
-        return status;
+    if (ctx->format == KAFKA_FORMAT_JSON) {
+        status = format_json_finalize(buffer, &ctx->batch_fill,
+                                      &ctx->batch_free);
+        if (status != 0) {
+            ERROR("write_kafka plugin: format_json_finalize failed.");
+            sfree(ctx->batch);
+            return status;
+        }
+        blen = ctx->batch_fill;
+    }
 
-    bzero(buffer, sizeof(buffer));
+    /* Don't keep a mostly empty buffer in librdkafka's queue. Shrinking
+     * usually happens in place. */
+    if (blen + 1 < ctx->batch_fill + ctx->batch_free) {
+        char *tmp = realloc(buffer, blen + 1);
+        if (tmp != NULL)
+            buffer = tmp;
+    }
+    ctx->batch = NULL;
+
+    key = ctx->key;
+    keylen = (key != NULL) ? strlen(key) : 0;
+
+    status = rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
+                              RD_KAFKA_MSG_F_FREE, buffer, blen,
+                              key, keylen, NULL);
+    if (status != 0) {
+        rd_kafka_resp_err_t err = rd_kafka_errno2err(errno);
+
+        /* librdkafka only takes ownership on success. */
+        sfree(buffer);
+        ctx->stats_values_dropped += ctx->batch_values;
+        ctx->stats_messages_dropped++;
+
+        if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL)
+            c_complain(LOG_WARNING, &ctx->queue_complaint,
+                       "write_kafka plugin: Produce queue of topic %s is "
+                       "full, dropping values.", ctx->topic_name);
+        else
+            ERROR("write_kafka plugin: rd_kafka_produce failed: %s",
+                  rd_kafka_err2str(err));
+        return -1;
+    }
+
+    c_release(LOG_INFO, &ctx->queue_complaint,
+              "write_kafka plugin: Produce queue of topic %s is no longer "
+              "full.", ctx->topic_name);
+    return 0;
+} /* }}} int kafka_batch_send */
+
+/* Sends the current batch if it is older than `timeout'. A timeout of zero
+ * sends unconditionally. Must hold ctx->lock. */
+static int kafka_batch_flush(struct kafka_topic_context *ctx, /* {{{ */
+                             cdtime_t timeout)
+{
+    if (ctx->batch == NULL || ctx->batch_values == 0)
+        return 0;
+
+    if (timeout > 0 && (ctx->batch_init_time + timeout) > cdtime())
+        return 0;
+
+    return kafka_batch_send(ctx);
+} /* }}} int kafka_batch_flush */
+
+/* Formats one value list at the end of the current batch. Must hold
+ * ctx->lock. */
+static int kafka_batch_add(struct kafka_topic_context *ctx, /* {{{ */
+                           const data_set_t *ds, const value_list_t *vl)
+{
+    char    *buffer;
+    size_t   bfree;
+    size_t   blen;
+    int      status;
+
+    if (ctx->batch != NULL && ctx->batch_free < KAFKA_FORMAT_BUFFER_SIZE)
+        kafka_batch_send(ctx);
+
+    if (ctx->batch == NULL) {
+        status = kafka_batch_init(ctx);
+        if (status != 0)
+            return status;
+    }
+
+    buffer = ctx->batch + ctx->batch_fill;
+    bfree = ctx->batch_free;
 
     switch (ctx->format) {
     case KAFKA_FORMAT_COMMAND:
-        status = create_putval(buffer, sizeof(buffer), ds, vl);
+        /* One command per line; reserve room for the newline. */
+        status = create_putval(buffer, bfree - 1, ds, vl);
         if (status != 0) {
             ERROR("write_kafka plugin: create_putval failed with status %i.",
                   status);
             return status;
         }
         blen = strlen(buffer);
+        if (ctx->batch_size > 1) {
+            buffer[blen] = '\n';
+            buffer[blen + 1] = 0;
+            blen++;
+        }
+        ctx->batch_fill += blen;
+        ctx->batch_free -= blen;
         break;
     case KAFKA_FORMAT_JSON:
-        format_json_initialize(buffer, &bfill, &bfree);
-        format_json_value_list(buffer, &bfill, &bfree, ds, vl,
-                               ctx->store_rates);
-        format_json_finalize(buffer, &bfill, &bfree);
-        blen = strlen(buffer);
+        status = format_json_value_list(ctx->batch, &ctx->batch_fill,
+                                        &ctx->batch_free, ds, vl,
+                                        ctx->store_rates);
+        if (status != 0) {
+            ERROR("write_kafka plugin: format_json_value_list failed "
+                  "with status %i.", status);
+            return status;
+        }
         break;
     case KAFKA_FORMAT_GRAPHITE:
-        status = format_graphite(buffer, sizeof(buffer), ds, vl,
-                                 ctx->prefix, ctx->postfix, ctx->escape_char,
-                                 ctx->graphite_flags);
+        status = format_graphite_cached(ctx->graphite_cache, buffer, bfree,
+                                        ds, vl, ctx->prefix, ctx->postfix,
+                                        ctx->escape_char, ctx->graphite_flags);
         if (status != 0) {
             ERROR("write_kafka plugin: format_graphite failed with status %i.",
                   status);
             return status;
         }
         blen = strlen(buffer);
+        ctx->batch_fill += blen;
+        ctx->batch_free -= blen;
         break;
     default:
         ERROR("write_kafka plugin: invalid format %i.", ctx->format);
         return -1;
     }
 
-    key = ctx->key;
-    if (key != NULL)
-        keylen = strlen (key);
-    else
-        keylen = 0;
+    ctx->batch_values++;
+    if (ctx->batch_values >= ctx->batch_size)
+        return kafka_batch_send(ctx);
+
+    return 0;
+} /* }}} int kafka_batch_add */
+
+static int kafka_write(const data_set_t *ds, /* {{{ */
+          const value_list_t *vl,
+          user_data_t *ud)
+{
+    int      status = 0;
+    struct   kafka_topic_context  *ctx = ud->data;
+
+    if ((ds == NULL) || (vl == NULL) || (ctx == NULL))
+        return EINVAL;
 
-    rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
-                     RD_KAFKA_MSG_F_COPY, buffer, blen,
-                     key, keylen, NULL);
+    pthread_mutex_lock (&ctx->lock);
+    status = kafka_handle(ctx);
+    if (status == 0)
+        status = kafka_batch_add(ctx, ds, vl);
+    if (status == 0 && ctx->batch_linger > 0)
+        status = kafka_batch_flush(ctx, ctx->batch_linger);
+    pthread_mutex_unlock (&ctx->lock);
 
     return status;
 } /* }}} int kafka_write */
 
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       const char *identifier __attribute__((unused)),
+                       user_data_t *ud)
+{
+    struct kafka_topic_context *ctx = ud->data;
+    int status;
+
+    pthread_mutex_lock (&ctx->lock);
+    status = kafka_batch_flush(ctx, timeout);
+    pthread_mutex_unlock (&ctx->lock);
+
+    return status;
+} /* }}} int kafka_flush */
+
+/* Sends batches which have been lingering for too long, even when no new
+ * values arrive, and reports the number of dropped values. */
+static int kafka_read(user_data_t *ud) /* {{{ */
+{
+    struct kafka_topic_context *ctx = ud->data;
+    value_list_t vl = VALUE_LIST_INIT;
+    value_t values[1];
+    derive_t values_dropped;
+    derive_t messages_dropped;
+    gauge_t queue_length = NAN;
+
+    pthread_mutex_lock (&ctx->lock);
+    if (ctx->batch_linger > 0)
+        kafka_batch_flush(ctx, ctx->batch_linger);
+    values_dropped = ctx->stats_values_dropped;
+    messages_dropped = ctx->stats_messages_dropped;
+    if (ctx->kafka != NULL)
+        queue_length = (gauge_t) rd_kafka_outq_len(ctx->kafka);
+    pthread_mutex_unlock (&ctx->lock);
+
+    if (!ctx->report_stats)
+        return 0;
+
+    vl.values = values;
+    vl.values_len = 1;
+    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+    sstrncpy (vl.plugin, "write_kafka", sizeof (vl.plugin));
+    sstrncpy (vl.plugin_instance, ctx->topic_name, sizeof (vl.plugin_instance));
+
+    values[0].gauge = queue_length;
+    sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "produce", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = values_dropped;
+    sstrncpy (vl.type, "total_values", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    values[0].derive = messages_dropped;
+    sstrncpy (vl.type, "total_requests", sizeof (vl.type));
+    sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+    plugin_dispatch_values (&vl);
+
+    return 0;
+} /* }}} int kafka_read */
+
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
     struct kafka_topic_context *ctx = p;
+    int i;
 
     if (ctx == NULL)
         return;
 
+    if (ctx->topic != NULL)
+        kafka_batch_flush(ctx, /* timeout = */ 0);
+    sfree(ctx->batch);
+    graphite_cache_destroy(ctx->graphite_cache);
+
+    /* Give librdkafka up to five seconds to deliver queued messages. */
+    for (i = 0; ctx->kafka != NULL && rd_kafka_outq_len(ctx->kafka) > 0
+                && i < 50; i++)
+        rd_kafka_poll(ctx->kafka, 100);
+
     if (ctx->topic_name != NULL)
         sfree(ctx->topic_name);
     if (ctx->topic != NULL)
@@ -255,6 +475,10 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
     tctx->store_rates = 1;
     tctx->format = KAFKA_FORMAT_JSON;
     tctx->key = NULL;
+    tctx->batch_size = 1;
+    tctx->batch_bytes = 65536;
+    tctx->batch_linger = TIME_T_TO_CDTIME_T(1);
+    C_COMPLAIN_INIT (&tctx->queue_complaint);
 
     if ((tctx->kafka_conf = rd_kafka_conf_dup(conf)) == NULL) {
         sfree(tctx);
@@ -367,6 +591,22 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
                         "only one character. Others will be ignored.");
             tctx->escape_char = tmp_buff[0];
             sfree (tmp_buff);
+        } else if (strcasecmp ("BatchSize", child->key) == 0) {
+            status = cf_util_get_int (child, &tctx->batch_size);
+        } else if (strcasecmp ("BatchBytes", child->key) == 0) {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if (status == 0 && tmp < 2 * KAFKA_FORMAT_BUFFER_SIZE) {
+                WARNING ("write_kafka plugin: \"BatchBytes\" must be at "
+                        "least %i.", 2 * KAFKA_FORMAT_BUFFER_SIZE);
+                tmp = 2 * KAFKA_FORMAT_BUFFER_SIZE;
+            }
+            if (status == 0)
+                tctx->batch_bytes = (size_t) tmp;
+        } else if (strcasecmp ("BatchLinger", child->key) == 0) {
+            status = cf_util_get_cdtime (child, &tctx->batch_linger);
+        } else if (strcasecmp ("ReportStats", child->key) == 0) {
+            status = cf_util_get_boolean (child, &tctx->report_stats);
         } else {
             WARNING ("write_kafka plugin: Invalid directive: %s.", child->key);
         }
@@ -381,6 +621,19 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
     ssnprintf(callback_name, sizeof(callback_name),
               "write_kafka/%s", tctx->topic_name);
 
+    if (tctx->batch_size < 1)
+        tctx->batch_size = 1;
+
+    if (tctx->format == KAFKA_FORMAT_GRAPHITE) {
+        tctx->graphite_cache = graphite_cache_create(GRAPHITE_CACHE_DEFAULT_SIZE);
+        if (tctx->graphite_cache == NULL) {
+            ERROR ("write_kafka plugin: graphite_cache_create failed.");
+            goto errout;
+        }
+    }
+
+    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
+
     ud.data = tctx;
     ud.free_func = kafka_topic_context_free;
 
@@ -389,10 +642,19 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         WARNING ("write_kafka plugin: plugin_register_write (\"%s\") "
                 "failed with status %i.",
                 callback_name, status);
+        pthread_mutex_destroy (&tctx->lock);
         goto errout;
     }
 
-    pthread_mutex_init (&tctx->lock, /* attr = */ NULL);
+    ud.free_func = NULL;
+    plugin_register_flush (callback_name, kafka_flush, &ud);
+
+    /* The read callback sends lingering batches, so it runs once per
+     * linger period when batching. */
+    if (tctx->batch_size > 1 || tctx->report_stats)
+        plugin_register_complex_read (/* group = */ NULL, callback_name,
+                kafka_read,
+                (tctx->batch_size > 1) ? tctx->batch_linger : 0, &ud);
 
     return;
  errout:
@@ -402,6 +664,7 @@ static void kafka_config_topic(rd_kafka_conf_t *conf, oconfig_item_t *ci) /* {{{
         rd_kafka_topic_conf_destroy(tctx->conf);
     if (tctx->kafka_conf != NULL)
         rd_kafka_conf_destroy(tctx->kafka_conf);
+    graphite_cache_destroy(tctx->graphite_cache);
     sfree(tctx);
 } /* }}} int kafka_config_topic */
 
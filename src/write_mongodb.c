@@ -76,7 +76,7 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
     _Bool store_rates)
 {
   bson *ret;
-  gauge_t *rates;
+  gauge_t rates[ds->ds_num];
   int i;
 
   ret = bson_alloc (); /* matched by bson_dealloc() */
@@ -86,18 +86,10 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
     return (NULL);
   }
 
-  if (store_rates)
+  if (store_rates && (uc_get_rates (ds, vl, rates) != 0))
   {
-    rates = uc_get_rate (ds, vl);
-    if (rates == NULL)
-    {
-      ERROR ("write_mongodb plugin: uc_get_rate() failed.");
-      return (NULL);
-    }
-  }
-  else
-  {
-    rates = NULL;
+    ERROR ("write_mongodb plugin: uc_get_rates() failed.");
+    return (NULL);
   }
 
   bson_init (ret); /* matched by bson_destroy() */
@@ -156,7 +148,6 @@ static bson *wm_create_bson (const data_set_t *ds, /* {{{ */
 
   bson_finish (ret);
 
-  sfree (rates);
   return (ret);
 } /* }}} bson *wm_create_bson */
 
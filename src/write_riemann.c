@@ -412,6 +412,7 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 {
 	riemann_message_t *msg;
 	size_t i;
+	gauge_t rates_buffer[ds->ds_num];
 	gauge_t *rates = NULL;
 
 	/* Initialize the Msg structure. */
@@ -424,13 +425,13 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 
 	if (host->store_rates)
 	{
-		rates = uc_get_rate(ds, vl);
-		if (rates == NULL)
+		if (uc_get_rates(ds, vl, rates_buffer) != 0)
 		{
-			ERROR("write_riemann plugin: uc_get_rate failed.");
+			ERROR("write_riemann plugin: uc_get_rates failed.");
 			riemann_message_free(msg);
 			return (NULL);
 		}
+		rates = rates_buffer;
 	}
 
 	for (i = 0; i < vl->values_len; i++)
@@ -442,13 +443,11 @@ static riemann_message_t *wrr_value_list_to_message(struct riemann_host const *h
 		if (event == NULL)
 		{
 			riemann_message_free(msg);
-			sfree(rates);
 			return (NULL);
 		}
 		riemann_message_append_events(msg, event, NULL);
 	}
 
-	sfree(rates);
 	return (msg);
 } /* }}} riemann_message_t *wrr_value_list_to_message */
 
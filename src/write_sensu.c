@@ -838,6 +838,7 @@ static int sensu_write(const data_set_t *ds, /* {{{ */
 	int status = 0;
 	int statuses[vl->values_len];
 	struct sensu_host	*host = ud->data;
+	gauge_t rates_buffer[ds->ds_num];
 	gauge_t *rates = NULL;
 	size_t i;
 	char *msg;
@@ -846,17 +847,16 @@ static int sensu_write(const data_set_t *ds, /* {{{ */
 	memset(statuses, 0, vl->values_len * sizeof(*statuses));
 
 	if (host->store_rates) {
-		rates = uc_get_rate(ds, vl);
-		if (rates == NULL) {
-			ERROR("write_sensu plugin: uc_get_rate failed.");
+		if (uc_get_rates(ds, vl, rates_buffer) != 0) {
+			ERROR("write_sensu plugin: uc_get_rates failed.");
 			pthread_mutex_unlock(&host->lock);
 			return -1;
 		}
+		rates = rates_buffer;
 	}
 	for (i = 0; i < vl->values_len; i++) {
 		msg = sensu_value_to_json(host, ds, vl, (int) i, rates, statuses[i]);
 		if (msg == NULL) {
-			sfree(rates);
 			pthread_mutex_unlock(&host->lock);
 			return -1;
 		}
@@ -865,11 +865,9 @@ static int sensu_write(const data_set_t *ds, /* {{{ */
 		if (status != 0) {
 			ERROR("write_sensu plugin: sensu_send failed with status %i", status);
 			pthread_mutex_unlock(&host->lock);
-			sfree(rates);
 			return status;
 		}
 	}
-	sfree(rates);
 	pthread_mutex_unlock(&host->lock);
 	return status;
 } /* }}} int sensu_write */
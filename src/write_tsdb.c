@@ -282,7 +282,6 @@ static int wt_format_values(char *ret, size_t ret_len,
 {
     size_t offset = 0;
     int status;
-    gauge_t *rates = NULL;
 
     assert(0 == strcmp (ds->type, vl->type));
 
@@ -292,15 +291,9 @@ static int wt_format_values(char *ret, size_t ret_len,
         status = ssnprintf (ret + offset, ret_len - offset, \
                             __VA_ARGS__); \
         if (status < 1) \
-        { \
-            sfree(rates); \
             return -1; \
-        } \
         else if (((size_t) status) >= (ret_len - offset)) \
-        { \
-            sfree(rates); \
             return -1; \
-        } \
         else \
             offset += ((size_t) status); \
 } while (0)
@@ -309,12 +302,12 @@ static int wt_format_values(char *ret, size_t ret_len,
         BUFFER_ADD(GAUGE_FORMAT, vl->values[ds_num].gauge);
     else if (store_rates)
     {
-        if (rates == NULL)
-            rates = uc_get_rate (ds, vl);
-        if (rates == NULL)
+        gauge_t rates[ds->ds_num];
+
+        if (uc_get_rates (ds, vl, rates) != 0)
         {
             WARNING("format_values: "
-                    "uc_get_rate failed.");
+                    "uc_get_rates failed.");
             return -1;
         }
         BUFFER_ADD(GAUGE_FORMAT, rates[ds_num]);
@@ -329,13 +322,11 @@ static int wt_format_values(char *ret, size_t ret_len,
     {
         ERROR("format_values plugin: Unknown data source type: %i",
               ds->ds[ds_num].type);
-        sfree(rates);
         return -1;
     }
 
 #undef BUFFER_ADD
 
-    sfree(rates);
     return 0;
 }
 